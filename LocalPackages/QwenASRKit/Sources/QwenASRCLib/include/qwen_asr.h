@@ -10,6 +10,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include "qwen_asr_kernels.h"
+#include "qwen_asr_tokenizer.h"
+#include "qwen_asr_audio.h"
 
 /* ========================================================================
  * Constants
@@ -25,6 +28,9 @@
 #define QWEN_MAX_ENC_LAYERS   24
 #define QWEN_MAX_DEC_LAYERS   28
 
+/* Largest qwen_ctx_t.decode_batch (sequences per batched decode step) */
+#define QWEN_DECODE_BATCH_MAX 16
+
 /* Special token IDs */
 #define QWEN_TOKEN_IM_START     151644
 #define QWEN_TOKEN_IM_END       151645
@@ -72,24 +78,25 @@ typedef struct {
  * ======================================================================== */
 
 typedef struct {
-    /* Self-attention (ALL have biases) - pre-converted to f32 */
-    float *wq_weight;          /* [d_model, d_model] */
+    /* Self-attention (ALL have biases). Matrices use the encoder weight
+     * format selected at load (see qwen_set_encoder_weight_format). */
+    qwen_weight_t wq_weight;   /* [d_model, d_model] */
     float *wq_bias;            /* [d_model] */
-    float *wk_weight;          /* [d_model, d_model] */
+    qwen_weight_t wk_weight;   /* [d_model, d_model] */
     float *wk_bias;            /* [d_model] */
-    float *wv_weight;          /* [d_model, d_model] */
+    qwen_weight_t wv_weight;   /* [d_model, d_model] */
     float *wv_bias;            /* [d_model] */
-    float *wo_weight;          /* [d_model, d_model] */
+    qwen_weight_t wo_weight;   /* [d_model, d_model] */
     float *wo_bias;            /* [d_model] */
 
     /* Pre-attention LayerNorm (with bias) */
     float *attn_norm_weight;   /* [d_model] */
     float *attn_norm_bias;     /* [d_model] */
 
-    /* FFN: GELU(fc1(x)) -> fc2 (ALL have biases) - pre-converted to f32 */
-    float *fc1_weight;         /* [ffn_dim, d_model] */
+    /* FFN: GELU(fc1(x)) -> fc2 (ALL have biases) */
+    qwen_weight_t fc1_weight;  /* [ffn_dim, d_model] */
     float *fc1_bias;           /* [ffn_dim] */
-    float *fc2_weight;         /* [d_model, ffn_dim] */
+    qwen_weight_t fc2_weight;  /* [d_model, ffn_dim] */
     float *fc2_bias;           /* [d_model] */
 
     /* Pre-FFN LayerNorm (with bias) */
@@ -98,6 +105,9 @@ typedef struct {
 } qwen_enc_layer_t;
 
 typedef struct {
+    /* Storage format of the matrices below (QWEN_WEIGHT_*) */
+    int weight_format;
+
     /* Conv2D stem (3 layers, each 3x3, stride 2) */
     float *conv1_weight;       /* [480, 1, 3, 3] */
     float *conv1_bias;         /* [480] */
@@ -106,8 +116,8 @@ typedef struct {
     float *conv3_weight;       /* [480, 480, 3, 3] */
     float *conv3_bias;         /* [480] */
 
-    /* Conv output projection - pre-converted to f32 */
-    float *conv_out_weight;    /* [d_model, 7680] */
+    /* Conv output projection */
+    qwen_weight_t conv_out_weight; /* [d_model, 7680] */
 
     /* Transformer layers */
     qwen_enc_layer_t layers[QWEN_MAX_ENC_LAYERS];
@@ -116,10 +126,10 @@ typedef struct {
     float *ln_post_weight;     /* [d_model] */
     float *ln_post_bias;       /* [d_model] */
 
-    /* Projection layers - pre-converted to f32 */
-    float *proj1_weight;       /* [d_model, d_model] */
+    /* Projection layers */
+    qwen_weight_t proj1_weight; /* [d_model, d_model] */
     float *proj1_bias;         /* [d_model] */
-    float *proj2_weight;       /* [output_dim, d_model] */
+    qwen_weight_t proj2_weight; /* [output_dim, d_model] */
     float *proj2_bias;         /* [output_dim] */
 } qwen_encoder_t;
 
@@ -147,13 +157,25 @@ typedef struct {
     uint16_t *up_weight_bf16;   /* [intermediate, hidden] */
     uint16_t *down_weight_bf16; /* [hidden, intermediate] */
 
-    /* Fused gate+up weight for single-token matvec [2*intermediate, hidden] */
+    /* Fused gate+up weight for single-token matvec [2*intermediate, hidden].
+     * Only kept for QWEN_WEIGHT_BF16; quantized formats pack it into gate_up. */
     uint16_t *gate_up_fused_bf16;
+
+    /* Matrices in decoder.weight_format. For BF16 these alias the pointers
+     * above; INT8/INT4 own a copy quantized at load and the mmap'd bf16
+     * pages are no longer touched. */
+    qwen_weight_t wq, wk, wv, wo;
+    qwen_weight_t gate_up;     /* [2*intermediate, hidden], rows interleaved */
+    qwen_weight_t down;
 } qwen_dec_layer_t;
 
 typedef struct {
+    /* Storage format for the projection matrices and the LM head */
+    int weight_format;
+
     /* Token embeddings (tied with lm_head) */
     uint16_t *tok_embeddings_bf16; /* [vocab_size, hidden] */
+    qwen_weight_t lm_head;         /* tok_embeddings in weight_format (argmax only) */
 
     /* Transformer layers */
     qwen_dec_layer_t layers[QWEN_MAX_DEC_LAYERS];
@@ -162,6 +184,17 @@ typedef struct {
     float *norm;               /* [hidden] */
 } qwen_decoder_t;
 
+/* ========================================================================
+ * LM Head Modes
+ * ======================================================================== */
+
+#define QWEN_LM_HEAD_FULL   0  /* exact argmax over the whole vocabulary */
+#define QWEN_LM_HEAD_FAST   1  /* int4 first pass over the language vocabulary,
+                                * exact re-score of the top-k candidates */
+#define QWEN_LM_HEAD_CHECK  2  /* run both, emit FULL, count disagreements */
+
+#define QWEN_LM_HEAD_TOPK_DEFAULT 8
+
 /* ========================================================================
  * Token Callback (streaming output)
  * ======================================================================== */
@@ -170,24 +203,84 @@ typedef struct {
  * 'piece' is the decoded token string (UTF-8). */
 typedef void (*qwen_token_cb)(const char *piece, void *userdata);
 
+/* ========================================================================
+ * Performance Report
+ * ======================================================================== */
+
+#define QWEN_PERF_REPORT_VERSION 1
+#define QWEN_PERF_MAX_LAYERS 32    /* per-layer timings kept for the first N layers */
+#define QWEN_PERF_HIST_BINS 16     /* decode-step latency histogram: bin 0 < 1 ms,
+                                    * bin i in [2^(i-1), 2^i) ms, the last is open */
+
+/* Snapshot of the last transcription (see qwen_get_perf_report). Kernel,
+ * pool and per-layer figures are zero when built with QWEN_PROFILE=0. */
+typedef struct {
+    int version;                   /* QWEN_PERF_REPORT_VERSION */
+    int profiled;                  /* 1 = kernel counters and layer timers compiled in */
+
+    /* Stages */
+    double total_ms;
+    double encode_ms;              /* mel + encoder */
+    double prefill_ms;             /* decoder prompt prefill (part of decode_ms) */
+    double decode_ms;              /* prefill + token generation */
+    double audio_ms;
+    double ttft_ms;                /* call start to the first generated token */
+    double rtf;                    /* total_ms / audio_ms */
+    double pipeline_overlap;       /* share of encoder time hidden behind decoding
+                                    * (pipelined segments), 0..1 */
+    int text_tokens;
+
+    /* Decode steps (one per generated token; a batched step counts once) */
+    int decode_steps;
+    double step_mean_ms, step_p50_ms, step_p90_ms, step_p99_ms, step_max_ms;
+    int step_hist[QWEN_PERF_HIST_BINS];
+
+    /* Kernels (QWEN_PERF_* classes) and the worker pool */
+    qwen_perf_kernel_t kernel[QWEN_PERF_KERNELS];
+    uint64_t pool_dispatches;
+    double pool_compute_ms;
+    double pool_wait_ms;
+    double weight_bytes_per_step;  /* decode matvec + LM head bytes per step */
+    double weight_gb_per_s;        /* the same bytes over those kernels' time */
+
+    /* Layers, summed over the call */
+    int enc_layers, dec_layers;    /* entries filled below (<= QWEN_PERF_MAX_LAYERS) */
+    double enc_layer_ms[QWEN_PERF_MAX_LAYERS];
+    double dec_layer_ms[QWEN_PERF_MAX_LAYERS];
+
+    /* Memory high-water marks during the call */
+    size_t kv_peak_bytes;          /* KV cache pages (and batched lanes) */
+    size_t scratch_peak_bytes;     /* decoder prefill/batch and encoder buffers */
+} qwen_perf_report_t;
+
 /* ========================================================================
  * Main Context
  * ======================================================================== */
 
 typedef struct {
+    /* Model state: read-only once qwen_load returns, so contexts made with
+     * qwen_ctx_share point at the loading context's copy. Everything after
+     * dec_kernels is per-context (per-request) state. */
     qwen_config_t config;
     qwen_encoder_t encoder;
     qwen_decoder_t decoder;
 
     /* Model files (kept open for mmap) */
-    void *safetensors;         /* multi_safetensors_t* */
+    void *safetensors;         /* multi_safetensors_t*, NULL when compiled */
+    void *compiled;            /* read-only mapping of model.<enc>-<dec>.qwenc */
+    size_t compiled_bytes;
     char model_dir[512];
+    qwen_tokenizer_t *tokenizer; /* loaded on first use, kept until qwen_free */
+    int shares_model;          /* 1 = weights, files and tokenizer belong to the
+                                * context this one was shared from */
+
+    const qwen_dec_kernels_t *dec_kernels; /* picked for the geometry at load */
 
-    /* KV cache for decoder */
-    float *kv_cache_k;         /* [layers, max_seq, kv_heads * head_dim] */
-    float *kv_cache_v;
+    /* KV cache for decoder (paged, QWEN_KV_* storage) */
+    qwen_kv_cache_t kv_cache;
+    int kv_format;             /* format for the next cache set-up */
     int kv_cache_len;
-    int kv_cache_max;
+    int kv_cache_max;          /* positions the allocated pages hold */
 
     /* Persistent decoder buffers (single-token generation) */
     float *dec_x, *dec_x_norm, *dec_q, *dec_k, *dec_v;
@@ -201,6 +294,27 @@ typedef struct {
     float *pref_gate, *pref_gate_up;
     int pref_seq_cap;
 
+    /* Persistent batched decode buffers (one row per sequence) */
+    float *bat_x, *bat_x_norm, *bat_q, *bat_k, *bat_v;
+    float *bat_attn_out, *bat_proj_out, *bat_ffn_out;
+    float *bat_gate, *bat_gate_up, *bat_logits;
+    int bat_cap;
+
+    /* Persistent encoder buffers (see ensure_enc_buffers). The conv stem
+     * batches one window of chunks at a time, so its buffers are sized once
+     * from enc_n_window_infer; the sequence buffers grow with the input. */
+    float *enc_stem_mel, *enc_stem_c1, *enc_stem_c2, *enc_stem_c3;
+    float *enc_stem_cols;                     /* im2col scratch */
+    float *enc_stem_reshaped;                 /* [window tokens, conv_proj_dim] */
+    float *enc_pe;                            /* [tokens per chunk, d_model] */
+    int enc_stem_group;                       /* chunks per conv GEMM */
+    size_t enc_stem_bytes;                    /* the stem buffers together */
+    float *enc_x, *enc_x_norm, *enc_q, *enc_k, *enc_v;
+    float *enc_attn_out, *enc_proj_out, *enc_ffn_mid, *enc_ffn_out;
+    int *enc_window_starts;
+    int enc_seq_cap;
+    int enc_windows_cap;
+
     /* Cached RoPE tables for decoder positions */
     float *rope_cache_cos, *rope_cache_sin;   /* [pos, head_dim] */
     float *rope_inv_freq;                     /* [head_dim / 2] */
@@ -214,12 +328,25 @@ typedef struct {
     /* Segmentation settings */
     float segment_sec;             /* 0 = no splitting, default full-audio decode */
     float search_sec;              /* segment-cutting silence search window ± seconds (default 3) */
+    int decode_batch;              /* segments decoded in lockstep when they are independent
+                                    * (no past-text conditioning); 1 = one at a time (default,
+                                    * QWEN_DECODE_BATCH), max QWEN_DECODE_BATCH_MAX */
 
     /* Streaming settings */
     float stream_chunk_sec;        /* chunk interval in seconds (default 2.0) */
     int stream_rollback;           /* tokens to roll back per chunk (default 5) */
     int stream_unfixed_chunks;     /* cold-start chunks without prefix (default 2) */
     int stream_max_new_tokens;     /* max generated tokens per streaming step (default 32) */
+    float stream_horizon_sec;      /* decoder audio context in seconds; older windows are
+                                    * evicted and replaced by committed text (0 = unbounded) */
+    int stream_anchor_tokens;      /* committed text tokens kept as context on eviction (default 16) */
+    int stream_speculative;        /* 1 = check the previous chunk's hypothesis past the
+                                    * kept prefix in one pass instead of regenerating it
+                                    * token by token; same tokens as seq=1 decoding
+                                    * (default on; QWEN_STREAM_SPECULATIVE=0 off) */
+    int stream_vad_gate;           /* 1 = drop silent chunks after one chunk of hangover;
+                                    * the held-back tail waits for the next speech chunk
+                                    * or the end of audio (default off; QWEN_STREAM_VAD=1 on) */
     int past_text_conditioning;    /* 1=enable past text conditioning in -S/--stream (default: off).
                                     * In segmented mode, this also enables boundary cleanup/post-processing. */
     int skip_silence;              /* 1=drop long silent spans before transcription */
@@ -232,6 +359,36 @@ typedef struct {
     int *force_prompt_tokens;      /* cached token ids for "language X" + <asr_text> */
     int n_force_prompt_tokens;
     int prompt_tokens_ready;       /* cache valid flag */
+    int kv_prompt_len;             /* leading KV positions holding the current
+                                    * static prompt prefix (0 = not cached) */
+    int stream_sessions;           /* open streaming sessions; they own the KV
+                                    * cache until closed */
+
+    /* LM-head acceleration (see qwen_set_lm_head_mode) */
+    int lm_head_mode;              /* QWEN_LM_HEAD_* */
+    int lm_head_topk;              /* candidates re-scored exactly in FAST/CHECK */
+    qwen_weight_t lm_draft;        /* int4 first-pass rows of the active vocabulary */
+    int *lm_vocab;                 /* token id per lm_draft row, NULL = identity */
+    char *lm_vocab_lang;           /* force_language the table was built for */
+    int lm_vocab_ready;            /* lm_draft matches lm_vocab_lang */
+    int lm_draft_shared;           /* lm_draft and lm_vocab belong to the context
+                                    * this one was shared from (read-only) */
+    qwen_topk_scratch_t *lm_topk;  /* first-pass candidate lists, kept across steps */
+    int lm_check_tokens;           /* CHECK: tokens compared since last mode change */
+    int lm_check_mismatch;         /* CHECK: tokens where FAST != FULL */
+
+    /* Worker pool bound while this context transcribes (NULL = default pool) */
+    qwen_threadpool_t *pool;
+    qwen_threadpool_t *enc_pool;   /* encoder stage of pipelined segmented decoding,
+                                    * NULL = encode inline (see qwen_ctx_set_pipeline) */
+    qwen_bf16_cache_t *bf16_cache; /* prefill f32 weight expansions, NULL = off */
+    qwen_scratch_t scratch;        /* bf16 panel buffer of the calling thread */
+    qwen_scratch_t enc_scratch;    /* ... and of the pipeline encoder thread */
+
+    /* Residency of file-mapped weights (see qwen_set_low_memory) */
+    int low_memory;                /* release encoder pages after each encode */
+    int weights_cold;              /* next pass prefetches layer i+1 (set at load
+                                    * and when pages are released) */
 
     /* Per-run performance stats (populated by last transcription call) */
     double perf_total_ms;          /* end-to-end inference time in milliseconds */
@@ -239,6 +396,22 @@ typedef struct {
     double perf_audio_ms;          /* input audio duration in milliseconds */
     double perf_encode_ms;         /* mel + encoder time in milliseconds */
     double perf_decode_ms;         /* decoder prefill + decode time in milliseconds */
+    double perf_pipeline_overlap;  /* share of encoder time hidden behind decoding
+                                    * (0..1; 0 when segments were not pipelined) */
+    double perf_prefill_ms;        /* decoder prefill share of perf_decode_ms */
+    double perf_ttft_ms;           /* call start to the first generated token (0 = none) */
+    double perf_start_ms;          /* qwen_perf_now_ms() at the call start */
+    float *perf_step_ms;           /* per-step decode latencies of the call */
+    int perf_steps, perf_steps_cap;
+    double perf_enc_layer_ms[QWEN_PERF_MAX_LAYERS];
+    double perf_dec_layer_ms[QWEN_PERF_MAX_LAYERS];
+    size_t perf_kv_peak_bytes;
+    size_t perf_scratch_peak_bytes;
+    qwen_perf_counters_t perf_counters; /* bound while the context transcribes */
+
+    /* Load stats (set once by qwen_load) */
+    double perf_load_ms;           /* qwen_load wall time in milliseconds */
+    size_t load_resident_bytes;    /* process resident memory added by qwen_load */
 } qwen_ctx_t;
 
 /* ========================================================================
@@ -248,9 +421,92 @@ typedef struct {
 /* Load model from directory */
 qwen_ctx_t *qwen_load(const char *model_dir);
 
-/* Free all resources */
+/* Free all resources. A shared context frees only its own state. */
 void qwen_free(qwen_ctx_t *ctx);
 
+/* New context on base's weights, file mappings and tokenizer, with its own
+ * KV cache, scratch buffers, prompt caches and perf stats, so several can
+ * transcribe concurrently (give each its own pool with
+ * qwen_ctx_set_threads) on one copy of the model. Segmentation, streaming,
+ * prompt, language, LM-head and KV settings are copied from base; the
+ * token callback, pools and bf16 cache are not. A FAST/CHECK LM-head draft
+ * is built on base once and read in place. base must outlive every context
+ * shared from it and keep its language and LM-head mode meanwhile.
+ * Returns NULL on failure. */
+qwen_ctx_t *qwen_ctx_share(qwen_ctx_t *base);
+
+/* Select the storage format for encoder matrices used by subsequent
+ * qwen_load calls: QWEN_WEIGHT_F32 (default, bf16 expanded at load),
+ * QWEN_WEIGHT_BF16 (mmap'd, no copy) or QWEN_WEIGHT_INT8 (quantized at load).
+ * Pass -1 to fall back to the QWEN_ENC_WEIGHTS env var (f32|bf16|int8).
+ * Returns 0 on success, -1 for an unknown format. */
+int qwen_set_encoder_weight_format(int format);
+
+/* Select the storage format for decoder matrices and the tied LM head used by
+ * subsequent qwen_load calls: QWEN_WEIGHT_BF16 (default, mmap'd),
+ * QWEN_WEIGHT_INT8 (per-row scales) or QWEN_WEIGHT_INT4 (32-wide groups),
+ * both quantized at load. Pass -1 to fall back to the QWEN_DEC_WEIGHTS env
+ * var (bf16|int8|int4). Returns 0 on success, -1 for an unknown format. */
+int qwen_set_decoder_weight_format(int format);
+
+/* Write the loaded model's final weight layouts to
+ * <model_dir>/model.<enc>-<dec>.qwenc (e.g. model.f32-int4.qwenc). Later
+ * qwen_load calls with the same formats map that file read-only instead of
+ * parsing, converting and quantizing the safetensors; it is ignored once the
+ * safetensors change. QWEN_COMPILED=0 disables loading it.
+ * Returns 0 on success, -1 on failure. */
+int qwen_compile_model(qwen_ctx_t *ctx);
+
+/* Select how the decoder picks each token from the tied LM head
+ * (QWEN_LM_HEAD_FULL/FAST/CHECK). FAST restricts the first pass to tokens of
+ * the forced language's scripts plus special tokens (full vocabulary when no
+ * language is forced), scores them with int4 weights and re-scores the best
+ * topk rows with the decoder's LM head. topk <= 0 keeps the current value.
+ * Resets the CHECK counters. Returns 0 on success, -1 for an unknown mode. */
+int qwen_set_lm_head_mode(qwen_ctx_t *ctx, int mode, int topk);
+
+/* Give the context its own worker pool of n_threads with the given
+ * QWEN_QOS_* class, replacing any previous one; n_threads <= 0 drops back
+ * to the shared default pool (qwen_set_threads). Contexts with their own
+ * pools can transcribe concurrently from different threads; scratch
+ * buffers belong to the context either way.
+ * Returns 0 on success, -1 on failure. */
+int qwen_ctx_set_threads(qwen_ctx_t *ctx, int n_threads, int qos);
+
+/* Pipeline segmented offline transcription: a worker thread encodes the
+ * next segment on a separate pool of enc_threads (QWEN_QOS_* class) while
+ * the context's own pool decodes the current one, so choose the two sizes
+ * to split the cores between the stages. enc_threads <= 0 encodes inline
+ * (default). qwen_load starts from QWEN_PIPELINE_ENC_THREADS.
+ * Returns 0 on success, -1 on failure. */
+int qwen_ctx_set_pipeline(qwen_ctx_t *ctx, int enc_threads, int qos);
+
+/* Size the context's bf16->f32 weight cache used by bf16 prefill matmuls
+ * (0 disables it and frees its memory). qwen_load starts from
+ * QWEN_BF16_CACHE_MB (default 0). Returns 0 on success, -1 on failure. */
+int qwen_ctx_set_bf16_cache(qwen_ctx_t *ctx, size_t limit_mb);
+
+/* Select the decoder KV cache storage: QWEN_KV_F32 (default), QWEN_KV_FP16
+ * (half the memory) or QWEN_KV_INT8 (a quarter, per-head row scales).
+ * Drops the current cache. qwen_load starts from QWEN_KV_CACHE
+ * (f32|fp16|int8). Returns 0 on success, -1 for an unknown format. */
+int qwen_ctx_set_kv_cache_format(qwen_ctx_t *ctx, int format);
+
+/* Low-memory mode for OS memory pressure. Enabling drops the pages of every
+ * file-mapped weight (bf16 safetensors matrices, or the whole compiled
+ * model), the prefill/encoder scratch, the conv stem buffers and the bf16
+ * cache contents; with no streaming session open it also frees the KV cache
+ * pages (and the cached prompt prefix) and the LM-head draft, which are
+ * rebuilt on the next call. While on, encoder pages are released after each
+ * encode and every pass prefetches the next layer. Heap-owned weights are
+ * kept. The model stays loaded, so the next call only pays the page-ins and
+ * rebuilds. Must not race a transcription.
+ * Clean file pages only leave RSS: Darwin's phys_footprint (what jetsam
+ * acts on) never counted them, so on iOS the footprint drop comes from the
+ * freed heap buffers; check it on device rather than from RSS.
+ * Returns 0 on success, -1 on failure. */
+int qwen_set_low_memory(qwen_ctx_t *ctx, int enabled);
+
 /* Set a callback to receive each decoded token as it's generated.
  * Set cb=NULL to disable. The callback is invoked during transcription. */
 void qwen_set_token_callback(qwen_ctx_t *ctx, qwen_token_cb cb, void *userdata);
@@ -275,11 +531,98 @@ char *qwen_transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples
 /* Transcribe from stdin (auto-detect WAV or raw s16le) */
 char *qwen_transcribe_stdin(qwen_ctx_t *ctx);
 
+/* Fill out with the last transcription's stage, decode-step, kernel,
+ * per-layer and memory figures (streaming sessions report since open).
+ * Returns 0, or -1 on a NULL argument or allocation failure. */
+int qwen_get_perf_report(const qwen_ctx_t *ctx, qwen_perf_report_t *out);
+
+/* Transcribe n_files independent recordings (mono float32, 16kHz) on
+ * n_workers contexts shared from ctx, each with a pool of
+ * threads_per_worker threads (<= 0: the CPUs split between the workers).
+ * Files are cut into segments as in qwen_transcribe_audio and the segments
+ * spread over per-worker queues; a worker that runs dry steals from the
+ * back of the fullest queue. With past-text conditioning each file stays
+ * one work item. texts[i] receives file i's text (caller must free), or
+ * NULL if it failed. The token callback is not invoked. ctx's perf stats
+ * cover the whole batch: perf_total_ms is wall time, the others are summed
+ * over files. Returns 0 if every file was transcribed, -1 otherwise. */
+int qwen_transcribe_batch(qwen_ctx_t *ctx, const float *const *samples, const int *n_samples,
+                          int n_files, int n_workers, int threads_per_worker, char **texts);
+
 /* Streaming transcription: process audio in chunks with prefix rollback.
  * Re-encodes growing audio and uses previous text as decoder context.
  * Tokens are emitted via the token callback as they become "fixed". */
 char *qwen_transcribe_stream(qwen_ctx_t *ctx, const float *samples, int n_samples);
 
+/* Incremental streaming session: the same chunked-rollback policy as
+ * qwen_transcribe_stream, fed live. Encoder windows, decoded token history
+ * and the decoder KV cache persist between pushes, so each chunk costs
+ * the new audio plus the current partial encoder window.
+ * The session owns the context's decoder state until closed: do not
+ * transcribe with, or change the prompt/language of, the context while a
+ * session is open. Silent chunks are dropped only with stream_vad_gate. */
+typedef struct qwen_stream qwen_stream_t;
+
+/* Open a session on a loaded context. Returns NULL on failure. */
+qwen_stream_t *qwen_stream_open(qwen_ctx_t *ctx);
+
+/* Append mono float32 16 kHz samples; every complete stream_chunk_sec of
+ * audio is transcribed before returning. Returns 0, or -1 on failure or
+ * after qwen_stream_finish. */
+int qwen_stream_push(qwen_stream_t *s, const float *samples, int n_samples);
+
+/* Same as qwen_stream_push with everything unread in a capture ring; the
+ * caller is the ring's consumer. Whole chunks that lie in one ring span are
+ * transcribed in place. The rest is copied once into the stream's pending
+ * chunk: the part that tops up a chunk started by an earlier push, a chunk
+ * split by the ring's wrap, and the remainder shorter than a chunk. Pushes
+ * shorter than a chunk, as from a live tap, therefore still copy all their
+ * audio once. Returns the samples taken, or -1 on failure (the ring is
+ * drained either way). */
+int qwen_stream_push_ring(qwen_stream_t *s, qwen_audio_ring_t *ring);
+
+/* End of audio: transcribe what is left and commit all remaining text.
+ * Returns 0 on success, -1 on failure. */
+int qwen_stream_finish(qwen_stream_t *s);
+
+/* Text committed since the previous poll ("" if none). Committed text is
+ * never revised. Returns an allocated string (caller must free), or NULL
+ * on allocation failure. */
+char *qwen_stream_poll(qwen_stream_t *s);
+
+void qwen_stream_close(qwen_stream_t *s);
+
+/* ========================================================================
+ * Benchmarks (qwen_asr_bench.c)
+ * ======================================================================== */
+
+/* Geometry of a model variant (large = 1.7B, else 0.6B), as qwen_load
+ * detects it; only shapes are set. */
+void qwen_config_variant(qwen_config_t *cfg, int large);
+
+#define QWEN_BENCH_MAX_KERNELS 32
+
+typedef struct {
+    const char *name;          /* kernel, e.g. "argmax_matvec_bf16" */
+    char shape[48];            /* problem size at the model's geometry */
+    int threaded;              /* 1 = runs on the bound pool, 0 = one thread */
+    double ms;                 /* mean per call after a warm-up call */
+    double gflops;             /* useful multiply-adds x 2 (0 if not meaningful) */
+    double gb_per_s;           /* weights streamed (matvecs) or KV read (decode attention) */
+} qwen_bench_kernel_t;
+
+/* Time the hot kernels on random inputs at cfg's shapes (NULL = 0.6B):
+ * the bf16 matvec inner loop on the fused gate/up matrix, the streaming
+ * LM-head argmax, the decoder's paged-cache attention (causal_attention_kv)
+ * for one decode step over a 1024-token cache and for a 256-token prefill,
+ * per KV format with the geometry's specialized kernel set and the generic
+ * one, windowed encoder attention, the first two conv stem layers on one
+ * chunk and the mel spectrogram of 30 s.
+ * Threaded kernels use the pool bound to the calling thread. Fills up to
+ * max_out entries; returns how many, or -1 on allocation failure. */
+int qwen_bench_kernels(const qwen_config_t *cfg, int iters,
+                       qwen_bench_kernel_t *out, int max_out);
+
 /* ========================================================================
  * Internal Functions
  * ======================================================================== */
@@ -294,6 +637,29 @@ void qwen_decoder_prefill(qwen_ctx_t *ctx, const float *input_embeds, int seq_le
 /* Decoder forward (single token, uses KV cache, returns greedy token) */
 int qwen_decoder_forward(qwen_ctx_t *ctx, const float *input_embed);
 
+/* One decode step for n independent sequences: sequence i appends
+ * input_embeds row i at position lens[i] of caches[i] (set up on first use)
+ * and gets its greedy token in tokens[i]. Each weight matrix is read once
+ * for all n. Advances lens. Returns 0, or -1 on allocation failure. */
+int qwen_decoder_forward_batch(qwen_ctx_t *ctx, qwen_kv_cache_t *const *caches, int *lens,
+                               const float *input_embeds, int n, int *tokens);
+
+/* Append n inputs at ctx->kv_cache_len in one pass over the weights and put
+ * the greedy token following input i in tokens[i], for checking draft
+ * tokens. Each input goes through the seq=1 kernels (row-batched matvecs,
+ * per-query attention), so tokens[i] is what qwen_decoder_forward would
+ * return. Advances kv_cache_len by n; the caller rolls it back past a
+ * rejected draft. Returns 0, or -1 on failure. */
+int qwen_decoder_verify(qwen_ctx_t *ctx, const float *input_embeds, int n, int *tokens);
+
+/* madvise(WILLNEED) the mapped matrices of a layer; layer == n_layers
+ * prefetches what follows the last layer (LM head / output projections) */
+void qwen_residency_prefetch_dec_layer(qwen_ctx_t *ctx, int layer);
+void qwen_residency_prefetch_enc_layer(qwen_ctx_t *ctx, int layer);
+
+/* madvise(DONTNEED) the mapped encoder matrices */
+void qwen_residency_release_encoder(qwen_ctx_t *ctx);
+
 /* Global verbose flag */
 extern int qwen_verbose;
 
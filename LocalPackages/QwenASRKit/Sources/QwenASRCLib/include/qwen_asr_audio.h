@@ -27,7 +27,135 @@ float *qwen_read_pcm_stdin(int *out_n_samples);
  * n_samples: number of samples
  * out_frames: set to number of mel frames produced
  * Returns: [128, n_frames] mel spectrogram (caller must free)
- * Note: Returns in [mel_bins, frames] layout for Conv2D compatibility. */
+ * Note: Returns in [mel_bins, frames] layout for Conv2D compatibility.
+ * Window, filterbank and FFT tables are built on first use and shared
+ * process-wide; safe to call from multiple threads. */
 float *qwen_mel_spectrogram(const float *samples, int n_samples, int *out_frames);
 
+/* Frames qwen_mel_spectrogram() produces for n_samples (0 if too short). */
+int qwen_mel_frame_count(int n_samples);
+
+/* Same spectrogram written into a caller-owned [128, out_stride] buffer,
+ * e.g. a tensor padded to a chunk multiple; columns past the last frame
+ * are zeroed. out_stride must be >= qwen_mel_frame_count(n_samples).
+ * Returns the frame count, or -1 on error. */
+int qwen_mel_spectrogram_into(const float *samples, int n_samples,
+                              float *out, int out_stride);
+
+/* ========================================================================
+ * Streaming Mel Spectrogram
+ *
+ * Incremental front-end: samples are pushed as they arrive and only the new
+ * frames are computed. After qwen_mel_stream_finish() the full frame sequence
+ * is identical to qwen_mel_spectrogram() on the concatenated audio (same
+ * reflect padding, same dropped last frame); before finish, frames whose
+ * window would reach past the end of the pushed audio are held back.
+ *
+ * Clamp policy (the offline path clamps at global_max - 8):
+ *   QWEN_MEL_MAX_RUNNING: clamp at (max over all frames computed so far) - 8,
+ *     evaluated when frames are popped. Popped frames never change, so early
+ *     frames may keep a lower floor than an offline pass would give them.
+ *   QWEN_MEL_MAX_FIXED: clamp at fixed_max - 8, independent of the audio.
+ * ======================================================================== */
+
+#define QWEN_MEL_MAX_RUNNING 0
+#define QWEN_MEL_MAX_FIXED   1
+
+typedef struct qwen_mel_stream qwen_mel_stream_t;
+
+/* Returns NULL on allocation failure. fixed_max is used only with
+ * QWEN_MEL_MAX_FIXED. */
+qwen_mel_stream_t *qwen_mel_stream_create(int max_policy, float fixed_max);
+void qwen_mel_stream_free(qwen_mel_stream_t *s);
+
+/* Forget all audio and the running max; keeps allocated buffers. */
+void qwen_mel_stream_reset(qwen_mel_stream_t *s);
+
+/* Append mono 16kHz samples. Returns frames ready to pop, or -1 on error. */
+int qwen_mel_stream_push(qwen_mel_stream_t *s, const float *samples, int n_samples);
+
+/* Mark end of audio and emit the trailing (right-reflect-padded) frames.
+ * Further pushes fail until reset. Returns frames ready to pop, or -1. */
+int qwen_mel_stream_finish(qwen_mel_stream_t *s);
+
+/* Pop up to max_frames normalized frames into out, frame-major
+ * [n, 128] (transpose for qwen_encoder_forward). Returns count popped. */
+int qwen_mel_stream_pop(qwen_mel_stream_t *s, float *out, int max_frames);
+
+/* Frames currently ready to pop. */
+int qwen_mel_stream_available(const qwen_mel_stream_t *s);
+
+/* ========================================================================
+ * Online Voice Activity Gate
+ *
+ * Incremental counterpart of the offline silence compaction: 10 ms window
+ * RMS, smoothed, against a threshold of 1.8x a running noise floor (clamped
+ * to [0.002, 0.025]). The floor follows quieter audio quickly and louder
+ * audio slowly (ten times slower while voiced), so steady background noise
+ * is learned within seconds and speech barely lifts it. Voiced runs shorter than 50 ms count as clicks.
+ * Partial windows carry over between pushes.
+ * ======================================================================== */
+
+typedef struct qwen_vad qwen_vad_t;
+
+/* Returns NULL on allocation failure. */
+qwen_vad_t *qwen_vad_create(void);
+void qwen_vad_free(qwen_vad_t *v);
+
+/* Forget the noise floor and any partial window. */
+void qwen_vad_reset(qwen_vad_t *v);
+
+/* Append mono 16kHz samples. Returns 1 if they hold speech (a voiced run
+ * still open at the end counts), 0 if silent, -1 on error. */
+int qwen_vad_push(qwen_vad_t *v, const float *samples, int n_samples);
+
+/* ========================================================================
+ * Capture Ring
+ *
+ * Lock-free single-producer/single-consumer ring of mono float32 samples,
+ * sized once at creation so neither side allocates. The producer is the
+ * capture callback (an audio thread that must not block or allocate); the
+ * consumer is whoever drains it, e.g. qwen_stream_push_ring(). Each side
+ * owns one index and publishes it with release ordering, so exactly one
+ * thread may write and one may read at a time.
+ *
+ * A full ring never overwrites unread audio: writes are truncated and the
+ * dropped sample count is kept in the overrun counter.
+ * ======================================================================== */
+
+typedef struct qwen_audio_ring qwen_audio_ring_t;
+
+/* Capacity is rounded up to a power of two. Returns NULL on error. */
+qwen_audio_ring_t *qwen_audio_ring_create(int capacity_samples);
+void qwen_audio_ring_free(qwen_audio_ring_t *r);
+
+int qwen_audio_ring_capacity(const qwen_audio_ring_t *r);
+
+/* Producer: copy up to n samples in. Returns samples written, -1 on error. */
+int qwen_audio_ring_write(qwen_audio_ring_t *r, const float *samples, int n_samples);
+
+/* Producer: free space, usable for writing in place. The region is split in
+ * two when it wraps (*p2 may be NULL); fill a prefix and publish it with
+ * qwen_audio_ring_commit(). Returns the total free space. */
+int qwen_audio_ring_write_regions(qwen_audio_ring_t *r, float **p1, int *n1,
+                                  float **p2, int *n2);
+void qwen_audio_ring_commit(qwen_audio_ring_t *r, int n_samples);
+
+/* Consumer: unread samples in order, as at most two contiguous spans that
+ * stay valid until qwen_audio_ring_consume(). Returns the total unread. */
+int qwen_audio_ring_read_regions(qwen_audio_ring_t *r, const float **p1, int *n1,
+                                 const float **p2, int *n2);
+void qwen_audio_ring_consume(qwen_audio_ring_t *r, int n_samples);
+
+/* Unread samples (consumer side) and samples dropped on a full ring. */
+int qwen_audio_ring_available(const qwen_audio_ring_t *r);
+int64_t qwen_audio_ring_overruns(const qwen_audio_ring_t *r);
+
+/* Samples ever committed by the producer, e.g. for a third thread to tell
+ * where a producer that stopped writing left off. */
+int64_t qwen_audio_ring_written(const qwen_audio_ring_t *r);
+
+/* Consumer: discard everything unread. */
+void qwen_audio_ring_clear(qwen_audio_ring_t *r);
+
 #endif /* QWEN_ASR_AUDIO_H */
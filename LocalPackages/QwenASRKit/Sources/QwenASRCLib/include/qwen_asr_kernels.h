@@ -11,6 +11,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Upper bound on the threads of one pool (see Threading) */
+#define QWEN_MAX_THREADS 16
+
 /* ========================================================================
  * Basic Operations
  * ======================================================================== */
@@ -51,6 +54,149 @@ void qwen_linear_nobias_bf16_qkv(float *q, float *k, float *v, const float *x,
 void qwen_matmul_t_bf16(float *C, const float *A, const uint16_t *B_bf16,
                          int M, int K, int N);
 
+/* Bounded LRU cache of f32 expansions used by the bf16 variants above when
+ * seq > 1. Matrices that are not cached are expanded one L2-sized row panel
+ * at a time and never materialized whole. Thread-safe; entries in use are
+ * never evicted. */
+typedef struct qwen_bf16_cache qwen_bf16_cache_t;
+
+typedef struct {
+    uint64_t hits;          /* lookups served from the cache */
+    uint64_t misses;        /* lookups that converted */
+    uint64_t evictions;     /* entries dropped to make room */
+    uint64_t bypass;        /* misses too large to cache (used scratch) */
+    size_t bytes;           /* f32 bytes currently held */
+    size_t limit_bytes;
+    int entries;
+} qwen_bf16_cache_stats_t;
+
+qwen_bf16_cache_t *qwen_bf16_cache_create(size_t limit_bytes);
+void qwen_bf16_cache_free(qwen_bf16_cache_t *cache);
+void qwen_bf16_cache_stats(qwen_bf16_cache_t *cache, qwen_bf16_cache_stats_t *stats);
+
+/* Bind cache to the calling thread (NULL = none); returns the previous one. */
+qwen_bf16_cache_t *qwen_bf16_cache_bind(qwen_bf16_cache_t *cache);
+
+/* Growable f32 panel buffer the bf16 GEMMs expand uncached matrices into.
+ * Kernels use the one bound to the calling thread, so each context (and
+ * its pipeline encoder thread) keeps its own; unbound callers fall back to
+ * a per-thread buffer. Zero-initialize before use. */
+typedef struct {
+    float *buf;
+    size_t cap;             /* floats */
+} qwen_scratch_t;
+
+/* Bind scratch to the calling thread (NULL = fallback); returns the previous one. */
+qwen_scratch_t *qwen_scratch_bind(qwen_scratch_t *scratch);
+
+/* Free the buffer; the struct stays usable and regrows on demand. */
+void qwen_scratch_release(qwen_scratch_t *scratch);
+
+/* ========================================================================
+ * Weight Storage Formats
+ * ======================================================================== */
+
+#define QWEN_WEIGHT_F32   0   /* float32 copy on the heap */
+#define QWEN_WEIGHT_BF16  1   /* bf16 pointer into the mmap'd safetensors */
+#define QWEN_WEIGHT_INT8  2   /* int8 with per-row scale, quantized at load */
+#define QWEN_WEIGHT_INT4  3   /* int4 with per-group scale, quantized at load */
+
+/* INT4 group size along in_dim. Each group is 16 bytes: byte j holds element
+ * j in the low nibble and element j+16 in the high nibble, stored as q+8. */
+#define QWEN_Q4_GROUP 32
+
+/* Linear weight W[out_dim, in_dim] in one of the formats above.
+ * Only the pointer(s) matching `format` are set. */
+typedef struct {
+    int format;
+    int out_dim;
+    int in_dim;
+    float *f32;                /* QWEN_WEIGHT_F32 (owned) */
+    const uint16_t *bf16;      /* QWEN_WEIGHT_BF16 (not owned) */
+    int8_t *i8;                /* QWEN_WEIGHT_INT8 (owned) */
+    uint8_t *i4;               /* QWEN_WEIGHT_INT4: [out_dim, in_dim/2] (owned) */
+    float *scale;              /* INT8: [out_dim], INT4: [out_dim, in_dim/32] (owned) */
+} qwen_weight_t;
+
+/* Build w from a bf16 source in the requested format. F32, INT8 and INT4
+ * allocate; BF16 keeps the source pointer. INT4 needs in_dim to be a multiple
+ * of QWEN_Q4_GROUP. Returns 0 on success, -1 on failure. */
+int qwen_weight_from_bf16(qwen_weight_t *w, const uint16_t *src,
+                          int out_dim, int in_dim, int format);
+
+/* Same as qwen_weight_from_bf16 but gathers src rows rows[0..n_rows) into a
+ * compact [n_rows, in_dim] weight (rows == NULL takes rows 0..n_rows).
+ * BF16 cannot gather and fails when rows != NULL. */
+int qwen_weight_from_bf16_rows(qwen_weight_t *w, const uint16_t *src, const int *rows,
+                               int n_rows, int in_dim, int format);
+
+/* Free owned storage and reset w. Safe on zeroed or already-freed weights. */
+void qwen_weight_free(qwen_weight_t *w);
+
+/* Bytes held by w (heap for F32/INT8/INT4, mapped bytes for BF16). */
+size_t qwen_weight_bytes(const qwen_weight_t *w);
+
+const char *qwen_weight_format_name(int format);
+
+/* y = x @ W^T + b for any weight format: x[seq,in], y[seq,out], b may be NULL.
+ * BF16/INT8/INT4 rows are expanded to f32 one tile at a time into a reusable
+ * scratch buffer and fed to the same GEMM as qwen_linear. For seq_len == 1
+ * they go to the threaded matvec kernels, which read the packed rows directly. */
+void qwen_linear_w(float *y, const float *x, const qwen_weight_t *W,
+                   const float *b, int seq_len);
+
+/* seq=1 Q/K/V matvecs for any format with one threaded dispatch */
+void qwen_linear_w_qkv(float *q, float *k, float *v, const float *x,
+                       const qwen_weight_t *Wq, const qwen_weight_t *Wk,
+                       const qwen_weight_t *Wv);
+
+/* y[n, out] = x[n, in] @ W^T for the few rows of a batched decode step.
+ * Output rows are split across the pool and each weight row is widened once
+ * and dotted against all n inputs, so the matrix streams from memory once
+ * per call rather than once per input. f32 weights and n == 1 go through
+ * qwen_linear_w. */
+void qwen_linear_w_batch(float *y, const float *x, const qwen_weight_t *W, int n);
+
+/* seq=1 interleaved gate/up matvec with SwiGLU applied per worker slice:
+ * out[n, inter] = SiLU(gate) * up, gate_up[n, 2 * inter] is scratch. Each
+ * of the n inputs x[n, in] gets bit-for-bit its n == 1 result. */
+void qwen_linear_w_swiglu(float *out, float *gate_up, const float *x,
+                          const qwen_weight_t *W, int n);
+
+/* seq=1 y += W @ x (residual add folded into the matvec output), for n
+ * rows of y and x, each summed as in the n == 1 call. */
+void qwen_linear_w_residual(float *y, const float *x, const qwen_weight_t *W, int n);
+
+/* Streaming argmax(W @ x) for any format (see qwen_argmax_matvec_bf16). */
+int qwen_argmax_matvec_w(const float *x, const qwen_weight_t *W);
+
+/* Inputs qwen_argmax_matvec_w_rows scores per pass over W */
+#define QWEN_ARGMAX_ROWS_MAX 16
+
+/* out[i] = qwen_argmax_matvec_w(x + i * in_dim, W) for i < n, bit-exact,
+ * reading W once per QWEN_ARGMAX_ROWS_MAX inputs. */
+void qwen_argmax_matvec_w_rows(const float *x, const qwen_weight_t *W, int n, int *out);
+
+/* Largest k supported by qwen_topk_matvec_w */
+#define QWEN_TOPK_MAX 64
+
+/* Per-worker candidate lists of qwen_topk_matvec_w (about 8 KB per pool
+ * thread). Callers keep one across calls so a decode step does not allocate. */
+typedef struct {
+    int n_found[QWEN_MAX_THREADS];
+    int idx[QWEN_MAX_THREADS][QWEN_TOPK_MAX];
+    float val[QWEN_MAX_THREADS][QWEN_TOPK_MAX];
+} qwen_topk_scratch_t;
+
+/* Top-k rows of (W @ x) without materializing all scores. Writes row indices
+ * and scores in descending score order; returns min(k, QWEN_TOPK_MAX, out_dim). */
+int qwen_topk_matvec_w(const float *x, const qwen_weight_t *W, int k,
+                       qwen_topk_scratch_t *scratch, int *idx_out, float *val_out);
+
+/* argmax of (W @ x) restricted to rows[0..n_rows); returns the winning row. */
+int qwen_argmax_rows_w(const float *x, const qwen_weight_t *W,
+                       const int *rows, int n_rows);
+
 /* ========================================================================
  * 2D Convolution (for audio encoder conv stem)
  * ======================================================================== */
@@ -68,6 +214,16 @@ void qwen_conv2d(float *out, const float *in, const float *weight, const float *
                  int c_in, int c_out, int h_in, int w_in,
                  int kh, int kw, int stride, int padding);
 
+/* Batched conv2d over n images stored channel-major: in [C_in, n, H, W],
+ * out [C_out, n, H_out, W_out], so all images share one GEMM.
+ * cols is an im2col scratch of qwen_conv2d_cols_floats() floats
+ * (NULL = allocate per call). */
+void qwen_conv2d_batch(float *out, const float *in, const float *weight, const float *bias,
+                       int n, int c_in, int c_out, int h_in, int w_in,
+                       int kh, int kw, int stride, int padding, float *cols);
+size_t qwen_conv2d_cols_floats(int n, int c_in, int h_in, int w_in,
+                               int kh, int kw, int stride, int padding);
+
 /* ========================================================================
  * Normalization
  * ======================================================================== */
@@ -107,12 +263,27 @@ void qwen_swiglu_multiply(float *out, const float *gate_up, int seq_len, int int
  * window_starts: array of window start positions
  * window_starts[n_windows] = seq (sentinel)
  * All heads have same dimensions (no GQA in encoder).
+ * Threaded over (head, window); each window is tiled into query x key
+ * blocks whose score and PV products run as small GEMMs.
  */
 void qwen_bidirectional_attention(float *out, const float *Q, const float *K,
                                    const float *V, int seq, int n_heads,
                                    int head_dim, float scale,
                                    const int *window_starts, int n_windows);
 
+/* Single-threaded per-query reference of the above (online softmax). */
+void qwen_bidirectional_attention_ref(float *out, const float *Q, const float *K,
+                                       const float *V, int seq, int n_heads,
+                                       int head_dim, float scale,
+                                       const int *window_starts, int n_windows);
+
+/* Time both encoder attention kernels on random [window_tokens * n_windows]
+ * inputs: mean ms per call over iters, plus the max abs output difference.
+ * Returns 0 on success, -1 on bad arguments or allocation failure. */
+int qwen_bench_bidirectional_attention(int n_heads, int head_dim, int window_tokens,
+                                       int n_windows, int iters,
+                                       double *tiled_ms, double *ref_ms, float *max_diff);
+
 /*
  * Causal attention with GQA (decoder).
  * Q: [seq_q, n_heads * head_dim]
@@ -124,6 +295,92 @@ void qwen_causal_attention(float *out, const float *Q, const float *K, const flo
                             int seq_q, int seq_k, int n_heads, int n_kv_heads,
                             int head_dim, float scale, int q_offset);
 
+/* ========================================================================
+ * Paged KV Cache
+ * ======================================================================== */
+
+/* Decoder K/V storage: fixed-size pages of QWEN_KV_PAGE positions per layer,
+ * holding K then V rows in the cache's format (int8 pages append one f32
+ * scale per position per kv head). Growing adds pages without moving the
+ * ones already written. */
+#define QWEN_KV_F32   0
+#define QWEN_KV_FP16  1
+#define QWEN_KV_INT8  2
+
+#define QWEN_KV_PAGE  64
+#define QWEN_KV_MAX_HEAD_DIM 128
+
+typedef struct {
+    int format;                /* QWEN_KV_* */
+    int n_layers, n_kv_heads, head_dim;
+    int n_pages;               /* pages allocated per layer */
+    int pages_cap;             /* page-table capacity per layer */
+    size_t page_bytes;
+    uint8_t **pages;           /* [pages_cap * n_layers], page-major */
+} qwen_kv_cache_t;
+
+/* Set up an empty cache (no pages). Returns 0, or -1 for an unknown format
+ * or head_dim > QWEN_KV_MAX_HEAD_DIM. */
+int qwen_kv_cache_init(qwen_kv_cache_t *kv, int format, int n_layers,
+                       int n_kv_heads, int head_dim);
+void qwen_kv_cache_free(qwen_kv_cache_t *kv);
+
+/* Make room for positions [0, n_pos). Returns 0 on success, -1 on failure
+ * (pages already allocated stay valid). */
+int qwen_kv_cache_reserve(qwen_kv_cache_t *kv, int n_pos);
+
+/* Copy positions [0, n_pos) of every layer from src, setting dst up in
+ * src's layout on first use (whole pages are copied). Returns 0, or -1 if
+ * the layouts differ, src does not hold n_pos positions or allocation fails. */
+int qwen_kv_cache_copy_prefix(qwen_kv_cache_t *dst, const qwen_kv_cache_t *src, int n_pos);
+
+/* Positions the allocated pages can hold, and their resident size. */
+int qwen_kv_cache_capacity(const qwen_kv_cache_t *kv);
+size_t qwen_kv_cache_bytes(const qwen_kv_cache_t *kv);
+
+/* Convert and store n consecutive K/V rows ([n, n_kv_heads * head_dim])
+ * of one layer starting at pos. The positions must be reserved. */
+void qwen_kv_cache_store(qwen_kv_cache_t *kv, int layer, int pos, int n,
+                         const float *K, const float *V);
+
+/* Decoder kernels instantiated for one model geometry (constant hidden
+ * size and head_dim). Each entry has the signature of the runtime-shape
+ * kernel it replaces; the shape arguments must match the set. */
+typedef struct {
+    const char *name;
+    int hidden, head_dim;
+    void (*rms_norm)(float *out, const float *x, const float *weight,
+                     int seq_len, int hidden, float eps);
+    void (*causal_attention_kv)(float *out, const float *Q, const qwen_kv_cache_t *kv,
+                                int layer, int seq_q, int seq_k, int n_heads,
+                                float scale, int q_offset);
+} qwen_dec_kernels_t;
+
+/* Specialized set for (hidden, head_dim), or the generic one (never NULL). */
+const qwen_dec_kernels_t *qwen_dec_kernels_select(int hidden, int head_dim);
+
+/* seq=1 Q/K/V matvecs with the per-head epilogue in the same dispatch: Q
+ * and K heads get their RMSNorm and NeoX RoPE (rope_cos/sin for pos), and
+ * K/V heads are written to the cache at (layer, pos), which must be
+ * reserved. q, k and v hold the final activations on return. With n > 1,
+ * x holds n inputs at positions pos .. pos + n - 1 (rope rows likewise),
+ * each computed exactly as its own n == 1 call. */
+void qwen_linear_w_qkv_rope(float *q, float *k, float *v, const float *x,
+                            const qwen_weight_t *Wq, const qwen_weight_t *Wk,
+                            const qwen_weight_t *Wv, const float *q_norm,
+                            const float *k_norm, float eps, const float *rope_cos,
+                            const float *rope_sin, int head_dim,
+                            qwen_kv_cache_t *kv, int layer, int pos, int n);
+
+/* qwen_causal_attention over positions [0, seq_k) of one cached layer,
+ * reading the pages directly (converted one page at a time). */
+void qwen_causal_attention_kv(float *out, const float *Q, const qwen_kv_cache_t *kv,
+                              int layer, int seq_q, int seq_k, int n_heads,
+                              float scale, int q_offset);
+
+/* Short name of a QWEN_KV_* format ("f32", "fp16", "int8"). */
+const char *qwen_kv_format_name(int format);
+
 /* ========================================================================
  * Position Embeddings
  * ======================================================================== */
@@ -160,13 +417,85 @@ int qwen_argmax_matvec_bf16(const float *x, const uint16_t *W_bf16,
  * Threading
  * ======================================================================== */
 
-/* Set number of threads for parallel operations (default: 1).
- * Creates a persistent thread pool. Call before inference. */
+/* Persistent worker pool. Kernels run on the pool bound to the calling
+ * thread, or on the default pool when none is bound. */
+typedef struct qwen_threadpool qwen_threadpool_t;
+
+#define QWEN_QOS_DEFAULT     0  /* inherit the creating thread's class */
+#define QWEN_QOS_PERFORMANCE 1  /* user-interactive (P-cores on Apple) */
+#define QWEN_QOS_EFFICIENCY  2  /* utility (E-cores on Apple) */
+
+/* Create a pool of n_threads (caller included, clamped to 1..16).
+ * qos is applied on Apple. */
+qwen_threadpool_t *qwen_threadpool_create(int n_threads, int qos);
+void qwen_threadpool_free(qwen_threadpool_t *pool);
+int qwen_threadpool_threads(const qwen_threadpool_t *pool);
+
+/* Bind pool to the calling thread (NULL = default pool).
+ * Returns the previous binding so callers can restore it. */
+qwen_threadpool_t *qwen_threadpool_bind(qwen_threadpool_t *pool);
+
+/* Hold the current pool for the calling thread until the matching
+ * qwen_parallel_end and, on desktop, keep its workers spinning between
+ * dispatches, so a run of small kernels (a decoder token step) pays a
+ * single wake-up. Nestable. Idle workers otherwise park after
+ * QWEN_POOL_SPIN iterations (env; default 20000 on desktop, 2000 on iOS,
+ * 0 for QWEN_QOS_EFFICIENCY pools or when threads outnumber CPUs).
+ * QWEN_POOL_HOT=0/1 overrides whether regions suspend parking (default on
+ * desktop only). */
+void qwen_parallel_begin(void);
+void qwen_parallel_end(void);
+
+/* Set number of threads of the default pool (default: 1).
+ * Recreates the pool; call before inference. */
 void qwen_set_threads(int n);
 
 /* Get number of available CPU cores */
 int qwen_get_num_cpus(void);
 
+/* ========================================================================
+ * Profiling
+ * ======================================================================== */
+
+/* Build with -DQWEN_PROFILE=0 to compile the kernel counters, per-layer
+ * timers and signposts out; perf reports then carry the stage totals only. */
+#ifndef QWEN_PROFILE
+#define QWEN_PROFILE 1
+#endif
+
+/* Kernel classes */
+#define QWEN_PERF_MATVEC    0  /* decode-step linears, fused epilogues included */
+#define QWEN_PERF_MATMUL    1  /* prefill and encoder GEMMs */
+#define QWEN_PERF_ATTENTION 2
+#define QWEN_PERF_NORM      3  /* RMSNorm and LayerNorm */
+#define QWEN_PERF_LM_HEAD   4  /* argmax / top-k over the LM head */
+#define QWEN_PERF_CONV      5  /* encoder conv stem */
+#define QWEN_PERF_KERNELS   6
+
+typedef struct {
+    uint64_t calls;
+    double ms;                 /* wall time seen by the calling thread */
+    uint64_t weight_bytes;     /* weight bytes streamed (0 for activation-only kernels) */
+} qwen_perf_kernel_t;
+
+typedef struct {
+    qwen_perf_kernel_t kernel[QWEN_PERF_KERNELS];
+    uint64_t pool_dispatches;  /* kernels split across a pool */
+    double pool_compute_ms;    /* the calling thread's own share of their work */
+    double pool_wait_ms;       /* the calling thread waiting for the slowest worker */
+} qwen_perf_counters_t;
+
+/* Count kernels called from this thread into c (NULL = stop counting).
+ * A kernel that calls another is counted once, in its own class.
+ * Returns the previous binding so callers can restore it. */
+qwen_perf_counters_t *qwen_perf_bind(qwen_perf_counters_t *c);
+
+/* dst += src */
+void qwen_perf_counters_add(qwen_perf_counters_t *dst, const qwen_perf_counters_t *src);
+
+/* Monotonic clock in milliseconds */
+double qwen_perf_now_ms(void);
+
 /* Global verbose flag */
 extern int qwen_verbose;
 
@@ -9,9 +9,21 @@
 
 void qwen_bf16_matvec_fused_generic(float *y, const float *x, const uint16_t *W_bf16,
                                     const float *bias, int in_dim, int out_dim);
+void qwen_bf16_matmul_rows_generic(float *y, int ldy, const float *x, int n,
+                                    const uint16_t *W_bf16, int in_dim, int out_dim);
 void qwen_argmax_bf16_range_generic(const float *x, const uint16_t *W_bf16,
                                     int in_dim, int start, int end,
                                     int *best_out, float *best_val_out);
+void qwen_i8_matvec_generic(float *y, const float *x, const int8_t *W_i8,
+                            const float *scale, const float *bias, int in_dim, int out_dim);
+void qwen_argmax_i8_range_generic(const float *x, const int8_t *W_i8, const float *scale,
+                                  int in_dim, int start, int end,
+                                  int *best_out, float *best_val_out);
+void qwen_i4_matvec_generic(float *y, const float *x, const uint8_t *W_i4,
+                            const float *scale, const float *bias, int in_dim, int out_dim);
+void qwen_argmax_i4_range_generic(const float *x, const uint8_t *W_i4, const float *scale,
+                                  int in_dim, int start, int end,
+                                  int *best_out, float *best_val_out);
 float qwen_dot_f32_generic(const float *a, const float *b, int n);
 void qwen_vec_scale_inplace_generic(float *dst, float scale, int n);
 void qwen_vec_axpy_inplace_generic(float *dst, const float *src, float alpha, int n);
@@ -20,16 +32,33 @@ void qwen_vec_scale_add_generic(float *dst, const float *src, float correction,
 #ifdef __ARM_NEON
 void qwen_bf16_matvec_fused_neon(float *y, const float *x, const uint16_t *W_bf16,
                                  const float *bias, int in_dim, int out_dim);
+void qwen_bf16_matmul_rows_neon(float *y, int ldy, const float *x, int n,
+                                 const uint16_t *W_bf16, int in_dim, int out_dim);
 void qwen_argmax_bf16_range_neon(const float *x, const uint16_t *W_bf16,
                                  int in_dim, int start, int end,
                                  int *best_out, float *best_val_out);
+void qwen_i8_matvec_neon(float *y, const float *x, const int8_t *W_i8,
+                         const float *scale, const float *bias, int in_dim, int out_dim);
+void qwen_argmax_i8_range_neon(const float *x, const int8_t *W_i8, const float *scale,
+                               int in_dim, int start, int end,
+                               int *best_out, float *best_val_out);
+void qwen_i4_matvec_neon(float *y, const float *x, const uint8_t *W_i4,
+                         const float *scale, const float *bias, int in_dim, int out_dim);
+void qwen_argmax_i4_range_neon(const float *x, const uint8_t *W_i4, const float *scale,
+                               int in_dim, int start, int end,
+                               int *best_out, float *best_val_out);
 float qwen_dot_f32_neon(const float *a, const float *b, int n);
 void qwen_vec_scale_inplace_neon(float *dst, float scale, int n);
 void qwen_vec_axpy_inplace_neon(float *dst, const float *src, float alpha, int n);
 void qwen_vec_scale_add_neon(float *dst, const float *src, float correction, int n);
 
 #define qwen_bf16_matvec_fused_impl qwen_bf16_matvec_fused_neon
+#define qwen_bf16_matmul_rows_impl qwen_bf16_matmul_rows_neon
 #define qwen_argmax_bf16_range_impl qwen_argmax_bf16_range_neon
+#define qwen_i8_matvec_impl qwen_i8_matvec_neon
+#define qwen_argmax_i8_range_impl qwen_argmax_i8_range_neon
+#define qwen_i4_matvec_impl qwen_i4_matvec_neon
+#define qwen_argmax_i4_range_impl qwen_argmax_i4_range_neon
 #define qwen_dot_f32_impl qwen_dot_f32_neon
 #define qwen_vec_scale_inplace_impl qwen_vec_scale_inplace_neon
 #define qwen_vec_axpy_inplace_impl qwen_vec_axpy_inplace_neon
@@ -38,16 +67,33 @@ void qwen_vec_scale_add_neon(float *dst, const float *src, float correction, int
 #elif defined(__AVX2__) && defined(__FMA__)
 void qwen_bf16_matvec_fused_avx(float *y, const float *x, const uint16_t *W_bf16,
                                  const float *bias, int in_dim, int out_dim);
+void qwen_bf16_matmul_rows_avx(float *y, int ldy, const float *x, int n,
+                                 const uint16_t *W_bf16, int in_dim, int out_dim);
 void qwen_argmax_bf16_range_avx(const float *x, const uint16_t *W_bf16,
                                  int in_dim, int start, int end,
                                  int *best_out, float *best_val_out);
+void qwen_i8_matvec_avx(float *y, const float *x, const int8_t *W_i8,
+                        const float *scale, const float *bias, int in_dim, int out_dim);
+void qwen_argmax_i8_range_avx(const float *x, const int8_t *W_i8, const float *scale,
+                              int in_dim, int start, int end,
+                              int *best_out, float *best_val_out);
+void qwen_i4_matvec_avx(float *y, const float *x, const uint8_t *W_i4,
+                        const float *scale, const float *bias, int in_dim, int out_dim);
+void qwen_argmax_i4_range_avx(const float *x, const uint8_t *W_i4, const float *scale,
+                              int in_dim, int start, int end,
+                              int *best_out, float *best_val_out);
 float qwen_dot_f32_avx(const float *a, const float *b, int n);
 void qwen_vec_scale_inplace_avx(float *dst, float scale, int n);
 void qwen_vec_axpy_inplace_avx(float *dst, const float *src, float alpha, int n);
 void qwen_vec_scale_add_avx(float *dst, const float *src, float correction, int n);
 
 #define qwen_bf16_matvec_fused_impl qwen_bf16_matvec_fused_avx
+#define qwen_bf16_matmul_rows_impl qwen_bf16_matmul_rows_avx
 #define qwen_argmax_bf16_range_impl qwen_argmax_bf16_range_avx
+#define qwen_i8_matvec_impl qwen_i8_matvec_avx
+#define qwen_argmax_i8_range_impl qwen_argmax_i8_range_avx
+#define qwen_i4_matvec_impl qwen_i4_matvec_avx
+#define qwen_argmax_i4_range_impl qwen_argmax_i4_range_avx
 #define qwen_dot_f32_impl qwen_dot_f32_avx
 #define qwen_vec_scale_inplace_impl qwen_vec_scale_inplace_avx
 #define qwen_vec_axpy_inplace_impl qwen_vec_axpy_inplace_avx
@@ -55,7 +101,12 @@ void qwen_vec_scale_add_avx(float *dst, const float *src, float correction, int
 
 #else
 #define qwen_bf16_matvec_fused_impl qwen_bf16_matvec_fused_generic
+#define qwen_bf16_matmul_rows_impl qwen_bf16_matmul_rows_generic
 #define qwen_argmax_bf16_range_impl qwen_argmax_bf16_range_generic
+#define qwen_i8_matvec_impl qwen_i8_matvec_generic
+#define qwen_argmax_i8_range_impl qwen_argmax_i8_range_generic
+#define qwen_i4_matvec_impl qwen_i4_matvec_generic
+#define qwen_argmax_i4_range_impl qwen_argmax_i4_range_generic
 #define qwen_dot_f32_impl qwen_dot_f32_generic
 #define qwen_vec_scale_inplace_impl qwen_vec_scale_inplace_generic
 #define qwen_vec_axpy_inplace_impl qwen_vec_axpy_inplace_generic
@@ -4,14 +4,18 @@
  * Supports:
  *  - decode token ID -> UTF-8 text
  *  - encode UTF-8 text -> token IDs (vocab.json + merges.txt)
+ *  - a precompiled tokenizer.bin next to vocab.json, mmap'd instead of
+ *    parsing the JSON (written on the first parse)
  */
 
+#include <stddef.h>
+
 #ifndef QWEN_ASR_TOKENIZER_H
 #define QWEN_ASR_TOKENIZER_H
 
 typedef struct {
-    char **id_to_text;   /* [vocab_size] decoded text strings */
-    char **id_to_bpe;    /* [vocab_size] raw BPE token strings from vocab.json */
+    char **id_to_text;   /* [vocab_size] decoded text strings (NULL when mmap'd) */
+    char **id_to_bpe;    /* [vocab_size] raw BPE token strings from vocab.json (NULL when mmap'd) */
     int vocab_size;
 
     /* Internal hash maps (opaque to callers) */
@@ -19,9 +23,16 @@ typedef struct {
     int vocab_map_cap;
     void *merge_map;
     int merge_map_cap;
+
+    /* mmap'd tokenizer.bin backing the tables above, or NULL */
+    void *blob;
+    size_t blob_size;
 } qwen_tokenizer_t;
 
-/* Load tokenizer from vocab.json in model directory */
+/* Load tokenizer from vocab.json in model directory. A valid tokenizer.bin
+ * in the same directory is mmap'd instead; otherwise the JSON is parsed and
+ * tokenizer.bin is written for the next load (best effort).
+ * QWEN_TOKENIZER_BLOB=0 disables both. */
 qwen_tokenizer_t *qwen_tokenizer_load(const char *vocab_json_path);
 
 /* Decode a single token ID to text. Returns pointer to internal string. */
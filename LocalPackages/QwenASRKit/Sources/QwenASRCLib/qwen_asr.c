@@ -7,6 +7,7 @@
 
 #include "qwen_asr.h"
 #include "qwen_asr_kernels.h"
+#include "qwen_asr_perf.h"
 #include "qwen_asr_safetensors.h"
 #include "qwen_asr_audio.h"
 #include "qwen_asr_tokenizer.h"
@@ -16,15 +17,92 @@
 #include <ctype.h>
 #include <math.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#if QWEN_PROFILE
+#include <os/log.h>
+#include <os/signpost.h>
+#endif
+#endif
 
 /* Global verbose flag */
 int qwen_verbose = 0;
 
+static double get_time_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* Resident set size of the process in bytes (0 if unavailable). */
+static size_t resident_bytes(void) {
+#ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                  (task_info_t)&info, &count) != KERN_SUCCESS)
+        return 0;
+    return (size_t)info.resident_size;
+#else
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    unsigned long pages = 0, resident = 0;
+    int n = fscanf(f, "%lu %lu", &pages, &resident);
+    fclose(f);
+    return n == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
 void qwen_set_token_callback(qwen_ctx_t *ctx, qwen_token_cb cb, void *userdata) {
     ctx->token_cb = cb;
     ctx->token_cb_userdata = userdata;
 }
 
+int qwen_ctx_set_bf16_cache(qwen_ctx_t *ctx, size_t limit_mb) {
+    qwen_bf16_cache_free(ctx->bf16_cache);
+    ctx->bf16_cache = NULL;
+    if (limit_mb == 0) return 0;
+    ctx->bf16_cache = qwen_bf16_cache_create(limit_mb * 1024 * 1024);
+    return ctx->bf16_cache ? 0 : -1;
+}
+
+int qwen_ctx_set_kv_cache_format(qwen_ctx_t *ctx, int format) {
+    if (format != QWEN_KV_F32 && format != QWEN_KV_FP16 && format != QWEN_KV_INT8)
+        return -1;
+    qwen_kv_cache_free(&ctx->kv_cache);
+    memset(&ctx->kv_cache, 0, sizeof(ctx->kv_cache));
+    ctx->kv_format = format;
+    ctx->kv_cache_len = 0;
+    ctx->kv_cache_max = 0;
+    ctx->kv_prompt_len = 0;
+    return 0;
+}
+
+int qwen_ctx_set_threads(qwen_ctx_t *ctx, int n_threads, int qos) {
+    qwen_threadpool_t *pool = NULL;
+    if (n_threads > 0) {
+        pool = qwen_threadpool_create(n_threads, qos);
+        if (!pool) return -1;
+    }
+    qwen_threadpool_free(ctx->pool);
+    ctx->pool = pool;
+    return 0;
+}
+
+int qwen_ctx_set_pipeline(qwen_ctx_t *ctx, int enc_threads, int qos) {
+    qwen_threadpool_t *pool = NULL;
+    if (enc_threads > 0) {
+        pool = qwen_threadpool_create(enc_threads, qos);
+        if (!pool) return -1;
+    }
+    qwen_threadpool_free(ctx->enc_pool);
+    ctx->enc_pool = pool;
+    return 0;
+}
+
 static const char *QWEN_SUPPORTED_LANGUAGES[] = {
     "Chinese", "English", "Cantonese", "Arabic", "German", "French",
     "Spanish", "Portuguese", "Indonesian", "Italian", "Korean", "Russian",
@@ -53,6 +131,7 @@ static void reset_prompt_cache(qwen_ctx_t *ctx) {
     ctx->n_force_prompt_tokens = 0;
 
     ctx->prompt_tokens_ready = 0;
+    ctx->kv_prompt_len = 0;
 }
 
 int qwen_set_prompt(qwen_ctx_t *ctx, const char *prompt) {
@@ -116,6 +195,185 @@ int qwen_set_force_language(qwen_ctx_t *ctx, const char *language) {
     return 0;
 }
 
+/* ========================================================================
+ * LM Head Vocabulary
+ * ======================================================================== */
+
+/* Scripts a forced language may emit besides ASCII and common punctuation */
+#define SCRIPT_LATIN       (1 << 0)
+#define SCRIPT_CJK         (1 << 1)
+#define SCRIPT_KANA        (1 << 2)
+#define SCRIPT_HANGUL      (1 << 3)
+#define SCRIPT_CYRILLIC    (1 << 4)
+#define SCRIPT_GREEK       (1 << 5)
+#define SCRIPT_ARABIC      (1 << 6)
+#define SCRIPT_DEVANAGARI  (1 << 7)
+#define SCRIPT_THAI        (1 << 8)
+
+static const struct {
+    const char *language;
+    int scripts;
+} QWEN_LANGUAGE_SCRIPTS[] = {
+    { "Chinese", SCRIPT_CJK },         { "Cantonese", SCRIPT_CJK },
+    { "Japanese", SCRIPT_CJK | SCRIPT_KANA },
+    { "Korean", SCRIPT_HANGUL },       { "Russian", SCRIPT_CYRILLIC },
+    { "Macedonian", SCRIPT_CYRILLIC }, { "Greek", SCRIPT_GREEK },
+    { "Arabic", SCRIPT_ARABIC },       { "Persian", SCRIPT_ARABIC },
+    { "Hindi", SCRIPT_DEVANAGARI },    { "Thai", SCRIPT_THAI },
+};
+
+static int language_scripts(const char *language) {
+    int n = (int)(sizeof(QWEN_LANGUAGE_SCRIPTS) / sizeof(QWEN_LANGUAGE_SCRIPTS[0]));
+    for (int i = 0; i < n; i++) {
+        if (strcmp(language, QWEN_LANGUAGE_SCRIPTS[i].language) == 0)
+            return QWEN_LANGUAGE_SCRIPTS[i].scripts;
+    }
+    return SCRIPT_LATIN; /* every other supported language is Latin-script */
+}
+
+/* Script of one codepoint: 0 = common (digits, punctuation, symbols),
+ * -1 = a script no supported language uses. */
+static int codepoint_script(unsigned cp) {
+    if (cp < 0x80) return 0;
+    if (cp < 0x300) return SCRIPT_LATIN;
+    if (cp < 0x370) return 0;                          /* combining marks */
+    if (cp < 0x400) return SCRIPT_GREEK;
+    if (cp < 0x530) return SCRIPT_CYRILLIC;
+    if (cp >= 0x600 && cp < 0x700) return SCRIPT_ARABIC;
+    if (cp >= 0x750 && cp < 0x780) return SCRIPT_ARABIC;
+    if (cp >= 0x8A0 && cp < 0x900) return SCRIPT_ARABIC;
+    if (cp >= 0x900 && cp < 0x980) return SCRIPT_DEVANAGARI;
+    if (cp >= 0xE00 && cp < 0xE80) return SCRIPT_THAI;
+    if (cp >= 0x1100 && cp < 0x1200) return SCRIPT_HANGUL;
+    if (cp >= 0x1E00 && cp < 0x1F00) return SCRIPT_LATIN;
+    if (cp >= 0x1F00 && cp < 0x2000) return SCRIPT_GREEK;
+    if (cp >= 0x2000 && cp < 0x2C00) return 0;         /* punctuation, symbols */
+    if (cp >= 0x3000 && cp < 0x3040) return 0;         /* CJK punctuation */
+    if (cp >= 0x3040 && cp < 0x3100) return SCRIPT_KANA;
+    if (cp >= 0x3130 && cp < 0x3190) return SCRIPT_HANGUL;
+    if (cp >= 0x31F0 && cp < 0x3200) return SCRIPT_KANA;
+    if (cp >= 0x3400 && cp < 0x4DC0) return SCRIPT_CJK;
+    if (cp >= 0x4E00 && cp < 0xA000) return SCRIPT_CJK;
+    if (cp >= 0xA8E0 && cp < 0xA900) return SCRIPT_DEVANAGARI;
+    if (cp >= 0xAC00 && cp < 0xD7B0) return SCRIPT_HANGUL;
+    if (cp >= 0xF900 && cp < 0xFB00) return SCRIPT_CJK;
+    if (cp >= 0xFB50 && cp < 0xFE00) return SCRIPT_ARABIC;
+    if (cp >= 0xFE70 && cp < 0xFF00) return SCRIPT_ARABIC;
+    if (cp >= 0xFF65 && cp < 0xFFA0) return SCRIPT_KANA; /* halfwidth katakana */
+    if (cp >= 0xFF00 && cp < 0xFFF0) return 0;         /* fullwidth forms */
+    if (cp >= 0x20000 && cp < 0x30000) return SCRIPT_CJK;
+    return -1;
+}
+
+/* A token is kept if all of its complete codepoints are common or in
+ * `scripts`. Byte-level pieces that split a multi-byte character are always
+ * kept since they are needed to spell rare characters. */
+static int token_in_scripts(const char *text, int scripts) {
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p) {
+        unsigned cp;
+        int len;
+        if (p[0] < 0x80) { cp = p[0]; len = 1; }
+        else if ((p[0] & 0xE0) == 0xC0) { cp = p[0] & 0x1F; len = 2; }
+        else if ((p[0] & 0xF0) == 0xE0) { cp = p[0] & 0x0F; len = 3; }
+        else if ((p[0] & 0xF8) == 0xF0) { cp = p[0] & 0x07; len = 4; }
+        else return 1;
+        for (int i = 1; i < len; i++) {
+            if ((p[i] & 0xC0) != 0x80) return 1;
+            cp = (cp << 6) | (p[i] & 0x3F);
+        }
+        int script = codepoint_script(cp);
+        if (script < 0 || (script != 0 && !(script & scripts))) return 0;
+        p += len;
+    }
+    return 1;
+}
+
+static void reset_lm_vocab(qwen_ctx_t *ctx) {
+    if (ctx->lm_draft_shared) {
+        /* Borrowed from the context this one was shared from */
+        memset(&ctx->lm_draft, 0, sizeof(ctx->lm_draft));
+        ctx->lm_draft_shared = 0;
+    } else {
+        qwen_weight_free(&ctx->lm_draft);
+        free(ctx->lm_vocab);
+    }
+    ctx->lm_vocab = NULL;
+    free(ctx->lm_vocab_lang);
+    ctx->lm_vocab_lang = NULL;
+    ctx->lm_vocab_ready = 0;
+}
+
+int qwen_set_lm_head_mode(qwen_ctx_t *ctx, int mode, int topk) {
+    if (!ctx) return -1;
+    if (mode != QWEN_LM_HEAD_FULL && mode != QWEN_LM_HEAD_FAST &&
+        mode != QWEN_LM_HEAD_CHECK)
+        return -1;
+    ctx->lm_head_mode = mode;
+    if (topk > 0) ctx->lm_head_topk = topk < QWEN_TOPK_MAX ? topk : QWEN_TOPK_MAX;
+    ctx->lm_check_tokens = 0;
+    ctx->lm_check_mismatch = 0;
+    return 0;
+}
+
+/* Build the int4 first-pass table for the current force_language. On failure
+ * the decoder falls back to the full argmax. */
+static void prepare_lm_vocab(qwen_ctx_t *ctx, const qwen_tokenizer_t *tokenizer) {
+    if (ctx->lm_head_mode == QWEN_LM_HEAD_FULL) return;
+    if (!ctx->lm_topk) {
+        ctx->lm_topk = (qwen_topk_scratch_t *)malloc(sizeof(qwen_topk_scratch_t));
+        if (!ctx->lm_topk) {
+            reset_lm_vocab(ctx);
+            return;
+        }
+    }
+    const char *lang = ctx->force_language;
+    if (ctx->lm_vocab_ready &&
+        ((!lang && !ctx->lm_vocab_lang) ||
+         (lang && ctx->lm_vocab_lang && strcmp(lang, ctx->lm_vocab_lang) == 0)))
+        return;
+
+    reset_lm_vocab(ctx);
+    const qwen_decoder_t *dec = &ctx->decoder;
+    int vocab = ctx->config.vocab_size;
+    int hidden = ctx->config.dec_hidden;
+    double t0 = get_time_ms();
+
+    if (lang) {
+        int scripts = language_scripts(lang);
+        ctx->lm_vocab = (int *)malloc((size_t)vocab * sizeof(int));
+        ctx->lm_vocab_lang = strdup(lang);
+        if (!ctx->lm_vocab || !ctx->lm_vocab_lang) {
+            reset_lm_vocab(ctx);
+            return;
+        }
+        int n = 0;
+        for (int id = 0; id < vocab; id++) {
+            const char *text = qwen_tokenizer_decode(tokenizer, id);
+            if (id >= QWEN_TOKEN_ENDOFTEXT || (text[0] && token_in_scripts(text, scripts)))
+                ctx->lm_vocab[n++] = id;
+        }
+        if (qwen_weight_from_bf16_rows(&ctx->lm_draft, dec->tok_embeddings_bf16,
+                                       ctx->lm_vocab, n, hidden, QWEN_WEIGHT_INT4) != 0) {
+            reset_lm_vocab(ctx);
+            return;
+        }
+    } else if (dec->weight_format != QWEN_WEIGHT_INT4) {
+        /* No language: the first pass still reads a quarter of the bytes */
+        if (qwen_weight_from_bf16(&ctx->lm_draft, dec->tok_embeddings_bf16,
+                                  vocab, hidden, QWEN_WEIGHT_INT4) != 0) {
+            reset_lm_vocab(ctx);
+            return;
+        }
+    }
+    ctx->lm_vocab_ready = 1;
+
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "LM head: %s vocabulary %d/%d tokens, top-%d re-score (%.0f ms)\n",
+                lang ? lang : "full", ctx->lm_draft.out_dim ? ctx->lm_draft.out_dim : vocab,
+                vocab, ctx->lm_head_topk, get_time_ms() - t0);
+}
+
 /* ========================================================================
  * Internal load functions (defined in encoder/decoder .c files)
  * ======================================================================== */
@@ -125,26 +383,17 @@ extern int qwen_encoder_load(qwen_encoder_t *enc, multi_safetensors_t *ms,
 extern int qwen_decoder_load(qwen_decoder_t *dec, multi_safetensors_t *ms,
                               const qwen_config_t *cfg);
 
+/* Compiled model cache (qwen_asr_compiled.c) */
+extern int qwen_compiled_load(qwen_ctx_t *ctx);
+extern int qwen_compiled_owns(const qwen_ctx_t *ctx, const void *p);
+extern void qwen_compiled_close(qwen_ctx_t *ctx);
+
 /* ========================================================================
  * Config Detection
  * ======================================================================== */
 
-/* Detect model variant from config.json or heuristics */
-static int detect_config(qwen_ctx_t *ctx) {
-    qwen_config_t *cfg = &ctx->config;
-
-    /* Try to detect from number of shards:
-     * 1.7B has 2 shards, 0.6B has 1 shard
-     * But we can also check a specific weight shape. */
-
-    /* Check if thinker.audio_tower.layers.17 exists (0.6B has 18 layers, 1.7B has 24) */
-    multi_safetensors_t *ms = (multi_safetensors_t *)ctx->safetensors;
-
-    /* Check for layer 18 (0-indexed) in encoder - if it exists, it's 1.7B */
-    const safetensor_t *test = multi_safetensors_find(ms,
-        "thinker.audio_tower.layers.18.self_attn.q_proj.weight", NULL);
-
-    if (test) {
+void qwen_config_variant(qwen_config_t *cfg, int large) {
+    if (large) {
         /* 1.7B model */
         cfg->enc_d_model = 1024;
         cfg->enc_layers = 24;
@@ -158,7 +407,6 @@ static int detect_config(qwen_ctx_t *ctx) {
         cfg->dec_kv_heads = 8;
         cfg->dec_head_dim = 128;
         cfg->dec_intermediate = 6144;
-        if (qwen_verbose >= 1) fprintf(stderr, "Detected: Qwen3-ASR-1.7B\n");
     } else {
         /* 0.6B model */
         cfg->enc_d_model = 896;
@@ -173,7 +421,6 @@ static int detect_config(qwen_ctx_t *ctx) {
         cfg->dec_kv_heads = 8;
         cfg->dec_head_dim = 128;
         cfg->dec_intermediate = 3072;
-        if (qwen_verbose >= 1) fprintf(stderr, "Detected: Qwen3-ASR-0.6B\n");
     }
 
     /* Common parameters */
@@ -184,7 +431,24 @@ static int detect_config(qwen_ctx_t *ctx) {
     cfg->vocab_size = QWEN_VOCAB_SIZE;
     cfg->dec_rms_norm_eps = 1e-6f;
     cfg->dec_rope_theta = 1e6f;
+}
+
+/* Detect model variant from config.json or heuristics */
+static int detect_config(qwen_ctx_t *ctx) {
+    /* Try to detect from number of shards:
+     * 1.7B has 2 shards, 0.6B has 1 shard
+     * But we can also check a specific weight shape. */
+
+    /* Check if thinker.audio_tower.layers.17 exists (0.6B has 18 layers, 1.7B has 24) */
+    multi_safetensors_t *ms = (multi_safetensors_t *)ctx->safetensors;
+
+    /* Check for layer 18 (0-indexed) in encoder - if it exists, it's 1.7B */
+    const safetensor_t *test = multi_safetensors_find(ms,
+        "thinker.audio_tower.layers.18.self_attn.q_proj.weight", NULL);
 
+    qwen_config_variant(&ctx->config, test != NULL);
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "Detected: Qwen3-ASR-%s\n", test ? "1.7B" : "0.6B");
     return 0;
 }
 
@@ -192,15 +456,93 @@ static int detect_config(qwen_ctx_t *ctx) {
  * Model Loading
  * ======================================================================== */
 
+/* Encoder weight format for subsequent qwen_load calls; -1 = env/default. */
+static int enc_weight_format_override = -1;
+
+int qwen_set_encoder_weight_format(int format) {
+    if (format != -1 && format != QWEN_WEIGHT_F32 &&
+        format != QWEN_WEIGHT_BF16 && format != QWEN_WEIGHT_INT8)
+        return -1;
+    enc_weight_format_override = format;
+    return 0;
+}
+
+static int resolve_encoder_weight_format(void) {
+    if (enc_weight_format_override >= 0) return enc_weight_format_override;
+    const char *env = getenv("QWEN_ENC_WEIGHTS");
+    if (env && env[0] != '\0') {
+        if (strcmp(env, "bf16") == 0) return QWEN_WEIGHT_BF16;
+        if (strcmp(env, "int8") == 0) return QWEN_WEIGHT_INT8;
+        if (strcmp(env, "f32") != 0)
+            fprintf(stderr, "QWEN_ENC_WEIGHTS=%s not recognized, using f32\n", env);
+    }
+    return QWEN_WEIGHT_F32;
+}
+
+/* Decoder weight format for subsequent qwen_load calls; -1 = env/default. */
+static int dec_weight_format_override = -1;
+
+int qwen_set_decoder_weight_format(int format) {
+    if (format != -1 && format != QWEN_WEIGHT_BF16 &&
+        format != QWEN_WEIGHT_INT8 && format != QWEN_WEIGHT_INT4)
+        return -1;
+    dec_weight_format_override = format;
+    return 0;
+}
+
+static int resolve_decoder_weight_format(void) {
+    if (dec_weight_format_override >= 0) return dec_weight_format_override;
+    const char *env = getenv("QWEN_DEC_WEIGHTS");
+    if (env && env[0] != '\0') {
+        if (strcmp(env, "int8") == 0) return QWEN_WEIGHT_INT8;
+        if (strcmp(env, "int4") == 0) return QWEN_WEIGHT_INT4;
+        if (strcmp(env, "bf16") != 0)
+            fprintf(stderr, "QWEN_DEC_WEIGHTS=%s not recognized, using bf16\n", env);
+    }
+    return QWEN_WEIGHT_BF16;
+}
+
+static size_t encoder_weight_bytes(const qwen_encoder_t *enc, int n_layers) {
+    size_t total = qwen_weight_bytes(&enc->conv_out_weight) +
+                   qwen_weight_bytes(&enc->proj1_weight) +
+                   qwen_weight_bytes(&enc->proj2_weight);
+    for (int i = 0; i < n_layers; i++) {
+        const qwen_enc_layer_t *l = &enc->layers[i];
+        total += qwen_weight_bytes(&l->wq_weight) + qwen_weight_bytes(&l->wk_weight) +
+                 qwen_weight_bytes(&l->wv_weight) + qwen_weight_bytes(&l->wo_weight) +
+                 qwen_weight_bytes(&l->fc1_weight) + qwen_weight_bytes(&l->fc2_weight);
+    }
+    return total;
+}
+
+/* Bytes streamed by one decode step: every layer matrix plus the LM head. */
+static size_t decoder_weight_bytes(const qwen_decoder_t *dec, int n_layers) {
+    size_t total = qwen_weight_bytes(&dec->lm_head);
+    for (int i = 0; i < n_layers; i++) {
+        const qwen_dec_layer_t *l = &dec->layers[i];
+        total += qwen_weight_bytes(&l->wq) + qwen_weight_bytes(&l->wk) +
+                 qwen_weight_bytes(&l->wv) + qwen_weight_bytes(&l->wo) +
+                 qwen_weight_bytes(&l->gate_up) + qwen_weight_bytes(&l->down);
+    }
+    return total;
+}
+
 qwen_ctx_t *qwen_load(const char *model_dir) {
+    double load_t0 = get_time_ms();
+    size_t rss0 = resident_bytes();
     qwen_ctx_t *ctx = (qwen_ctx_t *)calloc(1, sizeof(qwen_ctx_t));
     if (!ctx) return NULL;
     snprintf(ctx->model_dir, sizeof(ctx->model_dir), "%s", model_dir);
 
-    /* Open safetensors (multi-shard) */
     if (qwen_verbose >= 1)
         fprintf(stderr, "Loading model from %s\n", model_dir);
 
+    /* A compiled file for these formats replaces the safetensors path */
+    ctx->encoder.weight_format = resolve_encoder_weight_format();
+    ctx->decoder.weight_format = resolve_decoder_weight_format();
+    if (qwen_compiled_load(ctx) == 0) goto weights_ready;
+
+    /* Open safetensors (multi-shard) */
     multi_safetensors_t *ms = multi_safetensors_open(model_dir);
     if (!ms) {
         fprintf(stderr, "qwen_load: cannot open safetensors in %s\n", model_dir);
@@ -213,34 +555,126 @@ qwen_ctx_t *qwen_load(const char *model_dir) {
     detect_config(ctx);
 
     /* Load encoder weights */
-    if (qwen_verbose >= 1) fprintf(stderr, "Loading encoder weights...\n");
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "Loading encoder weights (%s)...\n",
+                qwen_weight_format_name(ctx->encoder.weight_format));
     if (qwen_encoder_load(&ctx->encoder, ms, &ctx->config) != 0) {
         fprintf(stderr, "qwen_load: failed to load encoder\n");
         qwen_free(ctx);
         return NULL;
     }
+    if (qwen_verbose >= 1) {
+        size_t bytes = encoder_weight_bytes(&ctx->encoder, ctx->config.enc_layers);
+        fprintf(stderr, "Encoder matrices: %s, %.1f MB %s\n",
+                qwen_weight_format_name(ctx->encoder.weight_format),
+                (double)bytes / (1024.0 * 1024.0),
+                ctx->encoder.weight_format == QWEN_WEIGHT_BF16 ? "mapped" : "heap");
+    }
 
     /* Load decoder weights */
-    if (qwen_verbose >= 1) fprintf(stderr, "Loading decoder weights...\n");
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "Loading decoder weights (%s)...\n",
+                qwen_weight_format_name(ctx->decoder.weight_format));
     if (qwen_decoder_load(&ctx->decoder, ms, &ctx->config) != 0) {
         fprintf(stderr, "qwen_load: failed to load decoder\n");
         qwen_free(ctx);
         return NULL;
     }
+    if (qwen_verbose >= 1) {
+        size_t bytes = decoder_weight_bytes(&ctx->decoder, ctx->config.dec_layers);
+        fprintf(stderr, "Decoder matrices: %s, %.1f MB read per token\n",
+                qwen_weight_format_name(ctx->decoder.weight_format),
+                (double)bytes / (1024.0 * 1024.0));
+    }
+
+weights_ready:
+    /* Nothing mapped is resident yet */
+    ctx->weights_cold = 1;
+
+    /* Decoder kernels for this geometry; QWEN_GENERIC_KERNELS=1 keeps the
+     * runtime-shape ones (for A/B runs) */
+    const char *generic_env = getenv("QWEN_GENERIC_KERNELS");
+    if (generic_env && strcmp(generic_env, "1") == 0)
+        ctx->dec_kernels = qwen_dec_kernels_select(0, 0);
+    else
+        ctx->dec_kernels = qwen_dec_kernels_select(ctx->config.dec_hidden,
+                                                   ctx->config.dec_head_dim);
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "Decoder kernels: %s\n", ctx->dec_kernels->name);
 
     /* Default transcription mode: full-audio offline decode (no splitting). */
     ctx->segment_sec = 0.0f;
     ctx->search_sec = 3.0f;
 
+    /* Batched segment decoding: QWEN_DECODE_BATCH=N (1 = off) */
+    ctx->decode_batch = 1;
+    const char *batch_env = getenv("QWEN_DECODE_BATCH");
+    if (batch_env && atoi(batch_env) > 1) {
+        ctx->decode_batch = atoi(batch_env);
+        if (ctx->decode_batch > QWEN_DECODE_BATCH_MAX) ctx->decode_batch = QWEN_DECODE_BATCH_MAX;
+    }
+
+    /* Pipelined segments: QWEN_PIPELINE_ENC_THREADS=N encoder threads (0 = off) */
+    const char *pipe_env = getenv("QWEN_PIPELINE_ENC_THREADS");
+    if (pipe_env && atoi(pipe_env) > 0 &&
+        qwen_ctx_set_pipeline(ctx, atoi(pipe_env), QWEN_QOS_DEFAULT) != 0)
+        fprintf(stderr, "qwen: could not create the encoder pipeline pool\n");
+
     /* Default streaming parameters */
     ctx->stream_chunk_sec = 2.0f;
     ctx->stream_rollback = 5;
     ctx->stream_unfixed_chunks = 2;
     ctx->stream_max_new_tokens = 32;
+    ctx->stream_horizon_sec = 0.0f;
+    ctx->stream_anchor_tokens = 16;
+    /* The verify pass sums like seq=1 decoding: QWEN_STREAM_SPECULATIVE=0 off */
+    const char *spec_env = getenv("QWEN_STREAM_SPECULATIVE");
+    ctx->stream_speculative = !spec_env || atoi(spec_env) > 0;
+    const char *vad_env = getenv("QWEN_STREAM_VAD");
+    ctx->stream_vad_gate = vad_env && atoi(vad_env) > 0;
     ctx->past_text_conditioning = 0;
     ctx->skip_silence = 0;
 
-    if (qwen_verbose >= 1) fprintf(stderr, "Model loaded.\n");
+    /* LM head: QWEN_LM_HEAD=full|fast|check, QWEN_LM_TOPK=N */
+    ctx->lm_head_mode = QWEN_LM_HEAD_FULL;
+    ctx->lm_head_topk = QWEN_LM_HEAD_TOPK_DEFAULT;
+    const char *lm_env = getenv("QWEN_LM_HEAD");
+    if (lm_env && lm_env[0] != '\0') {
+        if (strcmp(lm_env, "fast") == 0) ctx->lm_head_mode = QWEN_LM_HEAD_FAST;
+        else if (strcmp(lm_env, "check") == 0) ctx->lm_head_mode = QWEN_LM_HEAD_CHECK;
+        else if (strcmp(lm_env, "full") != 0)
+            fprintf(stderr, "QWEN_LM_HEAD=%s not recognized, using full\n", lm_env);
+    }
+    const char *topk_env = getenv("QWEN_LM_TOPK");
+    if (topk_env && atoi(topk_env) > 0) qwen_set_lm_head_mode(ctx, ctx->lm_head_mode, atoi(topk_env));
+
+    /* KV cache storage: QWEN_KV_CACHE=f32|fp16|int8 */
+    ctx->kv_format = QWEN_KV_F32;
+    const char *kv_env = getenv("QWEN_KV_CACHE");
+    if (kv_env && kv_env[0] != '\0') {
+        if (strcmp(kv_env, "fp16") == 0) ctx->kv_format = QWEN_KV_FP16;
+        else if (strcmp(kv_env, "int8") == 0) ctx->kv_format = QWEN_KV_INT8;
+        else if (strcmp(kv_env, "f32") != 0)
+            fprintf(stderr, "QWEN_KV_CACHE=%s not recognized, using f32\n", kv_env);
+    }
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "KV cache: %s, %d-position pages\n",
+                qwen_kv_format_name(ctx->kv_format), QWEN_KV_PAGE);
+
+    /* Default OFF: a full f32 copy of the decoder is several GB */
+    const char *cache_env = getenv("QWEN_BF16_CACHE_MB");
+    if (cache_env && cache_env[0] != '\0') {
+        unsigned long long mb = strtoull(cache_env, NULL, 10);
+        if (mb > 0 && qwen_ctx_set_bf16_cache(ctx, (size_t)mb) == 0 && qwen_verbose >= 2)
+            fprintf(stderr, "BF16 cache: limit=%llu MB\n", mb);
+    }
+
+    ctx->perf_load_ms = get_time_ms() - load_t0;
+    size_t rss1 = resident_bytes();
+    ctx->load_resident_bytes = rss1 > rss0 ? rss1 - rss0 : 0;
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "Model loaded in %.0f ms (+%.1f MB resident).\n",
+                ctx->perf_load_ms, (double)ctx->load_resident_bytes / (1024.0 * 1024.0));
     return ctx;
 }
 
@@ -248,47 +682,87 @@ qwen_ctx_t *qwen_load(const char *model_dir) {
  * Free
  * ======================================================================== */
 
-void qwen_free(qwen_ctx_t *ctx) {
-    if (!ctx) return;
+/* qwen_weight_free for a context weight, skipping compiled-mapping storage */
+static void ctx_weight_free(qwen_ctx_t *ctx, qwen_weight_t *w) {
+    if (qwen_compiled_owns(ctx, w->f32)) w->f32 = NULL;
+    if (qwen_compiled_owns(ctx, w->i8)) w->i8 = NULL;
+    if (qwen_compiled_owns(ctx, w->i4)) w->i4 = NULL;
+    if (qwen_compiled_owns(ctx, w->scale)) w->scale = NULL;
+    qwen_weight_free(w);
+}
 
-    #define FREE0(p) do { free(p); (p) = NULL; } while (0)
+/* Weights, tokenizer and model files: everything a shared context borrows */
+static void ctx_model_free(qwen_ctx_t *ctx) {
+    /* Arrays inside a compiled model mapping are not heap-owned */
+    #define FREE0(p) do { \
+        if (!qwen_compiled_owns(ctx, (p))) free(p); \
+        (p) = NULL; \
+    } while (0)
 
     /* Encoder conv stem */
     FREE0(ctx->encoder.conv1_weight); FREE0(ctx->encoder.conv1_bias);
     FREE0(ctx->encoder.conv2_weight); FREE0(ctx->encoder.conv2_bias);
     FREE0(ctx->encoder.conv3_weight); FREE0(ctx->encoder.conv3_bias);
-    FREE0(ctx->encoder.conv_out_weight);
+    ctx_weight_free(ctx, &ctx->encoder.conv_out_weight);
 
-    /* Encoder layers (weights are pre-converted f32, all allocated) */
+    /* Encoder layers (matrix storage depends on encoder.weight_format) */
     for (int i = 0; i < ctx->config.enc_layers; i++) {
         qwen_enc_layer_t *l = &ctx->encoder.layers[i];
-        FREE0(l->wq_weight); FREE0(l->wq_bias);
-        FREE0(l->wk_weight); FREE0(l->wk_bias);
-        FREE0(l->wv_weight); FREE0(l->wv_bias);
-        FREE0(l->wo_weight); FREE0(l->wo_bias);
+        ctx_weight_free(ctx, &l->wq_weight); FREE0(l->wq_bias);
+        ctx_weight_free(ctx, &l->wk_weight); FREE0(l->wk_bias);
+        ctx_weight_free(ctx, &l->wv_weight); FREE0(l->wv_bias);
+        ctx_weight_free(ctx, &l->wo_weight); FREE0(l->wo_bias);
         FREE0(l->attn_norm_weight); FREE0(l->attn_norm_bias);
-        FREE0(l->fc1_weight); FREE0(l->fc1_bias);
-        FREE0(l->fc2_weight); FREE0(l->fc2_bias);
+        ctx_weight_free(ctx, &l->fc1_weight); FREE0(l->fc1_bias);
+        ctx_weight_free(ctx, &l->fc2_weight); FREE0(l->fc2_bias);
         FREE0(l->ffn_norm_weight); FREE0(l->ffn_norm_bias);
     }
     FREE0(ctx->encoder.ln_post_weight); FREE0(ctx->encoder.ln_post_bias);
-    FREE0(ctx->encoder.proj1_weight); FREE0(ctx->encoder.proj1_bias);
-    FREE0(ctx->encoder.proj2_weight); FREE0(ctx->encoder.proj2_bias);
+    ctx_weight_free(ctx, &ctx->encoder.proj1_weight); FREE0(ctx->encoder.proj1_bias);
+    ctx_weight_free(ctx, &ctx->encoder.proj2_weight); FREE0(ctx->encoder.proj2_bias);
 
-    /* Decoder layers */
+    /* Decoder layers (quantized copies depend on decoder.weight_format) */
     for (int i = 0; i < ctx->config.dec_layers; i++) {
         qwen_dec_layer_t *l = &ctx->decoder.layers[i];
         FREE0(l->q_norm_weight); FREE0(l->k_norm_weight);
         FREE0(l->input_norm); FREE0(l->post_attn_norm);
         FREE0(l->gate_up_fused_bf16);
+        ctx_weight_free(ctx, &l->wq); ctx_weight_free(ctx, &l->wk);
+        ctx_weight_free(ctx, &l->wv); ctx_weight_free(ctx, &l->wo);
+        ctx_weight_free(ctx, &l->gate_up); ctx_weight_free(ctx, &l->down);
     }
+    ctx_weight_free(ctx, &ctx->decoder.lm_head);
     FREE0(ctx->decoder.norm);
 
     #undef FREE0
 
+    qwen_tokenizer_free(ctx->tokenizer);
+    ctx->tokenizer = NULL;
+
+    /* Close safetensors / compiled mapping */
+    if (ctx->safetensors) {
+        multi_safetensors_close((multi_safetensors_t *)ctx->safetensors);
+    }
+    ctx->safetensors = NULL;
+    qwen_compiled_close(ctx);
+}
+
+void qwen_free(qwen_ctx_t *ctx) {
+    if (!ctx) return;
+
+    qwen_threadpool_free(ctx->pool);
+    ctx->pool = NULL;
+    qwen_threadpool_free(ctx->enc_pool);
+    ctx->enc_pool = NULL;
+    qwen_bf16_cache_free(ctx->bf16_cache);
+    ctx->bf16_cache = NULL;
+    qwen_scratch_release(&ctx->scratch);
+    qwen_scratch_release(&ctx->enc_scratch);
+
+    if (!ctx->shares_model) ctx_model_free(ctx);
+
     /* KV cache */
-    free(ctx->kv_cache_k);
-    free(ctx->kv_cache_v);
+    qwen_kv_cache_free(&ctx->kv_cache);
 
     /* Persistent decoder buffers */
     free(ctx->dec_x); free(ctx->dec_x_norm);
@@ -303,6 +777,22 @@ void qwen_free(qwen_ctx_t *ctx) {
     free(ctx->pref_attn_out); free(ctx->pref_proj_out); free(ctx->pref_ffn_out);
     free(ctx->pref_gate); free(ctx->pref_gate_up);
 
+    /* Persistent batched decode buffers */
+    free(ctx->bat_x); free(ctx->bat_x_norm);
+    free(ctx->bat_q); free(ctx->bat_k); free(ctx->bat_v);
+    free(ctx->bat_attn_out); free(ctx->bat_proj_out); free(ctx->bat_ffn_out);
+    free(ctx->bat_gate); free(ctx->bat_gate_up); free(ctx->bat_logits);
+
+    /* Persistent encoder buffers */
+    free(ctx->enc_stem_mel); free(ctx->enc_stem_c1);
+    free(ctx->enc_stem_c2); free(ctx->enc_stem_c3);
+    free(ctx->enc_stem_cols); free(ctx->enc_stem_reshaped); free(ctx->enc_pe);
+    free(ctx->enc_x); free(ctx->enc_x_norm);
+    free(ctx->enc_q); free(ctx->enc_k); free(ctx->enc_v);
+    free(ctx->enc_attn_out); free(ctx->enc_proj_out);
+    free(ctx->enc_ffn_mid); free(ctx->enc_ffn_out);
+    free(ctx->enc_window_starts);
+
     /* Decoder RoPE caches */
     free(ctx->rope_cache_cos); free(ctx->rope_cache_sin);
     free(ctx->rope_inv_freq);
@@ -312,13 +802,296 @@ void qwen_free(qwen_ctx_t *ctx) {
     free(ctx->force_language);
     free(ctx->prompt_tokens);
     free(ctx->force_prompt_tokens);
+    reset_lm_vocab(ctx);
+    free(ctx->lm_topk);
 
-    /* Close safetensors */
-    if (ctx->safetensors) {
-        multi_safetensors_close((multi_safetensors_t *)ctx->safetensors);
+    free(ctx->perf_step_ms);
+    free(ctx);
+}
+
+/* ========================================================================
+ * Shared Model Contexts
+ * ======================================================================== */
+
+static qwen_tokenizer_t *ctx_tokenizer(qwen_ctx_t *ctx);
+
+static char *dup_or_null(const char *s) {
+    return s ? strdup(s) : NULL;
+}
+
+qwen_ctx_t *qwen_ctx_share(qwen_ctx_t *base) {
+    /* Load the tokenizer once, here, rather than once per share */
+    if (!base || !ctx_tokenizer(base)) return NULL;
+    qwen_ctx_t *ctx = (qwen_ctx_t *)calloc(1, sizeof(qwen_ctx_t));
+    if (!ctx) return NULL;
+
+    /* Model state, by reference */
+    ctx->config = base->config;
+    ctx->encoder = base->encoder;
+    ctx->decoder = base->decoder;
+    ctx->safetensors = base->safetensors;
+    ctx->compiled = base->compiled;
+    ctx->compiled_bytes = base->compiled_bytes;
+    memcpy(ctx->model_dir, base->model_dir, sizeof(ctx->model_dir));
+    ctx->tokenizer = base->tokenizer;
+    ctx->shares_model = 1;
+    ctx->dec_kernels = base->dec_kernels;
+
+    /* Settings */
+    ctx->kv_format = base->kv_format;
+    ctx->segment_sec = base->segment_sec;
+    ctx->search_sec = base->search_sec;
+    ctx->decode_batch = base->decode_batch;
+    ctx->stream_chunk_sec = base->stream_chunk_sec;
+    ctx->stream_rollback = base->stream_rollback;
+    ctx->stream_unfixed_chunks = base->stream_unfixed_chunks;
+    ctx->stream_max_new_tokens = base->stream_max_new_tokens;
+    ctx->stream_horizon_sec = base->stream_horizon_sec;
+    ctx->stream_anchor_tokens = base->stream_anchor_tokens;
+    ctx->stream_speculative = base->stream_speculative;
+    ctx->stream_vad_gate = base->stream_vad_gate;
+    ctx->past_text_conditioning = base->past_text_conditioning;
+    ctx->skip_silence = base->skip_silence;
+    ctx->lm_head_mode = base->lm_head_mode;
+    ctx->lm_head_topk = base->lm_head_topk;
+    ctx->low_memory = base->low_memory;
+    ctx->weights_cold = base->weights_cold;
+
+    /* LM-head draft: built once on base and read in place; each context
+     * keeps only its own candidate lists */
+    prepare_lm_vocab(base, base->tokenizer);
+    if (base->lm_vocab_ready) {
+        ctx->lm_draft = base->lm_draft;
+        ctx->lm_vocab = base->lm_vocab;
+        ctx->lm_vocab_lang = dup_or_null(base->lm_vocab_lang);
+        ctx->lm_draft_shared = 1;
+        ctx->lm_vocab_ready = 1;
     }
 
-    free(ctx);
+    /* Prompt and language; their token caches are rebuilt on first use */
+    ctx->prompt = dup_or_null(base->prompt);
+    ctx->force_language = dup_or_null(base->force_language);
+    if ((base->prompt && !ctx->prompt) ||
+        (base->force_language && !ctx->force_language) ||
+        (base->lm_vocab_ready && base->lm_vocab_lang && !ctx->lm_vocab_lang)) {
+        qwen_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/* ========================================================================
+ * Performance Report
+ * ======================================================================== */
+
+/* ---- Signposts ----
+ *
+ * Stage intervals and per-token events for the Instruments timeline. The
+ * id is derived from the context, so concurrent contexts get separate lanes. */
+
+#if QWEN_PROFILE && defined(__APPLE__)
+static os_log_t signpost_log;
+static pthread_once_t signpost_once = PTHREAD_ONCE_INIT;
+
+static void signpost_init(void) {
+    signpost_log = os_log_create("com.voiceping.qwenasr", "Inference");
+}
+
+static os_log_t signpost_handle(void) {
+    pthread_once(&signpost_once, signpost_init);
+    return signpost_log;
+}
+#endif
+
+void qwen_signpost_begin(const qwen_ctx_t *ctx, int kind) {
+#if QWEN_PROFILE && defined(__APPLE__)
+    os_log_t log = signpost_handle();
+    if (!os_signpost_enabled(log)) return;
+    os_signpost_id_t id = os_signpost_id_make_with_pointer(log, ctx);
+    switch (kind) {
+    case QWEN_SIGNPOST_TRANSCRIBE: os_signpost_interval_begin(log, id, "Transcribe"); break;
+    case QWEN_SIGNPOST_ENCODE: os_signpost_interval_begin(log, id, "Encode"); break;
+    case QWEN_SIGNPOST_PREFILL: os_signpost_interval_begin(log, id, "Prefill"); break;
+    }
+#else
+    (void)ctx;
+    (void)kind;
+#endif
+}
+
+void qwen_signpost_end(const qwen_ctx_t *ctx, int kind) {
+#if QWEN_PROFILE && defined(__APPLE__)
+    os_log_t log = signpost_handle();
+    if (!os_signpost_enabled(log)) return;
+    os_signpost_id_t id = os_signpost_id_make_with_pointer(log, ctx);
+    switch (kind) {
+    case QWEN_SIGNPOST_TRANSCRIBE: os_signpost_interval_end(log, id, "Transcribe"); break;
+    case QWEN_SIGNPOST_ENCODE: os_signpost_interval_end(log, id, "Encode"); break;
+    case QWEN_SIGNPOST_PREFILL: os_signpost_interval_end(log, id, "Prefill"); break;
+    }
+#else
+    (void)ctx;
+    (void)kind;
+#endif
+}
+
+/* Start a call's stats: stage totals, step samples, layer timers and kernel
+ * counters start from zero, the memory marks from what is allocated now. */
+static void perf_reset(qwen_ctx_t *ctx, double audio_ms) {
+    ctx->perf_total_ms = 0;
+    ctx->perf_text_tokens = 0;
+    ctx->perf_audio_ms = audio_ms;
+    ctx->perf_encode_ms = 0;
+    ctx->perf_decode_ms = 0;
+    ctx->perf_pipeline_overlap = 0;
+    ctx->perf_prefill_ms = 0;
+    ctx->perf_ttft_ms = 0;
+    ctx->perf_start_ms = qwen_perf_now_ms();
+    ctx->perf_steps = 0;
+    memset(ctx->perf_enc_layer_ms, 0, sizeof(ctx->perf_enc_layer_ms));
+    memset(ctx->perf_dec_layer_ms, 0, sizeof(ctx->perf_dec_layer_ms));
+    memset(&ctx->perf_counters, 0, sizeof(ctx->perf_counters));
+    ctx->perf_kv_peak_bytes = 0;
+    ctx->perf_scratch_peak_bytes = 0;
+    qwen_perf_note_memory(ctx, qwen_kv_cache_bytes(&ctx->kv_cache));
+}
+
+/* Fold one call on src into dst's totals (batch transcription). The TTFT
+ * stays relative to dst's start; memory marks keep the larger. */
+static void perf_merge(qwen_ctx_t *dst, const qwen_ctx_t *src) {
+    dst->perf_text_tokens += src->perf_text_tokens;
+    dst->perf_encode_ms += src->perf_encode_ms;
+    dst->perf_decode_ms += src->perf_decode_ms;
+    dst->perf_prefill_ms += src->perf_prefill_ms;
+    if (src->perf_ttft_ms > 0) {
+        double ttft = src->perf_start_ms + src->perf_ttft_ms - dst->perf_start_ms;
+        if (dst->perf_ttft_ms <= 0 || ttft < dst->perf_ttft_ms) dst->perf_ttft_ms = ttft;
+    }
+    if (src->perf_steps > 0) {
+        int need = dst->perf_steps + src->perf_steps;
+        if (need > dst->perf_steps_cap) {
+            float *tmp = (float *)realloc(dst->perf_step_ms, (size_t)need * sizeof(float));
+            if (tmp) {
+                dst->perf_step_ms = tmp;
+                dst->perf_steps_cap = need;
+            }
+        }
+        if (need <= dst->perf_steps_cap) {
+            memcpy(dst->perf_step_ms + dst->perf_steps, src->perf_step_ms,
+                   (size_t)src->perf_steps * sizeof(float));
+            dst->perf_steps = need;
+        }
+    }
+    for (int i = 0; i < QWEN_PERF_MAX_LAYERS; i++) {
+        dst->perf_enc_layer_ms[i] += src->perf_enc_layer_ms[i];
+        dst->perf_dec_layer_ms[i] += src->perf_dec_layer_ms[i];
+    }
+    qwen_perf_counters_add(&dst->perf_counters, &src->perf_counters);
+    if (src->perf_kv_peak_bytes > dst->perf_kv_peak_bytes)
+        dst->perf_kv_peak_bytes = src->perf_kv_peak_bytes;
+    if (src->perf_scratch_peak_bytes > dst->perf_scratch_peak_bytes)
+        dst->perf_scratch_peak_bytes = src->perf_scratch_peak_bytes;
+}
+
+void qwen_perf_decode_step(qwen_ctx_t *ctx, double t0) {
+    double now = qwen_perf_now_ms();
+    if (ctx->perf_ttft_ms <= 0) ctx->perf_ttft_ms = now - ctx->perf_start_ms;
+    if (ctx->perf_steps == ctx->perf_steps_cap) {
+        int cap = ctx->perf_steps_cap > 0 ? ctx->perf_steps_cap * 2 : 256;
+        float *tmp = (float *)realloc(ctx->perf_step_ms, (size_t)cap * sizeof(float));
+        if (!tmp) return;
+        ctx->perf_step_ms = tmp;
+        ctx->perf_steps_cap = cap;
+    }
+    ctx->perf_step_ms[ctx->perf_steps++] = (float)(now - t0);
+#if QWEN_PROFILE && defined(__APPLE__)
+    os_log_t log = signpost_handle();
+    if (os_signpost_enabled(log))
+        os_signpost_event_emit(log, os_signpost_id_make_with_pointer(log, ctx), "Token");
+#endif
+}
+
+void qwen_perf_note_memory(qwen_ctx_t *ctx, size_t kv_bytes) {
+    const qwen_config_t *cfg = &ctx->config;
+    size_t dim = cfg->dec_hidden;
+    size_t q_dim = (size_t)cfg->dec_heads * cfg->dec_head_dim;
+    size_t kv_dim = (size_t)cfg->dec_kv_heads * cfg->dec_head_dim;
+    size_t inter = cfg->dec_intermediate;
+    size_t row = 4 * dim + 2 * q_dim + 2 * kv_dim + 3 * inter;
+    size_t enc_row = 8 * (size_t)cfg->enc_d_model + cfg->enc_ffn_dim;
+    size_t scratch = ((size_t)ctx->pref_seq_cap * row +
+                      (size_t)ctx->bat_cap * (row + cfg->vocab_size) +
+                      (size_t)ctx->enc_seq_cap * enc_row) * sizeof(float) +
+                     ctx->enc_stem_bytes;
+    if (kv_bytes > ctx->perf_kv_peak_bytes) ctx->perf_kv_peak_bytes = kv_bytes;
+    if (scratch > ctx->perf_scratch_peak_bytes) ctx->perf_scratch_peak_bytes = scratch;
+}
+
+static int cmp_float(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+int qwen_get_perf_report(const qwen_ctx_t *ctx, qwen_perf_report_t *out) {
+    if (!ctx || !out) return -1;
+    memset(out, 0, sizeof(*out));
+    out->version = QWEN_PERF_REPORT_VERSION;
+    out->profiled = QWEN_PROFILE;
+
+    out->total_ms = ctx->perf_total_ms;
+    out->encode_ms = ctx->perf_encode_ms;
+    out->prefill_ms = ctx->perf_prefill_ms;
+    out->decode_ms = ctx->perf_decode_ms;
+    out->audio_ms = ctx->perf_audio_ms;
+    out->ttft_ms = ctx->perf_ttft_ms;
+    out->rtf = ctx->perf_audio_ms > 0 ? ctx->perf_total_ms / ctx->perf_audio_ms : 0;
+    out->pipeline_overlap = ctx->perf_pipeline_overlap;
+    out->text_tokens = ctx->perf_text_tokens;
+
+    int n = ctx->perf_steps;
+    out->decode_steps = n;
+    if (n > 0) {
+        float *sorted = (float *)malloc((size_t)n * sizeof(float));
+        if (!sorted) return -1;
+        memcpy(sorted, ctx->perf_step_ms, (size_t)n * sizeof(float));
+        qsort(sorted, (size_t)n, sizeof(float), cmp_float);
+        double sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += sorted[i];
+            int bin = 0;
+            while (bin < QWEN_PERF_HIST_BINS - 1 && sorted[i] >= (float)(1 << bin)) bin++;
+            out->step_hist[bin]++;
+        }
+        out->step_mean_ms = sum / n;
+        out->step_p50_ms = sorted[(n - 1) * 50 / 100];
+        out->step_p90_ms = sorted[(n - 1) * 90 / 100];
+        out->step_p99_ms = sorted[(n - 1) * 99 / 100];
+        out->step_max_ms = sorted[n - 1];
+        free(sorted);
+    }
+
+    const qwen_perf_counters_t *pc = &ctx->perf_counters;
+    memcpy(out->kernel, pc->kernel, sizeof(out->kernel));
+    out->pool_dispatches = pc->pool_dispatches;
+    out->pool_compute_ms = pc->pool_compute_ms;
+    out->pool_wait_ms = pc->pool_wait_ms;
+    const qwen_perf_kernel_t *mv = &pc->kernel[QWEN_PERF_MATVEC];
+    const qwen_perf_kernel_t *lm = &pc->kernel[QWEN_PERF_LM_HEAD];
+    double step_bytes = (double)(mv->weight_bytes + lm->weight_bytes);
+    double step_ms = mv->ms + lm->ms;
+    if (n > 0) out->weight_bytes_per_step = step_bytes / n;
+    if (step_ms > 0) out->weight_gb_per_s = step_bytes / (step_ms * 1e6);
+
+    out->enc_layers = ctx->config.enc_layers < QWEN_PERF_MAX_LAYERS
+                    ? ctx->config.enc_layers : QWEN_PERF_MAX_LAYERS;
+    out->dec_layers = ctx->config.dec_layers < QWEN_PERF_MAX_LAYERS
+                    ? ctx->config.dec_layers : QWEN_PERF_MAX_LAYERS;
+    memcpy(out->enc_layer_ms, ctx->perf_enc_layer_ms, sizeof(out->enc_layer_ms));
+    memcpy(out->dec_layer_ms, ctx->perf_dec_layer_ms, sizeof(out->dec_layer_ms));
+
+    out->kv_peak_bytes = ctx->perf_kv_peak_bytes;
+    out->scratch_peak_bytes = ctx->perf_scratch_peak_bytes;
+    return 0;
 }
 
 /* ========================================================================
@@ -357,12 +1130,6 @@ static void tok_embed_bf16_to_f32(float *dst, const uint16_t *tok_emb_bf16,
     }
 }
 
-static double get_time_ms(void) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
-}
-
 static int cmp_float_asc(const void *a, const void *b) {
     float fa = *(const float *)a;
     float fb = *(const float *)b;
@@ -503,8 +1270,35 @@ static float *compact_silence(const float *samples, int n_samples, int *out_samp
     return out;
 }
 
+/* The tokenizer is parsed (or mapped from tokenizer.bin) on first use and
+ * then shared by every call on the context. */
+static qwen_tokenizer_t *ctx_tokenizer(qwen_ctx_t *ctx) {
+    if (!ctx->tokenizer) {
+        char vocab_path[1024];
+        snprintf(vocab_path, sizeof(vocab_path), "%s/vocab.json", ctx->model_dir);
+        ctx->tokenizer = qwen_tokenizer_load(vocab_path);
+    }
+    return ctx->tokenizer;
+}
+
+/* Decoder positions before the audio only attend to the static prefix
+ * ([PREFIX_HEAD] [prompt] [PREFIX_TAIL]), so once prefilled their KV rows
+ * stay valid for every later segment and call until the prompt, language or
+ * cache format changes (reset_prompt_cache). Returns how many leading
+ * positions of a prefill with this prefix can be skipped. */
+static int prompt_kv_cached(const qwen_ctx_t *ctx, int prefix_len) {
+    return ctx->kv_prompt_len == prefix_len ? prefix_len : 0;
+}
+
+/* Record the prefix as cached once a prefill has covered it. */
+static void prompt_kv_update(qwen_ctx_t *ctx, int prefix_len, int prefill_len) {
+    if (ctx->kv_cache_len == prefill_len && prefill_len >= prefix_len)
+        ctx->kv_prompt_len = prefix_len;
+}
+
 /* Prepare cached prompt-related tokens once per context. */
 static int prepare_prompt_tokens(qwen_ctx_t *ctx, qwen_tokenizer_t *tokenizer) {
+    prepare_lm_vocab(ctx, tokenizer);
     if (ctx->prompt_tokens_ready) return 0;
 
     reset_prompt_cache(ctx);
@@ -581,44 +1375,51 @@ static int find_split_point(const float *samples, int n_samples,
     return best_center;
 }
 
-/*
- * Transcribe a single audio segment. Returns malloc'd text or NULL.
- * The tokenizer is passed in so we only load it once.
- */
-static char *transcribe_segment(qwen_ctx_t *ctx, const float *samples,
-                                int n_samples, qwen_tokenizer_t *tokenizer,
-                                const int *past_tokens, int n_past_tokens,
-                                int *out_text_tokens) {
-    const qwen_config_t *cfg = &ctx->config;
-    int dim = cfg->dec_hidden;
-    double seg_t0 = get_time_ms();
-    int n_text_tokens = 0;
+/* Wall time of the stages before the autoregressive decode */
+typedef struct {
+    double mel_ms, enc_ms, prefill_ms;
+} segment_timing_t;
 
+/* Mel + encoder for one audio segment. Returns malloc'd encoder tokens
+ * [*out_seq_len, dec_hidden], or NULL. */
+static float *segment_encode(qwen_ctx_t *ctx, const float *samples, int n_samples,
+                             int *out_seq_len, segment_timing_t *tm) {
     /* ---- Mel spectrogram ---- */
     double t0 = get_time_ms();
     int mel_frames = 0;
     float *mel = qwen_mel_spectrogram(samples, n_samples, &mel_frames);
     if (!mel) return NULL;
-    double mel_ms = get_time_ms() - t0;
+    tm->mel_ms = get_time_ms() - t0;
 
     if (qwen_verbose >= 2)
-        fprintf(stderr, "  Mel: %d frames (%.0f ms)\n", mel_frames, mel_ms);
+        fprintf(stderr, "  Mel: %d frames (%.0f ms)\n", mel_frames, tm->mel_ms);
 
     /* ---- Encoder ---- */
     t0 = get_time_ms();
-    int enc_seq_len = 0;
-    float *enc_output = qwen_encoder_forward(ctx, mel, mel_frames, &enc_seq_len);
+    float *enc_output = qwen_encoder_forward(ctx, mel, mel_frames, out_seq_len);
     free(mel);
     if (!enc_output) return NULL;
-    double enc_ms = get_time_ms() - t0;
+    tm->enc_ms = get_time_ms() - t0;
 
     if (qwen_verbose >= 2)
-        fprintf(stderr, "  Encoder: %d tokens (%.0f ms)\n", enc_seq_len, enc_ms);
+        fprintf(stderr, "  Encoder: %d tokens (%.0f ms)\n", *out_seq_len, tm->enc_ms);
+    return enc_output;
+}
 
-    if (prepare_prompt_tokens(ctx, tokenizer) != 0) {
-        free(enc_output);
-        return NULL;
-    }
+/*
+ * Prefill the decoder with the prompt around one segment's encoder output,
+ * leaving the KV cache in ctx->kv_cache. Returns the first generated token,
+ * or -1. enc_output stays owned by the caller.
+ */
+static int segment_prefill(qwen_ctx_t *ctx, const float *enc_output, int enc_seq_len,
+                           qwen_tokenizer_t *tokenizer,
+                           const int *past_tokens, int n_past_tokens,
+                           segment_timing_t *tm) {
+    const qwen_config_t *cfg = &ctx->config;
+    int dim = cfg->dec_hidden;
+    double t0;
+
+    if (prepare_prompt_tokens(ctx, tokenizer) != 0) return -1;
 
     /* ---- Build input embeddings ---- */
     int prefix_len = PREFIX_HEAD_LEN + ctx->n_prompt_tokens + PREFIX_TAIL_LEN;
@@ -626,13 +1427,7 @@ static char *transcribe_segment(qwen_ctx_t *ctx, const float *samples,
     int n_past_prompt_tokens = (n_past_tokens > 0) ? (n_past_tokens + 1) : 0; /* + <asr_text> */
     int total_seq = prefix_len + enc_seq_len + suffix_len + n_past_prompt_tokens;
     float *input_embeds = (float *)malloc((size_t)total_seq * dim * sizeof(float));
-    float *tmp_embed = (float *)malloc(dim * sizeof(float));
-    if (!input_embeds || !tmp_embed) {
-        free(enc_output);
-        free(input_embeds);
-        free(tmp_embed);
-        return NULL;
-    }
+    if (!input_embeds) return -1;
 
     /* Embed prefix head: <|im_start|>system\n */
     int off = 0;
@@ -665,7 +1460,6 @@ static char *transcribe_segment(qwen_ctx_t *ctx, const float *samples,
                enc_output + i * dim,
                dim * sizeof(float));
     }
-    free(enc_output);
 
     /* Embed suffix base: <|audio_end|><|im_end|>\n<|im_start|>assistant\n */
     int suffix_off = prefix_len + enc_seq_len;
@@ -699,57 +1493,122 @@ static char *transcribe_segment(qwen_ctx_t *ctx, const float *samples,
 
     /* ---- Decoder prefill ---- */
     t0 = get_time_ms();
-    ctx->kv_cache_len = 0; /* Reset KV cache for this segment */
     int prefill_len = total_seq - 1; /* prefill all but last */
-    qwen_decoder_prefill(ctx, input_embeds, prefill_len);
+    /* Reset KV cache for this segment, keeping a cached prompt prefix */
+    int cached_prefix = prompt_kv_cached(ctx, prefix_len);
+    ctx->kv_cache_len = cached_prefix;
+    qwen_decoder_prefill(ctx, input_embeds + (size_t)cached_prefix * dim,
+                         prefill_len - cached_prefix);
+    prompt_kv_update(ctx, prefix_len, prefill_len);
 
     /* First token from last prefill position */
     float *last_embed = input_embeds + (size_t)prefill_len * dim;
     int token = qwen_decoder_forward(ctx, last_embed);
     free(input_embeds);
 
-    double prefill_ms = get_time_ms() - t0;
+    tm->prefill_ms = get_time_ms() - t0;
     if (qwen_verbose >= 2)
-        fprintf(stderr, "  Prefill: %d tokens (%.0f ms)\n", total_seq, prefill_ms);
+        fprintf(stderr, "  Prefill: %d tokens (%d cached prefix) (%.0f ms)\n",
+                total_seq, cached_prefix, tm->prefill_ms);
+    return token;
+}
 
-    /* ---- Autoregressive decode ---- */
-    t0 = get_time_ms();
-    int max_tokens = 2048;
-    int n_generated = 0;
-    /* If language is forced, <asr_text> is already part of prompt suffix. */
-    int past_asr_text = (ctx->n_force_prompt_tokens > 0 || n_past_tokens > 0) ? 1 : 0;
+/* Generated tokens per segment before decoding is cut off */
+#define SEGMENT_MAX_TOKENS 2048
 
-    size_t text_cap = 4096;
-    size_t text_len = 0;
-    char *text = (char *)malloc(text_cap);
-    text[0] = '\0';
+/* Text decoded so far for one segment */
+typedef struct {
+    char *text;
+    size_t len, cap;
+    int n_text_tokens;
+    int past_asr_text;         /* text tokens are emitted after <asr_text> */
+} segment_text_t;
+
+static int segment_text_init(segment_text_t *st, int past_asr_text) {
+    st->cap = 4096;
+    st->len = 0;
+    st->text = (char *)malloc(st->cap);
+    if (!st->text) return -1;
+    st->text[0] = '\0';
+    st->n_text_tokens = 0;
+    st->past_asr_text = past_asr_text;
+    return 0;
+}
 
-    while (n_generated < max_tokens) {
+/* Append one generated (non-EOS) token; text pieces also go to the token
+ * callback when emit is set. */
+static void segment_text_feed(qwen_ctx_t *ctx, qwen_tokenizer_t *tokenizer,
+                              segment_text_t *st, int token, int emit) {
+    /* Track <asr_text> marker */
+    if (token == QWEN_TOKEN_ASR_TEXT) {
+        st->past_asr_text = 1;
+        return;
+    }
+    if (!st->past_asr_text) return;
+
+    /* Decode and emit this text token */
+    const char *piece = qwen_tokenizer_decode(tokenizer, token);
+    size_t piece_len = strlen(piece);
+    if (st->len + piece_len + 1 > st->cap) {
+        while (st->len + piece_len + 1 > st->cap) st->cap *= 2;
+        st->text = (char *)realloc(st->text, st->cap);
+    }
+    memcpy(st->text + st->len, piece, piece_len);
+    st->len += piece_len;
+    st->text[st->len] = '\0';
+    st->n_text_tokens++;
+
+    /* Stream token via callback */
+    if (emit && ctx->token_cb)
+        ctx->token_cb(piece, ctx->token_cb_userdata);
+}
+
+/* Trim surrounding whitespace and hand the text over to the caller */
+static char *segment_text_finish(segment_text_t *st) {
+    char *text = st->text;
+    size_t rlen = strlen(text);
+    while (rlen > 0 && isspace((unsigned char)text[rlen - 1])) text[--rlen] = '\0';
+    char *start = text;
+    while (*start && isspace((unsigned char)*start)) start++;
+    if (start != text) memmove(text, start, strlen(start) + 1);
+    st->text = NULL;
+    return text;
+}
+
+/*
+ * Decode a single encoded segment. Returns malloc'd text or NULL.
+ */
+static char *transcribe_encoded_segment(qwen_ctx_t *ctx, const float *enc_output,
+                                        int enc_seq_len, qwen_tokenizer_t *tokenizer,
+                                        const int *past_tokens, int n_past_tokens,
+                                        int *out_text_tokens) {
+    int dim = ctx->config.dec_hidden;
+    double seg_t0 = get_time_ms();
+
+    segment_timing_t tm = {0};
+    int token = segment_prefill(ctx, enc_output, enc_seq_len, tokenizer,
+                                past_tokens, n_past_tokens, &tm);
+    if (token < 0) return NULL;
+
+    /* ---- Autoregressive decode ---- */
+    double t0 = get_time_ms();
+    int n_generated = 0;
+    segment_text_t st;
+    float *tmp_embed = (float *)malloc(dim * sizeof(float));
+    /* If language is forced, <asr_text> is already part of prompt suffix. */
+    if (!tmp_embed ||
+        segment_text_init(&st, (ctx->n_force_prompt_tokens > 0 || n_past_tokens > 0)) != 0) {
+        free(tmp_embed);
+        return NULL;
+    }
+
+    while (n_generated < SEGMENT_MAX_TOKENS) {
         n_generated++;
 
         /* Check EOS */
         if (token == QWEN_TOKEN_ENDOFTEXT || token == QWEN_TOKEN_IM_END) break;
 
-        /* Track <asr_text> marker */
-        if (token == QWEN_TOKEN_ASR_TEXT) {
-            past_asr_text = 1;
-        } else if (past_asr_text) {
-            /* Decode and emit this text token */
-            const char *piece = qwen_tokenizer_decode(tokenizer, token);
-            size_t piece_len = strlen(piece);
-            if (text_len + piece_len + 1 > text_cap) {
-                while (text_len + piece_len + 1 > text_cap) text_cap *= 2;
-                text = (char *)realloc(text, text_cap);
-            }
-            memcpy(text + text_len, piece, piece_len);
-            text_len += piece_len;
-            text[text_len] = '\0';
-            n_text_tokens++;
-
-            /* Stream token via callback */
-            if (ctx->token_cb)
-                ctx->token_cb(piece, ctx->token_cb_userdata);
-        }
+        segment_text_feed(ctx, tokenizer, &st, token, 1);
 
         /* Embed and generate next token */
         tok_embed_bf16_to_f32(tmp_embed, ctx->decoder.tok_embeddings_bf16, token, dim);
@@ -761,25 +1620,48 @@ static char *transcribe_segment(qwen_ctx_t *ctx, const float *samples,
         fprintf(stderr, "  Decode: %d tokens (%.0f ms, %.1f ms/token)\n",
                 n_generated, decode_ms,
                 n_generated > 0 ? decode_ms / n_generated : 0);
+    if (qwen_verbose >= 2 && ctx->lm_head_mode == QWEN_LM_HEAD_CHECK)
+        fprintf(stderr, "  LM head check: %d/%d tokens agree\n",
+                ctx->lm_check_tokens - ctx->lm_check_mismatch, ctx->lm_check_tokens);
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "  KV cache: %d/%d positions, %.1f MB %s\n",
+                ctx->kv_cache_len, ctx->kv_cache_max,
+                qwen_kv_cache_bytes(&ctx->kv_cache) / (1024.0 * 1024.0),
+                qwen_kv_format_name(ctx->kv_cache.format));
 
     free(tmp_embed);
 
-    /* Trim whitespace */
-    size_t rlen = strlen(text);
-    while (rlen > 0 && isspace((unsigned char)text[rlen - 1])) text[--rlen] = '\0';
-    char *start = text;
-    while (*start && isspace((unsigned char)*start)) start++;
-    if (start != text) memmove(text, start, strlen(start) + 1);
+    int n_text_tokens = st.n_text_tokens;
+    char *text = segment_text_finish(&st);
 
     ctx->perf_total_ms += get_time_ms() - seg_t0;
     ctx->perf_text_tokens += n_text_tokens;
-    ctx->perf_encode_ms += mel_ms + enc_ms;
-    ctx->perf_decode_ms += prefill_ms + decode_ms;
+    ctx->perf_decode_ms += tm.prefill_ms + decode_ms;
     if (out_text_tokens) *out_text_tokens = n_text_tokens;
 
     return text;
 }
 
+/*
+ * Transcribe a single audio segment. Returns malloc'd text or NULL.
+ */
+static char *transcribe_segment(qwen_ctx_t *ctx, const float *samples,
+                                int n_samples, qwen_tokenizer_t *tokenizer,
+                                const int *past_tokens, int n_past_tokens,
+                                int *out_text_tokens) {
+    double t0 = get_time_ms();
+    segment_timing_t tm = {0};
+    int enc_seq_len = 0;
+    float *enc_output = segment_encode(ctx, samples, n_samples, &enc_seq_len, &tm);
+    ctx->perf_total_ms += get_time_ms() - t0;
+    ctx->perf_encode_ms += tm.mel_ms + tm.enc_ms;
+    if (!enc_output) return NULL;
+    char *text = transcribe_encoded_segment(ctx, enc_output, enc_seq_len, tokenizer,
+                                            past_tokens, n_past_tokens, out_text_tokens);
+    free(enc_output);
+    return text;
+}
+
 static int should_retry_unconditioned_segment(const char *full_result,
                                               const char *seg_text,
                                               int core_samples,
@@ -836,12 +1718,437 @@ static void segment_emit_cb(const char *piece, void *userdata) {
     st->downstream_cb(piece, st->downstream_userdata);
 }
 
-char *qwen_transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples) {
-    ctx->perf_total_ms = 0;
-    ctx->perf_text_tokens = 0;
-    ctx->perf_audio_ms = 1000.0 * (double)n_samples / (double)QWEN_SAMPLE_RATE;
-    ctx->perf_encode_ms = 0;
-    ctx->perf_decode_ms = 0;
+/* Append a segment's text to the running result, inserting a boundary
+ * space where needed, and forward what was appended to cb (may be NULL).
+ * trim_leading drops the segment's leading whitespace. Frees seg_text. */
+static void append_segment_text(char **result, size_t *result_len, size_t *result_cap,
+                                char *seg_text, int trim_leading,
+                                qwen_token_cb cb, void *cb_userdata) {
+    if (!seg_text) return;
+
+    int cut_pos = 0;
+    if (trim_leading) {
+        while (seg_text[cut_pos] != '\0' && isspace((unsigned char)seg_text[cut_pos])) cut_pos++;
+    }
+    if (seg_text[cut_pos] == '\0') {
+        free(seg_text);
+        return;
+    }
+
+    size_t add_len = strlen(seg_text + cut_pos);
+    int need_space = should_insert_boundary_space(
+        *result_len > 0 ? (int)(unsigned char)(*result)[*result_len - 1] : 0,
+        (int)(unsigned char)seg_text[cut_pos]);
+    size_t need = *result_len + add_len + (size_t)(need_space ? 2 : 1);
+    if (need > *result_cap) {
+        while (need > *result_cap) *result_cap *= 2;
+        *result = (char *)realloc(*result, *result_cap);
+    }
+    if (need_space) {
+        (*result)[(*result_len)++] = ' ';
+        if (cb) cb(" ", cb_userdata);
+    }
+    memcpy(*result + *result_len, seg_text + cut_pos, add_len);
+    *result_len += add_len;
+    (*result)[*result_len] = '\0';
+    if (cb) cb(seg_text + cut_pos, cb_userdata);
+    free(seg_text);
+}
+
+/* Audio of one segment, zero-padded to 0.5 s (like the official pipeline).
+ * *pad_buf receives the padded copy, if one was needed, for the caller to free. */
+static const float *segment_audio(const float *samples, int seg_start, int seg_end,
+                                  float **pad_buf, int *out_samples) {
+    int min_samples = QWEN_SAMPLE_RATE / 2;
+    int seg_samples = seg_end - seg_start;
+    *pad_buf = NULL;
+    *out_samples = seg_samples;
+    if (seg_samples >= min_samples) return samples + seg_start;
+    *pad_buf = (float *)calloc(min_samples, sizeof(float));
+    if (!*pad_buf) return samples + seg_start;
+    memcpy(*pad_buf, samples + seg_start, seg_samples * sizeof(float));
+    *out_samples = min_samples;
+    return *pad_buf;
+}
+
+/* ---- Segment encoder pipeline ----
+ *
+ * The encoder is compute-bound and the decoder bandwidth-bound, so with an
+ * encoder pool (qwen_ctx_set_pipeline) a worker thread runs mel + encoder
+ * for the next segments on that pool while the calling thread prefills and
+ * decodes the current one on ctx->pool. Encoder tokens are small (about
+ * 1 MB per 20 s segment), so a few segments of lookahead cost little.
+ * Without an encoder pool, each segment is encoded inline when taken. */
+
+typedef struct {
+    float *enc;                /* encoder tokens, owned until taken */
+    int seq_len;
+    int ready;
+} seg_enc_slot_t;
+
+typedef struct {
+    qwen_ctx_t *ctx;
+    const float *samples;
+    const int *splits;
+    int n_splits;
+    int depth;                 /* segments the worker may run ahead of the decoder */
+    seg_enc_slot_t *slots;
+    int taken;                 /* segments handed to the decoder so far */
+    int stop;
+    int running;               /* worker thread started */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    double enc_ms;             /* mel + encoder time */
+    double stall_ms;           /* time the decoder waited for the worker */
+    qwen_perf_counters_t perf; /* the worker's kernels, folded into ctx at stop */
+} seg_encoder_t;
+
+static float *seg_encoder_run(seg_encoder_t *se, int s, int *seq_len, double *ms) {
+    float *pad_buf;
+    int seg_samples;
+    const float *seg_ptr = segment_audio(se->samples, se->splits[s], se->splits[s + 1],
+                                         &pad_buf, &seg_samples);
+    segment_timing_t tm = {0};
+    float *enc = segment_encode(se->ctx, seg_ptr, seg_samples, seq_len, &tm);
+    free(pad_buf);
+    *ms = tm.mel_ms + tm.enc_ms;
+    return enc;
+}
+
+static void *seg_encoder_main(void *arg) {
+    seg_encoder_t *se = (seg_encoder_t *)arg;
+    qwen_threadpool_bind(se->ctx->enc_pool);
+    qwen_bf16_cache_bind(se->ctx->bf16_cache);
+    qwen_scratch_bind(&se->ctx->enc_scratch);
+    qwen_perf_bind(&se->perf);
+    for (int s = 0; s < se->n_splits; s++) {
+        pthread_mutex_lock(&se->mutex);
+        while (!se->stop && s >= se->taken + se->depth)
+            pthread_cond_wait(&se->cond, &se->mutex);
+        int stop = se->stop;
+        pthread_mutex_unlock(&se->mutex);
+        if (stop) break;
+
+        int seq_len = 0;
+        double ms = 0;
+        float *enc = seg_encoder_run(se, s, &seq_len, &ms);
+
+        pthread_mutex_lock(&se->mutex);
+        se->slots[s].enc = enc;
+        se->slots[s].seq_len = seq_len;
+        se->slots[s].ready = 1;
+        se->enc_ms += ms;
+        pthread_cond_broadcast(&se->cond);
+        pthread_mutex_unlock(&se->mutex);
+    }
+    qwen_perf_bind(NULL);
+    qwen_scratch_bind(NULL);
+    qwen_bf16_cache_bind(NULL);
+    qwen_threadpool_bind(NULL);
+    return NULL;
+}
+
+/* Segments are encoded from samples[splits[s] .. splits[s + 1]). The worker
+ * is started only with an encoder pool and more than one segment. */
+static int seg_encoder_start(seg_encoder_t *se, qwen_ctx_t *ctx, const float *samples,
+                             const int *splits, int n_splits, int depth) {
+    memset(se, 0, sizeof(*se));
+    se->ctx = ctx;
+    se->samples = samples;
+    se->splits = splits;
+    se->n_splits = n_splits;
+    se->depth = depth > 0 ? depth : 1;
+    se->slots = (seg_enc_slot_t *)calloc(n_splits, sizeof(seg_enc_slot_t));
+    if (!se->slots) return -1;
+    if (!ctx->enc_pool || n_splits < 2) return 0;
+
+    pthread_mutex_init(&se->mutex, NULL);
+    pthread_cond_init(&se->cond, NULL);
+    if (pthread_create(&se->thread, NULL, seg_encoder_main, se) != 0) {
+        pthread_cond_destroy(&se->cond);
+        pthread_mutex_destroy(&se->mutex);
+        return 0;
+    }
+    se->running = 1;
+    return 0;
+}
+
+/* Encoder tokens of segment s, taken in increasing order; NULL on failure.
+ * The caller frees them. */
+static float *seg_encoder_take(seg_encoder_t *se, int s, int *seq_len) {
+    if (!se->running) {
+        double ms = 0;
+        float *enc = seg_encoder_run(se, s, seq_len, &ms);
+        se->enc_ms += ms;
+        return enc;
+    }
+    double t0 = get_time_ms();
+    pthread_mutex_lock(&se->mutex);
+    se->taken = s + 1;
+    pthread_cond_broadcast(&se->cond);
+    while (!se->slots[s].ready) pthread_cond_wait(&se->cond, &se->mutex);
+    float *enc = se->slots[s].enc;
+    *seq_len = se->slots[s].seq_len;
+    se->slots[s].enc = NULL;
+    pthread_mutex_unlock(&se->mutex);
+    se->stall_ms += get_time_ms() - t0;
+    return enc;
+}
+
+/* Stop the worker, drop segments never taken and record the stage stats */
+static void seg_encoder_stop(seg_encoder_t *se) {
+    qwen_ctx_t *ctx = se->ctx;
+    if (se->running) {
+        pthread_mutex_lock(&se->mutex);
+        se->stop = 1;
+        pthread_cond_broadcast(&se->cond);
+        pthread_mutex_unlock(&se->mutex);
+        pthread_join(se->thread, NULL);
+        pthread_cond_destroy(&se->cond);
+        pthread_mutex_destroy(&se->mutex);
+    }
+    for (int s = 0; s < se->n_splits && se->slots; s++) free(se->slots[s].enc);
+    free(se->slots);
+    se->slots = NULL;
+
+    ctx->perf_encode_ms += se->enc_ms;
+    qwen_perf_counters_add(&ctx->perf_counters, &se->perf);
+    qwen_perf_note_memory(ctx, qwen_kv_cache_bytes(&ctx->kv_cache));
+    if (!se->running || se->enc_ms <= 0) return;
+    double hidden = se->enc_ms - se->stall_ms;
+    ctx->perf_pipeline_overlap = hidden > 0 ? hidden / se->enc_ms : 0.0;
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "Pipeline: encoder %.0f ms on %d threads, decoder waited %.0f ms "
+                "(%.0f%% overlapped)\n",
+                se->enc_ms, qwen_threadpool_threads(ctx->enc_pool), se->stall_ms,
+                100.0 * ctx->perf_pipeline_overlap);
+}
+
+/* ---- Batched segment decoding ----
+ *
+ * Without past-text conditioning the segments are independent, so up to
+ * decode_batch of them decode in lockstep: each lane owns a KV cache and
+ * every step advances all lanes through qwen_decoder_forward_batch, which
+ * reads each weight matrix once for the whole batch. A lane that reaches
+ * EOS is refilled with the next segment right away (its cache pages are
+ * reused). Segment text is emitted in order as segments complete. */
+
+typedef struct {
+    qwen_kv_cache_t kv;
+    int kv_len;
+    int prompt_len;            /* leading positions holding the prompt prefix */
+    int seg;                   /* segment being decoded, -1 = idle */
+    int token;                 /* next token to feed */
+    int n_generated;
+    segment_text_t st;
+} decode_lane_t;
+
+/* segment_prefill into a lane's own cache. The static prompt prefix is
+ * prefilled once: a lane keeps it across its segments and starts from the
+ * context cache's copy, and the first lane to compute it stores it there. */
+static int lane_prefill(qwen_ctx_t *ctx, decode_lane_t *lane, const float *enc_output,
+                        int enc_seq_len, qwen_tokenizer_t *tokenizer, segment_timing_t *tm) {
+    if (lane->prompt_len == 0 && ctx->kv_prompt_len > 0 &&
+        qwen_kv_cache_copy_prefix(&lane->kv, &ctx->kv_cache, ctx->kv_prompt_len) == 0)
+        lane->prompt_len = ctx->kv_prompt_len;
+
+    qwen_kv_cache_t saved = ctx->kv_cache;
+    int saved_len = ctx->kv_cache_len;
+    int saved_max = ctx->kv_cache_max;
+    int saved_prompt_len = ctx->kv_prompt_len;
+
+    ctx->kv_cache = lane->kv;
+    ctx->kv_cache_len = 0;
+    ctx->kv_cache_max = qwen_kv_cache_capacity(&lane->kv);
+    ctx->kv_prompt_len = lane->prompt_len;
+    int token = segment_prefill(ctx, enc_output, enc_seq_len, tokenizer, NULL, 0, tm);
+    lane->kv = ctx->kv_cache;
+    lane->kv_len = ctx->kv_cache_len;
+    lane->prompt_len = ctx->kv_prompt_len;
+
+    ctx->kv_cache = saved;
+    ctx->kv_cache_len = saved_len;
+    ctx->kv_cache_max = saved_max;
+    ctx->kv_prompt_len = saved_prompt_len;
+    if (saved_prompt_len == 0 && lane->prompt_len > 0 &&
+        qwen_kv_cache_copy_prefix(&ctx->kv_cache, &lane->kv, lane->prompt_len) == 0) {
+        ctx->kv_cache_max = qwen_kv_cache_capacity(&ctx->kv_cache);
+        if (ctx->kv_cache_len < lane->prompt_len) ctx->kv_cache_len = lane->prompt_len;
+        ctx->kv_prompt_len = lane->prompt_len;
+    }
+    return token;
+}
+
+static char *transcribe_segments_batched(qwen_ctx_t *ctx, const float *samples,
+                                         const int *splits, int n_splits,
+                                         qwen_tokenizer_t *tokenizer) {
+    int dim = ctx->config.dec_hidden;
+    int n_lanes = ctx->decode_batch;
+    if (n_lanes > QWEN_DECODE_BATCH_MAX) n_lanes = QWEN_DECODE_BATCH_MAX;
+    if (n_lanes > n_splits) n_lanes = n_splits;
+    double t_start = get_time_ms();
+
+    decode_lane_t lanes[QWEN_DECODE_BATCH_MAX];
+    memset(lanes, 0, sizeof(lanes));
+    for (int b = 0; b < n_lanes; b++) lanes[b].seg = -1;
+
+    qwen_kv_cache_t *caches[QWEN_DECODE_BATCH_MAX];
+    int lens[QWEN_DECODE_BATCH_MAX], tokens[QWEN_DECODE_BATCH_MAX], lane_of[QWEN_DECODE_BATCH_MAX];
+    float *embeds = (float *)malloc((size_t)n_lanes * dim * sizeof(float));
+    char **seg_texts = (char **)calloc(n_splits, sizeof(char *));
+    char *seg_done = (char *)calloc(n_splits, 1);
+    size_t result_cap = 4096;
+    size_t result_len = 0;
+    char *result = (char *)malloc(result_cap);
+    seg_encoder_t se;
+    if (!embeds || !seg_texts || !seg_done || !result ||
+        seg_encoder_start(&se, ctx, samples, splits, n_splits, n_lanes) != 0) {
+        free(embeds); free(seg_texts); free(seg_done); free(result);
+        return NULL;
+    }
+    result[0] = '\0';
+
+    /* If language is forced, <asr_text> is already part of prompt suffix. */
+    int forced_asr_text = ctx->n_force_prompt_tokens > 0;
+    int next_seg = 0, flushed = 0, n_steps = 0, n_rows = 0, failed = 0;
+    double decode_ms = 0;
+
+    while (flushed < n_splits) {
+        /* Refill idle lanes */
+        for (int b = 0; b < n_lanes && !failed; b++) {
+            decode_lane_t *lane = &lanes[b];
+            while (lane->seg < 0 && next_seg < n_splits) {
+                int s = next_seg++;
+                if (qwen_verbose >= 2)
+                    fprintf(stderr, "Segment %d/%d: %.1f-%.1fs -> lane %d\n",
+                            s + 1, n_splits,
+                            (float)splits[s] / QWEN_SAMPLE_RATE,
+                            (float)splits[s + 1] / QWEN_SAMPLE_RATE, b);
+                segment_timing_t tm = {0};
+                int enc_seq_len = 0;
+                float *enc_output = seg_encoder_take(&se, s, &enc_seq_len);
+                int token = enc_output ?
+                    lane_prefill(ctx, lane, enc_output, enc_seq_len, tokenizer, &tm) : -1;
+                free(enc_output);
+                ctx->perf_decode_ms += tm.prefill_ms;
+                if (token < 0 || segment_text_init(&lane->st, forced_asr_text) != 0) {
+                    seg_done[s] = 1;
+                    continue;
+                }
+                lane->seg = s;
+                lane->token = token;
+                lane->n_generated = 0;
+            }
+        }
+
+        /* Feed each lane's pending token; finished lanes hand in their text */
+        int n = 0;
+        for (int b = 0; b < n_lanes; b++) {
+            decode_lane_t *lane = &lanes[b];
+            if (lane->seg < 0) continue;
+            int token = lane->token;
+            int done = failed || lane->n_generated >= SEGMENT_MAX_TOKENS;
+            if (!done) {
+                lane->n_generated++;
+                done = (token == QWEN_TOKEN_ENDOFTEXT || token == QWEN_TOKEN_IM_END);
+            }
+            if (done) {
+                ctx->perf_text_tokens += lane->st.n_text_tokens;
+                seg_texts[lane->seg] = segment_text_finish(&lane->st);
+                seg_done[lane->seg] = 1;
+                lane->seg = -1;
+                continue;
+            }
+            segment_text_feed(ctx, tokenizer, &lane->st, token, 0);
+            tok_embed_bf16_to_f32(embeds + (size_t)n * dim,
+                                  ctx->decoder.tok_embeddings_bf16, token, dim);
+            caches[n] = &lane->kv;
+            lens[n] = lane->kv_len;
+            lane_of[n] = b;
+            n++;
+        }
+
+        /* One step for every active lane */
+        if (n > 0) {
+            double t0 = get_time_ms();
+            if (qwen_decoder_forward_batch(ctx, caches, lens, embeds, n, tokens) != 0) {
+                fprintf(stderr, "qwen: batched decode step failed\n");
+                failed = 1;
+            } else {
+                for (int i = 0; i < n; i++) {
+                    lanes[lane_of[i]].kv_len = lens[i];
+                    lanes[lane_of[i]].token = tokens[i];
+                }
+                n_steps++;
+                n_rows += n;
+            }
+            decode_ms += get_time_ms() - t0;
+        }
+        if (failed) {
+            /* Give up on the segments not started yet */
+            while (next_seg < n_splits) seg_done[next_seg++] = 1;
+        }
+
+        /* Emit completed segments in order */
+        while (flushed < n_splits && seg_done[flushed]) {
+            append_segment_text(&result, &result_len, &result_cap, seg_texts[flushed], 0,
+                                ctx->token_cb, ctx->token_cb_userdata);
+            seg_texts[flushed] = NULL;
+            flushed++;
+        }
+    }
+
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "Batched decode: %d segments, %d lanes, %d steps, "
+                "%.2f sequences/step (%.0f ms, %.1f ms/step)\n",
+                n_splits, n_lanes, n_steps, n_steps > 0 ? (double)n_rows / n_steps : 0.0,
+                decode_ms, n_steps > 0 ? decode_ms / n_steps : 0.0);
+
+    seg_encoder_stop(&se);
+    for (int b = 0; b < n_lanes; b++) {
+        free(lanes[b].st.text);
+        qwen_kv_cache_free(&lanes[b].kv);
+    }
+    ctx->perf_decode_ms += decode_ms;
+    ctx->perf_total_ms += get_time_ms() - t_start;
+    free(embeds);
+    free(seg_texts);
+    free(seg_done);
+    return result;
+}
+
+/* Segment boundaries for offline transcription: splits[0..n] with the end
+ * sentinel at splits[n], n <= QWEN_MAX_SEGMENTS. Returns n, 1 when the audio
+ * is not split (segment_sec is 0 or it fits in one segment). The search
+ * window is clamped to half the segment size so split points can never
+ * overlap and produce zero-length segments. */
+#define QWEN_MAX_SEGMENTS 127
+
+static int plan_segments(const qwen_ctx_t *ctx, const float *samples, int n_samples,
+                         int *splits) {
+    float search = ctx->search_sec;
+    if (search > ctx->segment_sec / 2.0f) search = ctx->segment_sec / 2.0f;
+    int target_samples = (int)(ctx->segment_sec * QWEN_SAMPLE_RATE);
+    int margin_samples = (int)(search * QWEN_SAMPLE_RATE);
+
+    int n_splits = 0;
+    splits[n_splits++] = 0;
+    if (ctx->segment_sec > 0) {
+        int pos = 0;
+        while (pos + target_samples + margin_samples < n_samples) {
+            int split = find_split_point(samples, n_samples, pos + target_samples, search);
+            splits[n_splits++] = split;
+            pos = split;
+            if (n_splits >= QWEN_MAX_SEGMENTS) break; /* safety */
+        }
+    }
+    splits[n_splits] = n_samples; /* end sentinel */
+    return n_splits;
+}
+
+static char *transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples) {
+    perf_reset(ctx, 1000.0 * (double)n_samples / (double)QWEN_SAMPLE_RATE);
 
     const float *audio_samples = samples;
     int audio_n_samples = n_samples;
@@ -863,60 +2170,42 @@ char *qwen_transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples
         fprintf(stderr, "Audio: %d samples (%.1f seconds)\n",
                 audio_n_samples, (float)audio_n_samples / QWEN_SAMPLE_RATE);
 
-    /* Load tokenizer once for all segments */
-    char vocab_path[1024];
-    snprintf(vocab_path, sizeof(vocab_path), "%s/vocab.json", ctx->model_dir);
-    qwen_tokenizer_t *tokenizer = qwen_tokenizer_load(vocab_path);
-    if (!tokenizer) {
-        free(compacted_samples);
-        return NULL;
-    }
-    if (prepare_prompt_tokens(ctx, tokenizer) != 0) {
-        qwen_tokenizer_free(tokenizer);
+    qwen_tokenizer_t *tokenizer = ctx_tokenizer(ctx);
+    if (!tokenizer || prepare_prompt_tokens(ctx, tokenizer) != 0) {
         free(compacted_samples);
         return NULL;
     }
 
-    /* Determine segment boundaries.
-     * Clamp search window to half the segment size so split points
-     * can never overlap and produce zero-length segments. */
-    float search = ctx->search_sec;
-    if (search > ctx->segment_sec / 2.0f) search = ctx->segment_sec / 2.0f;
-    int target_samples = (int)(ctx->segment_sec * QWEN_SAMPLE_RATE);
-    int margin_samples = (int)(search * QWEN_SAMPLE_RATE);
-
     /* No splitting if segment_sec is 0 or audio fits in one segment */
-    if (ctx->segment_sec <= 0 || audio_n_samples <= target_samples + margin_samples) {
+    int splits[QWEN_MAX_SEGMENTS + 1];
+    int n_splits = plan_segments(ctx, audio_samples, audio_n_samples, splits);
+    if (n_splits == 1) {
         char *text = transcribe_segment(ctx, audio_samples, audio_n_samples, tokenizer, NULL, 0, NULL);
-        qwen_tokenizer_free(tokenizer);
         free(compacted_samples);
         return text;
     }
 
-    /* Build split points */
-    int splits[128]; /* max 128 segments */
-    int n_splits = 0;
-    splits[n_splits++] = 0;
-
-    int pos = 0;
-    while (pos + target_samples + margin_samples < audio_n_samples) {
-        int split = find_split_point(audio_samples, audio_n_samples,
-                                     pos + target_samples, search);
-        splits[n_splits++] = split;
-        pos = split;
-        if (n_splits >= 127) break; /* safety */
-    }
-    splits[n_splits] = audio_n_samples; /* end sentinel */
-
     if (qwen_verbose >= 2)
         fprintf(stderr, "Splitting into %d segments\n", n_splits);
 
-    /* Transcribe each segment and concatenate */
+    if (ctx->decode_batch > 1 && !ctx->past_text_conditioning) {
+        char *text = transcribe_segments_batched(ctx, audio_samples, splits, n_splits, tokenizer);
+        free(compacted_samples);
+        return text;
+    }
+
+    /* Transcribe each segment and concatenate; the encoder runs one segment
+     * ahead when pipelined */
+    seg_encoder_t se;
     size_t result_cap = 4096;
     size_t result_len = 0;
     char *result = (char *)malloc(result_cap);
+    if (!result || seg_encoder_start(&se, ctx, audio_samples, splits, n_splits, 1) != 0) {
+        free(result);
+        free(compacted_samples);
+        return NULL;
+    }
     result[0] = '\0';
-    int min_samples = QWEN_SAMPLE_RATE / 2; /* 0.5s minimum, like official */
     int do_boundary_cleanup = (ctx->past_text_conditioning != 0);
     int use_past_conditioning = ctx->past_text_conditioning;
     int conditioning_collapses = 0;
@@ -939,15 +2228,12 @@ char *qwen_transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples
                     (float)seg_end / QWEN_SAMPLE_RATE,
                     seg_samples);
 
-        /* Pad short segments to 0.5s with zeros (like official pipeline) */
-        float *seg_buf = NULL;
-        const float *seg_ptr = audio_samples + seg_start;
-        if (seg_samples < min_samples) {
-            seg_buf = (float *)calloc(min_samples, sizeof(float));
-            memcpy(seg_buf, seg_ptr, seg_samples * sizeof(float));
-            seg_ptr = seg_buf;
-            seg_samples = min_samples;
-        }
+        /* Encoder tokens (short segments are zero-padded to 0.5s first) */
+        double take_t0 = get_time_ms();
+        int enc_seq_len = 0;
+        float *enc_output = seg_encoder_take(&se, s, &enc_seq_len);
+        ctx->perf_total_ms += get_time_ms() - take_t0;
+        if (!enc_output) continue;
 
         int *past_tokens = NULL;
         int n_past_tokens = 0;
@@ -976,9 +2262,9 @@ char *qwen_transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples
         }
 
         int seg_text_tokens = 0;
-        char *seg_text = transcribe_segment(ctx, seg_ptr, seg_samples, tokenizer,
-                                            past_tokens, n_past_tokens,
-                                            &seg_text_tokens);
+        char *seg_text = transcribe_encoded_segment(ctx, enc_output, enc_seq_len, tokenizer,
+                                                    past_tokens, n_past_tokens,
+                                                    &seg_text_tokens);
         if (do_boundary_cleanup &&
             use_past_conditioning && n_past_tokens > 0 &&
             should_retry_unconditioned_segment(result, seg_text,
@@ -996,8 +2282,8 @@ char *qwen_transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples
             /* Guardrail: if conditioned decode collapses or drifts,
              * retry this segment without past-text conditioning. */
             free(seg_text);
-            seg_text = transcribe_segment(ctx, seg_ptr, seg_samples, tokenizer, NULL, 0,
-                                          &seg_text_tokens);
+            seg_text = transcribe_encoded_segment(ctx, enc_output, enc_seq_len, tokenizer,
+                                                  NULL, 0, &seg_text_tokens);
             if (conditioning_collapses >= 2) {
                 use_past_conditioning = 0;
                 if (qwen_verbose >= 2) {
@@ -1010,42 +2296,14 @@ char *qwen_transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples
         ctx->token_cb_userdata = saved_cb_userdata;
 
         free(past_tokens);
-        free(seg_buf);
-        if (!seg_text) continue;
-        if (seg_text[0] == '\0') { free(seg_text); continue; }
-
-        int cut_pos = 0;
-        if (do_boundary_cleanup) {
-            while (seg_text[cut_pos] != '\0' && isspace((unsigned char)seg_text[cut_pos])) cut_pos++;
-        }
-        if (seg_text[cut_pos] == '\0') {
-            free(seg_text);
-            continue;
-        }
-
-        size_t add_len = strlen(seg_text + cut_pos);
-        int need_space = should_insert_boundary_space(
-            result_len > 0 ? (int)(unsigned char)result[result_len - 1] : 0,
-            (int)(unsigned char)seg_text[cut_pos]);
-        size_t need = result_len + add_len + (size_t)(need_space ? 2 : 1);
-        if (need > result_cap) {
-            while (need > result_cap) result_cap *= 2;
-            result = (char *)realloc(result, result_cap);
-        }
-        if (need_space) {
-            result[result_len++] = ' ';
-            if (do_boundary_cleanup && saved_cb) saved_cb(" ", saved_cb_userdata);
-        }
-        memcpy(result + result_len, seg_text + cut_pos, add_len);
-        result_len += add_len;
-        result[result_len] = '\0';
-        if (do_boundary_cleanup && saved_cb) saved_cb(seg_text + cut_pos, saved_cb_userdata);
-        free(seg_text);
+        free(enc_output);
+        append_segment_text(&result, &result_len, &result_cap, seg_text, do_boundary_cleanup,
+                            do_boundary_cleanup ? saved_cb : NULL, saved_cb_userdata);
     }
 
+    seg_encoder_stop(&se);
     ctx->token_cb = saved_cb;
     ctx->token_cb_userdata = saved_cb_userdata;
-    qwen_tokenizer_free(tokenizer);
     free(compacted_samples);
     return result;
 }
@@ -1071,6 +2329,30 @@ static int stream_encode_span(qwen_ctx_t *ctx, const float *samples, int n_sampl
     return 0;
 }
 
+/* Encode n_frames of a frame-major [n_frames, 128] mel buffer (as produced
+ * by qwen_mel_stream_pop). Caller owns out_enc_output. */
+static int stream_encode_frames(qwen_ctx_t *ctx, const float *mel_frames, int n_frames,
+                                float **out_enc_output, int *out_seq_len) {
+    *out_enc_output = NULL;
+    *out_seq_len = 0;
+    if (n_frames <= 0) return 0;
+
+    float *mel = (float *)malloc((size_t)QWEN_MEL_BINS * n_frames * sizeof(float));
+    if (!mel) return -1;
+    for (int t = 0; t < n_frames; t++)
+        for (int m = 0; m < QWEN_MEL_BINS; m++)
+            mel[(size_t)m * n_frames + t] = mel_frames[(size_t)t * QWEN_MEL_BINS + m];
+
+    int seq_len = 0;
+    float *enc_output = qwen_encoder_forward(ctx, mel, n_frames, &seq_len);
+    free(mel);
+    if (!enc_output) return -1;
+
+    *out_enc_output = enc_output;
+    *out_seq_len = seq_len;
+    return 0;
+}
+
 typedef struct {
     int start_sample;
     int n_samples;
@@ -1078,6 +2360,8 @@ typedef struct {
     float *enc_output; /* [seq_len, dec_hidden] */
 } stream_enc_window_t;
 
+#define STREAM_MAX_ANCHOR 256   /* cap on stream_anchor_tokens */
+
 /* ========================================================================
  * Streaming Transcription (chunked rollback + encoder window cache)
  *
@@ -1092,553 +2376,835 @@ typedef struct {
  * Encoder-side optimization:
  * - The encoder uses local attention windows, so completed windows are
  *   immutable.
- * - We cache completed window outputs once and only re-encode the current
+ * - We encode each completed window once and only re-encode the current
  *   partial tail window.
- * - Decoder prefill still consumes all encoder tokens
- *   ([cached windows] + [current partial window]).
+ * - The log-mel front-end is incremental (qwen_mel_stream_t): each chunk
+ *   pushes only its new samples, and frames are kept until their window is
+ *   encoded. Frames are clamped against the running max (see
+ *   QWEN_MEL_MAX_RUNNING), so the front-end does O(new audio) work per chunk.
+ *
+ * Decoder-side reuse:
+ * - The prompt prefix and completed windows never change, so once their KV
+ *   rows are prefilled (kv_stable) a window's encoder output is dropped and
+ *   later chunks only build and diff inputs from kv_stable onward:
+ *   [new windows] [partial window] [suffix] [text prefix].
+ *
+ * Sliding horizon (stream_horizon_sec > 0):
+ * - Once the committed windows span the horizon, the current hypothesis is
+ *   committed in full and the decoder context is re-anchored: the windows
+ *   and text history are dropped, and the last stream_anchor_tokens
+ *   committed tokens are appended to the system prompt instead.
+ * - The first hypothesis after a re-anchor usually repeats the end of the
+ *   anchor (audio of the partial window); the overlap is not re-emitted.
+ * - KV rows, token histories and per-chunk work then stay bounded however
+ *   long the session runs. Text returned by qwen_stream_poll is released.
+ *
+ * The state lives in a qwen_stream_t session so audio can be pushed live
+ * (qwen_stream_push); qwen_transcribe_stream feeds a whole buffer through
+ * one.
  * ======================================================================== */
 
-char *qwen_transcribe_stream(qwen_ctx_t *ctx, const float *samples, int n_samples) {
-    const qwen_config_t *cfg = &ctx->config;
-    int dim = cfg->dec_hidden;
-    int chunk_samples = (int)(ctx->stream_chunk_sec * QWEN_SAMPLE_RATE);
-    int rollback = ctx->stream_rollback;
-    int unfixed_chunks = ctx->stream_unfixed_chunks;
-    int max_new_tokens = ctx->stream_max_new_tokens > 0 ? ctx->stream_max_new_tokens : 32;
+struct qwen_stream {
+    qwen_ctx_t *ctx;
+    qwen_tokenizer_t *tokenizer;   /* the context's */
+    float *tmp_embed;              /* single-token decoder input */
+
+    int chunk_samples;
+    int rollback;
+    int unfixed_chunks;
+    int max_new_tokens;
+    int enc_window_frames;
+    int use_enc_cache;
+    int chunk_idx;
+    int finished;
+
+    /* Audio pushed but not yet consumed by a chunk */
+    float *pending;
+    int n_pending, pending_cap;
+    /* All consumed audio, kept only for the QWEN_STREAM_NO_ENC_CACHE path */
+    float *audio;
+    int n_audio, audio_cap;
+
+    /* Incremental mel state for the cached-window encoder path. mel_buf holds
+     * the frames of the current (not yet encoded) window, frame-major. */
+    qwen_mel_stream_t *mel_stream;
+    float *mel_buf;
+    int mel_n, mel_cap;
+
+    /* Completed windows whose KV rows are not prefilled yet */
+    stream_enc_window_t *enc_cache;
+    int n_enc_cache, enc_cache_cap;
+    int n_enc_windows;             /* windows completed so far */
+    int enc_committed_seq;         /* encoder tokens of windows in kv_stable */
+
+    /* KV positions [0, kv_stable) hold the prompt prefix and committed
+     * windows; prev_tail keeps the previous prefill's inputs from kv_stable
+     * on for the embedding diff. */
+    int kv_stable;
+    float *prev_tail;
+    int prev_tail_len, prev_tail_cap;
+    int prefill_total_tokens;
+    int prefill_reused_tokens;
+    int spec_passes;               /* speculative verification passes */
+    int spec_drafted, spec_accepted;
+
+    /* Silence gate: consecutive silent chunks and how many were dropped */
+    qwen_vad_t *vad;
+    int silent_chunks;
+    int vad_skipped_chunks;
 
-    const float *audio_samples = samples;
-    int audio_n_samples = n_samples;
-    float *compacted_samples = NULL;
-    if (ctx->skip_silence) {
-        compacted_samples = compact_silence(samples, n_samples, &audio_n_samples);
-        if (compacted_samples) audio_samples = compacted_samples;
-        if (qwen_verbose >= 1) {
-            float used_pct = 100.0f * (float)audio_n_samples /
-                             (float)(n_samples > 0 ? n_samples : 1);
-            float skipped_pct = 100.0f - used_pct;
-            if (skipped_pct < 0.0f) skipped_pct = 0.0f;
-            fprintf(stderr, "Silence skip: used %.1f%%, skipped %.1f%% (%d -> %d samples)\n",
-                    used_pct, skipped_pct, n_samples, audio_n_samples);
-        }
+    /* Raw decoded history (language + <asr_text> + text), tokenized. */
+    int *raw_tokens;
+    int n_raw_tokens, raw_tokens_cap;
+
+    /* Stable committed text tokens already emitted. */
+    int *stable_text_tokens;
+    int n_stable_text_tokens, stable_text_cap;
+
+    /* Sliding horizon: windows committed since the last re-anchor, and the
+     * committed text tail that stands in for them in the system prompt. */
+    int horizon_windows;           /* 0 = unbounded */
+    int anchor_windows;
+    int *anchor_tokens;
+    int n_anchor_tokens, anchor_cap;
+    int anchor_overlap_pending;
+
+    /* Committed text not yet returned by qwen_stream_poll */
+    char *result;
+    size_t result_len, result_cap;
+};
+
+static int stream_append(float **buf, int *n, int *cap, const float *samples, int n_samples) {
+    if (n_samples <= 0) return 0;
+    if (*n + n_samples > *cap) {
+        int new_cap = *cap > 0 ? *cap : QWEN_SAMPLE_RATE;
+        while (new_cap < *n + n_samples) new_cap *= 2;
+        float *tmp = (float *)realloc(*buf, (size_t)new_cap * sizeof(float));
+        if (!tmp) return -1;
+        *buf = tmp;
+        *cap = new_cap;
     }
+    memcpy(*buf + *n, samples, (size_t)n_samples * sizeof(float));
+    *n += n_samples;
+    return 0;
+}
 
-    ctx->perf_total_ms = 0;
-    ctx->perf_text_tokens = 0;
-    ctx->perf_audio_ms = 1000.0 * (double)n_samples / (double)QWEN_SAMPLE_RATE;
-    ctx->perf_encode_ms = 0;
-    ctx->perf_decode_ms = 0;
-    int enc_window_frames = ctx->config.enc_n_window_infer;
-    if (enc_window_frames < 100) enc_window_frames = 100;
-    if (enc_window_frames > 800) enc_window_frames = 800;
-    int enc_window_samples = enc_window_frames * QWEN_HOP_LENGTH;
+static void stream_free(qwen_stream_t *s) {
+    if (!s) return;
+    s->ctx->stream_sessions--;
+    for (int i = 0; i < s->n_enc_cache; i++) free(s->enc_cache[i].enc_output);
+    free(s->enc_cache);
+    qwen_mel_stream_free(s->mel_stream);
+    qwen_vad_free(s->vad);
+    free(s->mel_buf);
+    free(s->pending);
+    free(s->audio);
+    free(s->prev_tail);
+    free(s->raw_tokens);
+    free(s->stable_text_tokens);
+    free(s->anchor_tokens);
+    free(s->result);
+    free(s->tmp_embed);
+    free(s);
+}
+
+static qwen_stream_t *stream_open(qwen_ctx_t *ctx) {
+    const qwen_config_t *cfg = &ctx->config;
+    qwen_stream_t *s = (qwen_stream_t *)calloc(1, sizeof(qwen_stream_t));
+    if (!s) return NULL;
+    s->ctx = ctx;
+    ctx->stream_sessions++;
+    s->chunk_samples = (int)(ctx->stream_chunk_sec * QWEN_SAMPLE_RATE);
+    if (s->chunk_samples < 1) s->chunk_samples = 1;
+    s->rollback = ctx->stream_rollback;
+    s->unfixed_chunks = ctx->stream_unfixed_chunks;
+    s->max_new_tokens = ctx->stream_max_new_tokens > 0 ? ctx->stream_max_new_tokens : 32;
+
+    perf_reset(ctx, 0);
+    s->enc_window_frames = cfg->enc_n_window_infer;
+    if (s->enc_window_frames < 100) s->enc_window_frames = 100;
+    if (s->enc_window_frames > 800) s->enc_window_frames = 800;
     const char *no_cache_env = getenv("QWEN_STREAM_NO_ENC_CACHE");
-    int use_enc_cache = 1;
+    s->use_enc_cache = 1;
     if (no_cache_env && no_cache_env[0] != '\0' && strcmp(no_cache_env, "0") != 0) {
-        use_enc_cache = 0;
+        s->use_enc_cache = 0;
     }
 
     if (qwen_verbose >= 2)
         fprintf(stderr,
-                "Streaming: %d samples (%.1f s), chunk=%.1f s, rollback=%d, "
-                "unfixed=%d, max_new=%d, enc_window=%.1fs, enc_cache=%s, prefix=%s\n",
-                audio_n_samples, (float)audio_n_samples / QWEN_SAMPLE_RATE,
-                ctx->stream_chunk_sec, rollback,
-                unfixed_chunks, max_new_tokens,
-                (float)enc_window_frames / 100.0f,
-                use_enc_cache ? "on" : "off",
-                ctx->past_text_conditioning ? "on" : "off");
-
-    /* Load tokenizer */
-    char vocab_path[1024];
-    snprintf(vocab_path, sizeof(vocab_path), "%s/vocab.json", ctx->model_dir);
-    qwen_tokenizer_t *tokenizer = qwen_tokenizer_load(vocab_path);
-    if (!tokenizer) {
-        free(compacted_samples);
+                "Streaming: chunk=%.1f s, rollback=%d, "
+                "unfixed=%d, max_new=%d, enc_window=%.1fs, enc_cache=%s, prefix=%s, vad=%s\n",
+                ctx->stream_chunk_sec, s->rollback,
+                s->unfixed_chunks, s->max_new_tokens,
+                (float)s->enc_window_frames / 100.0f,
+                s->use_enc_cache ? "on" : "off",
+                ctx->past_text_conditioning ? "on" : "off",
+                ctx->stream_vad_gate ? "on" : "off");
+
+    s->tokenizer = ctx_tokenizer(ctx);
+    if (!s->tokenizer || prepare_prompt_tokens(ctx, s->tokenizer) != 0) {
+        stream_free(s);
         return NULL;
     }
-    if (prepare_prompt_tokens(ctx, tokenizer) != 0) {
-        qwen_tokenizer_free(tokenizer);
-        free(compacted_samples);
+
+    s->raw_tokens_cap = 8192;
+    s->raw_tokens = (int *)malloc((size_t)s->raw_tokens_cap * sizeof(int));
+    s->stable_text_cap = 8192;
+    s->stable_text_tokens = (int *)malloc((size_t)s->stable_text_cap * sizeof(int));
+    s->result_cap = 4096;
+    s->result = (char *)malloc(s->result_cap);
+    s->tmp_embed = (float *)malloc(cfg->dec_hidden * sizeof(float));
+    if (!s->raw_tokens || !s->stable_text_tokens || !s->result || !s->tmp_embed) {
+        stream_free(s);
         return NULL;
     }
+    s->result[0] = '\0';
 
-    /* In non-interactive mode (no token callback), streaming chunks are not
-     * externally consumed and the final answer is already produced by a full
-     * refinement pass. Skip chunk-by-chunk decoding entirely. */
-    if (!ctx->token_cb) {
-        if (qwen_verbose >= 2) {
-            fprintf(stderr, "Streaming: no token callback, using direct final refinement\n");
-        }
-        char *text = transcribe_segment(ctx, audio_samples, audio_n_samples, tokenizer, NULL, 0, NULL);
-        qwen_tokenizer_free(tokenizer);
-        free(compacted_samples);
-        return text;
+    if (s->use_enc_cache) {
+        s->mel_stream = qwen_mel_stream_create(QWEN_MEL_MAX_RUNNING, 0.0f);
+        if (!s->mel_stream) s->use_enc_cache = 0;
     }
 
-    /* Raw decoded history (language + <asr_text> + text), tokenized. */
-    int *raw_tokens = (int *)malloc(8192 * sizeof(int));
-    int n_raw_tokens = 0;
-    int raw_tokens_cap = 8192;
-
-    /* Stable committed text tokens already emitted to stdout. */
-    int *stable_text_tokens = (int *)malloc(8192 * sizeof(int));
-    int n_stable_text_tokens = 0;
-    int stable_text_cap = 8192;
-
-    /* Result text accumulator */
-    size_t result_cap = 4096;
-    size_t result_len = 0;
-    char *result = (char *)malloc(result_cap);
-    if (!raw_tokens || !stable_text_tokens || !result) {
-        free(raw_tokens);
-        free(stable_text_tokens);
-        free(result);
-        qwen_tokenizer_free(tokenizer);
-        free(compacted_samples);
-        return NULL;
+    if (ctx->stream_vad_gate) s->vad = qwen_vad_create();
+
+    /* The horizon evicts whole committed windows, so it needs the cache. */
+    if (s->use_enc_cache && ctx->stream_horizon_sec > 0.0f) {
+        float window_sec = (float)s->enc_window_frames / 100.0f;
+        s->horizon_windows = (int)ceilf(ctx->stream_horizon_sec / window_sec);
+        if (s->horizon_windows < 1) s->horizon_windows = 1;
+        s->anchor_cap = ctx->stream_anchor_tokens;
+        if (s->anchor_cap < 0) s->anchor_cap = 0;
+        if (s->anchor_cap > STREAM_MAX_ANCHOR) s->anchor_cap = STREAM_MAX_ANCHOR;
+        if (s->anchor_cap > 0) {
+            s->anchor_tokens = (int *)malloc((size_t)s->anchor_cap * sizeof(int));
+            if (!s->anchor_tokens) {
+                stream_free(s);
+                return NULL;
+            }
+        }
+        if (qwen_verbose >= 2)
+            fprintf(stderr, "Streaming: horizon=%d windows (%.1f s), anchor=%d tokens\n",
+                    s->horizon_windows, s->horizon_windows * window_sec, s->anchor_cap);
     }
-    result[0] = '\0';
+    return s;
+}
 
-    /* Single-token decoder input buffer reused across all chunks. */
-    float *tmp_embed = (float *)malloc(dim * sizeof(float));
-    if (!tmp_embed) {
-        free(raw_tokens);
-        free(stable_text_tokens);
-        free(result);
-        qwen_tokenizer_free(tokenizer);
-        free(compacted_samples);
-        return NULL;
+/* Encode the chunk's audio. Cached path: completed windows are appended to
+ * s->enc_cache and the partial tail window is returned in *tail_enc.
+ * Fallback path: the whole consumed audio is returned in *tail_enc. */
+static int stream_encode_chunk(qwen_stream_t *s, const float *chunk, int n_chunk,
+                               int is_final, float **tail_enc, int *tail_seq) {
+    qwen_ctx_t *ctx = s->ctx;
+    *tail_enc = NULL;
+    *tail_seq = 0;
+
+    if (!s->use_enc_cache) {
+        if (stream_append(&s->audio, &s->n_audio, &s->audio_cap, chunk, n_chunk) != 0)
+            return -1;
+        if (stream_encode_span(ctx, s->audio, s->n_audio, tail_enc, tail_seq) != 0 ||
+            !*tail_enc || *tail_seq <= 0) {
+            free(*tail_enc);
+            *tail_enc = NULL;
+            return -1;
+        }
+        return 0;
     }
 
-    int chunk_idx = 0;
-    int audio_cursor = 0;
-    stream_enc_window_t *enc_cache = NULL;
-    int n_enc_cache = 0;
-    int enc_cache_cap = 0;
-    int enc_cached_seq_total = 0;
-    float *prev_prefill_embeds = NULL;
-    int prev_prefill_len = 0;
-    int prev_prefill_cap = 0;
-    int prefill_total_tokens = 0;
-    int prefill_reused_tokens = 0;
-
-    while (audio_cursor < audio_n_samples) {
-        double chunk_t0 = get_time_ms();
-        audio_cursor += chunk_samples;
-        if (audio_cursor > audio_n_samples) audio_cursor = audio_n_samples;
-        int is_final = (audio_cursor >= audio_n_samples);
-
-        /* Encoder path:
-         * - default: cache completed local-attention windows and re-encode only
-         *   the current partial tail window,
-         * - debug fallback (`QWEN_STREAM_NO_ENC_CACHE=1`): re-encode full audio
-         *   prefix every chunk. */
-        double t0 = get_time_ms();
-        int enc_seq_len = 0;
-        float *enc_output = NULL;
-        int full_end = (audio_cursor / enc_window_samples) * enc_window_samples;
+    /* Feed only the new samples; the mel stream carries the overlap. */
+    if (qwen_mel_stream_push(s->mel_stream, chunk, n_chunk) < 0 ||
+        (is_final && qwen_mel_stream_finish(s->mel_stream) < 0))
+        return -1;
+
+    int n_ready = qwen_mel_stream_available(s->mel_stream);
+    if (s->mel_n + n_ready > s->mel_cap) {
+        int new_cap = s->mel_cap > 0 ? s->mel_cap : s->enc_window_frames;
+        while (new_cap < s->mel_n + n_ready) new_cap *= 2;
+        float *tmp = (float *)realloc(s->mel_buf,
+                                      (size_t)new_cap * QWEN_MEL_BINS * sizeof(float));
+        if (!tmp) return -1;
+        s->mel_buf = tmp;
+        s->mel_cap = new_cap;
+    }
+    s->mel_n += qwen_mel_stream_pop(s->mel_stream,
+                                    s->mel_buf + (size_t)s->mel_n * QWEN_MEL_BINS,
+                                    n_ready);
+
+    int enc_window_samples = s->enc_window_frames * QWEN_HOP_LENGTH;
+    while (s->mel_n >= s->enc_window_frames) {
+        float *win_enc = NULL;
+        int win_seq = 0;
+        if (stream_encode_frames(ctx, s->mel_buf, s->enc_window_frames,
+                                 &win_enc, &win_seq) != 0 ||
+            !win_enc || win_seq <= 0) {
+            free(win_enc);
+            return -1;
+        }
 
-        if (!use_enc_cache) {
-            if (stream_encode_span(ctx, audio_samples, audio_cursor,
-                                   &enc_output, &enc_seq_len) != 0 ||
-                !enc_output || enc_seq_len <= 0) {
-                free(enc_output);
-                ctx->perf_total_ms += get_time_ms() - chunk_t0;
-                chunk_idx++;
-                continue;
-            }
-            double enc_ms = get_time_ms() - t0;
-            ctx->perf_encode_ms += enc_ms;
-            if (qwen_verbose >= 2) {
-                fprintf(stderr,
-                        "  Encoder: %d tokens from 0.0-%.1f s (full recompute, %.0f ms)\n",
-                        enc_seq_len,
-                        (float)audio_cursor / QWEN_SAMPLE_RATE,
-                        enc_ms);
+        if (s->n_enc_cache == s->enc_cache_cap) {
+            int new_cap = s->enc_cache_cap > 0 ? s->enc_cache_cap * 2 : 8;
+            stream_enc_window_t *tmp = (stream_enc_window_t *)realloc(
+                s->enc_cache, (size_t)new_cap * sizeof(stream_enc_window_t));
+            if (!tmp) {
+                free(win_enc);
+                return -1;
             }
-        } else {
-            int enc_failed = 0;
-
-            while (n_enc_cache * enc_window_samples < full_end) {
-                int ws = n_enc_cache * enc_window_samples;
-                float *win_enc = NULL;
-                int win_seq = 0;
-                if (stream_encode_span(ctx, audio_samples + ws, enc_window_samples,
-                                       &win_enc, &win_seq) != 0 ||
-                    !win_enc || win_seq <= 0) {
-                    free(win_enc);
-                    enc_failed = 1;
-                    break;
-                }
-
-                if (n_enc_cache == enc_cache_cap) {
-                    int new_cap = enc_cache_cap > 0 ? enc_cache_cap * 2 : 8;
-                    stream_enc_window_t *tmp = (stream_enc_window_t *)realloc(
-                        enc_cache, (size_t)new_cap * sizeof(stream_enc_window_t));
-                    if (!tmp) {
-                        free(win_enc);
-                        enc_failed = 1;
-                        break;
-                    }
-                    enc_cache = tmp;
-                    enc_cache_cap = new_cap;
-                }
+            s->enc_cache = tmp;
+            s->enc_cache_cap = new_cap;
+        }
 
-                enc_cache[n_enc_cache].start_sample = ws;
-                enc_cache[n_enc_cache].n_samples = enc_window_samples;
-                enc_cache[n_enc_cache].seq_len = win_seq;
-                enc_cache[n_enc_cache].enc_output = win_enc;
-                n_enc_cache++;
-                enc_cached_seq_total += win_seq;
-            }
+        stream_enc_window_t *w = &s->enc_cache[s->n_enc_cache++];
+        w->start_sample = s->n_enc_windows * enc_window_samples;
+        w->n_samples = enc_window_samples;
+        w->seq_len = win_seq;
+        w->enc_output = win_enc;
+        s->n_enc_windows++;
+
+        /* Window frames are no longer needed once it is encoded. */
+        s->mel_n -= s->enc_window_frames;
+        memmove(s->mel_buf, s->mel_buf + (size_t)s->enc_window_frames * QWEN_MEL_BINS,
+                (size_t)s->mel_n * QWEN_MEL_BINS * sizeof(float));
+    }
 
-            float *partial_enc = NULL;
-            int partial_seq = 0;
-            if (!enc_failed && full_end < audio_cursor) {
-                int partial_samples = audio_cursor - full_end;
-                if (stream_encode_span(ctx, audio_samples + full_end, partial_samples,
-                                       &partial_enc, &partial_seq) != 0) {
-                    free(partial_enc);
-                    partial_enc = NULL;
-                    enc_failed = 1;
-                }
-            }
+    if (s->mel_n > 0 &&
+        stream_encode_frames(ctx, s->mel_buf, s->mel_n, tail_enc, tail_seq) != 0) {
+        free(*tail_enc);
+        *tail_enc = NULL;
+        return -1;
+    }
+    return 0;
+}
 
-            if (enc_failed) {
-                free(partial_enc);
-                ctx->perf_total_ms += get_time_ms() - chunk_t0;
-                chunk_idx++;
-                continue;
+/* Commit newly fixed text tokens: append to the result and emit them. */
+static int stream_commit(qwen_stream_t *s, int is_final) {
+    qwen_ctx_t *ctx = s->ctx;
+
+    /* Parse text region from raw stream output:
+     * - default: language ... <asr_text> TEXT
+     * - forced language: prompt already anchors language, so generated stream is TEXT. */
+    int text_start = 0;
+    if (ctx->n_force_prompt_tokens <= 0) {
+        int asr_text_pos = -1;
+        for (int i = 0; i < s->n_raw_tokens; i++) {
+            if (s->raw_tokens[i] == QWEN_TOKEN_ASR_TEXT) {
+                asr_text_pos = i;
+                break;
             }
+        }
+        text_start = (asr_text_pos >= 0) ? asr_text_pos + 1 : 0;
+    }
+    if (text_start < 0) text_start = 0;
+    if (text_start > s->n_raw_tokens) text_start = s->n_raw_tokens;
+    int n_text_tokens = s->n_raw_tokens - text_start;
+
+    /* "Fixed" frontier for this chunk:
+     * - cold-start chunks: emit nothing,
+     * - intermediate chunks: keep last `rollback` text tokens unfixed,
+     * - final chunk: emit everything. */
+    int candidate_len = 0;
+    if (is_final) {
+        candidate_len = n_text_tokens;
+    } else if (s->chunk_idx >= s->unfixed_chunks) {
+        candidate_len = n_text_tokens - s->rollback;
+        if (candidate_len < 0) candidate_len = 0;
+    }
 
-            enc_seq_len = enc_cached_seq_total + partial_seq;
-            if (enc_seq_len <= 0) {
-                free(partial_enc);
-                ctx->perf_total_ms += get_time_ms() - chunk_t0;
-                chunk_idx++;
-                continue;
-            }
+    int *candidate_tokens = s->raw_tokens + text_start;
+
+    /* After a re-anchor the hypothesis restarts at the partial window, whose
+     * start was usually committed already: the longest anchor suffix that
+     * prefixes the candidate counts as committed. */
+    if (s->anchor_overlap_pending && candidate_len > 0) {
+        int k = s->n_anchor_tokens < candidate_len ? s->n_anchor_tokens : candidate_len;
+        while (k > 0 && memcmp(s->anchor_tokens + s->n_anchor_tokens - k, candidate_tokens,
+                               (size_t)k * sizeof(int)) != 0)
+            k--;
+        memcpy(s->stable_text_tokens, candidate_tokens, (size_t)k * sizeof(int));
+        s->n_stable_text_tokens = k;
+        s->anchor_overlap_pending = 0;
+        if (qwen_verbose >= 2)
+            fprintf(stderr, "  Commit: %d tokens overlap the anchor\n", k);
+    }
 
-            enc_output = (float *)malloc((size_t)enc_seq_len * dim * sizeof(float));
-            if (!enc_output) {
-                free(partial_enc);
-                ctx->perf_total_ms += get_time_ms() - chunk_t0;
-                chunk_idx++;
-                continue;
-            }
+    /* Monotonic commit:
+     * We never retract already-emitted tokens. If a new chunk revises older
+     * text, we keep the committed prefix and only append additional
+     * confirmed suffix tokens. */
+    int lcp = 0;
+    while (lcp < s->n_stable_text_tokens &&
+           lcp < candidate_len &&
+           s->stable_text_tokens[lcp] == candidate_tokens[lcp]) {
+        lcp++;
+    }
+    if (lcp < s->n_stable_text_tokens && qwen_verbose >= 2) {
+        fprintf(stderr,
+                "  Commit: boundary revision before committed frontier "
+                "(lcp=%d, committed=%d), keeping committed prefix\n",
+                lcp, s->n_stable_text_tokens);
+    }
 
-            int enc_off = 0;
-            for (int i = 0; i < n_enc_cache; i++) {
-                memcpy(enc_output + (size_t)enc_off * dim,
-                       enc_cache[i].enc_output,
-                       (size_t)enc_cache[i].seq_len * dim * sizeof(float));
-                enc_off += enc_cache[i].seq_len;
-            }
-            if (partial_seq > 0 && partial_enc) {
-                memcpy(enc_output + (size_t)enc_off * dim,
-                       partial_enc, (size_t)partial_seq * dim * sizeof(float));
-            }
-            free(partial_enc);
+    int emit_from = s->n_stable_text_tokens;
+    int emit_to = candidate_len;
+    if (emit_to < emit_from) emit_to = emit_from;
+
+    if (emit_to > s->stable_text_cap) {
+        int new_cap = s->stable_text_cap;
+        while (emit_to > new_cap) new_cap *= 2;
+        int *tmp_stable = (int *)realloc(s->stable_text_tokens, (size_t)new_cap * sizeof(int));
+        if (!tmp_stable) return -1;
+        s->stable_text_tokens = tmp_stable;
+        s->stable_text_cap = new_cap;
+    }
 
-            if (qwen_verbose >= 2) {
-                double enc_ms = get_time_ms() - t0;
-                ctx->perf_encode_ms += enc_ms;
-                fprintf(stderr,
-                        "  Encoder: %d tokens from 0.0-%.1f s (cached windows=%d, partial=%.1f s, %.0f ms)\n",
-                        enc_seq_len,
-                        (float)audio_cursor / QWEN_SAMPLE_RATE,
-                        n_enc_cache,
-                        (float)(audio_cursor - full_end) / QWEN_SAMPLE_RATE,
-                        enc_ms);
-            }
-            if (qwen_verbose < 2) {
-                double enc_ms = get_time_ms() - t0;
-                ctx->perf_encode_ms += enc_ms;
-            }
+    for (int i = emit_from; i < emit_to; i++) {
+        const char *piece = qwen_tokenizer_decode(s->tokenizer, candidate_tokens[i]);
+        size_t piece_len = strlen(piece);
+        if (s->result_len + piece_len + 1 > s->result_cap) {
+            size_t new_cap = s->result_cap;
+            while (s->result_len + piece_len + 1 > new_cap) new_cap *= 2;
+            char *tmp = (char *)realloc(s->result, new_cap);
+            if (!tmp) return -1;
+            s->result = tmp;
+            s->result_cap = new_cap;
         }
+        s->stable_text_tokens[i] = candidate_tokens[i];
+        s->n_stable_text_tokens = i + 1;
+        if (ctx->token_cb)
+            ctx->token_cb(piece, ctx->token_cb_userdata);
+        ctx->perf_text_tokens++;
+
+        memcpy(s->result + s->result_len, piece, piece_len);
+        s->result_len += piece_len;
+        s->result[s->result_len] = '\0';
+    }
 
-        /* Prefix rollback state:
-         * we feed previously decoded raw tokens minus last `rollback` tokens.
-         * This mirrors official streaming and keeps boundary text stable. */
-        int n_prefix_tokens = 0;
-        if (ctx->past_text_conditioning && chunk_idx >= unfixed_chunks && n_raw_tokens > 0) {
-            n_prefix_tokens = n_raw_tokens - rollback;
-            if (n_prefix_tokens < 0) n_prefix_tokens = 0;
-        }
+    if (qwen_verbose >= 2) {
+        fprintf(stderr, "  Commit: candidate=%d tokens, emitted_total=%d\n",
+                candidate_len, s->n_stable_text_tokens);
+    }
+    return 0;
+}
 
-        /* ---- Build input embeddings ---- */
-        /* [PREFIX_HEAD] [prompt] [PREFIX_TAIL] [audio] [SUFFIX_BASE] [force-lang] [prefix_tokens] */
-        int prefix_len = PREFIX_HEAD_LEN + ctx->n_prompt_tokens + PREFIX_TAIL_LEN;
-        int suffix_len = SUFFIX_BASE_LEN + ctx->n_force_prompt_tokens;
-        int total_seq = prefix_len + enc_seq_len + suffix_len + n_prefix_tokens;
-        float *input_embeds = (float *)malloc((size_t)total_seq * dim * sizeof(float));
-        if (!input_embeds) {
-            free(enc_output);
-            ctx->perf_total_ms += get_time_ms() - chunk_t0;
-            chunk_idx++;
-            continue;
+/* Commit the whole current hypothesis, then restart the decoder context
+ * after the committed windows with the committed text tail as context. */
+static int stream_reanchor(qwen_stream_t *s) {
+    if (stream_commit(s, 1) != 0) return -1;
+
+    int n = s->n_stable_text_tokens < s->anchor_cap ? s->n_stable_text_tokens : s->anchor_cap;
+    if (n > 0)
+        memcpy(s->anchor_tokens, s->stable_text_tokens + s->n_stable_text_tokens - n,
+               (size_t)n * sizeof(int));
+    s->n_anchor_tokens = n;
+    s->anchor_overlap_pending = n > 0;
+    s->n_stable_text_tokens = 0;
+    s->n_raw_tokens = 0;
+
+    /* Rows from the anchor on are rewritten by the next prefill. */
+    s->enc_committed_seq = 0;
+    s->kv_stable = 0;
+    s->prev_tail_len = 0;
+    s->ctx->kv_prompt_len = 0;
+
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "  Re-anchor: dropped %d windows, anchor=%d tokens\n",
+                s->anchor_windows, n);
+    s->anchor_windows = 0;
+    return 0;
+}
+
+/* Feed draft[0..n) in one decoder pass, draft[0] being the token the model
+ * just produced, and accept the longest run it would have generated itself.
+ * Returns the accepted count with the KV cache cut back to it and *token set
+ * to the model's next token; 0 if the pass failed (cache length unchanged). */
+static int stream_verify_draft(qwen_stream_t *s, const int *draft, int n, int *token) {
+    qwen_ctx_t *ctx = s->ctx;
+    int dim = ctx->config.dec_hidden;
+    int start = ctx->kv_cache_len;
+    float *embeds = (float *)malloc((size_t)n * dim * sizeof(float));
+    int *pred = (int *)malloc((size_t)n * sizeof(int));
+    int accepted = 0;
+    if (embeds && pred) {
+        for (int i = 0; i < n; i++)
+            tok_embed_bf16_to_f32(embeds + (size_t)i * dim,
+                                  ctx->decoder.tok_embeddings_bf16, draft[i], dim);
+        if (qwen_decoder_verify(ctx, embeds, n, pred) == 0) {
+            accepted = 1;
+            while (accepted < n && pred[accepted - 1] == draft[accepted]) accepted++;
+            *token = pred[accepted - 1];
         }
+        ctx->kv_cache_len = start + accepted;
+        s->spec_passes++;
+        s->spec_drafted += n;
+        s->spec_accepted += accepted;
+    }
+    free(embeds);
+    free(pred);
+    return accepted;
+}
 
-        int off = 0;
-        for (int i = 0; i < PREFIX_HEAD_LEN; i++) {
-            tok_embed_bf16_to_f32(input_embeds + off * dim,
+/* One streaming step over the next chunk of n_chunk consumed samples.
+ * Returns 0, or -1 if the step failed (its audio stays consumed). */
+static int stream_step(qwen_stream_t *s, const float *chunk, int n_chunk, int is_final) {
+    qwen_ctx_t *ctx = s->ctx;
+    const qwen_config_t *cfg = &ctx->config;
+    int dim = cfg->dec_hidden;
+    double chunk_t0 = get_time_ms();
+    int rc = -1;
+    float *tail_enc = NULL;
+    float *input_embeds = NULL;
+    int *chunk_tokens = NULL;
+
+    if (s->horizon_windows > 0 && s->anchor_windows >= s->horizon_windows &&
+        stream_reanchor(s) != 0)
+        goto done;
+
+    /* Encoder path:
+     * - default: encode completed local-attention windows once and re-encode
+     *   only the current partial tail window,
+     * - debug fallback (`QWEN_STREAM_NO_ENC_CACHE=1`): re-encode full audio
+     *   prefix every chunk. */
+    double t0 = get_time_ms();
+    int tail_seq = 0;
+    if (stream_encode_chunk(s, chunk, n_chunk, is_final, &tail_enc, &tail_seq) != 0)
+        goto done;
+
+    int new_win_seq = 0;
+    for (int i = 0; i < s->n_enc_cache; i++) new_win_seq += s->enc_cache[i].seq_len;
+    int enc_seq_len = s->enc_committed_seq + new_win_seq + tail_seq;
+    double enc_ms = get_time_ms() - t0;
+    ctx->perf_encode_ms += enc_ms;
+    if (qwen_verbose >= 2) {
+        if (s->use_enc_cache)
+            fprintf(stderr,
+                    "  Encoder: %d tokens (windows=%d, new=%d, partial=%.1f s, %.0f ms)\n",
+                    enc_seq_len, s->n_enc_windows, s->n_enc_cache,
+                    (float)s->mel_n * QWEN_HOP_LENGTH / QWEN_SAMPLE_RATE, enc_ms);
+        else
+            fprintf(stderr,
+                    "  Encoder: %d tokens from 0.0-%.1f s (full recompute, %.0f ms)\n",
+                    enc_seq_len, (float)s->n_audio / QWEN_SAMPLE_RATE, enc_ms);
+    }
+    if (enc_seq_len <= 0) goto done;
+
+    /* Prefix rollback state:
+     * we feed previously decoded raw tokens minus last `rollback` tokens.
+     * This mirrors official streaming and keeps boundary text stable. */
+    int n_prefix_tokens = 0;
+    if (ctx->past_text_conditioning && s->chunk_idx >= s->unfixed_chunks && s->n_raw_tokens > 0) {
+        n_prefix_tokens = s->n_raw_tokens - s->rollback;
+        if (n_prefix_tokens < 0) n_prefix_tokens = 0;
+    }
+
+    /* ---- Build input embeddings from kv_stable on ---- */
+    /* [PREFIX_HEAD] [prompt] [anchor] [PREFIX_TAIL] [audio] [SUFFIX_BASE] [force-lang] [prefix_tokens] */
+    int prefix_len = PREFIX_HEAD_LEN + ctx->n_prompt_tokens + s->n_anchor_tokens + PREFIX_TAIL_LEN;
+    int suffix_len = SUFFIX_BASE_LEN + ctx->n_force_prompt_tokens;
+    int total_seq = prefix_len + enc_seq_len + suffix_len + n_prefix_tokens;
+    int base = s->kv_stable;
+    input_embeds = (float *)malloc((size_t)(total_seq - base) * dim * sizeof(float));
+    if (!input_embeds) goto done;
+
+    int off = 0;
+    if (base == 0) {
+        for (int i = 0; i < PREFIX_HEAD_LEN; i++)
+            tok_embed_bf16_to_f32(input_embeds + (size_t)off++ * dim,
                                   ctx->decoder.tok_embeddings_bf16,
                                   PROMPT_PREFIX_HEAD[i], dim);
-            off++;
-        }
-        for (int i = 0; i < ctx->n_prompt_tokens; i++) {
-            tok_embed_bf16_to_f32(input_embeds + off * dim,
+        for (int i = 0; i < ctx->n_prompt_tokens; i++)
+            tok_embed_bf16_to_f32(input_embeds + (size_t)off++ * dim,
                                   ctx->decoder.tok_embeddings_bf16,
                                   ctx->prompt_tokens[i], dim);
-            off++;
-        }
-        for (int i = 0; i < PREFIX_TAIL_LEN; i++) {
-            tok_embed_bf16_to_f32(input_embeds + off * dim,
+        for (int i = 0; i < s->n_anchor_tokens; i++)
+            tok_embed_bf16_to_f32(input_embeds + (size_t)off++ * dim,
+                                  ctx->decoder.tok_embeddings_bf16,
+                                  s->anchor_tokens[i], dim);
+        for (int i = 0; i < PREFIX_TAIL_LEN; i++)
+            tok_embed_bf16_to_f32(input_embeds + (size_t)off++ * dim,
                                   ctx->decoder.tok_embeddings_bf16,
                                   PROMPT_PREFIX_TAIL[i], dim);
-            off++;
+    }
+    for (int i = 0; i < s->n_enc_cache; i++) {
+        memcpy(input_embeds + (size_t)off * dim, s->enc_cache[i].enc_output,
+               (size_t)s->enc_cache[i].seq_len * dim * sizeof(float));
+        off += s->enc_cache[i].seq_len;
+    }
+    if (tail_seq > 0) {
+        memcpy(input_embeds + (size_t)off * dim, tail_enc, (size_t)tail_seq * dim * sizeof(float));
+        off += tail_seq;
+    }
+    free(tail_enc);
+    tail_enc = NULL;
+
+    for (int i = 0; i < SUFFIX_BASE_LEN; i++)
+        tok_embed_bf16_to_f32(input_embeds + (size_t)off++ * dim,
+                              ctx->decoder.tok_embeddings_bf16,
+                              PROMPT_SUFFIX_BASE[i], dim);
+    for (int i = 0; i < ctx->n_force_prompt_tokens; i++)
+        tok_embed_bf16_to_f32(input_embeds + (size_t)off++ * dim,
+                              ctx->decoder.tok_embeddings_bf16,
+                              ctx->force_prompt_tokens[i], dim);
+    for (int i = 0; i < n_prefix_tokens; i++)
+        tok_embed_bf16_to_f32(input_embeds + (size_t)off++ * dim,
+                              ctx->decoder.tok_embeddings_bf16,
+                              s->raw_tokens[i], dim);
+
+    /* ---- Decoder prefill + first token ---- */
+    t0 = get_time_ms();
+    int prefill_len = total_seq - 1;
+    int reused_prefill = base;
+    {
+        int cmp_len = prefill_len - base < s->prev_tail_len ? prefill_len - base : s->prev_tail_len;
+        size_t row_bytes = (size_t)dim * sizeof(float);
+        int same = 0;
+        while (same < cmp_len &&
+               memcmp(s->prev_tail + (size_t)same * dim,
+                      input_embeds + (size_t)same * dim, row_bytes) == 0)
+            same++;
+        reused_prefill += same;
+    }
+    /* Decoder KV reuse:
+     * keep the longest unchanged prefill prefix and only prefill delta tokens. */
+    /* The context-wide prefix cache only holds the prompt without an anchor. */
+    int cached_prefix = s->n_anchor_tokens > 0 ? 0 : prompt_kv_cached(ctx, prefix_len);
+    if (reused_prefill < cached_prefix) reused_prefill = cached_prefix;
+    ctx->kv_cache_len = reused_prefill;
+    int delta_prefill = prefill_len - reused_prefill;
+    if (delta_prefill > 0) {
+        qwen_decoder_prefill(ctx,
+                             input_embeds + (size_t)(reused_prefill - base) * dim,
+                             delta_prefill);
+    }
+    if (ctx->kv_cache_len != prefill_len) {
+        s->prev_tail_len = 0;
+        goto done;
+    }
+    if (s->n_anchor_tokens == 0) prompt_kv_update(ctx, prefix_len, prefill_len);
+    s->prefill_total_tokens += prefill_len;
+    s->prefill_reused_tokens += reused_prefill;
+
+    int token = qwen_decoder_forward(ctx, input_embeds + (size_t)(prefill_len - base) * dim);
+
+    /* The new windows' KV rows are final: drop their encoder outputs and
+     * keep only the inputs past them for the next chunk's diff. */
+    if (s->use_enc_cache) {
+        for (int i = 0; i < s->n_enc_cache; i++) free(s->enc_cache[i].enc_output);
+        s->anchor_windows += s->n_enc_cache;
+        s->n_enc_cache = 0;
+        s->enc_committed_seq += new_win_seq;
+        s->kv_stable = prefix_len + s->enc_committed_seq;
+    } else {
+        s->kv_stable = prefix_len;
+    }
+    int tail_from = s->kv_stable - base;
+    int tail_len = prefill_len - s->kv_stable;
+    if (tail_len > s->prev_tail_cap) {
+        int new_cap = s->prev_tail_cap > 0 ? s->prev_tail_cap : 64;
+        while (new_cap < tail_len) new_cap *= 2;
+        float *tmp = (float *)realloc(s->prev_tail, (size_t)new_cap * dim * sizeof(float));
+        if (tmp) {
+            s->prev_tail = tmp;
+            s->prev_tail_cap = new_cap;
         }
+    }
+    if (tail_len <= s->prev_tail_cap) {
+        memcpy(s->prev_tail, input_embeds + (size_t)tail_from * dim,
+               (size_t)tail_len * dim * sizeof(float));
+        s->prev_tail_len = tail_len;
+    } else {
+        s->prev_tail_len = 0;
+    }
+    free(input_embeds);
+    input_embeds = NULL;
 
-        for (int i = 0; i < enc_seq_len; i++)
-            memcpy(input_embeds + (prefix_len + i) * dim,
-                   enc_output + i * dim, dim * sizeof(float));
-        free(enc_output);
-        enc_output = NULL;
+    double prefill_ms = get_time_ms() - t0;
+    ctx->perf_decode_ms += prefill_ms;
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "  Prefill: %d tokens (%d prefix, reused %d) (%.0f ms)\n",
+                total_seq, n_prefix_tokens, reused_prefill, prefill_ms);
 
-        int suffix_off = prefix_len + enc_seq_len;
-        for (int i = 0; i < SUFFIX_BASE_LEN; i++)
-            tok_embed_bf16_to_f32(input_embeds + (suffix_off + i) * dim,
-                                  ctx->decoder.tok_embeddings_bf16,
-                                  PROMPT_SUFFIX_BASE[i], dim);
+    /* ---- Autoregressive decode ---- */
+    t0 = get_time_ms();
+    int n_generated = 0;
 
-        for (int i = 0; i < ctx->n_force_prompt_tokens; i++)
-            tok_embed_bf16_to_f32(input_embeds + (suffix_off + SUFFIX_BASE_LEN + i) * dim,
-                                  ctx->decoder.tok_embeddings_bf16,
-                                  ctx->force_prompt_tokens[i], dim);
+    /* Collect ALL generated tokens (including language, <asr_text>, etc.) */
+    chunk_tokens = (int *)malloc((size_t)s->max_new_tokens * sizeof(int));
+    if (!chunk_tokens) goto done;
+    int n_chunk_tokens = 0;
+
+    /* The previous hypothesis past the kept prefix usually comes out again:
+     * once the first token agrees, verify the rest in one pass. */
+    int n_draft = ctx->stream_speculative ? s->n_raw_tokens - n_prefix_tokens : 0;
+    if (n_draft > s->max_new_tokens) n_draft = s->max_new_tokens;
+    if (n_draft > 1 && token == s->raw_tokens[n_prefix_tokens]) {
+        int accepted = stream_verify_draft(s, s->raw_tokens + n_prefix_tokens, n_draft, &token);
+        memcpy(chunk_tokens, s->raw_tokens + n_prefix_tokens, (size_t)accepted * sizeof(int));
+        n_chunk_tokens = accepted;
+        n_generated = accepted;
+    }
 
-        int text_off = suffix_off + suffix_len;
-        for (int i = 0; i < n_prefix_tokens; i++)
-            tok_embed_bf16_to_f32(input_embeds + (text_off + i) * dim,
-                                  ctx->decoder.tok_embeddings_bf16,
-                                  raw_tokens[i], dim);
-
-        /* ---- Decoder prefill + first token ---- */
-        t0 = get_time_ms();
-        int prefill_len = total_seq - 1;
-        int reused_prefill = 0;
-        if (prev_prefill_embeds && prev_prefill_len > 0) {
-            int cmp_len = prefill_len < prev_prefill_len ? prefill_len : prev_prefill_len;
-            size_t row_bytes = (size_t)dim * sizeof(float);
-            while (reused_prefill < cmp_len) {
-                const float *a = prev_prefill_embeds + (size_t)reused_prefill * dim;
-                const float *b = input_embeds + (size_t)reused_prefill * dim;
-                if (memcmp(a, b, row_bytes) != 0) break;
-                reused_prefill++;
-            }
-        }
-        /* Decoder KV reuse:
-         * keep the longest unchanged prefill prefix and only prefill delta tokens. */
-        ctx->kv_cache_len = reused_prefill;
-        int delta_prefill = prefill_len - reused_prefill;
-        if (delta_prefill > 0) {
-            qwen_decoder_prefill(ctx,
-                                 input_embeds + (size_t)reused_prefill * dim,
-                                 delta_prefill);
-        }
-        prefill_total_tokens += prefill_len;
-        prefill_reused_tokens += reused_prefill;
-
-        float *last_embed = input_embeds + (size_t)prefill_len * dim;
-        int token = qwen_decoder_forward(ctx, last_embed);
-
-        if (prefill_len > prev_prefill_cap) {
-            int new_cap = prev_prefill_cap > 0 ? prev_prefill_cap : 64;
-            while (new_cap < prefill_len) new_cap *= 2;
-            float *tmp_prev = (float *)realloc(prev_prefill_embeds,
-                                               (size_t)new_cap * dim * sizeof(float));
-            if (tmp_prev) {
-                prev_prefill_embeds = tmp_prev;
-                prev_prefill_cap = new_cap;
-            } else {
-                prev_prefill_len = 0;
-            }
-        }
-        if (prev_prefill_embeds && prev_prefill_cap >= prefill_len) {
-            memcpy(prev_prefill_embeds, input_embeds,
-                   (size_t)prefill_len * dim * sizeof(float));
-            prev_prefill_len = prefill_len;
-        } else {
-            prev_prefill_len = 0;
-        }
-        free(input_embeds);
+    while (n_generated < s->max_new_tokens) {
+        n_generated++;
+        if (token == QWEN_TOKEN_ENDOFTEXT || token == QWEN_TOKEN_IM_END) break;
 
-        double prefill_ms = get_time_ms() - t0;
-        ctx->perf_decode_ms += prefill_ms;
-        if (qwen_verbose >= 2)
-            fprintf(stderr, "  Prefill: %d tokens (%d prefix, reused %d) (%.0f ms)\n",
-                    total_seq, n_prefix_tokens, reused_prefill, prefill_ms);
-
-        /* ---- Autoregressive decode ---- */
-        t0 = get_time_ms();
-        int n_generated = 0;
-
-        /* Collect ALL generated tokens (including language, <asr_text>, etc.) */
-        int *chunk_tokens = (int *)malloc((size_t)max_new_tokens * sizeof(int));
-        if (!chunk_tokens) {
-            ctx->perf_total_ms += get_time_ms() - chunk_t0;
-            chunk_idx++;
-            continue;
-        }
-        int n_chunk_tokens = 0;
+        chunk_tokens[n_chunk_tokens++] = token;
 
-        while (n_generated < max_new_tokens) {
-            n_generated++;
-            if (token == QWEN_TOKEN_ENDOFTEXT || token == QWEN_TOKEN_IM_END) break;
+        tok_embed_bf16_to_f32(s->tmp_embed, ctx->decoder.tok_embeddings_bf16, token, dim);
+        token = qwen_decoder_forward(ctx, s->tmp_embed);
+    }
 
-            chunk_tokens[n_chunk_tokens++] = token;
+    double decode_ms = get_time_ms() - t0;
+    ctx->perf_decode_ms += decode_ms;
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "  Decode: %d tokens (%.0f ms, %.1f ms/token%s)\n",
+                n_generated, decode_ms,
+                n_generated > 0 ? decode_ms / n_generated : 0,
+                (n_generated >= s->max_new_tokens &&
+                 token != QWEN_TOKEN_ENDOFTEXT &&
+                 token != QWEN_TOKEN_IM_END) ? ", hit max_new" : "");
+
+    /* Update raw token history = prefix + newly generated continuation. */
+    int n_raw_new = n_prefix_tokens + n_chunk_tokens;
+    if (n_raw_new > s->raw_tokens_cap) {
+        int new_cap = s->raw_tokens_cap;
+        while (n_raw_new > new_cap) new_cap *= 2;
+        int *tmp_raw = (int *)realloc(s->raw_tokens, (size_t)new_cap * sizeof(int));
+        if (!tmp_raw) goto done;
+        s->raw_tokens = tmp_raw;
+        s->raw_tokens_cap = new_cap;
+    }
+    if (n_chunk_tokens > 0) {
+        memcpy(s->raw_tokens + n_prefix_tokens, chunk_tokens,
+               (size_t)n_chunk_tokens * sizeof(int));
+    }
+    s->n_raw_tokens = n_raw_new;
 
-            tok_embed_bf16_to_f32(tmp_embed, ctx->decoder.tok_embeddings_bf16, token, dim);
-            token = qwen_decoder_forward(ctx, tmp_embed);
-        }
+    rc = stream_commit(s, is_final);
 
-        double decode_ms = get_time_ms() - t0;
-        ctx->perf_decode_ms += decode_ms;
-        if (qwen_verbose >= 2)
-            fprintf(stderr, "  Decode: %d tokens (%.0f ms, %.1f ms/token%s)\n",
-                    n_generated, decode_ms,
-                    n_generated > 0 ? decode_ms / n_generated : 0,
-                    (n_generated >= max_new_tokens &&
-                     token != QWEN_TOKEN_ENDOFTEXT &&
-                     token != QWEN_TOKEN_IM_END) ? ", hit max_new" : "");
-
-        /* Update raw token history = prefix + newly generated continuation. */
-        int n_raw_new = n_prefix_tokens + n_chunk_tokens;
-        if (n_raw_new > raw_tokens_cap) {
-            while (n_raw_new > raw_tokens_cap) raw_tokens_cap *= 2;
-            int *tmp_raw = (int *)realloc(raw_tokens, (size_t)raw_tokens_cap * sizeof(int));
-            if (!tmp_raw) {
-                free(chunk_tokens);
-                ctx->perf_total_ms += get_time_ms() - chunk_t0;
-                chunk_idx++;
-                continue;
-            }
-            raw_tokens = tmp_raw;
-        }
-        if (n_chunk_tokens > 0) {
-            memcpy(raw_tokens + n_prefix_tokens, chunk_tokens,
-                   (size_t)n_chunk_tokens * sizeof(int));
-        }
-        n_raw_tokens = n_raw_new;
-        free(chunk_tokens);
-
-        /* Parse text region from raw stream output:
-         * - default: language ... <asr_text> TEXT
-         * - forced language: prompt already anchors language, so generated stream is TEXT. */
-        int text_start = 0;
-        if (ctx->n_force_prompt_tokens <= 0) {
-            int asr_text_pos = -1;
-            for (int i = 0; i < n_raw_tokens; i++) {
-                if (raw_tokens[i] == QWEN_TOKEN_ASR_TEXT) {
-                    asr_text_pos = i;
-                    break;
-                }
-            }
-            text_start = (asr_text_pos >= 0) ? asr_text_pos + 1 : 0;
-        }
-        if (text_start < 0) text_start = 0;
-        if (text_start > n_raw_tokens) text_start = n_raw_tokens;
-        int n_text_tokens = n_raw_tokens - text_start;
-
-        /* "Fixed" frontier for this chunk:
-         * - cold-start chunks: emit nothing,
-         * - intermediate chunks: keep last `rollback` text tokens unfixed,
-         * - final chunk: emit everything. */
-        int candidate_len = 0;
-        if (is_final) {
-            candidate_len = n_text_tokens;
-        } else if (chunk_idx >= unfixed_chunks) {
-            candidate_len = n_text_tokens - rollback;
-            if (candidate_len < 0) candidate_len = 0;
-        }
+done:
+    free(tail_enc);
+    free(input_embeds);
+    free(chunk_tokens);
+    ctx->perf_total_ms += get_time_ms() - chunk_t0;
+    s->chunk_idx++;
+    return rc;
+}
 
-        /* Monotonic commit:
-         * We never retract already-emitted tokens in CLI mode. If a new chunk
-         * revises older text, we keep the committed prefix and only append
-         * additional confirmed suffix tokens. */
-        int *candidate_tokens = raw_tokens + text_start;
-        int lcp = 0;
-        while (lcp < n_stable_text_tokens &&
-               lcp < candidate_len &&
-               stable_text_tokens[lcp] == candidate_tokens[lcp]) {
-            lcp++;
-        }
-        if (lcp < n_stable_text_tokens && qwen_verbose >= 2) {
-            fprintf(stderr,
-                    "  Commit: boundary revision before committed frontier "
-                    "(lcp=%d, committed=%d), keeping committed prefix\n",
-                    lcp, n_stable_text_tokens);
-        }
+/* Silence gate: returns 1 if the chunk can be dropped without encoding or
+ * decoding it. The first silent chunk after speech still runs, so words
+ * ending at the chunk edge get their trailing context. While the gate is
+ * closed only already-stable text stays committed: the rolled-back tail is
+ * revised by the next speech chunk, or committed at the end of audio. */
+static int stream_gate_silent(qwen_stream_t *s, const float *chunk, int n_chunk) {
+    if (!s->vad || qwen_vad_push(s->vad, chunk, n_chunk) != 0) {
+        s->silent_chunks = 0;
+        return 0;
+    }
+    s->silent_chunks++;
+    if (s->chunk_idx > 0 && s->silent_chunks < 2) return 0;
+    if (s->chunk_idx > 0 && s->silent_chunks == 2 && qwen_verbose >= 2)
+        fprintf(stderr, "  Silence: gate closed\n");
+    s->vad_skipped_chunks++;
+    return 1;
+}
 
-        int emit_from = n_stable_text_tokens;
-        int emit_to = candidate_len;
-        if (emit_to < emit_from) emit_to = emit_from;
-
-        if (emit_to > stable_text_cap) {
-            while (emit_to > stable_text_cap) stable_text_cap *= 2;
-            int *tmp_stable = (int *)realloc(stable_text_tokens,
-                                             (size_t)stable_text_cap * sizeof(int));
-            if (!tmp_stable) {
-                ctx->perf_total_ms += get_time_ms() - chunk_t0;
-                chunk_idx++;
-                continue;
-            }
-            stable_text_tokens = tmp_stable;
-        }
+/* Run one full, non-final chunk unless the silence gate drops it. */
+static int stream_run_chunk(qwen_stream_t *s, const float *chunk) {
+    int silent = stream_gate_silent(s, chunk, s->chunk_samples);
+    if (silent < 0 || (!silent && stream_step(s, chunk, s->chunk_samples, 0) != 0))
+        return -1;
+    return 0;
+}
 
-        for (int i = emit_from; i < emit_to; i++) {
-            stable_text_tokens[i] = candidate_tokens[i];
-            const char *piece = qwen_tokenizer_decode(tokenizer, candidate_tokens[i]);
-            if (ctx->token_cb)
-                ctx->token_cb(piece, ctx->token_cb_userdata);
-            ctx->perf_text_tokens++;
-
-            size_t piece_len = strlen(piece);
-            if (result_len + piece_len + 1 > result_cap) {
-                while (result_len + piece_len + 1 > result_cap) result_cap *= 2;
-                result = (char *)realloc(result, result_cap);
-            }
-            memcpy(result + result_len, piece, piece_len);
-            result_len += piece_len;
-            result[result_len] = '\0';
+/* Run full chunks of pending audio; with is_final, everything left with
+ * the last chunk marked final. */
+static int stream_drain(qwen_stream_t *s, int is_final) {
+    int rc = 0;
+    int used = 0;
+    while (s->n_pending - used > s->chunk_samples ||
+           (!is_final && s->n_pending - used == s->chunk_samples)) {
+        if (stream_run_chunk(s, s->pending + used) != 0) rc = -1;
+        used += s->chunk_samples;
+    }
+    if (is_final && (s->n_pending - used > 0 || s->chunk_idx > 0)) {
+        /* Nothing to decode while the gate is closed: no audio will revise
+         * the held-back tail now, so commit it as is */
+        int silent = (s->silent_chunks >= 2 || (s->chunk_idx == 0 && s->vad)) ?
+                     stream_gate_silent(s, s->pending + used, s->n_pending - used) : 0;
+        if (silent < 0 || (!silent && stream_step(s, s->pending + used, s->n_pending - used, 1) != 0) ||
+            (silent && s->chunk_idx > 0 && stream_commit(s, 1) != 0))
+            rc = -1;
+        used = s->n_pending;
+    }
+    s->n_pending -= used;
+    memmove(s->pending, s->pending + used, (size_t)s->n_pending * sizeof(float));
+    return rc;
+}
+
+static int stream_finish(qwen_stream_t *s) {
+    if (s->finished) return 0;
+    s->finished = 1;
+    int rc = stream_drain(s, 1);
+    if (qwen_verbose >= 2 && s->prefill_total_tokens > 0) {
+        double reuse_pct = 100.0 * (double)s->prefill_reused_tokens / (double)s->prefill_total_tokens;
+        fprintf(stderr, "  Prefill reuse: %d/%d tokens (%.1f%%)\n",
+                s->prefill_reused_tokens, s->prefill_total_tokens, reuse_pct);
+    }
+    if (qwen_verbose >= 2 && s->spec_passes > 0)
+        fprintf(stderr, "  Speculative: %d/%d draft tokens accepted in %d passes\n",
+                s->spec_accepted, s->spec_drafted, s->spec_passes);
+    if (qwen_verbose >= 2 && s->vad_skipped_chunks > 0)
+        fprintf(stderr, "  Silence: %d chunks skipped\n", s->vad_skipped_chunks);
+    return rc;
+}
+
+static char *transcribe_stream(qwen_ctx_t *ctx, const float *samples, int n_samples) {
+    const float *audio_samples = samples;
+    int audio_n_samples = n_samples;
+    float *compacted_samples = NULL;
+    if (ctx->skip_silence) {
+        compacted_samples = compact_silence(samples, n_samples, &audio_n_samples);
+        if (compacted_samples) audio_samples = compacted_samples;
+        if (qwen_verbose >= 1) {
+            float used_pct = 100.0f * (float)audio_n_samples /
+                             (float)(n_samples > 0 ? n_samples : 1);
+            float skipped_pct = 100.0f - used_pct;
+            if (skipped_pct < 0.0f) skipped_pct = 0.0f;
+            fprintf(stderr, "Silence skip: used %.1f%%, skipped %.1f%% (%d -> %d samples)\n",
+                    used_pct, skipped_pct, n_samples, audio_n_samples);
         }
-        n_stable_text_tokens = emit_to;
+    }
 
+    /* In non-interactive mode (no token callback), streaming chunks are not
+     * externally consumed and the final answer is already produced by a full
+     * refinement pass. Skip chunk-by-chunk decoding entirely. */
+    if (!ctx->token_cb) {
         if (qwen_verbose >= 2) {
-            fprintf(stderr, "  Commit: candidate=%d tokens, emitted_total=%d\n",
-                    candidate_len, n_stable_text_tokens);
+            fprintf(stderr, "Streaming: no token callback, using direct final refinement\n");
         }
+        perf_reset(ctx, 1000.0 * (double)n_samples / (double)QWEN_SAMPLE_RATE);
 
-        ctx->perf_total_ms += get_time_ms() - chunk_t0;
-        chunk_idx++;
+        qwen_tokenizer_t *tokenizer = ctx_tokenizer(ctx);
+        char *text = NULL;
+        if (tokenizer && prepare_prompt_tokens(ctx, tokenizer) == 0)
+            text = transcribe_segment(ctx, audio_samples, audio_n_samples, tokenizer, NULL, 0, NULL);
+        free(compacted_samples);
+        return text;
     }
 
-    free(tmp_embed);
-    for (int i = 0; i < n_enc_cache; i++) {
-        free(enc_cache[i].enc_output);
-    }
-    free(enc_cache);
-    if (qwen_verbose >= 2 && prefill_total_tokens > 0) {
-        double reuse_pct = 100.0 * (double)prefill_reused_tokens / (double)prefill_total_tokens;
-        fprintf(stderr, "  Prefill reuse: %d/%d tokens (%.1f%%)\n",
-                prefill_reused_tokens, prefill_total_tokens, reuse_pct);
+    qwen_stream_t *s = stream_open(ctx);
+    if (!s || stream_append(&s->pending, &s->n_pending, &s->pending_cap,
+                            audio_samples, audio_n_samples) != 0) {
+        stream_free(s);
+        free(compacted_samples);
+        return NULL;
     }
-    free(prev_prefill_embeds);
-    free(raw_tokens);
-    free(stable_text_tokens);
-    qwen_tokenizer_free(tokenizer);
+    ctx->perf_audio_ms = 1000.0 * (double)n_samples / (double)QWEN_SAMPLE_RATE;
+    stream_finish(s);
     free(compacted_samples);
 
-    /* Trim whitespace */
+    /* Take the committed text and trim whitespace */
+    char *result = s->result;
+    s->result = NULL;
+    stream_free(s);
     size_t rlen = strlen(result);
     while (rlen > 0 && isspace((unsigned char)result[rlen - 1])) result[--rlen] = '\0';
     char *start = result;
@@ -1648,6 +3214,147 @@ char *qwen_transcribe_stream(qwen_ctx_t *ctx, const float *samples, int n_sample
     return result;
 }
 
+/* Public entry points run on the context's pool, weight cache and scratch,
+ * count kernels into its perf counters and show as one signpost interval. */
+typedef struct {
+    qwen_threadpool_t *pool;
+    qwen_bf16_cache_t *cache;
+    qwen_scratch_t *scratch;
+    qwen_perf_counters_t *perf;
+} ctx_binding_t;
+
+static ctx_binding_t ctx_bind(qwen_ctx_t *ctx) {
+    ctx_binding_t prev;
+    prev.pool = qwen_threadpool_bind(ctx->pool);
+    prev.cache = qwen_bf16_cache_bind(ctx->bf16_cache);
+    prev.scratch = qwen_scratch_bind(&ctx->scratch);
+    prev.perf = qwen_perf_bind(&ctx->perf_counters);
+    qwen_signpost_begin(ctx, QWEN_SIGNPOST_TRANSCRIBE);
+    return prev;
+}
+
+static void ctx_unbind(qwen_ctx_t *ctx, ctx_binding_t prev) {
+    qwen_signpost_end(ctx, QWEN_SIGNPOST_TRANSCRIBE);
+    qwen_threadpool_bind(prev.pool);
+    qwen_bf16_cache_bind(prev.cache);
+    qwen_scratch_bind(prev.scratch);
+    qwen_perf_bind(prev.perf);
+    if (qwen_verbose >= 2 && ctx->bf16_cache) {
+        qwen_bf16_cache_stats_t st;
+        qwen_bf16_cache_stats(ctx->bf16_cache, &st);
+        fprintf(stderr, "BF16 cache: %llu hits, %llu misses, %llu evictions, "
+                "%d entries, %.1f/%.1f MB\n",
+                (unsigned long long)st.hits, (unsigned long long)st.misses,
+                (unsigned long long)st.evictions, st.entries,
+                st.bytes / (1024.0 * 1024.0), st.limit_bytes / (1024.0 * 1024.0));
+    }
+}
+
+char *qwen_transcribe_audio(qwen_ctx_t *ctx, const float *samples, int n_samples) {
+    ctx_binding_t prev = ctx_bind(ctx);
+    char *text = transcribe_audio(ctx, samples, n_samples);
+    ctx_unbind(ctx, prev);
+    return text;
+}
+
+char *qwen_transcribe_stream(qwen_ctx_t *ctx, const float *samples, int n_samples) {
+    ctx_binding_t prev = ctx_bind(ctx);
+    char *text = transcribe_stream(ctx, samples, n_samples);
+    ctx_unbind(ctx, prev);
+    return text;
+}
+
+qwen_stream_t *qwen_stream_open(qwen_ctx_t *ctx) {
+    if (!ctx) return NULL;
+    ctx_binding_t prev = ctx_bind(ctx);
+    qwen_stream_t *s = stream_open(ctx);
+    ctx_unbind(ctx, prev);
+    return s;
+}
+
+int qwen_stream_push(qwen_stream_t *s, const float *samples, int n_samples) {
+    if (!s || s->finished || n_samples < 0 || (n_samples > 0 && !samples)) return -1;
+    if (stream_append(&s->pending, &s->n_pending, &s->pending_cap, samples, n_samples) != 0)
+        return -1;
+    s->ctx->perf_audio_ms += 1000.0 * (double)n_samples / (double)QWEN_SAMPLE_RATE;
+    if (s->n_pending < s->chunk_samples) return 0;
+
+    ctx_binding_t prev = ctx_bind(s->ctx);
+    int rc = stream_drain(s, 0);
+    ctx_unbind(s->ctx, prev);
+    return rc;
+}
+
+/* Take one ring span: top up a partly filled chunk, run every whole chunk
+ * left in the span where it lies, and keep the remainder in pending. */
+static int stream_take_span(qwen_stream_t *s, const float *p, int n) {
+    int rc = 0;
+    if (s->n_pending > 0) {
+        int take = s->chunk_samples - s->n_pending;
+        if (take > n) take = n;
+        if (stream_append(&s->pending, &s->n_pending, &s->pending_cap, p, take) != 0) return -1;
+        p += take;
+        n -= take;
+        if (s->n_pending < s->chunk_samples) return 0;
+        rc = stream_drain(s, 0);
+    }
+    for (; n >= s->chunk_samples; p += s->chunk_samples, n -= s->chunk_samples)
+        if (stream_run_chunk(s, p) != 0) rc = -1;
+    if (stream_append(&s->pending, &s->n_pending, &s->pending_cap, p, n) != 0) rc = -1;
+    return rc;
+}
+
+int qwen_stream_push_ring(qwen_stream_t *s, qwen_audio_ring_t *ring) {
+    if (!s || !ring) return -1;
+    const float *p1, *p2;
+    int n1, n2;
+    int n = qwen_audio_ring_read_regions(ring, &p1, &n1, &p2, &n2);
+    if (s->finished) {
+        qwen_audio_ring_consume(ring, n);
+        return -1;
+    }
+    s->ctx->perf_audio_ms += 1000.0 * (double)n / (double)QWEN_SAMPLE_RATE;
+    int rc = 0;
+    if (s->n_pending + n < s->chunk_samples) {
+        /* No chunk completes: just queue the samples */
+        if (stream_append(&s->pending, &s->n_pending, &s->pending_cap, p1, n1) != 0 ||
+            stream_append(&s->pending, &s->n_pending, &s->pending_cap, p2, n2) != 0)
+            rc = -1;
+    } else {
+        ctx_binding_t prev = ctx_bind(s->ctx);
+        if (stream_take_span(s, p1, n1) != 0) rc = -1;
+        if (stream_take_span(s, p2, n2) != 0) rc = -1;
+        ctx_unbind(s->ctx, prev);
+    }
+    /* Chunks ran straight from the ring, so it is released only now */
+    qwen_audio_ring_consume(ring, n);
+    return rc == 0 ? n : -1;
+}
+
+int qwen_stream_finish(qwen_stream_t *s) {
+    if (!s) return -1;
+    ctx_binding_t prev = ctx_bind(s->ctx);
+    int rc = stream_finish(s);
+    ctx_unbind(s->ctx, prev);
+    return rc;
+}
+
+char *qwen_stream_poll(qwen_stream_t *s) {
+    if (!s) return NULL;
+    size_t n = s->result_len;
+    char *text = (char *)malloc(n + 1);
+    if (!text) return NULL;
+    memcpy(text, s->result, n);
+    text[n] = '\0';
+    s->result_len = 0;
+    s->result[0] = '\0';
+    return text;
+}
+
+void qwen_stream_close(qwen_stream_t *s) {
+    stream_free(s);
+}
+
 char *qwen_transcribe(qwen_ctx_t *ctx, const char *wav_path) {
     int n_samples = 0;
     float *samples = qwen_load_wav(wav_path, &n_samples);
@@ -1668,3 +3375,287 @@ char *qwen_transcribe_stdin(qwen_ctx_t *ctx) {
     free(samples);
     return text;
 }
+
+/* ========================================================================
+ * Batch Transcription
+ *
+ * Work items are (file, segment) pairs so one long recording cannot leave
+ * the other workers idle at the end of a batch. Each worker starts with a
+ * contiguous run of items (neighbouring segments of the same files) in its
+ * own queue, pops from the front, and when empty steals from the back of
+ * the fullest other queue. Items take seconds, so a mutex per queue costs
+ * nothing measurable.
+ * ======================================================================== */
+
+typedef struct {
+    const float *audio;        /* samples after silence compaction */
+    int n_audio;
+    float *compacted;          /* owned copy behind audio, or NULL */
+    int splits[QWEN_MAX_SEGMENTS + 1];
+    int n_splits;              /* segments; 1 = transcribed whole */
+    int first_item;
+} batch_file_t;
+
+typedef struct {
+    int file;
+    int seg;
+} batch_item_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    int head, tail;            /* pending items [head, tail) of the batch order */
+} batch_queue_t;
+
+typedef struct {
+    const float *const *samples;
+    const int *n_samples;
+    batch_file_t *files;
+    batch_item_t *items;
+    char **item_texts;
+    batch_queue_t *queues;
+    int n_workers;
+    int whole_files;           /* past-text conditioning: one item per file */
+    qwen_tokenizer_t *tokenizer;
+    qwen_ctx_t *base;          /* collects every item's perf stats */
+    pthread_mutex_t perf_mutex;
+} batch_t;
+
+typedef struct {
+    batch_t *b;
+    int id;
+    qwen_ctx_t *ctx;
+    pthread_t thread;
+    int started;
+    int items_done, items_stolen;
+} batch_worker_t;
+
+/* Next item for worker id: its own front, else the back of the fullest
+ * other queue. Returns -1 when the batch is drained. */
+static int batch_take(batch_t *b, int id, int *stolen) {
+    batch_queue_t *own = &b->queues[id];
+    pthread_mutex_lock(&own->mutex);
+    int item = own->head < own->tail ? own->head++ : -1;
+    pthread_mutex_unlock(&own->mutex);
+    if (item >= 0) return item;
+
+    for (;;) {
+        int victim = -1, most = 0;
+        for (int v = 0; v < b->n_workers; v++) {
+            if (v == id) continue;
+            batch_queue_t *q = &b->queues[v];
+            pthread_mutex_lock(&q->mutex);
+            int left = q->tail - q->head;
+            pthread_mutex_unlock(&q->mutex);
+            if (left > most) { most = left; victim = v; }
+        }
+        if (victim < 0) return -1;
+        batch_queue_t *q = &b->queues[victim];
+        pthread_mutex_lock(&q->mutex);
+        item = q->head < q->tail ? --q->tail : -1;
+        pthread_mutex_unlock(&q->mutex);
+        if (item >= 0) {
+            *stolen = 1;
+            return item;
+        }
+        /* Lost the race for that queue's last item; look again */
+    }
+}
+
+static char *batch_run_item(batch_worker_t *w, const batch_item_t *it) {
+    batch_t *b = w->b;
+    qwen_ctx_t *ctx = w->ctx;
+    const batch_file_t *f = &b->files[it->file];
+    if (b->whole_files)
+        return transcribe_audio(ctx, b->samples[it->file], b->n_samples[it->file]);
+    if (f->n_splits == 1)
+        return transcribe_segment(ctx, f->audio, f->n_audio, b->tokenizer, NULL, 0, NULL);
+
+    float *pad_buf;
+    int seg_samples;
+    const float *seg_ptr = segment_audio(f->audio, f->splits[it->seg], f->splits[it->seg + 1],
+                                         &pad_buf, &seg_samples);
+    char *text = transcribe_segment(ctx, seg_ptr, seg_samples, b->tokenizer, NULL, 0, NULL);
+    free(pad_buf);
+    return text;
+}
+
+static void *batch_worker_main(void *arg) {
+    batch_worker_t *w = (batch_worker_t *)arg;
+    batch_t *b = w->b;
+    qwen_ctx_t *ctx = w->ctx;
+    ctx_binding_t prev = ctx_bind(ctx);
+
+    /* Whole-file items prepare their own prompt in transcribe_audio */
+    if (b->whole_files || prepare_prompt_tokens(ctx, b->tokenizer) == 0) {
+        int item, stolen = 0;
+        while ((item = batch_take(b, w->id, &stolen)) >= 0) {
+            perf_reset(ctx, 0);
+            char *text = batch_run_item(w, &b->items[item]);
+            b->item_texts[item] = text;
+            pthread_mutex_lock(&b->perf_mutex);
+            perf_merge(b->base, ctx);
+            pthread_mutex_unlock(&b->perf_mutex);
+            w->items_done++;
+            w->items_stolen += stolen;
+            stolen = 0;
+        }
+    }
+
+    ctx_unbind(ctx, prev);
+    return NULL;
+}
+
+/* Join each file's segment texts in order. Returns 0, or -1 if a file
+ * could not be transcribed at all. */
+static int batch_collect(batch_t *b, int n_files, char **texts) {
+    int rc = 0;
+    for (int i = 0; i < n_files; i++) {
+        const batch_file_t *f = &b->files[i];
+        char **seg_texts = b->item_texts + f->first_item;
+        int n_items = b->whole_files ? 1 : f->n_splits;
+        if (n_items == 1) {
+            texts[i] = seg_texts[0];
+            seg_texts[0] = NULL;
+        } else {
+            /* Like transcribe_audio, a failed segment only leaves a gap */
+            size_t result_cap = 4096, result_len = 0;
+            char *result = (char *)malloc(result_cap);
+            if (result) {
+                result[0] = '\0';
+                for (int s = 0; s < n_items; s++) {
+                    append_segment_text(&result, &result_len, &result_cap, seg_texts[s], 0,
+                                        NULL, NULL);
+                    seg_texts[s] = NULL;
+                }
+            }
+            texts[i] = result;
+        }
+        if (!texts[i]) rc = -1;
+    }
+    return rc;
+}
+
+int qwen_transcribe_batch(qwen_ctx_t *ctx, const float *const *samples, const int *n_samples,
+                          int n_files, int n_workers, int threads_per_worker, char **texts) {
+    if (!ctx || n_files < 0 || (n_files > 0 && (!samples || !n_samples || !texts))) return -1;
+    for (int i = 0; i < n_files; i++) texts[i] = NULL;
+    if (n_files == 0) return 0;
+
+    double t0 = get_time_ms();
+    qwen_tokenizer_t *tokenizer = ctx_tokenizer(ctx);
+    if (!tokenizer) return -1;
+
+    perf_reset(ctx, 0);
+    batch_t b = {0};
+    b.base = ctx;
+    b.samples = samples;
+    b.n_samples = n_samples;
+    b.tokenizer = tokenizer;
+    b.whole_files = ctx->past_text_conditioning;
+    b.files = (batch_file_t *)calloc((size_t)n_files, sizeof(batch_file_t));
+    if (!b.files) return -1;
+
+    /* Cut every file up front; compaction and split search are cheap
+     * next to the encoder */
+    double audio_ms = 0;
+    int n_items = 0;
+    for (int i = 0; i < n_files; i++) {
+        batch_file_t *f = &b.files[i];
+        audio_ms += 1000.0 * (double)n_samples[i] / (double)QWEN_SAMPLE_RATE;
+        f->first_item = n_items;
+        f->n_splits = 1;
+        if (b.whole_files) {
+            n_items++;
+            continue;
+        }
+        f->audio = samples[i];
+        f->n_audio = n_samples[i];
+        if (ctx->skip_silence) {
+            f->compacted = compact_silence(samples[i], n_samples[i], &f->n_audio);
+            if (f->compacted) f->audio = f->compacted;
+            else f->n_audio = n_samples[i];
+        }
+        f->n_splits = plan_segments(ctx, f->audio, f->n_audio, f->splits);
+        n_items += f->n_splits;
+    }
+
+    if (n_workers < 1) n_workers = 1;
+    if (n_workers > n_items) n_workers = n_items;
+    if (threads_per_worker <= 0) {
+        threads_per_worker = qwen_get_num_cpus() / n_workers;
+        if (threads_per_worker < 1) threads_per_worker = 1;
+    }
+
+    int rc = -1, n_queues = 0;
+    b.n_workers = n_workers;
+    b.items = (batch_item_t *)malloc((size_t)n_items * sizeof(batch_item_t));
+    b.item_texts = (char **)calloc((size_t)n_items, sizeof(char *));
+    b.queues = (batch_queue_t *)calloc((size_t)n_workers, sizeof(batch_queue_t));
+    batch_worker_t *workers = (batch_worker_t *)calloc((size_t)n_workers, sizeof(batch_worker_t));
+    if (!b.items || !b.item_texts || !b.queues || !workers) goto done;
+
+    for (int i = 0; i < n_files; i++) {
+        for (int s = 0; s < b.files[i].n_splits; s++) {
+            b.items[b.files[i].first_item + s].file = i;
+            b.items[b.files[i].first_item + s].seg = s;
+        }
+    }
+    for (int w = 0; w < n_workers; w++) {
+        pthread_mutex_init(&b.queues[w].mutex, NULL);
+        b.queues[w].head = (int)((long long)n_items * w / n_workers);
+        b.queues[w].tail = (int)((long long)n_items * (w + 1) / n_workers);
+        n_queues++;
+    }
+
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "Batch: %d files, %d items, %d workers x %d threads\n",
+                n_files, n_items, n_workers, threads_per_worker);
+
+    /* Workers that fail to start leave their queue to be stolen. The first
+     * share builds the base's LM-head draft, on the base's pool and scratch. */
+    pthread_mutex_init(&b.perf_mutex, NULL);
+    int started = 0;
+    ctx_binding_t prev = ctx_bind(ctx);
+    for (int w = 0; w < n_workers; w++) {
+        batch_worker_t *wk = &workers[w];
+        wk->b = &b;
+        wk->id = w;
+        wk->ctx = qwen_ctx_share(ctx);
+        if (!wk->ctx || qwen_ctx_set_threads(wk->ctx, threads_per_worker, QWEN_QOS_DEFAULT) != 0)
+            continue;
+        if (pthread_create(&wk->thread, NULL, batch_worker_main, wk) == 0) {
+            wk->started = 1;
+            started++;
+        }
+    }
+    ctx_unbind(ctx, prev);
+    for (int w = 0; w < n_workers; w++) {
+        if (workers[w].started) pthread_join(workers[w].thread, NULL);
+    }
+
+    if (started > 0) rc = batch_collect(&b, n_files, texts);
+
+    pthread_mutex_destroy(&b.perf_mutex);
+    ctx->perf_audio_ms = audio_ms;
+    for (int w = 0; w < n_workers; w++) {
+        batch_worker_t *wk = &workers[w];
+        if (qwen_verbose >= 2 && wk->started)
+            fprintf(stderr, "Batch worker %d: %d items (%d stolen)\n",
+                    w, wk->items_done, wk->items_stolen);
+        qwen_free(wk->ctx);
+    }
+    ctx->perf_total_ms = get_time_ms() - t0;
+
+done:
+    for (int w = 0; w < n_queues; w++) pthread_mutex_destroy(&b.queues[w].mutex);
+    if (b.item_texts) {
+        for (int i = 0; i < n_items; i++) free(b.item_texts[i]);
+    }
+    for (int i = 0; i < n_files; i++) free(b.files[i].compacted);
+    free(workers);
+    free(b.queues);
+    free(b.item_texts);
+    free(b.items);
+    free(b.files);
+    return rc;
+}
@@ -17,6 +17,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#ifdef USE_BLAS
+#ifdef __APPLE__
+#include <Accelerate/Accelerate.h>
+#else
+#include <cblas.h>
+#endif
+#endif
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -285,18 +295,214 @@ static float *build_mel_filters(void) {
     return filters;
 }
 
+
+/* ========================================================================
+ * Cached Front-End Tables
+ *
+ * The Hann window, mel filterbank and FFT twiddles depend only on the fixed
+ * WhisperFeatureExtractor parameters, so they are built once per process and
+ * shared by every call (offline, segmented and streaming).
+ *
+ * The 400-point real FFT is evaluated as a 200-point complex FFT over the
+ * even/odd-packed frame followed by a split step. vDSP's DFT setups only
+ * accept f*2^n lengths with f in {1,3,5,15}, which excludes 400 and 200, so
+ * a small mixed-radix FFT (200 = 4*2*5*5) is used on every platform.
+ * ======================================================================== */
+
+#define FFT_HALF   (N_FFT / 2)   /* 200-point complex FFT */
+#define MEL_BLOCK  128           /* frames per filterbank GEMM block */
+
+typedef struct { float re, im; } mel_cpx_t;
+
+/* Factor plan as (radix, remaining length) pairs, outermost stage first. */
+static const int fft_plan[] = {4, 50, 2, 25, 5, 5, 5, 1};
+
+typedef struct {
+    float window[WIN_LENGTH];
+    float *filters;                  /* [N_MEL, N_FREQ] dense Slaney filters */
+    int band_lo[N_MEL];              /* first nonzero bin of each filter */
+    int band_hi[N_MEL];              /* one past the last nonzero bin */
+    mel_cpx_t twiddle[FFT_HALF];     /* exp(-2*pi*i*k / FFT_HALF) */
+    mel_cpx_t split[FFT_HALF + 1];   /* exp(-2*pi*i*k / N_FFT) */
+} mel_tables_t;
+
+static mel_tables_t mel_tab;
+static pthread_once_t mel_tab_once = PTHREAD_ONCE_INIT;
+
+static void mel_tables_init(void) {
+    /* Periodic Hann window */
+    for (int i = 0; i < WIN_LENGTH; i++)
+        mel_tab.window[i] = 0.5f * (1.0f - cosf(2.0f * (float)M_PI * (float)i / (float)WIN_LENGTH));
+
+    for (int k = 0; k < FFT_HALF; k++) {
+        double a = -2.0 * M_PI * (double)k / (double)FFT_HALF;
+        mel_tab.twiddle[k].re = (float)cos(a);
+        mel_tab.twiddle[k].im = (float)sin(a);
+    }
+    for (int k = 0; k <= FFT_HALF; k++) {
+        double a = -2.0 * M_PI * (double)k / (double)N_FFT;
+        mel_tab.split[k].re = (float)cos(a);
+        mel_tab.split[k].im = (float)sin(a);
+    }
+
+    mel_tab.filters = build_mel_filters();
+    if (!mel_tab.filters) return;
+
+    /* Each triangular filter only touches a narrow band of bins; record it so
+     * the non-BLAS projection skips the zeros. */
+    for (int m = 0; m < N_MEL; m++) {
+        const float *filt = mel_tab.filters + (size_t)m * N_FREQ;
+        int lo = 0, hi = N_FREQ;
+        while (lo < N_FREQ && filt[lo] == 0.0f) lo++;
+        while (hi > lo && filt[hi - 1] == 0.0f) hi--;
+        mel_tab.band_lo[m] = lo;
+        mel_tab.band_hi[m] = hi;
+    }
+}
+
+static const mel_tables_t *mel_tables(void) {
+    pthread_once(&mel_tab_once, mel_tables_init);
+    return mel_tab.filters ? &mel_tab : NULL;
+}
+
+/* ========================================================================
+ * Real FFT (mixed radix, decimation in time)
+ * ======================================================================== */
+
+static void fft_butterfly(mel_cpx_t *out, int fstride, int p, int m,
+                          const mel_cpx_t *tw) {
+    mel_cpx_t scratch[5];
+    for (int u = 0; u < m; u++) {
+        for (int q = 0, k = u; q < p; q++, k += m) scratch[q] = out[k];
+        for (int q1 = 0, k = u; q1 < p; q1++, k += m) {
+            float re = scratch[0].re, im = scratch[0].im;
+            int twidx = 0;
+            for (int q = 1; q < p; q++) {
+                twidx += fstride * k;
+                if (twidx >= FFT_HALF) twidx -= FFT_HALF;
+                const mel_cpx_t w = tw[twidx];
+                re += scratch[q].re * w.re - scratch[q].im * w.im;
+                im += scratch[q].re * w.im + scratch[q].im * w.re;
+            }
+            out[k].re = re;
+            out[k].im = im;
+        }
+    }
+}
+
+static void fft_work(mel_cpx_t *out, const mel_cpx_t *in, int fstride,
+                     const int *plan, const mel_cpx_t *tw) {
+    int p = plan[0];
+    int m = plan[1];
+    if (m == 1) {
+        for (int j = 0; j < p; j++) out[j] = in[j * fstride];
+    } else {
+        for (int j = 0; j < p; j++)
+            fft_work(out + j * m, in + j * fstride, fstride * p, plan + 2, tw);
+    }
+    fft_butterfly(out, fstride, p, m, tw);
+}
+
+/* Power spectrum |X[k]|^2 for k = 0..N_FREQ-1 of one windowed frame. */
+static void frame_power(const mel_tables_t *tab, const float *frame, float *power) {
+    mel_cpx_t packed[FFT_HALF];
+    mel_cpx_t z[FFT_HALF];
+    for (int n = 0; n < FFT_HALF; n++) {
+        packed[n].re = frame[2 * n] * tab->window[2 * n];
+        packed[n].im = frame[2 * n + 1] * tab->window[2 * n + 1];
+    }
+    fft_work(z, packed, 1, fft_plan, tab->twiddle);
+
+    for (int k = 0; k <= FFT_HALF; k++) {
+        mel_cpx_t a = z[k % FFT_HALF];
+        mel_cpx_t b = z[(FFT_HALF - k) % FFT_HALF];   /* conj taken below */
+        float er = 0.5f * (a.re + b.re), ei = 0.5f * (a.im - b.im);
+        float or_ = 0.5f * (a.im + b.im), oi = -0.5f * (a.re - b.re);
+        const mel_cpx_t w = tab->split[k];
+        float xr = er + or_ * w.re - oi * w.im;
+        float xi = ei + or_ * w.im + oi * w.re;
+        power[k] = xr * xr + xi * xi;
+    }
+}
+
+/* Log-mel for n_frames consecutive frames of an already padded signal
+ * (frame t starts at padded[t * HOP_LENGTH]). Writes [n_frames, N_MEL]
+ * log10 values and returns their maximum. */
+static float mel_log_frames(const mel_tables_t *tab, const float *padded,
+                            int n_frames, float *out, float *power_buf) {
+    float global_max = -1e30f;
+    for (int t0 = 0; t0 < n_frames; t0 += MEL_BLOCK) {
+        int nb = n_frames - t0;
+        if (nb > MEL_BLOCK) nb = MEL_BLOCK;
+
+        for (int t = 0; t < nb; t++)
+            frame_power(tab, padded + (size_t)(t0 + t) * HOP_LENGTH,
+                        power_buf + (size_t)t * N_FREQ);
+
+        float *dst = out + (size_t)t0 * N_MEL;
+#ifdef USE_BLAS
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                    nb, N_MEL, N_FREQ,
+                    1.0f, power_buf, N_FREQ, tab->filters, N_FREQ,
+                    0.0f, dst, N_MEL);
+#else
+        for (int t = 0; t < nb; t++) {
+            const float *pw = power_buf + (size_t)t * N_FREQ;
+            float *row = dst + (size_t)t * N_MEL;
+            for (int m = 0; m < N_MEL; m++) {
+                const float *filt = tab->filters + (size_t)m * N_FREQ;
+                float sum = 0.0f;
+                for (int k = tab->band_lo[m]; k < tab->band_hi[m]; k++)
+                    sum += filt[k] * pw[k];
+                row[m] = sum;
+            }
+        }
+#endif
+
+        int n = nb * N_MEL;
+        for (int i = 0; i < n; i++)
+            if (dst[i] < 1e-10f) dst[i] = 1e-10f;
+#if defined(__APPLE__) && defined(USE_BLAS)
+        vvlog10f(dst, dst, &n);
+#else
+        for (int i = 0; i < n; i++) dst[i] = log10f(dst[i]);
+#endif
+        for (int i = 0; i < n; i++)
+            if (dst[i] > global_max) global_max = dst[i];
+    }
+    return global_max;
+}
+
 /* ========================================================================
  * Mel Spectrogram (dynamic max, returns [128, n_frames])
  * ======================================================================== */
 
-float *qwen_mel_spectrogram(const float *samples, int n_samples, int *out_frames) {
+int qwen_mel_frame_count(int n_samples) {
+    if (n_samples <= 0) return 0;
+    int padded_len = n_samples + N_FFT; /* N_FFT / 2 reflect pad per side */
+    int n_frames = (padded_len - N_FFT) / HOP_LENGTH; /* last frame dropped */
+    return n_frames > 0 ? n_frames : 0;
+}
+
+int qwen_mel_spectrogram_into(const float *samples, int n_samples,
+                              float *out, int out_stride) {
     int n_fft = N_FFT;
-    int n_freqs = N_FREQ;
     int pad_len = n_fft / 2; /* center=True padding (reflect) */
 
+    int n_frames = qwen_mel_frame_count(n_samples);
+    if (n_frames <= 0) {
+        fprintf(stderr, "qwen_mel_spectrogram: audio too short (%d samples)\n", n_samples);
+        return -1;
+    }
+    if (out_stride < n_frames) return -1;
+
+    const mel_tables_t *tab = mel_tables();
+    if (!tab) return -1;
+
     /* Reflect-pad the signal */
     int padded_len = n_samples + 2 * pad_len;
     float *padded = (float *)malloc(padded_len * sizeof(float));
+    if (!padded) return -1;
     for (int i = 0; i < pad_len; i++) {
         int src = pad_len - i;
         padded[i] = (src < n_samples) ? samples[src] : 0.0f;
@@ -307,70 +513,18 @@ float *qwen_mel_spectrogram(const float *samples, int n_samples, int *out_frames
         padded[pad_len + n_samples + i] = (src >= 0) ? samples[src] : 0.0f;
     }
 
-    int n_frames_total = (padded_len - n_fft) / HOP_LENGTH + 1;
-    int n_frames = n_frames_total - 1; /* drop last frame */
-    if (n_frames <= 0) {
-        fprintf(stderr, "qwen_mel_spectrogram: audio too short (%d samples)\n", n_samples);
-        free(padded);
-        return NULL;
-    }
-
-    float *mel_filters = build_mel_filters();
-    if (!mel_filters) { free(padded); return NULL; }
-
-    /* Periodic Hann window */
-    float window[WIN_LENGTH];
-    for (int i = 0; i < WIN_LENGTH; i++)
-        window[i] = 0.5f * (1.0f - cosf(2.0f * (float)M_PI * (float)i / (float)WIN_LENGTH));
-
-    /* Precompute DFT tables */
-    float *dft_cos = (float *)malloc((size_t)N_FREQ * N_FFT * sizeof(float));
-    float *dft_sin = (float *)malloc((size_t)N_FREQ * N_FFT * sizeof(float));
-    for (int k = 0; k < N_FREQ; k++) {
-        for (int n = 0; n < N_FFT; n++) {
-            float angle = 2.0f * (float)M_PI * (float)k * (float)n / (float)N_FFT;
-            dft_cos[k * N_FFT + n] = cosf(angle);
-            dft_sin[k * N_FFT + n] = sinf(angle);
-        }
-    }
-
-    /* First pass: compute mel values and find global max.
-     * Store as [n_frames, N_MEL] temporarily for convenient max search. */
-    float *mel_tmp = (float *)calloc(n_frames * N_MEL, sizeof(float));
-    float windowed[N_FFT];
-    float power[N_FREQ];
-    float global_max = -1e30f;
-
-    for (int t = 0; t < n_frames; t++) {
-        int start = t * HOP_LENGTH;
-        for (int i = 0; i < N_FFT; i++)
-            windowed[i] = padded[start + i] * window[i];
-
-        for (int k = 0; k < n_freqs; k++) {
-            float re = 0, im = 0;
-            const float *cos_row = dft_cos + k * N_FFT;
-            const float *sin_row = dft_sin + k * N_FFT;
-            for (int n = 0; n < N_FFT; n++) {
-                re += windowed[n] * cos_row[n];
-                im += windowed[n] * sin_row[n];
-            }
-            power[k] = re * re + im * im;
-        }
-
-        for (int m = 0; m < N_MEL; m++) {
-            float sum = 0.0f;
-            const float *filt = mel_filters + (size_t)m * n_freqs;
-            for (int k = 0; k < n_freqs; k++) sum += filt[k] * power[k];
-            if (sum < 1e-10f) sum = 1e-10f;
-            float val = log10f(sum);
-            mel_tmp[t * N_MEL + m] = val;
-            if (val > global_max) global_max = val;
-        }
+    /* First pass: compute log-mel values and find global max.
+     * Stored as [n_frames, N_MEL] temporarily (GEMM output layout). */
+    float *mel_tmp = (float *)malloc((size_t)n_frames * N_MEL * sizeof(float));
+    float *power_buf = (float *)malloc((size_t)MEL_BLOCK * N_FREQ * sizeof(float));
+    if (!mel_tmp || !power_buf) {
+        free(mel_tmp); free(power_buf); free(padded);
+        return -1;
     }
+    float global_max = mel_log_frames(tab, padded, n_frames, mel_tmp, power_buf);
 
     /* Second pass: clamp with dynamic max and normalize.
-     * Output layout: [N_MEL, n_frames] for Conv2D compatibility. */
-    float *mel = (float *)malloc((size_t)N_MEL * n_frames * sizeof(float));
+     * Output layout: [N_MEL, out_stride] for Conv2D compatibility. */
     float min_val = global_max - 8.0f;
 
     for (int t = 0; t < n_frames; t++) {
@@ -378,16 +532,456 @@ float *qwen_mel_spectrogram(const float *samples, int n_samples, int *out_frames
             float val = mel_tmp[t * N_MEL + m];
             if (val < min_val) val = min_val;
             /* Store as [mel_bin, frame] for Conv2D input */
-            mel[m * n_frames + t] = (val + 4.0f) / 4.0f;
+            out[(size_t)m * out_stride + t] = (val + 4.0f) / 4.0f;
         }
     }
+    if (out_stride > n_frames) {
+        for (int m = 0; m < N_MEL; m++)
+            memset(out + (size_t)m * out_stride + n_frames, 0,
+                   (size_t)(out_stride - n_frames) * sizeof(float));
+    }
 
     free(mel_tmp);
-    free(dft_cos);
-    free(dft_sin);
+    free(power_buf);
     free(padded);
-    free(mel_filters);
+    return n_frames;
+}
 
+float *qwen_mel_spectrogram(const float *samples, int n_samples, int *out_frames) {
+    int n_frames = qwen_mel_frame_count(n_samples);
+    float *mel = (float *)malloc((size_t)N_MEL * (n_frames > 0 ? n_frames : 1) * sizeof(float));
+    if (!mel) return NULL;
+    if (qwen_mel_spectrogram_into(samples, n_samples, mel, n_frames) < 0) {
+        free(mel);
+        return NULL;
+    }
     *out_frames = n_frames;
     return mel;
 }
+
+/* ========================================================================
+ * Streaming Mel Spectrogram
+ *
+ * Keeps the reflect-padded signal tail between pushes so each sample goes
+ * through the FFT exactly once. Internally the buffer is addressed in padded
+ * coordinates (raw sample j lives at padded index j + N_FFT/2), so frame t
+ * always starts at padded index t * HOP_LENGTH, as in the offline path.
+ * The left reflect pad is materialized once N_FFT/2 + 1 samples exist (or at
+ * finish); the right reflect pad is appended only by qwen_mel_stream_finish.
+ * ======================================================================== */
+
+struct qwen_mel_stream {
+    int max_policy;
+    float fixed_max;
+    float running_max;
+
+    float *buf;            /* padded signal; buf[0] is padded index buf_off */
+    int buf_len;
+    int buf_cap;
+    long long buf_off;
+    long long n_samples;   /* raw samples pushed */
+    int padded;            /* left reflect pad materialized */
+    int finished;
+
+    long long next_frame;  /* next frame index to compute */
+    float *logmel;         /* [n_pending, N_MEL] raw log10 values */
+    int n_pending;
+    int pending_cap;
+    float *power_buf;      /* [MEL_BLOCK, N_FREQ] */
+};
+
+qwen_mel_stream_t *qwen_mel_stream_create(int max_policy, float fixed_max) {
+    if (!mel_tables()) return NULL;
+    qwen_mel_stream_t *s = (qwen_mel_stream_t *)calloc(1, sizeof(qwen_mel_stream_t));
+    if (!s) return NULL;
+    s->max_policy = max_policy;
+    s->fixed_max = fixed_max;
+    s->running_max = -1e30f;
+    s->power_buf = (float *)malloc((size_t)MEL_BLOCK * N_FREQ * sizeof(float));
+    if (!s->power_buf) { free(s); return NULL; }
+    return s;
+}
+
+void qwen_mel_stream_reset(qwen_mel_stream_t *s) {
+    if (!s) return;
+    s->running_max = -1e30f;
+    s->buf_len = 0;
+    s->buf_off = 0;
+    s->n_samples = 0;
+    s->padded = 0;
+    s->finished = 0;
+    s->next_frame = 0;
+    s->n_pending = 0;
+}
+
+void qwen_mel_stream_free(qwen_mel_stream_t *s) {
+    if (!s) return;
+    free(s->buf);
+    free(s->logmel);
+    free(s->power_buf);
+    free(s);
+}
+
+static int mel_stream_reserve(float **buf, int *cap, size_t need) {
+    if (need <= (size_t)*cap) return 0;
+    size_t new_cap = *cap > 0 ? (size_t)*cap : 4096;
+    while (new_cap < need) new_cap *= 2;
+    float *tmp = (float *)realloc(*buf, new_cap * sizeof(float));
+    if (!tmp) return -1;
+    *buf = tmp;
+    *cap = (int)new_cap;
+    return 0;
+}
+
+/* Raw sample j of the stream; only valid while j is still buffered. */
+static float mel_stream_raw(const qwen_mel_stream_t *s, long long j) {
+    long long idx = s->padded ? j + N_FFT / 2 - s->buf_off : j;
+    return s->buf[idx];
+}
+
+/* Prepend the left reflect pad (same rule as qwen_mel_spectrogram). */
+static int mel_stream_pad_left(qwen_mel_stream_t *s) {
+    int pad_len = N_FFT / 2;
+    if (mel_stream_reserve(&s->buf, &s->buf_cap, (size_t)s->buf_len + pad_len) != 0)
+        return -1;
+    memmove(s->buf + pad_len, s->buf, (size_t)s->buf_len * sizeof(float));
+    for (int i = 0; i < pad_len; i++) {
+        int src = pad_len - i;
+        s->buf[i] = (src < s->n_samples) ? s->buf[pad_len + src] : 0.0f;
+    }
+    s->buf_len += pad_len;
+    s->buf_off = 0;
+    s->padded = 1;
+    return 0;
+}
+
+/* Compute every frame fully covered by the buffered padded signal, up to
+ * frame_limit (exclusive). */
+static int mel_stream_compute(qwen_mel_stream_t *s, long long frame_limit) {
+    const mel_tables_t *tab = mel_tables();
+    long long padded_end = s->buf_off + s->buf_len;
+    long long avail = padded_end >= N_FFT ? (padded_end - N_FFT) / HOP_LENGTH + 1 : 0;
+    if (avail > frame_limit) avail = frame_limit;
+    int n_new = (int)(avail - s->next_frame);
+    if (n_new <= 0) return 0;
+
+    if (mel_stream_reserve(&s->logmel, &s->pending_cap,
+                           (size_t)(s->n_pending + n_new) * N_MEL) != 0)
+        return -1;
+
+    const float *start = s->buf + (s->next_frame * HOP_LENGTH - s->buf_off);
+    float max = mel_log_frames(tab, start, n_new,
+                               s->logmel + (size_t)s->n_pending * N_MEL,
+                               s->power_buf);
+    if (max > s->running_max) s->running_max = max;
+    s->n_pending += n_new;
+    s->next_frame += n_new;
+
+    /* Drop samples no future frame can reach; amortize the memmove. */
+    long long keep_from = s->next_frame * HOP_LENGTH;
+    int drop = (int)(keep_from - s->buf_off);
+    if (drop > 0 && drop >= s->buf_len / 2) {
+        memmove(s->buf, s->buf + drop, (size_t)(s->buf_len - drop) * sizeof(float));
+        s->buf_len -= drop;
+        s->buf_off = keep_from;
+    }
+    return n_new;
+}
+
+int qwen_mel_stream_push(qwen_mel_stream_t *s, const float *samples, int n_samples) {
+    if (!s || s->finished || n_samples < 0) return -1;
+    if (n_samples == 0) return s->n_pending;
+
+    if (mel_stream_reserve(&s->buf, &s->buf_cap, (size_t)s->buf_len + n_samples) != 0)
+        return -1;
+    memcpy(s->buf + s->buf_len, samples, (size_t)n_samples * sizeof(float));
+    s->buf_len += n_samples;
+    s->n_samples += n_samples;
+
+    if (!s->padded) {
+        if (s->n_samples <= N_FFT / 2) return s->n_pending;
+        if (mel_stream_pad_left(s) != 0) return -1;
+    }
+    /* Before finish, every frame whose window lies inside the real signal
+     * is final; the last frame of the offline path is also never produced. */
+    if (mel_stream_compute(s, s->n_samples / HOP_LENGTH) < 0) return -1;
+    return s->n_pending;
+}
+
+int qwen_mel_stream_finish(qwen_mel_stream_t *s) {
+    if (!s) return -1;
+    if (s->finished) return s->n_pending;
+    s->finished = 1;
+    if (s->n_samples == 0) return s->n_pending;
+    if (!s->padded && mel_stream_pad_left(s) != 0) return -1;
+
+    int pad_len = N_FFT / 2;
+    if (mel_stream_reserve(&s->buf, &s->buf_cap, (size_t)s->buf_len + pad_len) != 0)
+        return -1;
+    float *tail = s->buf + s->buf_len;
+    for (int i = 0; i < pad_len; i++) {
+        long long src = s->n_samples - 2 - i;
+        tail[i] = (src >= 0) ? mel_stream_raw(s, src) : 0.0f;
+    }
+    s->buf_len += pad_len;
+
+    if (mel_stream_compute(s, s->n_samples / HOP_LENGTH) < 0) return -1;
+    return s->n_pending;
+}
+
+int qwen_mel_stream_pop(qwen_mel_stream_t *s, float *out, int max_frames) {
+    if (!s || !out || max_frames < 0) return -1;
+    int n = s->n_pending < max_frames ? s->n_pending : max_frames;
+    if (n == 0) return 0;
+
+    float ref = (s->max_policy == QWEN_MEL_MAX_FIXED) ? s->fixed_max : s->running_max;
+    float min_val = ref - 8.0f;
+    int total = n * N_MEL;
+    for (int i = 0; i < total; i++) {
+        float val = s->logmel[i];
+        if (val < min_val) val = min_val;
+        out[i] = (val + 4.0f) / 4.0f;
+    }
+
+    s->n_pending -= n;
+    if (s->n_pending > 0)
+        memmove(s->logmel, s->logmel + total,
+                (size_t)s->n_pending * N_MEL * sizeof(float));
+    return n;
+}
+
+int qwen_mel_stream_available(const qwen_mel_stream_t *s) {
+    return s ? s->n_pending : 0;
+}
+
+/* ========================================================================
+ * Online Voice Activity Gate
+ * ======================================================================== */
+
+#define VAD_WIN          160     /* 10 ms at 16kHz */
+#define VAD_BASE_THRESH  0.002f  /* ~ -54 dBFS */
+#define VAD_MAX_THRESH   0.025f
+#define VAD_SMOOTH_ALPHA 0.2f
+#define VAD_FLOOR_FALL   0.1f    /* per window toward quieter audio */
+#define VAD_FLOOR_RISE   0.002f  /* per window toward louder audio (~5 s) */
+#define VAD_FLOOR_RISE_VOICED 0.0002f /* same while voiced, so speech barely lifts it */
+#define VAD_MIN_VOICE    5       /* reject <50ms spikes as noise */
+
+struct qwen_vad {
+    float carry[VAD_WIN];        /* partial window from the previous push */
+    int n_carry;
+    int started;
+    float smooth;
+    float noise_floor;
+    int voice_run;               /* consecutive windows above threshold */
+};
+
+qwen_vad_t *qwen_vad_create(void) {
+    qwen_vad_t *v = (qwen_vad_t *)malloc(sizeof(qwen_vad_t));
+    if (v) qwen_vad_reset(v);
+    return v;
+}
+
+void qwen_vad_free(qwen_vad_t *v) {
+    free(v);
+}
+
+void qwen_vad_reset(qwen_vad_t *v) {
+    if (!v) return;
+    v->n_carry = 0;
+    v->started = 0;
+    v->smooth = 0.0f;
+    /* Start at the base threshold so the first seconds fail open */
+    v->noise_floor = VAD_BASE_THRESH / 1.8f;
+    v->voice_run = 0;
+}
+
+/* Feed one window's RMS; returns 1 once the voiced run is long enough. */
+static int vad_window(qwen_vad_t *v, float rms) {
+    if (!v->started) {
+        v->smooth = rms;
+        v->started = 1;
+    }
+    v->smooth = (1.0f - VAD_SMOOTH_ALPHA) * v->smooth + VAD_SMOOTH_ALPHA * rms;
+
+    float thresh = v->noise_floor * 1.8f;
+    if (thresh < VAD_BASE_THRESH) thresh = VAD_BASE_THRESH;
+    if (thresh > VAD_MAX_THRESH) thresh = VAD_MAX_THRESH;
+    int voiced = v->smooth > thresh;
+
+    float rate = v->smooth < v->noise_floor ? VAD_FLOOR_FALL :
+                 voiced ? VAD_FLOOR_RISE_VOICED : VAD_FLOOR_RISE;
+    v->noise_floor += (v->smooth - v->noise_floor) * rate;
+
+    v->voice_run = voiced ? v->voice_run + 1 : 0;
+    return v->voice_run >= VAD_MIN_VOICE;
+}
+
+int qwen_vad_push(qwen_vad_t *v, const float *samples, int n_samples) {
+    if (!v || (!samples && n_samples > 0) || n_samples < 0) return -1;
+    int speech = 0;
+    int i = 0;
+
+    if (v->n_carry > 0) {
+        int take = VAD_WIN - v->n_carry;
+        if (take > n_samples) take = n_samples;
+        memcpy(v->carry + v->n_carry, samples, (size_t)take * sizeof(float));
+        v->n_carry += take;
+        i = take;
+        if (v->n_carry < VAD_WIN) return v->voice_run > 0;
+        float energy = 0.0f;
+        for (int k = 0; k < VAD_WIN; k++) energy += v->carry[k] * v->carry[k];
+        speech |= vad_window(v, sqrtf(energy / VAD_WIN));
+        v->n_carry = 0;
+    }
+
+    for (; i + VAD_WIN <= n_samples; i += VAD_WIN) {
+        float energy = 0.0f;
+        for (int k = 0; k < VAD_WIN; k++) energy += samples[i + k] * samples[i + k];
+        speech |= vad_window(v, sqrtf(energy / VAD_WIN));
+    }
+
+    v->n_carry = n_samples - i;
+    memcpy(v->carry, samples + i, (size_t)v->n_carry * sizeof(float));
+    /* A run that has not reached the spike length yet may still be speech */
+    return speech || v->voice_run > 0;
+}
+
+/* ========================================================================
+ * Capture Ring
+ *
+ * head and tail are free-running sample counts; positions are taken modulo
+ * the power-of-two capacity, so head - tail is the fill level and a full
+ * ring needs no spare slot. The producer stores head with release after
+ * writing samples, the consumer stores tail with release after reading
+ * them, and each loads the other's index with acquire.
+ * ======================================================================== */
+
+#define RING_MAX_CAPACITY (1 << 30)
+
+struct qwen_audio_ring {
+    float *buf;
+    size_t cap;                    /* power of two */
+    size_t mask;
+    atomic_size_t head;            /* written by the producer only */
+    atomic_size_t tail;            /* written by the consumer only */
+    _Atomic int64_t overruns;
+};
+
+qwen_audio_ring_t *qwen_audio_ring_create(int capacity_samples) {
+    if (capacity_samples <= 0 || capacity_samples > RING_MAX_CAPACITY) return NULL;
+    size_t cap = 1;
+    while (cap < (size_t)capacity_samples) cap <<= 1;
+    qwen_audio_ring_t *r = (qwen_audio_ring_t *)calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->buf = (float *)calloc(cap, sizeof(float));
+    if (!r->buf) {
+        free(r);
+        return NULL;
+    }
+    r->cap = cap;
+    r->mask = cap - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->overruns, 0);
+    return r;
+}
+
+void qwen_audio_ring_free(qwen_audio_ring_t *r) {
+    if (!r) return;
+    free(r->buf);
+    free(r);
+}
+
+int qwen_audio_ring_capacity(const qwen_audio_ring_t *r) {
+    return r ? (int)r->cap : 0;
+}
+
+int qwen_audio_ring_write_regions(qwen_audio_ring_t *r, float **p1, int *n1,
+                                  float **p2, int *n2) {
+    *p1 = *p2 = NULL;
+    *n1 = *n2 = 0;
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t space = r->cap - (head - tail);
+    if (space == 0) return 0;
+    size_t pos = head & r->mask;
+    size_t first = r->cap - pos < space ? r->cap - pos : space;
+    *p1 = r->buf + pos;
+    *n1 = (int)first;
+    if (space > first) {
+        *p2 = r->buf;
+        *n2 = (int)(space - first);
+    }
+    return (int)space;
+}
+
+void qwen_audio_ring_commit(qwen_audio_ring_t *r, int n_samples) {
+    if (n_samples <= 0) return;
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    atomic_store_explicit(&r->head, head + (size_t)n_samples, memory_order_release);
+}
+
+int qwen_audio_ring_write(qwen_audio_ring_t *r, const float *samples, int n_samples) {
+    if (!r || n_samples < 0 || (n_samples > 0 && !samples)) return -1;
+    float *p1, *p2;
+    int n1, n2;
+    int space = qwen_audio_ring_write_regions(r, &p1, &n1, &p2, &n2);
+    int n = n_samples < space ? n_samples : space;
+    int a = n < n1 ? n : n1;
+    if (a > 0) memcpy(p1, samples, (size_t)a * sizeof(float));
+    if (n > a) memcpy(p2, samples + a, (size_t)(n - a) * sizeof(float));
+    qwen_audio_ring_commit(r, n);
+    if (n < n_samples)
+        atomic_fetch_add_explicit(&r->overruns, (int64_t)(n_samples - n), memory_order_relaxed);
+    return n;
+}
+
+int qwen_audio_ring_read_regions(qwen_audio_ring_t *r, const float **p1, int *n1,
+                                 const float **p2, int *n2) {
+    *p1 = *p2 = NULL;
+    *n1 = *n2 = 0;
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    size_t avail = head - tail;
+    if (avail == 0) return 0;
+    size_t pos = tail & r->mask;
+    size_t first = r->cap - pos < avail ? r->cap - pos : avail;
+    *p1 = r->buf + pos;
+    *n1 = (int)first;
+    if (avail > first) {
+        *p2 = r->buf;
+        *n2 = (int)(avail - first);
+    }
+    return (int)avail;
+}
+
+void qwen_audio_ring_consume(qwen_audio_ring_t *r, int n_samples) {
+    if (n_samples <= 0) return;
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + (size_t)n_samples, memory_order_release);
+}
+
+int qwen_audio_ring_available(const qwen_audio_ring_t *r) {
+    if (!r) return 0;
+    qwen_audio_ring_t *m = (qwen_audio_ring_t *)r;
+    size_t tail = atomic_load_explicit(&m->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&m->head, memory_order_acquire);
+    return (int)(head - tail);
+}
+
+int64_t qwen_audio_ring_overruns(const qwen_audio_ring_t *r) {
+    if (!r) return 0;
+    return atomic_load_explicit(&((qwen_audio_ring_t *)r)->overruns, memory_order_relaxed);
+}
+
+int64_t qwen_audio_ring_written(const qwen_audio_ring_t *r) {
+    if (!r) return 0;
+    return (int64_t)atomic_load_explicit(&((qwen_audio_ring_t *)r)->head, memory_order_acquire);
+}
+
+void qwen_audio_ring_clear(qwen_audio_ring_t *r) {
+    if (!r) return;
+    size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    atomic_store_explicit(&r->tail, head, memory_order_release);
+}
@@ -0,0 +1,241 @@
+/*
+ * qwen_asr_bench.c - Kernel micro-benchmarks at model shapes
+ *
+ * Each kernel runs once to warm caches and page in its inputs, then iters
+ * times back to back; the mean wall time per call is reported with the
+ * throughput it implies. Inputs are deterministic pseudo-random values, so
+ * runs on the same machine and build are comparable.
+ */
+
+#include "qwen_asr.h"
+#include "qwen_asr_kernels.h"
+#include "qwen_asr_kernels_impl.h"
+#include "qwen_asr_audio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Encoder attention: four windows of one 8 s inference window's tokens */
+#define BENCH_ENC_WINDOW_TOKENS 104
+#define BENCH_ENC_WINDOWS 4
+
+/* Decoder attention: one step over a cache this long, and a prompt prefill */
+#define BENCH_DEC_CACHE_LEN 1024
+#define BENCH_DEC_PREFILL_LEN 256
+
+#define BENCH_MEL_SECONDS 30
+
+#define TIME_CALLS(ms, iters, call) do {                                       \
+    call;                                                                       \
+    double t0__ = qwen_perf_now_ms();                                           \
+    for (int i__ = 0; i__ < (iters); i__++) { call; }                           \
+    (ms) = (qwen_perf_now_ms() - t0__) / (iters);                               \
+} while (0)
+
+static uint32_t bench_seed = 12345u;
+
+static float bench_rand(void) {
+    bench_seed = bench_seed * 1664525u + 1013904223u;
+    return (float)(bench_seed >> 8) / 16777216.0f - 0.5f;
+}
+
+static float *rand_f32(size_t n) {
+    float *p = (float *)malloc(n * sizeof(float));
+    if (p) for (size_t i = 0; i < n; i++) p[i] = bench_rand();
+    return p;
+}
+
+static uint16_t *rand_bf16(size_t n) {
+    uint16_t *p = (uint16_t *)malloc(n * sizeof(uint16_t));
+    if (!p) return NULL;
+    for (size_t i = 0; i < n; i++) {
+        float f = bench_rand() * 0.1f;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        p[i] = (uint16_t)(bits >> 16);
+    }
+    return p;
+}
+
+static void bench_add(qwen_bench_kernel_t *out, int max_out, int *n, const char *name,
+                      int threaded, double ms, double flops, double bytes,
+                      const char *shape_fmt, int a, int b, int c) {
+    if (*n >= max_out) return;
+    qwen_bench_kernel_t *k = &out[(*n)++];
+    memset(k, 0, sizeof(*k));
+    k->name = name;
+    snprintf(k->shape, sizeof(k->shape), shape_fmt, a, b, c);
+    k->threaded = threaded;
+    k->ms = ms;
+    if (ms > 0) {
+        k->gflops = flops / (ms * 1e6);
+        k->gb_per_s = bytes / (ms * 1e6);
+    }
+}
+
+int qwen_bench_kernels(const qwen_config_t *cfg, int iters,
+                       qwen_bench_kernel_t *out, int max_out) {
+    qwen_config_t def;
+    if (!cfg) {
+        memset(&def, 0, sizeof(def));
+        qwen_config_variant(&def, 0);
+        cfg = &def;
+    }
+    if (!out || max_out <= 0) return -1;
+    if (iters < 1) iters = 1;
+    bench_seed = 12345u;
+    int n = 0;
+    volatile int sink = 0;
+    double ms;
+
+    /* ---- Decoder matvecs: the fused gate/up matrix and the LM head ---- */
+    {
+        int in_dim = cfg->dec_hidden;
+        int gu_dim = 2 * cfg->dec_intermediate;
+        int vocab = cfg->vocab_size;
+        float *x = rand_f32((size_t)in_dim);
+        float *y = (float *)malloc((size_t)gu_dim * sizeof(float));
+        uint16_t *w_gu = rand_bf16((size_t)gu_dim * in_dim);
+        uint16_t *w_lm = rand_bf16((size_t)vocab * in_dim);
+        if (!x || !y || !w_gu || !w_lm) {
+            free(x); free(y); free(w_gu); free(w_lm);
+            return -1;
+        }
+        double gu_bytes = (double)gu_dim * in_dim * sizeof(uint16_t);
+        TIME_CALLS(ms, iters, qwen_bf16_matvec_fused_impl(y, x, w_gu, NULL, in_dim, gu_dim));
+        bench_add(out, max_out, &n, "bf16_matvec_fused", 0, ms, 2.0 * gu_dim * in_dim,
+                  gu_bytes, "%dx%d", gu_dim, in_dim, 0);
+
+        double lm_bytes = (double)vocab * in_dim * sizeof(uint16_t);
+        TIME_CALLS(ms, iters, sink += qwen_argmax_matvec_bf16(x, w_lm, in_dim, vocab));
+        bench_add(out, max_out, &n, "argmax_matvec_bf16", 1, ms, 2.0 * vocab * in_dim,
+                  lm_bytes, "%dx%d", vocab, in_dim, 0);
+        free(x); free(y); free(w_gu); free(w_lm);
+    }
+
+    /* ---- Decoder causal attention over the paged cache: one step, then a
+     * prefill, per KV format, with the geometry's specialized kernel set
+     * and the generic one ---- */
+    {
+        int n_heads = cfg->dec_heads, n_kv = cfg->dec_kv_heads, hd = cfg->dec_head_dim;
+        int q_dim = n_heads * hd, kv_dim = n_kv * hd;
+        int len = BENCH_DEC_CACHE_LEN, p = BENCH_DEC_PREFILL_LEN;
+        const qwen_dec_kernels_t *sets[2];
+        int n_sets = 0;
+        sets[n_sets++] = qwen_dec_kernels_select(cfg->dec_hidden, hd);
+        /* No geometry matches (0, 0): that returns the generic set */
+        if (qwen_dec_kernels_select(0, 0) != sets[0])
+            sets[n_sets++] = qwen_dec_kernels_select(0, 0);
+        static const int formats[] = { QWEN_KV_F32, QWEN_KV_FP16, QWEN_KV_INT8 };
+
+        float *q = rand_f32((size_t)p * q_dim);
+        float *k = rand_f32((size_t)len * kv_dim);
+        float *v = rand_f32((size_t)len * kv_dim);
+        float *o = (float *)malloc((size_t)p * q_dim * sizeof(float));
+        if (!q || !k || !v || !o) {
+            free(q); free(k); free(v); free(o);
+            return -1;
+        }
+        float scale = 1.0f / sqrtf((float)hd);
+
+        for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+            qwen_kv_cache_t kv;
+            if (qwen_kv_cache_init(&kv, formats[f], 1, n_kv, hd) != 0 ||
+                qwen_kv_cache_reserve(&kv, len) != 0) {
+                qwen_kv_cache_free(&kv);
+                free(q); free(k); free(v); free(o);
+                return -1;
+            }
+            qwen_kv_cache_store(&kv, 0, 0, len, k, v);
+            double kv_bytes = (double)qwen_kv_cache_bytes(&kv);
+
+            for (int t = 0; t < n_sets; t++) {
+                const qwen_dec_kernels_t *dk = sets[t];
+                const char *fmt_name = qwen_kv_format_name(formats[f]);
+                char set_name[16], shape_fmt[48];
+                if (dk->head_dim) snprintf(set_name, sizeof(set_name), "d%d", dk->head_dim);
+                else snprintf(set_name, sizeof(set_name), "generic");
+
+                snprintf(shape_fmt, sizeof(shape_fmt), "%s %s, 1x%%d, %%d heads",
+                         fmt_name, set_name);
+                TIME_CALLS(ms, iters, dk->causal_attention_kv(o, q, &kv, 0, 1, len, n_heads,
+                                                              scale, len - 1));
+                bench_add(out, max_out, &n, "causal_attention_kv_decode", 1, ms,
+                          4.0 * n_heads * len * hd, kv_bytes, shape_fmt, len, n_heads, 0);
+
+                snprintf(shape_fmt, sizeof(shape_fmt), "%s %s, %%dx%%d, %%d heads",
+                         fmt_name, set_name);
+                TIME_CALLS(ms, iters, dk->causal_attention_kv(o, q, &kv, 0, p, p, n_heads,
+                                                              scale, 0));
+                bench_add(out, max_out, &n, "causal_attention_kv_prefill", 1, ms,
+                          4.0 * n_heads * hd * ((double)p * (p + 1) / 2), 0,
+                          shape_fmt, p, p, n_heads);
+            }
+            qwen_kv_cache_free(&kv);
+        }
+        free(q); free(k); free(v); free(o);
+    }
+
+    /* ---- Encoder windowed attention ---- */
+    {
+        int n_heads = cfg->enc_heads, hd = cfg->enc_head_dim;
+        int wt = BENCH_ENC_WINDOW_TOKENS, nw = BENCH_ENC_WINDOWS;
+        int seq = wt * nw;
+        size_t sz = (size_t)seq * n_heads * hd;
+        float *q = rand_f32(sz), *k = rand_f32(sz), *v = rand_f32(sz);
+        float *o = (float *)malloc(sz * sizeof(float));
+        int starts[BENCH_ENC_WINDOWS + 1];
+        if (!q || !k || !v || !o) {
+            free(q); free(k); free(v); free(o);
+            return -1;
+        }
+        for (int w = 0; w <= nw; w++) starts[w] = w * wt;
+        float scale = 1.0f / sqrtf((float)hd);
+        TIME_CALLS(ms, iters, qwen_bidirectional_attention(o, q, k, v, seq, n_heads, hd,
+                                                           scale, starts, nw));
+        bench_add(out, max_out, &n, "bidirectional_attention", 1, ms,
+                  4.0 * n_heads * hd * (double)wt * wt * nw, 0,
+                  "%dx%d tokens, %d heads", nw, wt, n_heads);
+        free(q); free(k); free(v); free(o);
+    }
+
+    /* ---- Conv stem: layers 1 and 2 on one 100-frame chunk ---- */
+    {
+        int h0 = QWEN_MEL_BINS, w0 = cfg->enc_chunk_size, c = QWEN_CONV_HIDDEN;
+        int h1 = (h0 - 1) / 2 + 1, w1 = (w0 - 1) / 2 + 1;
+        int h2 = (h1 - 1) / 2 + 1, w2 = (w1 - 1) / 2 + 1;
+        float *in0 = rand_f32((size_t)h0 * w0);
+        float *in1 = rand_f32((size_t)c * h1 * w1);
+        float *w_1 = rand_f32((size_t)c * 9);
+        float *w_2 = rand_f32((size_t)c * c * 9);
+        float *bias = rand_f32((size_t)c);
+        float *o = (float *)malloc((size_t)c * h1 * w1 * sizeof(float));
+        if (!in0 || !in1 || !w_1 || !w_2 || !bias || !o) {
+            free(in0); free(in1); free(w_1); free(w_2); free(bias); free(o);
+            return -1;
+        }
+        TIME_CALLS(ms, iters, qwen_conv2d(o, in0, w_1, bias, 1, c, h0, w0, 3, 3, 2, 1));
+        bench_add(out, max_out, &n, "conv2d_stem1", 1, ms, 2.0 * c * h1 * w1 * 9, 0,
+                  "1->%d, %dx%d", c, h0, w0);
+        TIME_CALLS(ms, iters, qwen_conv2d(o, in1, w_2, bias, c, c, h1, w1, 3, 3, 2, 1));
+        bench_add(out, max_out, &n, "conv2d_stem2", 1, ms, 2.0 * c * h2 * w2 * c * 9,
+                  0, "%d ch, %dx%d", c, h1, w1);
+        free(in0); free(in1); free(w_1); free(w_2); free(bias); free(o);
+    }
+
+    /* ---- Mel spectrogram ---- */
+    {
+        int n_samples = BENCH_MEL_SECONDS * QWEN_SAMPLE_RATE;
+        float *audio = rand_f32((size_t)n_samples);
+        if (!audio) return -1;
+        int frames = 0;
+        TIME_CALLS(ms, iters, free(qwen_mel_spectrogram(audio, n_samples, &frames)));
+        bench_add(out, max_out, &n, "mel_spectrogram", 0, ms, 0, 0,
+                  "%d s, %d frames", BENCH_MEL_SECONDS, frames, 0);
+        free(audio);
+    }
+
+    (void)sink;
+    return n;
+}
@@ -0,0 +1,427 @@
+/*
+ * qwen_asr_compiled.c - Pre-packed model cache (model.<enc>-<dec>.qwenc)
+ *
+ * qwen_load normally rebuilds the runtime model on every launch: it parses
+ * the safetensors headers, expands or quantizes the encoder matrices and
+ * interleaves gate/up for every decoder layer. A compiled file stores those
+ * final layouts for one (encoder, decoder) weight format pair, so loading
+ * is one mmap plus pointing each tensor at its offset.
+ *
+ * Layout:
+ *   [header] [entry table: offset/bytes per array] [arrays, aligned]
+ *
+ * The arrays are visited in one fixed order (walk_model) by both the writer
+ * and the loader, so the table needs no names. Arrays shared between fields
+ * (the bf16 LM head is the embedding table) are written once. The header
+ * records the config, the formats and the size/mtime of the safetensors
+ * files, and a stale or mismatched file is ignored.
+ */
+
+#include "qwen_asr.h"
+#include "qwen_asr_kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#define QWENC_MAGIC        0x434e4551u /* "QENC" */
+#define QWENC_VERSION      1
+#define QWENC_ALIGN        64          /* small arrays */
+#define QWENC_PAGE_ALIGN   16384       /* arrays of at least one page */
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t config_bytes;
+    int32_t enc_format, dec_format;
+    uint32_t n_entries;
+    uint64_t source_bytes;
+    int64_t source_mtime;
+    uint64_t file_bytes;
+    qwen_config_t config;
+} qwenc_header_t;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t bytes;
+} qwenc_entry_t;
+
+/* ========================================================================
+ * Model Walk
+ * ======================================================================== */
+
+/* Called for every array in file order. field points at the tensor
+ * pointer; bytes is its expected size. */
+typedef int (*qwenc_slot_fn)(void *arg, void **field, size_t bytes);
+
+typedef struct {
+    int loading;               /* 1: weights get their metadata set */
+    qwenc_slot_fn fn;
+    void *arg;
+} qwenc_walk_t;
+
+static int walk_f32(qwenc_walk_t *wk, float **p, size_t n) {
+    return wk->fn(wk->arg, (void **)p, n * sizeof(float));
+}
+
+static int walk_weight(qwenc_walk_t *wk, qwen_weight_t *w, int format, int out_dim, int in_dim) {
+    if (wk->loading) {
+        memset(w, 0, sizeof(*w));
+        w->format = format;
+        w->out_dim = out_dim;
+        w->in_dim = in_dim;
+    } else if (w->format != format || w->out_dim != out_dim || w->in_dim != in_dim) {
+        return -1;
+    }
+    size_t n = (size_t)out_dim * in_dim;
+    switch (format) {
+    case QWEN_WEIGHT_F32:
+        return wk->fn(wk->arg, (void **)&w->f32, n * sizeof(float));
+    case QWEN_WEIGHT_BF16:
+        return wk->fn(wk->arg, (void **)&w->bf16, n * sizeof(uint16_t));
+    case QWEN_WEIGHT_INT8:
+        if (wk->fn(wk->arg, (void **)&w->i8, n) != 0) return -1;
+        return wk->fn(wk->arg, (void **)&w->scale, (size_t)out_dim * sizeof(float));
+    case QWEN_WEIGHT_INT4:
+        if (wk->fn(wk->arg, (void **)&w->i4, n / 2) != 0) return -1;
+        return wk->fn(wk->arg, (void **)&w->scale, n / QWEN_Q4_GROUP * sizeof(float));
+    default:
+        return -1;
+    }
+}
+
+static int walk_model(qwenc_walk_t *wk, qwen_ctx_t *ctx) {
+    const qwen_config_t *c = &ctx->config;
+    qwen_encoder_t *enc = &ctx->encoder;
+    qwen_decoder_t *dec = &ctx->decoder;
+    int ef = enc->weight_format, df = dec->weight_format;
+    int d = c->enc_d_model;
+    size_t conv_k = (size_t)QWEN_CONV_KERNEL * QWEN_CONV_KERNEL;
+    int rc = 0;
+
+    rc |= walk_f32(wk, &enc->conv1_weight, QWEN_CONV_HIDDEN * conv_k);
+    rc |= walk_f32(wk, &enc->conv1_bias, QWEN_CONV_HIDDEN);
+    rc |= walk_f32(wk, &enc->conv2_weight, (size_t)QWEN_CONV_HIDDEN * QWEN_CONV_HIDDEN * conv_k);
+    rc |= walk_f32(wk, &enc->conv2_bias, QWEN_CONV_HIDDEN);
+    rc |= walk_f32(wk, &enc->conv3_weight, (size_t)QWEN_CONV_HIDDEN * QWEN_CONV_HIDDEN * conv_k);
+    rc |= walk_f32(wk, &enc->conv3_bias, QWEN_CONV_HIDDEN);
+    rc |= walk_weight(wk, &enc->conv_out_weight, ef, d, c->enc_conv_proj_dim);
+    for (int i = 0; i < c->enc_layers && rc == 0; i++) {
+        qwen_enc_layer_t *l = &enc->layers[i];
+        rc |= walk_weight(wk, &l->wq_weight, ef, d, d);
+        rc |= walk_f32(wk, &l->wq_bias, d);
+        rc |= walk_weight(wk, &l->wk_weight, ef, d, d);
+        rc |= walk_f32(wk, &l->wk_bias, d);
+        rc |= walk_weight(wk, &l->wv_weight, ef, d, d);
+        rc |= walk_f32(wk, &l->wv_bias, d);
+        rc |= walk_weight(wk, &l->wo_weight, ef, d, d);
+        rc |= walk_f32(wk, &l->wo_bias, d);
+        rc |= walk_f32(wk, &l->attn_norm_weight, d);
+        rc |= walk_f32(wk, &l->attn_norm_bias, d);
+        rc |= walk_weight(wk, &l->fc1_weight, ef, c->enc_ffn_dim, d);
+        rc |= walk_f32(wk, &l->fc1_bias, c->enc_ffn_dim);
+        rc |= walk_weight(wk, &l->fc2_weight, ef, d, c->enc_ffn_dim);
+        rc |= walk_f32(wk, &l->fc2_bias, d);
+        rc |= walk_f32(wk, &l->ffn_norm_weight, d);
+        rc |= walk_f32(wk, &l->ffn_norm_bias, d);
+    }
+    rc |= walk_f32(wk, &enc->ln_post_weight, d);
+    rc |= walk_f32(wk, &enc->ln_post_bias, d);
+    rc |= walk_weight(wk, &enc->proj1_weight, ef, d, d);
+    rc |= walk_f32(wk, &enc->proj1_bias, d);
+    rc |= walk_weight(wk, &enc->proj2_weight, ef, c->enc_output_dim, d);
+    rc |= walk_f32(wk, &enc->proj2_bias, c->enc_output_dim);
+
+    int hidden = c->dec_hidden;
+    int q_dim = c->dec_heads * c->dec_head_dim;
+    int kv_dim = c->dec_kv_heads * c->dec_head_dim;
+    rc |= wk->fn(wk->arg, (void **)&dec->tok_embeddings_bf16,
+                 (size_t)c->vocab_size * hidden * sizeof(uint16_t));
+    rc |= walk_weight(wk, &dec->lm_head, df, c->vocab_size, hidden);
+    for (int i = 0; i < c->dec_layers && rc == 0; i++) {
+        qwen_dec_layer_t *l = &dec->layers[i];
+        rc |= walk_weight(wk, &l->wq, df, q_dim, hidden);
+        rc |= walk_weight(wk, &l->wk, df, kv_dim, hidden);
+        rc |= walk_weight(wk, &l->wv, df, kv_dim, hidden);
+        rc |= walk_weight(wk, &l->wo, df, hidden, q_dim);
+        rc |= walk_weight(wk, &l->gate_up, df, 2 * c->dec_intermediate, hidden);
+        rc |= walk_weight(wk, &l->down, df, hidden, c->dec_intermediate);
+        rc |= walk_f32(wk, &l->q_norm_weight, c->dec_head_dim);
+        rc |= walk_f32(wk, &l->k_norm_weight, c->dec_head_dim);
+        rc |= walk_f32(wk, &l->input_norm, hidden);
+        rc |= walk_f32(wk, &l->post_attn_norm, hidden);
+    }
+    rc |= walk_f32(wk, &dec->norm, hidden);
+    return rc ? -1 : 0;
+}
+
+/* ========================================================================
+ * Paths and Source Stamp
+ * ======================================================================== */
+
+static void compiled_path(const qwen_ctx_t *ctx, char *out, size_t cap) {
+    snprintf(out, cap, "%s/model.%s-%s.qwenc", ctx->model_dir,
+             qwen_weight_format_name(ctx->encoder.weight_format),
+             qwen_weight_format_name(ctx->decoder.weight_format));
+}
+
+/* Total size and newest mtime of the model's safetensors files. */
+static int source_stamp(const char *model_dir, uint64_t *bytes, int64_t *mtime) {
+    *bytes = 0;
+    *mtime = 0;
+    DIR *dir = opendir(model_dir);
+    if (!dir) return -1;
+    struct dirent *entry;
+    int n = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 12 || strcmp(entry->d_name + len - 12, ".safetensors") != 0) continue;
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", model_dir, entry->d_name);
+        if (stat(path, &st) != 0) continue;
+        *bytes += (uint64_t)st.st_size;
+        if ((int64_t)st.st_mtime > *mtime) *mtime = (int64_t)st.st_mtime;
+        n++;
+    }
+    closedir(dir);
+    return n > 0 ? 0 : -1;
+}
+
+/* ========================================================================
+ * Load
+ * ======================================================================== */
+
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    const qwenc_entry_t *entries;
+    uint32_t n_entries;
+    uint32_t next;
+} qwenc_reader_t;
+
+static int load_slot(void *arg, void **field, size_t bytes) {
+    qwenc_reader_t *r = (qwenc_reader_t *)arg;
+    if (r->next >= r->n_entries) return -1;
+    const qwenc_entry_t *e = &r->entries[r->next++];
+    if (e->bytes != bytes || e->offset % QWENC_ALIGN != 0 ||
+        e->offset > r->size || bytes > r->size - e->offset)
+        return -1;
+    *field = (void *)(r->base + e->offset);
+    return 0;
+}
+
+int qwen_compiled_load(qwen_ctx_t *ctx) {
+    const char *env = getenv("QWEN_COMPILED");
+    if (env && strcmp(env, "0") == 0) return -1;
+
+    char path[1024];
+    compiled_path(ctx, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(qwenc_header_t)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+
+    const qwenc_header_t *h = (const qwenc_header_t *)data;
+    uint64_t src_bytes = 0;
+    int64_t src_mtime = 0;
+    const char *why = NULL;
+    if (h->magic != QWENC_MAGIC || h->version != QWENC_VERSION ||
+        h->config_bytes != sizeof(qwen_config_t) || h->file_bytes != size)
+        why = "unsupported or truncated file";
+    else if (h->enc_format != ctx->encoder.weight_format ||
+             h->dec_format != ctx->decoder.weight_format)
+        why = "weight formats differ";
+    else if (source_stamp(ctx->model_dir, &src_bytes, &src_mtime) != 0 ||
+             src_bytes != h->source_bytes || src_mtime != h->source_mtime)
+        why = "safetensors changed";
+    else if (h->config.enc_layers <= 0 || h->config.enc_layers > QWEN_MAX_ENC_LAYERS ||
+             h->config.dec_layers <= 0 || h->config.dec_layers > QWEN_MAX_DEC_LAYERS ||
+             sizeof(qwenc_header_t) + (size_t)h->n_entries * sizeof(qwenc_entry_t) > size)
+        why = "bad header";
+    if (why) {
+        if (qwen_verbose >= 1) fprintf(stderr, "Compiled model %s ignored: %s\n", path, why);
+        munmap(data, size);
+        return -1;
+    }
+
+    ctx->config = h->config;
+    qwenc_reader_t r = {
+        (const uint8_t *)data, size,
+        (const qwenc_entry_t *)(h + 1), h->n_entries, 0
+    };
+    qwenc_walk_t wk = { 1, load_slot, &r };
+    if (walk_model(&wk, ctx) != 0 || r.next != r.n_entries) {
+        if (qwen_verbose >= 1) fprintf(stderr, "Compiled model %s ignored: bad table\n", path);
+        /* Nothing points into the mapping once the tensors are cleared */
+        memset(&ctx->encoder, 0, sizeof(ctx->encoder));
+        memset(&ctx->decoder, 0, sizeof(ctx->decoder));
+        ctx->encoder.weight_format = h->enc_format;
+        ctx->decoder.weight_format = h->dec_format;
+        munmap(data, size);
+        return -1;
+    }
+
+    /* Keep the documented aliasing: bf16 layer pointers name the matrices;
+     * quantized formats never touch bf16 layer weights after load. */
+    if (ctx->decoder.weight_format == QWEN_WEIGHT_BF16) {
+        for (int i = 0; i < ctx->config.dec_layers; i++) {
+            qwen_dec_layer_t *l = &ctx->decoder.layers[i];
+            l->wq_weight_bf16 = (uint16_t *)l->wq.bf16;
+            l->wk_weight_bf16 = (uint16_t *)l->wk.bf16;
+            l->wv_weight_bf16 = (uint16_t *)l->wv.bf16;
+            l->wo_weight_bf16 = (uint16_t *)l->wo.bf16;
+            l->down_weight_bf16 = (uint16_t *)l->down.bf16;
+        }
+    }
+
+    ctx->compiled = data;
+    ctx->compiled_bytes = size;
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "Mapped compiled model %s (%.1f MB, %u arrays)\n",
+                path, (double)size / (1024.0 * 1024.0), h->n_entries);
+    return 0;
+}
+
+int qwen_compiled_owns(const qwen_ctx_t *ctx, const void *p) {
+    const uint8_t *base = (const uint8_t *)ctx->compiled;
+    return base && p && (const uint8_t *)p >= base &&
+           (const uint8_t *)p < base + ctx->compiled_bytes;
+}
+
+void qwen_compiled_close(qwen_ctx_t *ctx) {
+    if (ctx->compiled) munmap(ctx->compiled, ctx->compiled_bytes);
+    ctx->compiled = NULL;
+    ctx->compiled_bytes = 0;
+}
+
+/* ========================================================================
+ * Save
+ * ======================================================================== */
+
+typedef struct {
+    const void *src;
+    qwenc_entry_t e;
+} qwenc_plan_item_t;
+
+typedef struct {
+    qwenc_plan_item_t *items;
+    int n, cap;
+    uint64_t end;              /* first free byte */
+} qwenc_plan_t;
+
+static uint64_t align_up(uint64_t x, uint64_t a) {
+    return (x + a - 1) / a * a;
+}
+
+static int plan_slot(void *arg, void **field, size_t bytes) {
+    qwenc_plan_t *p = (qwenc_plan_t *)arg;
+    if (!*field || bytes == 0) return -1;
+    if (p->n == p->cap) {
+        int new_cap = p->cap > 0 ? p->cap * 2 : 256;
+        qwenc_plan_item_t *tmp = (qwenc_plan_item_t *)realloc(
+            p->items, (size_t)new_cap * sizeof(qwenc_plan_item_t));
+        if (!tmp) return -1;
+        p->items = tmp;
+        p->cap = new_cap;
+    }
+    qwenc_plan_item_t *it = &p->items[p->n++];
+    it->src = *field;
+    it->e.bytes = bytes;
+    /* An array already placed (same pointer and size) is shared */
+    for (int i = 0; i < p->n - 1; i++) {
+        if (p->items[i].src == it->src && p->items[i].e.bytes == bytes) {
+            it->e.offset = p->items[i].e.offset;
+            return 0;
+        }
+    }
+    it->e.offset = align_up(p->end, bytes >= QWENC_PAGE_ALIGN ? QWENC_PAGE_ALIGN : QWENC_ALIGN);
+    p->end = it->e.offset + bytes;
+    return 0;
+}
+
+int qwen_compile_model(qwen_ctx_t *ctx) {
+    if (!ctx) return -1;
+
+    qwenc_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = QWENC_MAGIC;
+    h.version = QWENC_VERSION;
+    h.config_bytes = sizeof(qwen_config_t);
+    h.enc_format = ctx->encoder.weight_format;
+    h.dec_format = ctx->decoder.weight_format;
+    h.config = ctx->config;
+    if (source_stamp(ctx->model_dir, &h.source_bytes, &h.source_mtime) != 0) {
+        fprintf(stderr, "qwen_compile_model: no safetensors in %s\n", ctx->model_dir);
+        return -1;
+    }
+
+    /* Count entries first so the table size (and every offset) is known */
+    qwenc_plan_t plan = { NULL, 0, 0, 0 };
+    qwenc_walk_t wk = { 0, plan_slot, &plan };
+    if (walk_model(&wk, ctx) != 0) {
+        free(plan.items);
+        fprintf(stderr, "qwen_compile_model: model is incomplete\n");
+        return -1;
+    }
+    uint64_t data_start = sizeof(qwenc_header_t) + (uint64_t)plan.n * sizeof(qwenc_entry_t);
+    plan.n = 0;
+    plan.end = data_start;
+    if (walk_model(&wk, ctx) != 0) {
+        free(plan.items);
+        return -1;
+    }
+    h.n_entries = (uint32_t)plan.n;
+    h.file_bytes = plan.end;
+
+    char path[1024], tmp_path[1100];
+    compiled_path(ctx, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        free(plan.items);
+        fprintf(stderr, "qwen_compile_model: cannot create %s\n", tmp_path);
+        return -1;
+    }
+
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (int i = 0; ok && i < plan.n; i++)
+        ok = fwrite(&plan.items[i].e, sizeof(qwenc_entry_t), 1, f) == 1;
+    /* Arrays in offset order; shared ones were placed by their first use */
+    static const uint8_t zeros[QWENC_PAGE_ALIGN];
+    uint64_t pos = data_start;
+    for (int i = 0; ok && i < plan.n; i++) {
+        const qwenc_entry_t *e = &plan.items[i].e;
+        if (e->offset < pos) continue;
+        while (ok && pos < e->offset) {
+            size_t pad = (size_t)(e->offset - pos) < sizeof(zeros)
+                             ? (size_t)(e->offset - pos) : sizeof(zeros);
+            ok = fwrite(zeros, 1, pad, f) == pad;
+            pos += pad;
+        }
+        ok = ok && fwrite(plan.items[i].src, 1, (size_t)e->bytes, f) == e->bytes;
+        pos += e->bytes;
+    }
+    free(plan.items);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        fprintf(stderr, "qwen_compile_model: failed to write %s\n", path);
+        return -1;
+    }
+    if (qwen_verbose >= 1)
+        fprintf(stderr, "Wrote compiled model %s (%.1f MB)\n",
+                path, (double)h.file_bytes / (1024.0 * 1024.0));
+    return 0;
+}
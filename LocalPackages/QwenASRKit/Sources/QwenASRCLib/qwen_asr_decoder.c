@@ -12,6 +12,7 @@
 
 #include "qwen_asr.h"
 #include "qwen_asr_kernels.h"
+#include "qwen_asr_perf.h"
 #include "qwen_asr_safetensors.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -42,15 +43,36 @@ static uint16_t *load_bf16_direct(multi_safetensors_t *ms, const char *name) {
     return safetensors_get_bf16_direct(sf, t);
 }
 
+/* Wrap a bf16 matrix in the decoder's storage format. */
+static int dec_weight(qwen_weight_t *w, const uint16_t *src,
+                      int out_dim, int in_dim, int format) {
+    if (qwen_weight_from_bf16(w, src, out_dim, in_dim, format) != 0) {
+        fprintf(stderr, "decoder: cannot build %s weight [%d, %d]\n",
+                qwen_weight_format_name(format), out_dim, in_dim);
+        return -1;
+    }
+    return 0;
+}
+
 int qwen_decoder_load(qwen_decoder_t *dec, multi_safetensors_t *ms,
                        const qwen_config_t *cfg) {
     char name[512];
+    int fmt = dec->weight_format;
+    int hidden = cfg->dec_hidden;
+    int inter = cfg->dec_intermediate;
+    int q_dim = cfg->dec_heads * cfg->dec_head_dim;
+    int kv_dim = cfg->dec_kv_heads * cfg->dec_head_dim;
 
     /* Token embeddings (large, bf16 mmap direct) */
     dec->tok_embeddings_bf16 = load_bf16_direct(ms,
         "thinker.model.embed_tokens.weight");
     if (!dec->tok_embeddings_bf16) return -1;
 
+    /* Tied LM head: embedding lookups keep reading bf16 rows, the per-token
+     * argmax reads this copy. */
+    if (dec_weight(&dec->lm_head, dec->tok_embeddings_bf16,
+                   cfg->vocab_size, hidden, fmt) != 0) return -1;
+
     /* Transformer layers */
     for (int i = 0; i < cfg->dec_layers; i++) {
         qwen_dec_layer_t *l = &dec->layers[i];
@@ -94,10 +116,9 @@ int qwen_decoder_load(qwen_decoder_t *dec, multi_safetensors_t *ms,
 
         /* Fuse gate+up weights: interleave rows [gate_row0, up_row0, gate_row1, up_row1, ...] */
         {
-            int inter = cfg->dec_intermediate;
-            int hidden = cfg->dec_hidden;
             size_t row_bytes = (size_t)hidden * sizeof(uint16_t);
             l->gate_up_fused_bf16 = (uint16_t *)malloc(2 * (size_t)inter * row_bytes);
+            if (!l->gate_up_fused_bf16) return -1;
             for (int r = 0; r < inter; r++) {
                 memcpy(l->gate_up_fused_bf16 + (size_t)(2 * r) * hidden,
                        l->gate_weight_bf16 + (size_t)r * hidden, row_bytes);
@@ -106,6 +127,21 @@ int qwen_decoder_load(qwen_decoder_t *dec, multi_safetensors_t *ms,
             }
         }
 
+        if (dec_weight(&l->wq, l->wq_weight_bf16, q_dim, hidden, fmt) != 0 ||
+            dec_weight(&l->wk, l->wk_weight_bf16, kv_dim, hidden, fmt) != 0 ||
+            dec_weight(&l->wv, l->wv_weight_bf16, kv_dim, hidden, fmt) != 0 ||
+            dec_weight(&l->wo, l->wo_weight_bf16, hidden, q_dim, fmt) != 0 ||
+            dec_weight(&l->gate_up, l->gate_up_fused_bf16, 2 * inter, hidden, fmt) != 0 ||
+            dec_weight(&l->down, l->down_weight_bf16, hidden, inter, fmt) != 0) {
+            fprintf(stderr, "decoder: failed to prepare layer %d\n", i);
+            return -1;
+        }
+
+        /* The quantized gate_up owns its own interleaved copy */
+        if (fmt != QWEN_WEIGHT_BF16) {
+            free(l->gate_up_fused_bf16);
+            l->gate_up_fused_bf16 = NULL;
+        }
     }
 
     /* Final RMSNorm */
@@ -119,56 +155,21 @@ int qwen_decoder_load(qwen_decoder_t *dec, multi_safetensors_t *ms,
  * KV Cache Management
  * ======================================================================== */
 
-static int kv_cache_init(qwen_ctx_t *ctx, int max_seq) {
-    int kv_dim = ctx->config.dec_kv_heads * ctx->config.dec_head_dim;
-    size_t cache_size = (size_t)ctx->config.dec_layers * max_seq * kv_dim * sizeof(float);
-    ctx->kv_cache_k = (float *)calloc(1, cache_size);
-    ctx->kv_cache_v = (float *)calloc(1, cache_size);
-    ctx->kv_cache_len = 0;
-    ctx->kv_cache_max = max_seq;
-    if (!ctx->kv_cache_k || !ctx->kv_cache_v) return -1;
-    return 0;
-}
-
-static int kv_cache_grow(qwen_ctx_t *ctx, int required) {
-    if (required <= ctx->kv_cache_max) return 0;
-
-    int kv_dim = ctx->config.dec_kv_heads * ctx->config.dec_head_dim;
-    int new_max = ctx->kv_cache_max;
-    while (new_max < required) new_max *= 2;
-
-    size_t new_stride = (size_t)new_max * kv_dim;
-    size_t old_stride = (size_t)ctx->kv_cache_max * kv_dim;
-    size_t total = (size_t)ctx->config.dec_layers * new_stride * sizeof(float);
-
-    float *new_k = (float *)calloc(1, total);
-    float *new_v = (float *)calloc(1, total);
-    if (!new_k || !new_v) { free(new_k); free(new_v); return -1; }
-
-    size_t copy = (size_t)ctx->kv_cache_len * kv_dim * sizeof(float);
-    for (int l = 0; l < ctx->config.dec_layers; l++) {
-        memcpy(new_k + l * new_stride, ctx->kv_cache_k + l * old_stride, copy);
-        memcpy(new_v + l * new_stride, ctx->kv_cache_v + l * old_stride, copy);
+/* Reserve pages for positions [0, required), setting the cache up in
+ * ctx->kv_format on first use. Pages are added without copying. */
+static int kv_cache_ensure(qwen_ctx_t *ctx, int required) {
+    qwen_kv_cache_t *kv = &ctx->kv_cache;
+    if (!kv->page_bytes) {
+        if (qwen_kv_cache_init(kv, ctx->kv_format, ctx->config.dec_layers,
+                               ctx->config.dec_kv_heads, ctx->config.dec_head_dim) != 0)
+            return -1;
+        ctx->kv_cache_len = 0;
     }
-
-    free(ctx->kv_cache_k);
-    free(ctx->kv_cache_v);
-    ctx->kv_cache_k = new_k;
-    ctx->kv_cache_v = new_v;
-    ctx->kv_cache_max = new_max;
+    if (qwen_kv_cache_reserve(kv, required) != 0) return -1;
+    ctx->kv_cache_max = qwen_kv_cache_capacity(kv);
     return 0;
 }
 
-static float *kv_cache_k_at(qwen_ctx_t *ctx, int layer, int pos) {
-    int kv_dim = ctx->config.dec_kv_heads * ctx->config.dec_head_dim;
-    return ctx->kv_cache_k + ((size_t)layer * ctx->kv_cache_max + pos) * kv_dim;
-}
-
-static float *kv_cache_v_at(qwen_ctx_t *ctx, int layer, int pos) {
-    int kv_dim = ctx->config.dec_kv_heads * ctx->config.dec_head_dim;
-    return ctx->kv_cache_v + ((size_t)layer * ctx->kv_cache_max + pos) * kv_dim;
-}
-
 static int ensure_prefill_buffers(qwen_ctx_t *ctx, int seq_len) {
     const qwen_config_t *cfg = &ctx->config;
     int dim = cfg->dec_hidden;
@@ -259,9 +260,19 @@ static int ensure_rope_cache(qwen_ctx_t *ctx, int required_pos, int head_dim, fl
  * Decoder Prefill (Multiple Tokens)
  * ======================================================================== */
 
+/* bf16 prefill keeps the cached f32 expansion path; quantized formats expand
+ * tiles on the fly so the bf16 pages stay cold. */
+static void dec_linear(float *y, const float *x, const qwen_weight_t *W, int seq_len) {
+    if (W->format == QWEN_WEIGHT_BF16)
+        qwen_linear_nobias_bf16(y, x, W->bf16, seq_len, W->in_dim, W->out_dim);
+    else
+        qwen_linear_w(y, x, W, NULL, seq_len);
+}
+
 void qwen_decoder_prefill(qwen_ctx_t *ctx, const float *input_embeds, int seq_len) {
     qwen_decoder_t *dec = &ctx->decoder;
     const qwen_config_t *cfg = &ctx->config;
+    const qwen_dec_kernels_t *kern = ctx->dec_kernels;
     int dim = cfg->dec_hidden;
     int n_heads = cfg->dec_heads;
     int n_kv_heads = cfg->dec_kv_heads;
@@ -269,17 +280,14 @@ void qwen_decoder_prefill(qwen_ctx_t *ctx, const float *input_embeds, int seq_le
     int intermediate = cfg->dec_intermediate;
     float eps = cfg->dec_rms_norm_eps;
     float theta = cfg->dec_rope_theta;
-    int q_dim = n_heads * head_dim;
-    int kv_dim = n_kv_heads * head_dim;
 
     /* Ensure KV cache */
-    if (!ctx->kv_cache_k) {
-        if (kv_cache_init(ctx, seq_len + 1024) != 0) return;
-    } else if (ctx->kv_cache_len + seq_len > ctx->kv_cache_max) {
-        if (kv_cache_grow(ctx, ctx->kv_cache_len + seq_len + 1024) != 0) return;
-    }
+    if (kv_cache_ensure(ctx, ctx->kv_cache_len + seq_len) != 0) return;
 
     if (ensure_prefill_buffers(ctx, seq_len) != 0) return;
+    qwen_perf_note_memory(ctx, qwen_kv_cache_bytes(&ctx->kv_cache));
+    double perf_t0 = qwen_perf_now_ms();
+    qwen_signpost_begin(ctx, QWEN_SIGNPOST_PREFILL);
 
     float *x = ctx->pref_x;
     float *x_norm = ctx->pref_x_norm;
@@ -301,16 +309,22 @@ void qwen_decoder_prefill(qwen_ctx_t *ctx, const float *input_embeds, int seq_le
 
     float scale = 1.0f / sqrtf((float)head_dim);
 
+    /* Page the next layer in while this one computes */
+    int prefetch = ctx->weights_cold || ctx->low_memory;
+    if (prefetch) qwen_residency_prefetch_dec_layer(ctx, 0);
+
     for (int layer = 0; layer < cfg->dec_layers; layer++) {
         qwen_dec_layer_t *l = &dec->layers[layer];
+        if (prefetch) qwen_residency_prefetch_dec_layer(ctx, layer + 1);
+        QWEN_PERF_LAYER_BEGIN();
 
         /* Input RMSNorm */
-        qwen_rms_norm(x_norm, x, l->input_norm, seq_len, dim, eps);
+        kern->rms_norm(x_norm, x, l->input_norm, seq_len, dim, eps);
 
         /* QKV projections (no bias) */
-        qwen_linear_nobias_bf16(q, x_norm, l->wq_weight_bf16, seq_len, dim, q_dim);
-        qwen_linear_nobias_bf16(k, x_norm, l->wk_weight_bf16, seq_len, dim, kv_dim);
-        qwen_linear_nobias_bf16(v, x_norm, l->wv_weight_bf16, seq_len, dim, kv_dim);
+        dec_linear(q, x_norm, &l->wq, seq_len);
+        dec_linear(k, x_norm, &l->wk, seq_len);
+        dec_linear(v, x_norm, &l->wv, seq_len);
 
         /* Per-head Q/K RMSNorm */
         qwen_rms_norm_per_head(q, l->q_norm_weight, seq_len, n_heads, head_dim, eps);
@@ -321,47 +335,78 @@ void qwen_decoder_prefill(qwen_ctx_t *ctx, const float *input_embeds, int seq_le
         qwen_apply_rope_neox(k, rope_cos, rope_sin, seq_len, n_kv_heads, head_dim);
 
         /* Store K, V in cache */
-        for (int s = 0; s < seq_len; s++) {
-            memcpy(kv_cache_k_at(ctx, layer, start_pos + s),
-                   k + s * kv_dim, kv_dim * sizeof(float));
-            memcpy(kv_cache_v_at(ctx, layer, start_pos + s),
-                   v + s * kv_dim, kv_dim * sizeof(float));
-        }
+        qwen_kv_cache_store(&ctx->kv_cache, layer, start_pos, seq_len, k, v);
 
         /* Causal attention */
         int total_seq = start_pos + seq_len;
-        float *full_k = kv_cache_k_at(ctx, layer, 0);
-        float *full_v = kv_cache_v_at(ctx, layer, 0);
-        qwen_causal_attention(attn_out, q, full_k, full_v,
-                               seq_len, total_seq, n_heads, n_kv_heads,
-                               head_dim, scale, start_pos);
+        kern->causal_attention_kv(attn_out, q, &ctx->kv_cache, layer,
+                                  seq_len, total_seq, n_heads, scale, start_pos);
 
         /* Output projection + residual */
-        qwen_linear_nobias_bf16(proj_out, attn_out, l->wo_weight_bf16,
-                                 seq_len, q_dim, dim);
+        dec_linear(proj_out, attn_out, &l->wo, seq_len);
         qwen_add_inplace(x, proj_out, seq_len * dim);
 
         /* Post-attention RMSNorm */
-        qwen_rms_norm(x_norm, x, l->post_attn_norm, seq_len, dim, eps);
+        kern->rms_norm(x_norm, x, l->post_attn_norm, seq_len, dim, eps);
 
         /* SwiGLU MLP */
-        qwen_linear_nobias_bf16(gate_up, x_norm, l->gate_up_fused_bf16,
-                                 seq_len, dim, 2 * intermediate);
+        dec_linear(gate_up, x_norm, &l->gate_up, seq_len);
         qwen_swiglu_multiply(gate, gate_up, seq_len, intermediate);
-        qwen_linear_nobias_bf16(ffn_out, gate, l->down_weight_bf16,
-                                 seq_len, intermediate, dim);
+        dec_linear(ffn_out, gate, &l->down, seq_len);
 
         qwen_add_inplace(x, ffn_out, seq_len * dim);
-
+        QWEN_PERF_LAYER_END(ctx->perf_dec_layer_ms, layer);
     }
 
     ctx->kv_cache_len = start_pos + seq_len;
+    qwen_signpost_end(ctx, QWEN_SIGNPOST_PREFILL);
+    ctx->perf_prefill_ms += qwen_perf_now_ms() - perf_t0;
 }
 
 /* ========================================================================
  * Decoder Forward (Single Token Generation)
  * ======================================================================== */
 
+/* CHECK: count a FAST pick against the full argmax, which is returned */
+static int lm_head_check(qwen_ctx_t *ctx, int token, int ref) {
+    ctx->lm_check_tokens++;
+    if (ref != token) {
+        ctx->lm_check_mismatch++;
+        if (qwen_verbose >= 2)
+            fprintf(stderr, "  LM head mismatch at pos %d: fast %d, full %d\n",
+                    ctx->kv_cache_len, token, ref);
+    }
+    return ref;
+}
+
+/* Greedy token from the final hidden state. FAST/CHECK score the active
+ * vocabulary with the int4 draft and re-score the top-k against lm_head;
+ * CHECK also runs the full argmax and returns it. */
+static int lm_head_argmax(qwen_ctx_t *ctx, const float *x) {
+    const qwen_decoder_t *dec = &ctx->decoder;
+    if (ctx->lm_head_mode == QWEN_LM_HEAD_FULL || !ctx->lm_vocab_ready)
+        return qwen_argmax_matvec_w(x, &dec->lm_head);
+
+    int cand[QWEN_TOPK_MAX];
+    float score[QWEN_TOPK_MAX];
+    int token;
+    if (ctx->lm_draft.out_dim > 0) {
+        int n = qwen_topk_matvec_w(x, &ctx->lm_draft, ctx->lm_head_topk, ctx->lm_topk,
+                                   cand, score);
+        if (ctx->lm_vocab) {
+            for (int i = 0; i < n; i++) cand[i] = ctx->lm_vocab[cand[i]];
+        }
+        token = qwen_argmax_rows_w(x, &dec->lm_head, cand, n);
+    } else {
+        /* lm_head is already int4 and nothing is pruned */
+        token = qwen_argmax_matvec_w(x, &dec->lm_head);
+    }
+
+    if (ctx->lm_head_mode == QWEN_LM_HEAD_CHECK)
+        return lm_head_check(ctx, token, qwen_argmax_matvec_w(x, &dec->lm_head));
+    return token;
+}
+
 static void ensure_dec_buffers(qwen_ctx_t *ctx) {
     if (ctx->dec_x) return;
     const qwen_config_t *cfg = &ctx->config;
@@ -379,7 +424,7 @@ static void ensure_dec_buffers(qwen_ctx_t *ctx) {
     ctx->dec_attn_out = (float *)malloc(q_dim * sizeof(float));
     ctx->dec_proj_out = (float *)malloc(dim * sizeof(float));
     ctx->dec_gate     = (float *)malloc(2 * intermediate * sizeof(float));
-    ctx->dec_up       = NULL; /* unused: gate buffer holds fused gate+up */
+    ctx->dec_up       = (float *)malloc(intermediate * sizeof(float)); /* SwiGLU output */
     ctx->dec_ffn_out  = (float *)malloc(dim * sizeof(float));
     ctx->dec_rope_cos = (float *)malloc(head_dim * sizeof(float));
     ctx->dec_rope_sin = (float *)malloc(head_dim * sizeof(float));
@@ -388,15 +433,13 @@ static void ensure_dec_buffers(qwen_ctx_t *ctx) {
 int qwen_decoder_forward(qwen_ctx_t *ctx, const float *input_embed) {
     qwen_decoder_t *dec = &ctx->decoder;
     const qwen_config_t *cfg = &ctx->config;
+    const qwen_dec_kernels_t *kern = ctx->dec_kernels;
     int dim = cfg->dec_hidden;
     int n_heads = cfg->dec_heads;
-    int n_kv_heads = cfg->dec_kv_heads;
     int head_dim = cfg->dec_head_dim;
-    int intermediate = cfg->dec_intermediate;
     float eps = cfg->dec_rms_norm_eps;
     float theta = cfg->dec_rope_theta;
-    int q_dim = n_heads * head_dim;
-    int kv_dim = n_kv_heads * head_dim;
+    double perf_t0 = qwen_perf_now_ms();
 
     ensure_dec_buffers(ctx);
     float *x = ctx->dec_x;
@@ -405,16 +448,16 @@ int qwen_decoder_forward(qwen_ctx_t *ctx, const float *input_embed) {
     float *k = ctx->dec_k;
     float *v = ctx->dec_v;
     float *attn_out = ctx->dec_attn_out;
-    float *proj_out = ctx->dec_proj_out;
     float *gate_buf = ctx->dec_gate;
-    float *ffn_out = ctx->dec_ffn_out;
+    float *ffn_in = ctx->dec_up;
     memcpy(x, input_embed, dim * sizeof(float));
 
     int pos = ctx->kv_cache_len;
 
     /* Grow KV cache if needed */
     if (pos >= ctx->kv_cache_max) {
-        if (kv_cache_grow(ctx, pos + 1024) != 0) return QWEN_TOKEN_IM_END;
+        if (kv_cache_ensure(ctx, pos + 1) != 0) return QWEN_TOKEN_IM_END;
+        qwen_perf_note_memory(ctx, qwen_kv_cache_bytes(&ctx->kv_cache));
     }
 
     if (ensure_rope_cache(ctx, pos + 1, head_dim, theta) != 0) {
@@ -425,52 +468,350 @@ int qwen_decoder_forward(qwen_ctx_t *ctx, const float *input_embed) {
 
     float scale = 1.0f / sqrtf((float)head_dim);
 
+    /* One wake-up for the whole token step: workers stay hot across the
+     * ~7 dispatches per layer and the LM head */
+    qwen_parallel_begin();
+
+    /* Only cold passes prefetch: a madvise per matrix per token is not free */
+    int prefetch = ctx->weights_cold;
+    if (prefetch) qwen_residency_prefetch_dec_layer(ctx, 0);
+
     for (int layer = 0; layer < cfg->dec_layers; layer++) {
         qwen_dec_layer_t *l = &dec->layers[layer];
+        if (prefetch) qwen_residency_prefetch_dec_layer(ctx, layer + 1);
+        QWEN_PERF_LAYER_BEGIN();
+
+        kern->rms_norm(x_norm, x, l->input_norm, 1, dim, eps);
+        /* QKV matvec; per-head Q/K RMSNorm, NeoX RoPE and the K/V cache
+         * write run on each worker's heads in the same dispatch */
+        qwen_linear_w_qkv_rope(q, k, v, x_norm, &l->wq, &l->wk, &l->wv,
+                               l->q_norm_weight, l->k_norm_weight, eps,
+                               rope_cos, rope_sin, head_dim,
+                               &ctx->kv_cache, layer, pos, 1);
+        kern->causal_attention_kv(attn_out, q, &ctx->kv_cache, layer,
+                                  1, pos + 1, n_heads, scale, pos);
+
+        /* Residual adds ride on the O and down outputs */
+        qwen_linear_w_residual(x, attn_out, &l->wo, 1);
+
+        kern->rms_norm(x_norm, x, l->post_attn_norm, 1, dim, eps);
+
+        /* Fused gate+up matvec (rows interleaved [g0,u0,g1,u1,...]) with
+         * SwiGLU applied to each worker's pairs */
+        qwen_linear_w_swiglu(ffn_in, gate_buf, x_norm, &l->gate_up, 1);
+        qwen_linear_w_residual(x, ffn_in, &l->down, 1);
+        QWEN_PERF_LAYER_END(ctx->perf_dec_layer_ms, layer);
+    }
 
-        qwen_rms_norm(x_norm, x, l->input_norm, 1, dim, eps);
-        qwen_linear_nobias_bf16_qkv(q, k, v, x_norm,
-                                    l->wq_weight_bf16,
-                                    l->wk_weight_bf16,
-                                    l->wv_weight_bf16,
-                                    dim, q_dim, kv_dim);
+    ctx->kv_cache_len = pos + 1;
+    ctx->weights_cold = 0;
 
-        /* Per-head Q/K RMSNorm */
-        qwen_rms_norm_per_head(q, l->q_norm_weight, 1, n_heads, head_dim, eps);
-        qwen_rms_norm_per_head(k, l->k_norm_weight, 1, n_kv_heads, head_dim, eps);
+    /* Final norm + streaming argmax (no logits buffer needed) */
+    kern->rms_norm(x, x, dec->norm, 1, dim, eps);
+    int token = lm_head_argmax(ctx, x);
 
-        /* Apply NeoX RoPE */
-        qwen_apply_rope_neox(q, rope_cos, rope_sin, 1, n_heads, head_dim);
-        qwen_apply_rope_neox(k, rope_cos, rope_sin, 1, n_kv_heads, head_dim);
+    qwen_parallel_end();
+    qwen_perf_decode_step(ctx, perf_t0);
+    return token;
+}
 
-        memcpy(kv_cache_k_at(ctx, layer, pos), k, kv_dim * sizeof(float));
-        memcpy(kv_cache_v_at(ctx, layer, pos), v, kv_dim * sizeof(float));
+/* ========================================================================
+ * Batched Decoder Forward (one token for each of n sequences)
+ * ======================================================================== */
 
-        int total_seq = pos + 1;
-        float *full_k = kv_cache_k_at(ctx, layer, 0);
-        float *full_v = kv_cache_v_at(ctx, layer, 0);
+static int ensure_batch_buffers(qwen_ctx_t *ctx, int n) {
+    if (n <= ctx->bat_cap) return 0;
+    const qwen_config_t *cfg = &ctx->config;
+    int dim = cfg->dec_hidden;
+    int q_dim = cfg->dec_heads * cfg->dec_head_dim;
+    int kv_dim = cfg->dec_kv_heads * cfg->dec_head_dim;
+    int intermediate = cfg->dec_intermediate;
 
-        qwen_causal_attention(attn_out, q, full_k, full_v,
-                               1, total_seq, n_heads, n_kv_heads,
-                               head_dim, scale, pos);
+#define REALLOC_BAT(ptr, count) do {                                           \
+    void *tmp__ = realloc((ptr), (size_t)(count) * sizeof(float));             \
+    if (!tmp__) return -1;                                                      \
+    (ptr) = (float *)tmp__;                                                     \
+} while (0)
 
-        qwen_linear_nobias_bf16(proj_out, attn_out, l->wo_weight_bf16, 1, q_dim, dim);
-        qwen_add_inplace(x, proj_out, dim);
+    REALLOC_BAT(ctx->bat_x, n * dim);
+    REALLOC_BAT(ctx->bat_x_norm, n * dim);
+    REALLOC_BAT(ctx->bat_q, n * q_dim);
+    REALLOC_BAT(ctx->bat_k, n * kv_dim);
+    REALLOC_BAT(ctx->bat_v, n * kv_dim);
+    REALLOC_BAT(ctx->bat_attn_out, n * q_dim);
+    REALLOC_BAT(ctx->bat_proj_out, n * dim);
+    REALLOC_BAT(ctx->bat_ffn_out, n * dim);
+    REALLOC_BAT(ctx->bat_gate, n * intermediate);
+    REALLOC_BAT(ctx->bat_gate_up, n * 2 * intermediate);
+    REALLOC_BAT(ctx->bat_logits, (size_t)n * cfg->vocab_size);
+
+#undef REALLOC_BAT
+
+    ctx->bat_cap = n;
+    return 0;
+}
 
-        qwen_rms_norm(x_norm, x, l->post_attn_norm, 1, dim, eps);
+static int logits_argmax(const float *logits, int n) {
+    int best = 0;
+    for (int t = 1; t < n; t++)
+        if (logits[t] > logits[best]) best = t;
+    return best;
+}
 
-        /* Fused gate+up matvec: one pass over x_norm, output interleaved [g0,u0,g1,u1,...] */
-        qwen_linear_nobias_bf16(gate_buf, x_norm, l->gate_up_fused_bf16,
-                                 1, dim, 2 * intermediate);
-        /* In-place for seq=1: gate_buf[0:inter] receives SwiGLU output. */
-        qwen_swiglu_multiply(gate_buf, gate_buf, 1, intermediate);
-        qwen_linear_nobias_bf16(ffn_out, gate_buf, l->down_weight_bf16, 1, intermediate, dim);
-        qwen_add_inplace(x, ffn_out, dim);
+/* Indices of the k largest of v[0..n), unordered; k <= QWEN_TOPK_MAX. */
+static int logits_topk(const float *v, int n, int k, int *idx) {
+    float val[QWEN_TOPK_MAX];
+    if (k > n) k = n;
+    int m = 0, lo = 0;
+    for (int i = 0; i < n; i++) {
+        if (m < k) {
+            idx[m] = i;
+            val[m] = v[i];
+            if (v[i] < val[lo]) lo = m;
+            m++;
+            continue;
+        }
+        if (v[i] <= val[lo]) continue;
+        idx[lo] = i;
+        val[lo] = v[i];
+        for (int j = 0; j < k; j++)
+            if (val[j] < val[lo]) lo = j;
     }
+    return m;
+}
 
-    ctx->kv_cache_len = pos + 1;
+/* Greedy tokens for n final hidden states. Up to QWEN_DECODE_BATCH_MAX rows
+ * share each pass over the head's weights: the full-vocabulary head in FULL
+ * mode, the int4 draft in FAST/CHECK, whose top-k per row is then re-scored
+ * exactly (CHECK adds a batched full pass for its reference). */
+static int lm_head_argmax_rows(qwen_ctx_t *ctx, const float *x, int n, int *tokens) {
+    const qwen_config_t *cfg = &ctx->config;
+    const qwen_decoder_t *dec = &ctx->decoder;
+    int dim = cfg->dec_hidden;
+    if (n == 1) {
+        tokens[0] = lm_head_argmax(ctx, x);
+        return 0;
+    }
+    int fast = ctx->lm_head_mode != QWEN_LM_HEAD_FULL && ctx->lm_vocab_ready;
+    /* An int4 lm_head with nothing pruned has no draft: score it directly */
+    const qwen_weight_t *W = fast && ctx->lm_draft.out_dim > 0 ? &ctx->lm_draft : &dec->lm_head;
+    int rows = W->out_dim;
+    for (int r0 = 0; r0 < n; r0 += QWEN_DECODE_BATCH_MAX) {
+        int nr = n - r0 < QWEN_DECODE_BATCH_MAX ? n - r0 : QWEN_DECODE_BATCH_MAX;
+        const float *xr = x + (size_t)r0 * dim;
+        if (ensure_batch_buffers(ctx, nr) != 0) return -1;
+        qwen_linear_w_batch(ctx->bat_logits, xr, W, nr);
+        for (int i = 0; i < nr; i++) {
+            const float *logits = ctx->bat_logits + (size_t)i * rows;
+            if (W == &dec->lm_head) {
+                tokens[r0 + i] = logits_argmax(logits, rows);
+                continue;
+            }
+            int cand[QWEN_TOPK_MAX];
+            int k = logits_topk(logits, rows, ctx->lm_head_topk, cand);
+            if (ctx->lm_vocab) {
+                for (int j = 0; j < k; j++) cand[j] = ctx->lm_vocab[cand[j]];
+            }
+            tokens[r0 + i] = qwen_argmax_rows_w(xr + (size_t)i * dim, &dec->lm_head, cand, k);
+        }
+        if (fast && ctx->lm_head_mode == QWEN_LM_HEAD_CHECK) {
+            qwen_linear_w_batch(ctx->bat_logits, xr, &dec->lm_head, nr);
+            for (int i = 0; i < nr; i++) {
+                int ref = logits_argmax(ctx->bat_logits + (size_t)i * cfg->vocab_size,
+                                        cfg->vocab_size);
+                tokens[r0 + i] = lm_head_check(ctx, tokens[r0 + i], ref);
+            }
+        }
+    }
+    return 0;
+}
 
-    /* Final norm + streaming argmax (no logits buffer needed) */
-    qwen_rms_norm(x, x, dec->norm, 1, dim, eps);
-    return qwen_argmax_matvec_bf16(x, dec->tok_embeddings_bf16, dim, cfg->vocab_size);
+/* Reserve position `pos` of a per-sequence cache, setting it up on first use */
+static int batch_cache_ensure(qwen_ctx_t *ctx, qwen_kv_cache_t *kv, int pos) {
+    if (!kv->page_bytes &&
+        qwen_kv_cache_init(kv, ctx->kv_format, ctx->config.dec_layers,
+                           ctx->config.dec_kv_heads, ctx->config.dec_head_dim) != 0)
+        return -1;
+    return qwen_kv_cache_reserve(kv, pos + 1);
+}
+
+int qwen_decoder_forward_batch(qwen_ctx_t *ctx, qwen_kv_cache_t *const *caches, int *lens,
+                               const float *input_embeds, int n, int *tokens) {
+    qwen_decoder_t *dec = &ctx->decoder;
+    const qwen_config_t *cfg = &ctx->config;
+    const qwen_dec_kernels_t *kern = ctx->dec_kernels;
+    int dim = cfg->dec_hidden;
+    int n_heads = cfg->dec_heads;
+    int n_kv_heads = cfg->dec_kv_heads;
+    int head_dim = cfg->dec_head_dim;
+    int intermediate = cfg->dec_intermediate;
+    int q_dim = n_heads * head_dim;
+    int kv_dim = n_kv_heads * head_dim;
+    float eps = cfg->dec_rms_norm_eps;
+    float theta = cfg->dec_rope_theta;
+
+    if (n <= 0) return 0;
+    double perf_t0 = qwen_perf_now_ms();
+    if (ensure_batch_buffers(ctx, n) != 0) return -1;
+    int max_pos = 0;
+    size_t kv_bytes = 0;
+    for (int i = 0; i < n; i++) {
+        if (batch_cache_ensure(ctx, caches[i], lens[i]) != 0) return -1;
+        if (lens[i] > max_pos) max_pos = lens[i];
+        kv_bytes += qwen_kv_cache_bytes(caches[i]);
+    }
+    qwen_perf_note_memory(ctx, kv_bytes);
+    if (ensure_rope_cache(ctx, max_pos + 1, head_dim, theta) != 0) return -1;
+
+    float *x = ctx->bat_x;
+    float *x_norm = ctx->bat_x_norm;
+    float *q = ctx->bat_q;
+    float *k = ctx->bat_k;
+    float *v = ctx->bat_v;
+    float *attn_out = ctx->bat_attn_out;
+    float *proj_out = ctx->bat_proj_out;
+    float *ffn_out = ctx->bat_ffn_out;
+    float *gate = ctx->bat_gate;
+    float *gate_up = ctx->bat_gate_up;
+    memcpy(x, input_embeds, (size_t)n * dim * sizeof(float));
+
+    float scale = 1.0f / sqrtf((float)head_dim);
+
+    qwen_parallel_begin();
+
+    int prefetch = ctx->weights_cold;
+    if (prefetch) qwen_residency_prefetch_dec_layer(ctx, 0);
+
+    for (int layer = 0; layer < cfg->dec_layers; layer++) {
+        qwen_dec_layer_t *l = &dec->layers[layer];
+        if (prefetch) qwen_residency_prefetch_dec_layer(ctx, layer + 1);
+        QWEN_PERF_LAYER_BEGIN();
+
+        kern->rms_norm(x_norm, x, l->input_norm, n, dim, eps);
+        qwen_linear_w_batch(q, x_norm, &l->wq, n);
+        qwen_linear_w_batch(k, x_norm, &l->wk, n);
+        qwen_linear_w_batch(v, x_norm, &l->wv, n);
+
+        qwen_rms_norm_per_head(q, l->q_norm_weight, n, n_heads, head_dim, eps);
+        qwen_rms_norm_per_head(k, l->k_norm_weight, n, n_kv_heads, head_dim, eps);
+
+        /* Positions differ per sequence: RoPE, cache and attention per row */
+        for (int i = 0; i < n; i++) {
+            int pos = lens[i];
+            const float *rope_cos = ctx->rope_cache_cos + (size_t)pos * head_dim;
+            const float *rope_sin = ctx->rope_cache_sin + (size_t)pos * head_dim;
+            float *qi = q + (size_t)i * q_dim;
+            float *ki = k + (size_t)i * kv_dim;
+            qwen_apply_rope_neox(qi, rope_cos, rope_sin, 1, n_heads, head_dim);
+            qwen_apply_rope_neox(ki, rope_cos, rope_sin, 1, n_kv_heads, head_dim);
+            qwen_kv_cache_store(caches[i], layer, pos, 1, ki, v + (size_t)i * kv_dim);
+            kern->causal_attention_kv(attn_out + (size_t)i * q_dim, qi, caches[i], layer,
+                                      1, pos + 1, n_heads, scale, pos);
+        }
+
+        qwen_linear_w_batch(proj_out, attn_out, &l->wo, n);
+        qwen_add_inplace(x, proj_out, n * dim);
+
+        kern->rms_norm(x_norm, x, l->post_attn_norm, n, dim, eps);
+
+        qwen_linear_w_batch(gate_up, x_norm, &l->gate_up, n);
+        qwen_swiglu_multiply(gate, gate_up, n, intermediate);
+        qwen_linear_w_batch(ffn_out, gate, &l->down, n);
+        qwen_add_inplace(x, ffn_out, n * dim);
+        QWEN_PERF_LAYER_END(ctx->perf_dec_layer_ms, layer);
+    }
+
+    for (int i = 0; i < n; i++) lens[i]++;
+    ctx->weights_cold = 0;
+
+    kern->rms_norm(x, x, dec->norm, n, dim, eps);
+    int rc = lm_head_argmax_rows(ctx, x, n, tokens);
+
+    qwen_parallel_end();
+    qwen_perf_decode_step(ctx, perf_t0);
+    return rc;
+}
+
+/* ========================================================================
+ * Multi-Token Verification (greedy token after each of n inputs)
+ * ======================================================================== */
+
+int qwen_decoder_verify(qwen_ctx_t *ctx, const float *input_embeds, int n, int *tokens) {
+    qwen_decoder_t *dec = &ctx->decoder;
+    const qwen_config_t *cfg = &ctx->config;
+    const qwen_dec_kernels_t *kern = ctx->dec_kernels;
+    int dim = cfg->dec_hidden;
+    int n_heads = cfg->dec_heads;
+    int head_dim = cfg->dec_head_dim;
+    int q_dim = n_heads * head_dim;
+    float eps = cfg->dec_rms_norm_eps;
+    float theta = cfg->dec_rope_theta;
+
+    if (n <= 0) return 0;
+    double perf_t0 = qwen_perf_now_ms();
+    int start = ctx->kv_cache_len;
+    if (kv_cache_ensure(ctx, start + n) != 0) return -1;
+    if (ensure_prefill_buffers(ctx, n) != 0) return -1;
+    if (ensure_rope_cache(ctx, start + n, head_dim, theta) != 0) return -1;
+    qwen_perf_note_memory(ctx, qwen_kv_cache_bytes(&ctx->kv_cache));
+    const float *rope_cos = ctx->rope_cache_cos + (size_t)start * head_dim;
+    const float *rope_sin = ctx->rope_cache_sin + (size_t)start * head_dim;
+
+    float *x = ctx->pref_x;
+    float *x_norm = ctx->pref_x_norm;
+    float *q = ctx->pref_q;
+    float *k = ctx->pref_k;
+    float *v = ctx->pref_v;
+    float *attn_out = ctx->pref_attn_out;
+    float *gate = ctx->pref_gate;
+    float *gate_up = ctx->pref_gate_up;
+    memcpy(x, input_embeds, (size_t)n * dim * sizeof(float));
+
+    float scale = 1.0f / sqrtf((float)head_dim);
+
+    /* The seq=1 step's kernels with n rows per weight pass; attention runs
+     * per query through the seq=1 path */
+    qwen_parallel_begin();
+
+    int prefetch = ctx->weights_cold;
+    if (prefetch) qwen_residency_prefetch_dec_layer(ctx, 0);
+
+    for (int layer = 0; layer < cfg->dec_layers; layer++) {
+        qwen_dec_layer_t *l = &dec->layers[layer];
+        if (prefetch) qwen_residency_prefetch_dec_layer(ctx, layer + 1);
+        QWEN_PERF_LAYER_BEGIN();
+
+        kern->rms_norm(x_norm, x, l->input_norm, n, dim, eps);
+        qwen_linear_w_qkv_rope(q, k, v, x_norm, &l->wq, &l->wk, &l->wv,
+                               l->q_norm_weight, l->k_norm_weight, eps,
+                               rope_cos, rope_sin, head_dim,
+                               &ctx->kv_cache, layer, start, n);
+        for (int i = 0; i < n; i++) {
+            int pos = start + i;
+            kern->causal_attention_kv(attn_out + (size_t)i * q_dim, q + (size_t)i * q_dim,
+                                      &ctx->kv_cache, layer, 1, pos + 1, n_heads, scale, pos);
+        }
+        qwen_linear_w_residual(x, attn_out, &l->wo, n);
+
+        kern->rms_norm(x_norm, x, l->post_attn_norm, n, dim, eps);
+        qwen_linear_w_swiglu(gate, gate_up, x_norm, &l->gate_up, n);
+        qwen_linear_w_residual(x, gate, &l->down, n);
+        QWEN_PERF_LAYER_END(ctx->perf_dec_layer_ms, layer);
+    }
+
+    ctx->kv_cache_len = start + n;
+    ctx->weights_cold = 0;
+
+    kern->rms_norm(x, x, dec->norm, n, dim, eps);
+    if (ctx->lm_head_mode == QWEN_LM_HEAD_FULL || !ctx->lm_vocab_ready) {
+        qwen_argmax_matvec_w_rows(x, &dec->lm_head, n, tokens);
+    } else {
+        /* The draft's top-k merge is per input; score each row as seq=1 does */
+        for (int i = 0; i < n; i++)
+            tokens[i] = lm_head_argmax(ctx, x + (size_t)i * dim);
+    }
+
+    qwen_parallel_end();
+    qwen_perf_decode_step(ctx, perf_t0);
+    return 0;
 }
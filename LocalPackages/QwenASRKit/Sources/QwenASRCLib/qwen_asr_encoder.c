@@ -4,6 +4,7 @@
  * Architecture:
  *   Per-chunk Conv2D stem: 3 layers of Conv2D(3x3, stride=2, pad=1) -> GELU
  *     128 mel bins -> 64 -> 32 -> 16 frequency, time/8
+ *     (chunks of one attention window are batched into shared GEMMs)
  *     Reshape [480, 16, T/8] -> [T/8, 7680], project to d_model
  *   Per-chunk sinusoidal position embeddings
  *   Transformer encoder layers (bidirectional windowed attention):
@@ -15,6 +16,7 @@
 
 #include "qwen_asr.h"
 #include "qwen_asr_kernels.h"
+#include "qwen_asr_perf.h"
 #include "qwen_asr_safetensors.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,36 +39,32 @@ static float *load_f32(multi_safetensors_t *ms, const char *name) {
     return safetensors_get_f32(sf, t);
 }
 
-/* Load bf16 weight and convert to f32 at load time.
- * Encoder always processes batches, so pre-converting avoids
- * repeated scratch-buffer conversion during forward pass. */
-static float *load_bf16_as_f32(multi_safetensors_t *ms, const char *name) {
+/* Load a bf16 matrix in the encoder's weight format. The f32 format
+ * pre-converts at load time (encoder always processes batches); bf16 keeps
+ * the mmap'd pointer and int8 quantizes per row, both expanded per tile
+ * inside qwen_linear_w. */
+static int load_enc_weight(qwen_weight_t *w, multi_safetensors_t *ms,
+                           const char *name, int format) {
     safetensors_file_t *sf = NULL;
     const safetensor_t *t = multi_safetensors_find(ms, name, &sf);
     if (!t) {
         fprintf(stderr, "encoder: weight not found: %s\n", name);
-        return NULL;
+        return -1;
+    }
+    if (t->ndim != 2) {
+        fprintf(stderr, "encoder: expected 2D weight: %s\n", name);
+        return -1;
     }
     uint16_t *bf16 = safetensors_get_bf16_direct(sf, t);
-    if (!bf16) return NULL;
-
-    /* Compute number of elements from tensor shape */
-    size_t n = 1;
-    for (int i = 0; i < t->ndim; i++) n *= t->shape[i];
+    if (!bf16) return -1;
 
-    float *f32 = (float *)malloc(n * sizeof(float));
-    if (!f32) return NULL;
-
-    uint32_t *d = (uint32_t *)(void *)f32;
-    for (size_t i = 0; i < n; i++)
-        d[i] = ((uint32_t)bf16[i]) << 16;
-
-    return f32;
+    return qwen_weight_from_bf16(w, bf16, (int)t->shape[0], (int)t->shape[1], format);
 }
 
 int qwen_encoder_load(qwen_encoder_t *enc, multi_safetensors_t *ms,
                        const qwen_config_t *cfg) {
     char name[512];
+    int fmt = enc->weight_format;
 
     /* Conv2D stem (small, f32) */
     snprintf(name, sizeof(name), "%sconv2d1.weight", ENC_PREFIX);
@@ -86,29 +84,29 @@ int qwen_encoder_load(qwen_encoder_t *enc, multi_safetensors_t *ms,
 
     /* Conv output projection (bf16, no bias) */
     snprintf(name, sizeof(name), "%sconv_out.weight", ENC_PREFIX);
-    enc->conv_out_weight = load_bf16_as_f32(ms, name);
-    if (!enc->conv_out_weight) return -1;
+    if (load_enc_weight(&enc->conv_out_weight, ms, name, fmt) != 0) return -1;
 
     /* Transformer layers */
     for (int i = 0; i < cfg->enc_layers; i++) {
         qwen_enc_layer_t *l = &enc->layers[i];
         const char *lp = ENC_PREFIX "layers";
+        int failed = 0;
 
         /* Attention weights (bf16) and biases (f32) */
         snprintf(name, sizeof(name), "%s.%d.self_attn.q_proj.weight", lp, i);
-        l->wq_weight = load_bf16_as_f32(ms, name);
+        if (load_enc_weight(&l->wq_weight, ms, name, fmt) != 0) failed = 1;
         snprintf(name, sizeof(name), "%s.%d.self_attn.q_proj.bias", lp, i);
         l->wq_bias = load_f32(ms, name);
         snprintf(name, sizeof(name), "%s.%d.self_attn.k_proj.weight", lp, i);
-        l->wk_weight = load_bf16_as_f32(ms, name);
+        if (load_enc_weight(&l->wk_weight, ms, name, fmt) != 0) failed = 1;
         snprintf(name, sizeof(name), "%s.%d.self_attn.k_proj.bias", lp, i);
         l->wk_bias = load_f32(ms, name);
         snprintf(name, sizeof(name), "%s.%d.self_attn.v_proj.weight", lp, i);
-        l->wv_weight = load_bf16_as_f32(ms, name);
+        if (load_enc_weight(&l->wv_weight, ms, name, fmt) != 0) failed = 1;
         snprintf(name, sizeof(name), "%s.%d.self_attn.v_proj.bias", lp, i);
         l->wv_bias = load_f32(ms, name);
         snprintf(name, sizeof(name), "%s.%d.self_attn.out_proj.weight", lp, i);
-        l->wo_weight = load_bf16_as_f32(ms, name);
+        if (load_enc_weight(&l->wo_weight, ms, name, fmt) != 0) failed = 1;
         snprintf(name, sizeof(name), "%s.%d.self_attn.out_proj.bias", lp, i);
         l->wo_bias = load_f32(ms, name);
 
@@ -120,11 +118,11 @@ int qwen_encoder_load(qwen_encoder_t *enc, multi_safetensors_t *ms,
 
         /* FFN weights (bf16) and biases (f32) */
         snprintf(name, sizeof(name), "%s.%d.fc1.weight", lp, i);
-        l->fc1_weight = load_bf16_as_f32(ms, name);
+        if (load_enc_weight(&l->fc1_weight, ms, name, fmt) != 0) failed = 1;
         snprintf(name, sizeof(name), "%s.%d.fc1.bias", lp, i);
         l->fc1_bias = load_f32(ms, name);
         snprintf(name, sizeof(name), "%s.%d.fc2.weight", lp, i);
-        l->fc2_weight = load_bf16_as_f32(ms, name);
+        if (load_enc_weight(&l->fc2_weight, ms, name, fmt) != 0) failed = 1;
         snprintf(name, sizeof(name), "%s.%d.fc2.bias", lp, i);
         l->fc2_bias = load_f32(ms, name);
 
@@ -134,8 +132,7 @@ int qwen_encoder_load(qwen_encoder_t *enc, multi_safetensors_t *ms,
         snprintf(name, sizeof(name), "%s.%d.final_layer_norm.bias", lp, i);
         l->ffn_norm_bias = load_f32(ms, name);
 
-        if (!l->wq_weight || !l->wk_weight ||
-            !l->wv_weight || !l->wo_weight) {
+        if (failed) {
             fprintf(stderr, "encoder: failed to load layer %d weights\n", i);
             return -1;
         }
@@ -150,186 +147,300 @@ int qwen_encoder_load(qwen_encoder_t *enc, multi_safetensors_t *ms,
 
     /* Projection layers */
     snprintf(name, sizeof(name), "%sproj1.weight", ENC_PREFIX);
-    enc->proj1_weight = load_bf16_as_f32(ms, name);
+    int proj_failed = load_enc_weight(&enc->proj1_weight, ms, name, fmt) != 0;
     snprintf(name, sizeof(name), "%sproj1.bias", ENC_PREFIX);
     enc->proj1_bias = load_f32(ms, name);
     snprintf(name, sizeof(name), "%sproj2.weight", ENC_PREFIX);
-    enc->proj2_weight = load_bf16_as_f32(ms, name);
+    if (load_enc_weight(&enc->proj2_weight, ms, name, fmt) != 0) proj_failed = 1;
     snprintf(name, sizeof(name), "%sproj2.bias", ENC_PREFIX);
     enc->proj2_bias = load_f32(ms, name);
 
-    if (!enc->ln_post_weight || !enc->proj1_weight || !enc->proj2_weight)
+    if (!enc->ln_post_weight || proj_failed)
         return -1;
 
     return 0;
 }
 
 /* ========================================================================
- * Forward Pass
+ * Persistent Buffers
  * ======================================================================== */
 
-float *qwen_encoder_forward(qwen_ctx_t *ctx, const float *mel, int mel_frames,
-                             int *out_seq_len) {
+/* im2col budget for one batched conv (floats, 8M = 32 MB). Bounds how many
+ * chunks of a window share a conv GEMM. */
+#define ENC_STEM_COLS_MAX (1 << 23)
+
+/* Output length of a 3x3, stride-2, pad-1 conv */
+#define ENC_CONV_OUT(n) (((n) + 2 * 1 - 3) / 2 + 1)
+
+static int enc_chunks_per_window(const qwen_config_t *cfg) {
+    int cpw = cfg->enc_n_window_infer / cfg->enc_chunk_size;
+    return cpw > 0 ? cpw : 1;
+}
+
+/* Conv stem buffers for one group of full chunks plus the window-sized
+ * projection input and the per-chunk PE table. Allocated once. */
+static int ensure_enc_stem(qwen_ctx_t *ctx) {
+    if (ctx->enc_stem_mel) return 0;
     const qwen_config_t *cfg = &ctx->config;
-    qwen_encoder_t *enc = &ctx->encoder;
+    int w0 = cfg->enc_chunk_size;
+    int h1 = ENC_CONV_OUT(QWEN_MEL_BINS), w1 = ENC_CONV_OUT(w0);
+    int h2 = ENC_CONV_OUT(h1), w2 = ENC_CONV_OUT(w1);
+    int h3 = ENC_CONV_OUT(h2), w3 = ENC_CONV_OUT(w2);
+    int cpw = enc_chunks_per_window(cfg);
+
+    size_t cols1 = qwen_conv2d_cols_floats(1, 1, QWEN_MEL_BINS, w0, 3, 3, 2, 1);
+    size_t cols2 = qwen_conv2d_cols_floats(1, QWEN_CONV_HIDDEN, h1, w1, 3, 3, 2, 1);
+    size_t cols3 = qwen_conv2d_cols_floats(1, QWEN_CONV_HIDDEN, h2, w2, 3, 3, 2, 1);
+    size_t cols = cols1 > cols2 ? cols1 : cols2;
+    if (cols3 > cols) cols = cols3;
+
+    int group = cpw;
+    while (group > 1 && cols * group > ENC_STEM_COLS_MAX) group--;
+    ctx->enc_stem_group = group;
+
+    ctx->enc_stem_mel = (float *)malloc((size_t)group * QWEN_MEL_BINS * w0 * sizeof(float));
+    ctx->enc_stem_c1 = (float *)malloc((size_t)group * QWEN_CONV_HIDDEN * h1 * w1 * sizeof(float));
+    ctx->enc_stem_c2 = (float *)malloc((size_t)group * QWEN_CONV_HIDDEN * h2 * w2 * sizeof(float));
+    ctx->enc_stem_c3 = (float *)malloc((size_t)group * QWEN_CONV_HIDDEN * h3 * w3 * sizeof(float));
+    ctx->enc_stem_cols = (float *)malloc((size_t)group * cols * sizeof(float));
+    ctx->enc_stem_reshaped = (float *)malloc((size_t)cpw * w3 * cfg->enc_conv_proj_dim * sizeof(float));
+    ctx->enc_pe = (float *)malloc((size_t)w3 * cfg->enc_d_model * sizeof(float));
+    if (!ctx->enc_stem_mel || !ctx->enc_stem_c1 || !ctx->enc_stem_c2 ||
+        !ctx->enc_stem_c3 || !ctx->enc_stem_cols || !ctx->enc_stem_reshaped ||
+        !ctx->enc_pe) {
+        free(ctx->enc_stem_mel); free(ctx->enc_stem_c1); free(ctx->enc_stem_c2);
+        free(ctx->enc_stem_c3); free(ctx->enc_stem_cols);
+        free(ctx->enc_stem_reshaped); free(ctx->enc_pe);
+        ctx->enc_stem_mel = ctx->enc_stem_c1 = ctx->enc_stem_c2 = NULL;
+        ctx->enc_stem_c3 = ctx->enc_stem_cols = NULL;
+        ctx->enc_stem_reshaped = ctx->enc_pe = NULL;
+        return -1;
+    }
 
+    /* PE restarts at position 0 in every chunk, so one chunk's table serves all */
+    qwen_sinusoidal_pe(ctx->enc_pe, w3, cfg->enc_d_model);
+
+    ctx->enc_stem_bytes = ((size_t)group * (QWEN_MEL_BINS * w0 +
+                           QWEN_CONV_HIDDEN * (h1 * w1 + h2 * w2 + h3 * w3) + cols) +
+                           (size_t)cpw * w3 * cfg->enc_conv_proj_dim +
+                           (size_t)w3 * cfg->enc_d_model) * sizeof(float);
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "Encoder stem: %d chunk(s) per conv GEMM, %.1f MB buffers\n",
+                group, ctx->enc_stem_bytes / (1024.0 * 1024.0));
+    return 0;
+}
+
+static int ensure_enc_buffers(qwen_ctx_t *ctx, int seq_len, int n_windows) {
+    const qwen_config_t *cfg = &ctx->config;
     int d_model = cfg->enc_d_model;
-    int n_heads = cfg->enc_heads;
-    int head_dim = cfg->enc_head_dim;
     int ffn_dim = cfg->enc_ffn_dim;
-    int output_dim = cfg->enc_output_dim;
-    int chunk_size = cfg->enc_chunk_size;          /* 100 */
-    int n_window_infer = cfg->enc_n_window_infer;  /* 800 */
 
+    if (ensure_enc_stem(ctx) != 0) return -1;
 
-    /* ---- Per-chunk Conv2D stem ---- */
-    /* mel: [128, mel_frames] (already in Conv2D-friendly layout)
-     * Process chunks of chunk_size frames, each producing tokens_per_chunk tokens */
-    int n_chunks = (mel_frames + chunk_size - 1) / chunk_size;
-    int tokens_per_chunk = 0; /* computed from first chunk */
-
-    /* First: determine output tokens per chunk from a full chunk */
-    {
-        int w = chunk_size;
-        int w1 = (w + 2 * 1 - 3) / 2 + 1;
-        int w2 = (w1 + 2 * 1 - 3) / 2 + 1;
-        int w3 = (w2 + 2 * 1 - 3) / 2 + 1;
-        tokens_per_chunk = w3; /* 13 for chunk_size=100 */
-    }
-
-    /* Collect all chunks' output tokens */
-    int total_tokens = 0;
-
-    /* Pre-calculate total tokens */
-    for (int c = 0; c < n_chunks; c++) {
-        int start = c * chunk_size;
-        int end = start + chunk_size;
-        if (end > mel_frames) end = mel_frames;
-        int chunk_w = end - start;
-        int w1 = (chunk_w + 2 - 3) / 2 + 1;
-        int w2 = (w1 + 2 - 3) / 2 + 1;
-        int w3 = (w2 + 2 - 3) / 2 + 1;
-        total_tokens += w3;
+    if (n_windows + 1 > ctx->enc_windows_cap) {
+        int new_cap = ctx->enc_windows_cap > 0 ? ctx->enc_windows_cap : 16;
+        while (new_cap < n_windows + 1) new_cap *= 2;
+        int *tmp = (int *)realloc(ctx->enc_window_starts, (size_t)new_cap * sizeof(int));
+        if (!tmp) return -1;
+        ctx->enc_window_starts = tmp;
+        ctx->enc_windows_cap = new_cap;
     }
 
+    if (seq_len <= ctx->enc_seq_cap) return 0;
+
+    /* Start from one inference window so short streaming chunks never regrow */
+    int new_cap = ctx->enc_seq_cap > 0 ? ctx->enc_seq_cap
+                : ENC_CONV_OUT(ENC_CONV_OUT(ENC_CONV_OUT(cfg->enc_chunk_size))) *
+                  enc_chunks_per_window(cfg);
+    while (new_cap < seq_len) new_cap *= 2;
+
+#define REALLOC_ENC(ptr, count) do {                                           \
+    void *tmp__ = realloc((ptr), (size_t)(count) * sizeof(float));             \
+    if (!tmp__) return -1;                                                      \
+    (ptr) = (float *)tmp__;                                                     \
+} while (0)
+
+    REALLOC_ENC(ctx->enc_x, (size_t)new_cap * d_model);
+    REALLOC_ENC(ctx->enc_x_norm, (size_t)new_cap * d_model);
+    REALLOC_ENC(ctx->enc_q, (size_t)new_cap * d_model);
+    REALLOC_ENC(ctx->enc_k, (size_t)new_cap * d_model);
+    REALLOC_ENC(ctx->enc_v, (size_t)new_cap * d_model);
+    REALLOC_ENC(ctx->enc_attn_out, (size_t)new_cap * d_model);
+    REALLOC_ENC(ctx->enc_proj_out, (size_t)new_cap * d_model);
+    REALLOC_ENC(ctx->enc_ffn_mid, (size_t)new_cap * ffn_dim);
+    REALLOC_ENC(ctx->enc_ffn_out, (size_t)new_cap * d_model);
+
+#undef REALLOC_ENC
+
+    ctx->enc_seq_cap = new_cap;
+    return 0;
+}
 
-    /* Allocate main sequence buffer: [total_tokens, d_model] */
-    float *x = (float *)calloc((size_t)total_tokens * d_model, sizeof(float));
-    int token_offset = 0;
-
-    /* Process each chunk through Conv2D + reshape + project + sinusoidal PE */
-    for (int c = 0; c < n_chunks; c++) {
-        int start = c * chunk_size;
-        int end = start + chunk_size;
-        if (end > mel_frames) end = mel_frames;
-        int chunk_w = end - start;
+/* ========================================================================
+ * Forward Pass
+ * ======================================================================== */
 
-        /* Extract chunk mel: [128, chunk_w] */
-        float *chunk_mel = (float *)malloc(128 * chunk_w * sizeof(float));
-        for (int m = 0; m < 128; m++) {
-            memcpy(chunk_mel + m * chunk_w, mel + m * mel_frames + start,
+/* Run n_img chunks of width chunk_w starting at mel frame `start` through
+ * the conv stem as one batch, writing their [n_img * w3, 7680] rows to dst. */
+static void enc_conv_stem(qwen_ctx_t *ctx, float *dst, const float *mel, int mel_frames,
+                          int start, int chunk_w, int n_img) {
+    qwen_encoder_t *enc = &ctx->encoder;
+    int h1 = ENC_CONV_OUT(QWEN_MEL_BINS), w1 = ENC_CONV_OUT(chunk_w);
+    int h2 = ENC_CONV_OUT(h1), w2 = ENC_CONV_OUT(w1);
+    int h3 = ENC_CONV_OUT(h2), w3 = ENC_CONV_OUT(w2);
+
+    /* Gather chunk mels: [1, n_img, 128, chunk_w] */
+    float *in = ctx->enc_stem_mel;
+    for (int img = 0; img < n_img; img++) {
+        const float *src = mel + start + (size_t)img * chunk_w;
+        float *d = in + (size_t)img * QWEN_MEL_BINS * chunk_w;
+        for (int m = 0; m < QWEN_MEL_BINS; m++)
+            memcpy(d + (size_t)m * chunk_w, src + (size_t)m * mel_frames,
                    chunk_w * sizeof(float));
-        }
+    }
 
-        /* Conv2D layer 1: [1, 128, chunk_w] -> [480, 64, w1] */
-        int h1 = (128 + 2 - 3) / 2 + 1; /* 64 */
-        int w1 = (chunk_w + 2 - 3) / 2 + 1;
-        float *c1 = (float *)malloc(QWEN_CONV_HIDDEN * h1 * w1 * sizeof(float));
-        qwen_conv2d(c1, chunk_mel, enc->conv1_weight, enc->conv1_bias,
-                     1, QWEN_CONV_HIDDEN, 128, chunk_w, 3, 3, 2, 1);
-        qwen_gelu(c1, QWEN_CONV_HIDDEN * h1 * w1);
-        free(chunk_mel);
-
-        /* Conv2D layer 2: [480, 64, w1] -> [480, 32, w2] */
-        int h2 = (h1 + 2 - 3) / 2 + 1; /* 32 */
-        int w2 = (w1 + 2 - 3) / 2 + 1;
-        float *c2 = (float *)malloc(QWEN_CONV_HIDDEN * h2 * w2 * sizeof(float));
-        qwen_conv2d(c2, c1, enc->conv2_weight, enc->conv2_bias,
-                     QWEN_CONV_HIDDEN, QWEN_CONV_HIDDEN, h1, w1, 3, 3, 2, 1);
-        qwen_gelu(c2, QWEN_CONV_HIDDEN * h2 * w2);
-        free(c1);
-
-        /* Conv2D layer 3: [480, 32, w2] -> [480, 16, w3] */
-        int h3 = (h2 + 2 - 3) / 2 + 1; /* 16 */
-        int w3 = (w2 + 2 - 3) / 2 + 1;
-        float *c3 = (float *)malloc(QWEN_CONV_HIDDEN * h3 * w3 * sizeof(float));
-        qwen_conv2d(c3, c2, enc->conv3_weight, enc->conv3_bias,
-                     QWEN_CONV_HIDDEN, QWEN_CONV_HIDDEN, h2, w2, 3, 3, 2, 1);
-        qwen_gelu(c3, QWEN_CONV_HIDDEN * h3 * w3);
-        free(c2);
-
-        /* Reshape [480, 16, w3] -> [w3, 480*16=7680] then project to d_model */
-        int conv_proj_dim = QWEN_CONV_HIDDEN * h3; /* 480 * 16 = 7680 */
-        float *reshaped = (float *)malloc(w3 * conv_proj_dim * sizeof(float));
+    /* Conv2D layer 1: [1, n, 128, w] -> [480, n, 64, w1] */
+    float *c1 = ctx->enc_stem_c1;
+    qwen_conv2d_batch(c1, in, enc->conv1_weight, enc->conv1_bias, n_img,
+                      1, QWEN_CONV_HIDDEN, QWEN_MEL_BINS, chunk_w, 3, 3, 2, 1,
+                      ctx->enc_stem_cols);
+    qwen_gelu(c1, QWEN_CONV_HIDDEN * n_img * h1 * w1);
+
+    /* Conv2D layer 2: [480, n, 64, w1] -> [480, n, 32, w2] */
+    float *c2 = ctx->enc_stem_c2;
+    qwen_conv2d_batch(c2, c1, enc->conv2_weight, enc->conv2_bias, n_img,
+                      QWEN_CONV_HIDDEN, QWEN_CONV_HIDDEN, h1, w1, 3, 3, 2, 1,
+                      ctx->enc_stem_cols);
+    qwen_gelu(c2, QWEN_CONV_HIDDEN * n_img * h2 * w2);
+
+    /* Conv2D layer 3: [480, n, 32, w2] -> [480, n, 16, w3] */
+    float *c3 = ctx->enc_stem_c3;
+    qwen_conv2d_batch(c3, c2, enc->conv3_weight, enc->conv3_bias, n_img,
+                      QWEN_CONV_HIDDEN, QWEN_CONV_HIDDEN, h2, w2, 3, 3, 2, 1,
+                      ctx->enc_stem_cols);
+    qwen_gelu(c3, QWEN_CONV_HIDDEN * n_img * h3 * w3);
+
+    /* Reshape [480, n, 16, w3] -> [n * w3, 480*16=7680] */
+    int conv_proj_dim = QWEN_CONV_HIDDEN * h3;
+    for (int img = 0; img < n_img; img++) {
         for (int t = 0; t < w3; t++) {
+            float *row = dst + (size_t)(img * w3 + t) * conv_proj_dim;
             for (int ch = 0; ch < QWEN_CONV_HIDDEN; ch++) {
-                for (int f = 0; f < h3; f++) {
-                    reshaped[t * conv_proj_dim + ch * h3 + f] =
-                        c3[ch * h3 * w3 + f * w3 + t];
-                }
+                const float *plane = c3 + ((size_t)ch * n_img + img) * h3 * w3;
+                for (int f = 0; f < h3; f++)
+                    row[ch * h3 + f] = plane[f * w3 + t];
             }
         }
-        free(c3);
+    }
+}
 
-        /* Project: [w3, 7680] -> [w3, d_model] (no bias) */
-        float *projected = x + (size_t)token_offset * d_model;
-        qwen_linear_nobias(projected, reshaped, enc->conv_out_weight,
-                            w3, conv_proj_dim, d_model);
-        free(reshaped);
+float *qwen_encoder_forward(qwen_ctx_t *ctx, const float *mel, int mel_frames,
+                             int *out_seq_len) {
+    const qwen_config_t *cfg = &ctx->config;
+    qwen_encoder_t *enc = &ctx->encoder;
 
-        /* Add per-chunk sinusoidal position embeddings (starting from pos 0) */
-        float *pe = (float *)malloc(w3 * d_model * sizeof(float));
-        qwen_sinusoidal_pe(pe, w3, d_model);
-        qwen_add_inplace(projected, pe, w3 * d_model);
-        free(pe);
+    int d_model = cfg->enc_d_model;
+    int n_heads = cfg->enc_heads;
+    int head_dim = cfg->enc_head_dim;
+    int ffn_dim = cfg->enc_ffn_dim;
+    int output_dim = cfg->enc_output_dim;
+    int chunk_size = cfg->enc_chunk_size;          /* 100 */
+    int chunks_per_window = enc_chunks_per_window(cfg);  /* 800 / 100 */
 
-        token_offset += w3;
-    }
+    /* mel: [128, mel_frames] (already in Conv2D-friendly layout)
+     * Chunks of chunk_size frames each produce tokens_per_chunk tokens;
+     * only the last chunk can be shorter. */
+    int n_chunks = (mel_frames + chunk_size - 1) / chunk_size;
+    int tokens_per_chunk = ENC_CONV_OUT(ENC_CONV_OUT(ENC_CONV_OUT(chunk_size))); /* 13 */
+    int tail_w = mel_frames - (n_chunks - 1) * chunk_size;
+    int total_tokens = (n_chunks - 1) * tokens_per_chunk +
+                       ENC_CONV_OUT(ENC_CONV_OUT(ENC_CONV_OUT(tail_w)));
 
-    /* ---- Build attention window boundaries ---- */
     /* Window size = tokens_per_chunk * (n_window_infer / chunk_size) */
-    int window_token_size = tokens_per_chunk * (n_window_infer / chunk_size);
+    int window_token_size = tokens_per_chunk * chunks_per_window;
     int n_windows = (total_tokens + window_token_size - 1) / window_token_size;
-    int *window_starts = (int *)malloc((n_windows + 1) * sizeof(int));
+
+    /* Mapped pages may be out: start paging layer 0 in behind the conv stem */
+    int prefetch = ctx->weights_cold || ctx->low_memory;
+    if (prefetch) qwen_residency_prefetch_enc_layer(ctx, 0);
+
+    if (n_chunks <= 0 || ensure_enc_buffers(ctx, total_tokens, n_windows) != 0) return NULL;
+    qwen_signpost_begin(ctx, QWEN_SIGNPOST_ENCODE);
+
+    float *x = ctx->enc_x;
+    int *window_starts = ctx->enc_window_starts;
     for (int w = 0; w < n_windows; w++) {
         window_starts[w] = w * window_token_size;
     }
     window_starts[n_windows] = total_tokens;
 
+    /* ---- Conv2D stem + project + sinusoidal PE, one window at a time ---- */
+    for (int w = 0; w < n_windows; w++) {
+        int c_begin = w * chunks_per_window;
+        int c_end = c_begin + chunks_per_window;
+        if (c_end > n_chunks) c_end = n_chunks;
+
+        int win_tokens = 0;
+        for (int c = c_begin; c < c_end;) {
+            int chunk_w = (c == n_chunks - 1) ? tail_w : chunk_size;
+            int n_img = 1;
+            if (chunk_w == chunk_size) {
+                /* Batch consecutive full chunks */
+                while (n_img < ctx->enc_stem_group && c + n_img < c_end &&
+                       (c + n_img < n_chunks - 1 || tail_w == chunk_size))
+                    n_img++;
+            }
+            enc_conv_stem(ctx, ctx->enc_stem_reshaped +
+                          (size_t)win_tokens * cfg->enc_conv_proj_dim,
+                          mel, mel_frames, c * chunk_size, chunk_w, n_img);
+            win_tokens += n_img * ENC_CONV_OUT(ENC_CONV_OUT(ENC_CONV_OUT(chunk_w)));
+            c += n_img;
+        }
+
+        /* Project the whole window: [win_tokens, 7680] -> [win_tokens, d_model] */
+        float *projected = x + (size_t)window_starts[w] * d_model;
+        qwen_linear_w(projected, ctx->enc_stem_reshaped, &enc->conv_out_weight,
+                      NULL, win_tokens);
+
+        /* Per-chunk sinusoidal position embeddings (starting from pos 0) */
+        for (int t0 = 0; t0 < win_tokens; t0 += tokens_per_chunk) {
+            int nt = win_tokens - t0;
+            if (nt > tokens_per_chunk) nt = tokens_per_chunk;
+            qwen_add_inplace(projected + (size_t)t0 * d_model, ctx->enc_pe, nt * d_model);
+        }
+    }
 
     /* ---- Transformer layers ---- */
-    float *x_norm = (float *)malloc(total_tokens * d_model * sizeof(float));
-    float *q = (float *)malloc(total_tokens * d_model * sizeof(float));
-    float *k = (float *)malloc(total_tokens * d_model * sizeof(float));
-    float *v = (float *)malloc(total_tokens * d_model * sizeof(float));
-    float *attn_out = (float *)malloc(total_tokens * d_model * sizeof(float));
-    float *proj_out = (float *)malloc(total_tokens * d_model * sizeof(float));
-    float *ffn_mid = (float *)malloc(total_tokens * ffn_dim * sizeof(float));
-    float *ffn_out = (float *)malloc(total_tokens * d_model * sizeof(float));
+    float *x_norm = ctx->enc_x_norm;
+    float *q = ctx->enc_q;
+    float *k = ctx->enc_k;
+    float *v = ctx->enc_v;
+    float *attn_out = ctx->enc_attn_out;
+    float *proj_out = ctx->enc_proj_out;
+    float *ffn_mid = ctx->enc_ffn_mid;
+    float *ffn_out = ctx->enc_ffn_out;
 
     float scale = 1.0f / sqrtf((float)head_dim);
 
     for (int layer = 0; layer < cfg->enc_layers; layer++) {
         qwen_enc_layer_t *l = &enc->layers[layer];
+        if (prefetch) qwen_residency_prefetch_enc_layer(ctx, layer + 1);
+        QWEN_PERF_LAYER_BEGIN();
 
         /* ---- Self-attention ---- */
         qwen_layer_norm(x_norm, x, l->attn_norm_weight, l->attn_norm_bias,
                         total_tokens, d_model, 1e-5f);
 
-        qwen_linear(q, x_norm, l->wq_weight, l->wq_bias,
-                     total_tokens, d_model, d_model);
-        qwen_linear(k, x_norm, l->wk_weight, l->wk_bias,
-                     total_tokens, d_model, d_model);
-        qwen_linear(v, x_norm, l->wv_weight, l->wv_bias,
-                     total_tokens, d_model, d_model);
+        qwen_linear_w(q, x_norm, &l->wq_weight, l->wq_bias, total_tokens);
+        qwen_linear_w(k, x_norm, &l->wk_weight, l->wk_bias, total_tokens);
+        qwen_linear_w(v, x_norm, &l->wv_weight, l->wv_bias, total_tokens);
 
         qwen_bidirectional_attention(attn_out, q, k, v,
                                       total_tokens, n_heads, head_dim, scale,
                                       window_starts, n_windows);
 
         /* Output projection + residual */
-        qwen_linear(proj_out, attn_out, l->wo_weight, l->wo_bias,
-                     total_tokens, d_model, d_model);
+        qwen_linear_w(proj_out, attn_out, &l->wo_weight, l->wo_bias, total_tokens);
         qwen_add_inplace(x, proj_out, total_tokens * d_model);
 
         /* ---- FFN ---- */
@@ -337,13 +448,11 @@ float *qwen_encoder_forward(qwen_ctx_t *ctx, const float *mel, int mel_frames,
                         total_tokens, d_model, 1e-5f);
 
         /* GELU FFN: fc1 -> GELU -> fc2 */
-        qwen_linear(ffn_mid, x_norm, l->fc1_weight, l->fc1_bias,
-                     total_tokens, d_model, ffn_dim);
+        qwen_linear_w(ffn_mid, x_norm, &l->fc1_weight, l->fc1_bias, total_tokens);
         qwen_gelu(ffn_mid, total_tokens * ffn_dim);
-        qwen_linear(ffn_out, ffn_mid, l->fc2_weight, l->fc2_bias,
-                     total_tokens, ffn_dim, d_model);
+        qwen_linear_w(ffn_out, ffn_mid, &l->fc2_weight, l->fc2_bias, total_tokens);
         qwen_add_inplace(x, ffn_out, total_tokens * d_model);
-
+        QWEN_PERF_LAYER_END(ctx->perf_enc_layer_ms, layer);
     }
 
     /* Final LayerNorm */
@@ -351,22 +460,21 @@ float *qwen_encoder_forward(qwen_ctx_t *ctx, const float *mel, int mel_frames,
                     total_tokens, d_model, 1e-5f);
 
     /* Projection: proj1 (GELU) -> proj2 */
-    float *proj_mid = (float *)malloc(total_tokens * d_model * sizeof(float));
-    qwen_linear(proj_mid, x, enc->proj1_weight, enc->proj1_bias,
-                 total_tokens, d_model, d_model);
+    float *proj_mid = x_norm;
+    qwen_linear_w(proj_mid, x, &enc->proj1_weight, enc->proj1_bias, total_tokens);
     qwen_gelu(proj_mid, total_tokens * d_model);
 
-    float *enc_output = (float *)malloc(total_tokens * output_dim * sizeof(float));
-    qwen_linear(enc_output, proj_mid, enc->proj2_weight, enc->proj2_bias,
-                 total_tokens, d_model, output_dim);
-    free(proj_mid);
-
-    /* Clean up */
-    free(x); free(x_norm); free(q); free(k); free(v);
-    free(attn_out); free(proj_out);
-    free(ffn_mid); free(ffn_out);
-    free(window_starts);
+    /* The only per-call allocation: the output is handed to the caller */
+    float *enc_output = (float *)malloc((size_t)total_tokens * output_dim * sizeof(float));
+    if (!enc_output) {
+        qwen_signpost_end(ctx, QWEN_SIGNPOST_ENCODE);
+        return NULL;
+    }
+    qwen_linear_w(enc_output, proj_mid, &enc->proj2_weight, enc->proj2_bias,
+                  total_tokens);
+    qwen_signpost_end(ctx, QWEN_SIGNPOST_ENCODE);
 
     *out_seq_len = total_tokens;
+    if (ctx->low_memory) qwen_residency_release_encoder(ctx);
     return enc_output;
 }
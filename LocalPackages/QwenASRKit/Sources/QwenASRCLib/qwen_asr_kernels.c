@@ -10,11 +10,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
-#if (defined(__AVX512F__) || defined(__AVX2__)) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#include <stdatomic.h>
+#include <sys/time.h>
+#include <time.h>
+#if (defined(__AVX512F__) || defined(__AVX2__) || defined(__F16C__)) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
 #include <immintrin.h>
 #endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
 #ifdef __APPLE__
+#include <TargetConditionals.h>
 #include <sys/sysctl.h>
+#include <pthread/qos.h>
 #else
 #include <unistd.h>
 #endif
@@ -31,90 +39,241 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+/* Bodies instantiated with constant shapes (see "Shape-Specialized
+ * Kernels") must inline so the constant reaches their loops. */
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_INLINE __attribute__((always_inline))
+#else
+#define KERNEL_INLINE
+#endif
+
 /* ========================================================================
  * Thread Pool
+ *
+ * Each pool owns its workers, so contexts with their own pool can run
+ * concurrently. Kernels dispatch on the pool bound to the calling thread
+ * (qwen_threadpool_bind), else on the default pool configured by
+ * qwen_set_threads.
+ *
+ * Dispatch is a generation counter plus a completion counter, both atomic.
+ * Idle workers spin on the generation for a bounded number of iterations
+ * and only then park on a condition variable; the dispatcher touches the
+ * mutex only when someone is parked. On desktop, workers never park inside
+ * a qwen_parallel_begin/end region (unless spinning is disabled), so a
+ * decoder token step costs one wake-up instead of one per kernel. On
+ * iOS/tvOS/watchOS the spin budget is smaller and applies inside regions
+ * too, so workers park across any longer gap (e.g. between layers) rather
+ * than burn battery through a bandwidth-bound step; efficiency-class pools
+ * never spin.
  * ======================================================================== */
 
-#define QWEN_MAX_THREADS 16
+#if defined(__APPLE__) && TARGET_OS_IPHONE
+#define QWEN_POOL_SPIN_DEFAULT 2000    /* idle spin iterations before parking */
+#define QWEN_POOL_HOT_DEFAULT  0       /* regions do not suspend parking */
+#else
+#define QWEN_POOL_SPIN_DEFAULT 20000
+#define QWEN_POOL_HOT_DEFAULT  1
+#endif
 
 typedef void (*parallel_fn_t)(int tid, int n_threads, void *arg);
 
-static struct {
+typedef struct {
+    qwen_threadpool_t *pool;
+    int tid;
+} pool_worker_t;
+
+struct qwen_threadpool {
     pthread_t threads[QWEN_MAX_THREADS - 1];
-    int tids[QWEN_MAX_THREADS - 1];
+    pool_worker_t workers[QWEN_MAX_THREADS - 1];
     int n_threads;
-    int shutdown;
+    int qos;
+    int spin;                      /* idle spin iterations before parking */
+    int hot_spin;                  /* 1: no parking inside a parallel region */
 
-    parallel_fn_t fn;
+    parallel_fn_t fn;              /* published before generation++ */
     void *arg;
-    int generation;
+    atomic_int generation;
+    atomic_int n_done;
+    atomic_int shutdown;
+    atomic_int hot;                /* >0: inside a parallel region, no parking */
 
+    /* Parking only; the dispatch fast path never takes this */
     pthread_mutex_t mutex;
     pthread_cond_t cond_work;
     pthread_cond_t cond_done;
-    int n_done;
-} tp = {
-    .n_threads = 1,
-    .shutdown = 0,
-    .generation = 0,
-    .mutex = PTHREAD_MUTEX_INITIALIZER,
-    .cond_work = PTHREAD_COND_INITIALIZER,
-    .cond_done = PTHREAD_COND_INITIALIZER,
+    atomic_int n_parked;           /* workers waiting on cond_work */
+    atomic_int caller_parked;      /* dispatcher waiting on cond_done */
+
+    /* Serializes callers that share one pool (e.g. the default pool) */
+    pthread_mutex_t dispatch_mutex;
 };
 
+static qwen_threadpool_t *default_pool = NULL;
+static __thread qwen_threadpool_t *bound_pool = NULL;
+static __thread qwen_threadpool_t *region_pool = NULL;  /* pool this thread holds hot */
+static __thread int region_depth = 0;
+static __thread int in_pool_worker = 0;
+static __thread qwen_perf_counters_t *bound_perf = NULL;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static qwen_threadpool_t *cur_pool(void) {
+    return bound_pool ? bound_pool : default_pool;
+}
+
+/* Threads a dispatch from this thread would use (1 inside a worker). */
+static int pool_threads(void) {
+    qwen_threadpool_t *pool = cur_pool();
+    if (!pool || in_pool_worker) return 1;
+    return pool->n_threads;
+}
+
+static void pool_worker_setup(qwen_threadpool_t *pool) {
+#ifdef __APPLE__
+    if (pool->qos == QWEN_QOS_PERFORMANCE)
+        pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+    else if (pool->qos == QWEN_QOS_EFFICIENCY)
+        pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+#else
+    (void)pool;
+#endif
+}
+
+/* Wait until generation moves past my_gen; returns the new generation. */
+static int pool_wait_work(qwen_threadpool_t *pool, int my_gen) {
+    int spins = 0;
+    for (;;) {
+        int gen = atomic_load_explicit(&pool->generation, memory_order_acquire);
+        if (gen != my_gen || atomic_load_explicit(&pool->shutdown, memory_order_relaxed))
+            return gen;
+        if (spins < pool->spin ||
+            (pool->hot_spin && atomic_load_explicit(&pool->hot, memory_order_relaxed))) {
+            spins++;
+            cpu_relax();
+            continue;
+        }
+        /* Park. n_parked is raised before re-checking the generation, and the
+         * dispatcher bumps the generation before reading n_parked, so one of
+         * the two always sees the other. */
+        pthread_mutex_lock(&pool->mutex);
+        atomic_fetch_add(&pool->n_parked, 1);
+        while (atomic_load(&pool->generation) == my_gen && !atomic_load(&pool->shutdown))
+            pthread_cond_wait(&pool->cond_work, &pool->mutex);
+        atomic_fetch_sub(&pool->n_parked, 1);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
 static void *worker_loop(void *arg) {
-    int tid = *(int *)arg;
+    pool_worker_t *w = (pool_worker_t *)arg;
+    qwen_threadpool_t *pool = w->pool;
+    int tid = w->tid;
     int my_gen = 0;
 
+    in_pool_worker = 1;
+    pool_worker_setup(pool);
+
     for (;;) {
-        pthread_mutex_lock(&tp.mutex);
-        while (tp.generation == my_gen && !tp.shutdown)
-            pthread_cond_wait(&tp.cond_work, &tp.mutex);
-        if (tp.shutdown) {
-            pthread_mutex_unlock(&tp.mutex);
-            return NULL;
-        }
-        my_gen = tp.generation;
-        parallel_fn_t fn = tp.fn;
-        void *a = tp.arg;
-        int nt = tp.n_threads;
-        pthread_mutex_unlock(&tp.mutex);
+        my_gen = pool_wait_work(pool, my_gen);
+        if (atomic_load(&pool->shutdown)) return NULL;
 
-        fn(tid, nt, a);
+        pool->fn(tid, pool->n_threads, pool->arg);
 
-        pthread_mutex_lock(&tp.mutex);
-        if (++tp.n_done >= tp.n_threads - 1)
-            pthread_cond_signal(&tp.cond_done);
-        pthread_mutex_unlock(&tp.mutex);
+        /* Last finisher wakes the dispatcher if it gave up spinning */
+        if (atomic_fetch_add(&pool->n_done, 1) == pool->n_threads - 2 &&
+            atomic_load(&pool->caller_parked)) {
+            pthread_mutex_lock(&pool->mutex);
+            pthread_cond_signal(&pool->cond_done);
+            pthread_mutex_unlock(&pool->mutex);
+        }
     }
 }
 
-void qwen_set_threads(int n) {
-    if (n < 1) n = 1;
-    if (n > QWEN_MAX_THREADS) n = QWEN_MAX_THREADS;
-
-    /* Shutdown existing workers */
-    if (tp.n_threads > 1) {
-        pthread_mutex_lock(&tp.mutex);
-        tp.shutdown = 1;
-        pthread_cond_broadcast(&tp.cond_work);
-        pthread_mutex_unlock(&tp.mutex);
-        for (int i = 0; i < tp.n_threads - 1; i++)
-            pthread_join(tp.threads[i], NULL);
-        tp.shutdown = 0;
-        tp.generation = 0;
+qwen_threadpool_t *qwen_threadpool_create(int n_threads, int qos) {
+    if (n_threads < 1) n_threads = 1;
+    if (n_threads > QWEN_MAX_THREADS) n_threads = QWEN_MAX_THREADS;
+
+    qwen_threadpool_t *pool = (qwen_threadpool_t *)calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->n_threads = n_threads;
+    pool->qos = qos;
+
+    /* Spinning only pays off when every worker has a core of its own, and
+     * not at all for a pool asked to save energy */
+    const char *env = getenv("QWEN_POOL_SPIN");
+    pool->spin = env ? atoi(env) : QWEN_POOL_SPIN_DEFAULT;
+    if (!env && (n_threads > qwen_get_num_cpus() || qos == QWEN_QOS_EFFICIENCY))
+        pool->spin = 0;
+    if (pool->spin < 0) pool->spin = 0;
+    env = getenv("QWEN_POOL_HOT");
+    pool->hot_spin = pool->spin > 0 && (env ? atoi(env) != 0 : QWEN_POOL_HOT_DEFAULT);
+
+    atomic_init(&pool->generation, 0);
+    atomic_init(&pool->n_done, 0);
+    atomic_init(&pool->shutdown, 0);
+    atomic_init(&pool->hot, 0);
+    atomic_init(&pool->n_parked, 0);
+    atomic_init(&pool->caller_parked, 0);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond_work, NULL);
+    pthread_cond_init(&pool->cond_done, NULL);
+    pthread_mutex_init(&pool->dispatch_mutex, NULL);
+
+    for (int i = 0; i < n_threads - 1; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].tid = i + 1;
+        if (pthread_create(&pool->threads[i], NULL, worker_loop, &pool->workers[i]) != 0) {
+            /* Run with the workers that did start */
+            pool->n_threads = i + 1;
+            break;
+        }
     }
 
-    tp.n_threads = n;
-    if (n <= 1) return;
+    if (qwen_verbose >= 2)
+        fprintf(stderr, "Thread pool: %d threads, qos=%d, spin=%d%s\n",
+                pool->n_threads, qos, pool->spin, pool->hot_spin ? " (hot regions)" : "");
+    return pool;
+}
 
-    for (int i = 0; i < n - 1; i++) {
-        tp.tids[i] = i + 1;
-        pthread_create(&tp.threads[i], NULL, worker_loop, &tp.tids[i]);
+void qwen_threadpool_free(qwen_threadpool_t *pool) {
+    if (!pool) return;
+    if (pool->n_threads > 1) {
+        pthread_mutex_lock(&pool->mutex);
+        atomic_store(&pool->shutdown, 1);
+        pthread_cond_broadcast(&pool->cond_work);
+        pthread_mutex_unlock(&pool->mutex);
+        for (int i = 0; i < pool->n_threads - 1; i++)
+            pthread_join(pool->threads[i], NULL);
     }
+    if (bound_pool == pool) bound_pool = NULL;
+    if (default_pool == pool) default_pool = NULL;
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond_work);
+    pthread_cond_destroy(&pool->cond_done);
+    pthread_mutex_destroy(&pool->dispatch_mutex);
+    free(pool);
+}
 
-    if (qwen_verbose >= 2)
-        fprintf(stderr, "Thread pool: %d threads\n", n);
+int qwen_threadpool_threads(const qwen_threadpool_t *pool) {
+    return pool ? pool->n_threads : 1;
+}
+
+qwen_threadpool_t *qwen_threadpool_bind(qwen_threadpool_t *pool) {
+    qwen_threadpool_t *prev = bound_pool;
+    bound_pool = pool;
+    return prev;
+}
+
+void qwen_set_threads(int n) {
+    qwen_threadpool_t *old = default_pool;
+    default_pool = qwen_threadpool_create(n, QWEN_QOS_DEFAULT);
+    qwen_threadpool_free(old);
 }
 
 int qwen_get_num_cpus(void) {
@@ -129,29 +288,153 @@ int qwen_get_num_cpus(void) {
 #endif
 }
 
-/* Dispatch work to all threads; main thread is tid=0 */
-static void parallel_for(parallel_fn_t fn, void *arg) {
-    if (tp.n_threads <= 1) {
+void qwen_parallel_begin(void) {
+    if (region_depth++ > 0) return;
+    qwen_threadpool_t *pool = cur_pool();
+    if (!pool || pool->n_threads <= 1 || in_pool_worker) return;
+    pthread_mutex_lock(&pool->dispatch_mutex);
+    atomic_fetch_add(&pool->hot, 1);
+    region_pool = pool;
+}
+
+void qwen_parallel_end(void) {
+    if (region_depth <= 0 || --region_depth > 0) return;
+    qwen_threadpool_t *pool = region_pool;
+    if (!pool) return;
+    region_pool = NULL;
+    atomic_fetch_sub(&pool->hot, 1);
+    pthread_mutex_unlock(&pool->dispatch_mutex);
+}
+
+/* Dispatch work to all threads of the current pool; the calling thread is
+ * tid=0. Nested calls from inside a worker run serially. Returns the thread
+ * count passed to fn. */
+static int parallel_for(parallel_fn_t fn, void *arg) {
+    qwen_threadpool_t *pool = cur_pool();
+    if (!pool || pool->n_threads <= 1 || in_pool_worker) {
         fn(0, 1, arg);
-        return;
+        return 1;
     }
 
-    pthread_mutex_lock(&tp.mutex);
-    tp.fn = fn;
-    tp.arg = arg;
-    tp.n_done = 0;
-    tp.generation++;
-    pthread_cond_broadcast(&tp.cond_work);
-    pthread_mutex_unlock(&tp.mutex);
+    int owns_region = (region_pool == pool);
+    if (!owns_region) pthread_mutex_lock(&pool->dispatch_mutex);
+    int nt = pool->n_threads;
+
+    pool->fn = fn;
+    pool->arg = arg;
+    atomic_store_explicit(&pool->n_done, 0, memory_order_relaxed);
+    atomic_fetch_add(&pool->generation, 1);   /* seq_cst: publishes fn/arg */
+    if (atomic_load(&pool->n_parked) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->cond_work);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+#if QWEN_PROFILE
+    qwen_perf_counters_t *perf = bound_perf;
+    double perf_t0 = perf ? qwen_perf_now_ms() : 0.0, perf_t1 = 0.0;
+#endif
+    in_pool_worker = 1;
+    fn(0, nt, arg);
+    in_pool_worker = 0;
+#if QWEN_PROFILE
+    if (perf) perf_t1 = qwen_perf_now_ms();
+#endif
+
+    int spins = 0;
+    while (atomic_load_explicit(&pool->n_done, memory_order_acquire) < nt - 1) {
+        if (spins++ < pool->spin || (owns_region && pool->hot_spin)) {
+            cpu_relax();
+            continue;
+        }
+        pthread_mutex_lock(&pool->mutex);
+        atomic_store(&pool->caller_parked, 1);
+        while (atomic_load(&pool->n_done) < nt - 1)
+            pthread_cond_wait(&pool->cond_done, &pool->mutex);
+        atomic_store(&pool->caller_parked, 0);
+        pthread_mutex_unlock(&pool->mutex);
+        break;
+    }
+
+#if QWEN_PROFILE
+    if (perf) {
+        perf->pool_dispatches++;
+        perf->pool_compute_ms += perf_t1 - perf_t0;
+        perf->pool_wait_ms += qwen_perf_now_ms() - perf_t1;
+    }
+#endif
+
+    if (!owns_region) pthread_mutex_unlock(&pool->dispatch_mutex);
+    return nt;
+}
+
+/* ========================================================================
+ * Profiling Counters
+ *
+ * Counted kernels open a scope with PERF_KERNEL at their top; it closes
+ * when the function returns (cleanup attribute), so every exit path is
+ * covered. Only the calling thread of the outermost counted kernel times
+ * anything, which keeps the cost at two clock reads per kernel call.
+ * ======================================================================== */
+
+double qwen_perf_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+qwen_perf_counters_t *qwen_perf_bind(qwen_perf_counters_t *c) {
+    qwen_perf_counters_t *prev = bound_perf;
+    bound_perf = c;
+    return prev;
+}
+
+void qwen_perf_counters_add(qwen_perf_counters_t *dst, const qwen_perf_counters_t *src) {
+    for (int k = 0; k < QWEN_PERF_KERNELS; k++) {
+        dst->kernel[k].calls += src->kernel[k].calls;
+        dst->kernel[k].ms += src->kernel[k].ms;
+        dst->kernel[k].weight_bytes += src->kernel[k].weight_bytes;
+    }
+    dst->pool_dispatches += src->pool_dispatches;
+    dst->pool_compute_ms += src->pool_compute_ms;
+    dst->pool_wait_ms += src->pool_wait_ms;
+}
+
+#if QWEN_PROFILE
+static __thread int perf_depth = 0;
 
-    fn(0, tp.n_threads, arg);
+typedef struct {
+    qwen_perf_counters_t *c;   /* NULL = not timing */
+    int kind;
+    size_t bytes;
+    double t0;
+} perf_scope_t;
+
+static inline perf_scope_t perf_kernel_begin(int kind, size_t bytes) {
+    perf_scope_t sc = { NULL, kind, bytes, 0.0 };
+    if (!bound_perf || in_pool_worker || perf_depth++ > 0) return sc;
+    sc.c = bound_perf;
+    sc.t0 = qwen_perf_now_ms();
+    return sc;
+}
 
-    pthread_mutex_lock(&tp.mutex);
-    while (tp.n_done < tp.n_threads - 1)
-        pthread_cond_wait(&tp.cond_done, &tp.mutex);
-    pthread_mutex_unlock(&tp.mutex);
+static inline void perf_kernel_end(perf_scope_t *sc) {
+    if (!bound_perf || in_pool_worker) return;
+    perf_depth--;
+    if (!sc->c) return;
+    qwen_perf_kernel_t *k = &sc->c->kernel[sc->kind];
+    k->calls++;
+    k->ms += qwen_perf_now_ms() - sc->t0;
+    k->weight_bytes += sc->bytes;
 }
 
+#define PERF_KERNEL(kind, bytes) \
+    perf_scope_t perf_scope_ __attribute__((cleanup(perf_kernel_end))) = \
+        perf_kernel_begin((kind), (bytes))
+#else
+#define PERF_KERNEL(kind, bytes) ((void)0)
+#endif
+
 /* ========================================================================
  * Basic Element-wise Operations
  * ======================================================================== */
@@ -177,6 +460,7 @@ void qwen_copy(float *dst, const float *src, int n) {
  * ======================================================================== */
 
 void qwen_matmul_t(float *C, const float *A, const float *B, int M, int K, int N) {
+    PERF_KERNEL(QWEN_PERF_MATMUL, (size_t)N * K * sizeof(float));
 #ifdef USE_BLAS
     cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
                 M, N, K, 1.0f, A, K, B, K, 0.0f, C, N);
@@ -195,6 +479,8 @@ void qwen_matmul_t(float *C, const float *A, const float *B, int M, int K, int N
 
 void qwen_linear(float *y, const float *x, const float *W, const float *b,
                  int seq_len, int in_dim, int out_dim) {
+    PERF_KERNEL(seq_len == 1 ? QWEN_PERF_MATVEC : QWEN_PERF_MATMUL,
+                (size_t)out_dim * in_dim * sizeof(float));
 #ifdef USE_BLAS
     cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
                 seq_len, out_dim, in_dim,
@@ -228,6 +514,13 @@ void qwen_linear_nobias(float *y, const float *x, const float *W,
     qwen_linear(y, x, W, NULL, seq_len, in_dim, out_dim);
 }
 
+static inline float bf16_to_f32(uint16_t v) {
+    uint32_t bits = ((uint32_t)v) << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
 /* Convert bf16 buffer to f32 buffer */
 static void bf16_to_f32_buf(float *dst, const uint16_t *src, size_t n) {
     uint32_t *d = (uint32_t *)(void *)dst;
@@ -235,98 +528,284 @@ static void bf16_to_f32_buf(float *dst, const uint16_t *src, size_t n) {
         d[i] = ((uint32_t)src[i]) << 16;
 }
 
-/* Reusable scratch buffer for bf16->f32 conversion */
-static float *bf16_scratch = NULL;
-static size_t bf16_scratch_cap = 0;
+static __thread qwen_scratch_t *bound_scratch = NULL;
+
+qwen_scratch_t *qwen_scratch_bind(qwen_scratch_t *s) {
+    qwen_scratch_t *prev = bound_scratch;
+    bound_scratch = s;
+    return prev;
+}
+
+void qwen_scratch_release(qwen_scratch_t *s) {
+    if (!s) return;
+    free(s->buf);
+    s->buf = NULL;
+    s->cap = 0;
+}
 
+/* bf16->f32 scratch bound to the calling thread (a per-thread one when
+ * none is, e.g. for the benchmarks). */
 static float *bf16_get_scratch(size_t n) {
-    if (n > bf16_scratch_cap) {
-        free(bf16_scratch);
-        bf16_scratch = (float *)malloc(n * sizeof(float));
-        bf16_scratch_cap = bf16_scratch ? n : 0;
+    static __thread qwen_scratch_t fallback;
+    qwen_scratch_t *s = bound_scratch ? bound_scratch : &fallback;
+    if (n > s->cap) {
+        free(s->buf);
+        s->buf = (float *)malloc(n * sizeof(float));
+        s->cap = s->buf ? n : 0;
     }
-    return bf16_scratch;
+    return s->buf;
 }
 
+/* ------------------------------------------------------------------------
+ * bf16 -> f32 weight cache
+ *
+ * Keyed by (src, n) through a pointer hash; entries sit on an LRU list and
+ * the least recently used unpinned ones are evicted to stay within
+ * limit_bytes. Lookups pin the entry until bf16_cache_release, so another
+ * thread sharing the cache cannot free a matrix that is still being read.
+ * Kernels use the cache bound to the calling thread (qwen_bf16_cache_bind).
+ * ------------------------------------------------------------------------ */
+
+#define BF16_CACHE_MIN_BUCKETS 256
+
 typedef struct {
     const uint16_t *src;
     size_t n;
     float *dst_f32;
+    int refs;
+    int prev, next;                /* LRU list, head = most recent */
+    int hnext;                     /* hash chain */
 } bf16_cache_entry_t;
 
-static bf16_cache_entry_t *bf16_cache = NULL;
-static int bf16_cache_len = 0;
-static int bf16_cache_cap = 0;
-static size_t bf16_cache_bytes = 0;
-static size_t bf16_cache_limit_bytes = 0;
-static int bf16_cache_limit_init = 0;
+struct qwen_bf16_cache {
+    pthread_mutex_t mutex;
+    bf16_cache_entry_t *entries;
+    int n_entries, cap_entries;
+    int free_list;                 /* recycled slots, chained through hnext */
+    int *buckets;                  /* -1 = empty */
+    int n_buckets;                 /* power of two */
+    int lru_head, lru_tail;
+    size_t bytes, limit_bytes;
+    uint64_t hits, misses, evictions, bypass;
+};
 
-static void bf16_cache_init_limit(void) {
-    if (bf16_cache_limit_init) return;
-    bf16_cache_limit_init = 1;
+static __thread qwen_bf16_cache_t *bound_cache = NULL;
 
-    /* Default OFF. Override with QWEN_BF16_CACHE_MB=<n> to enable. */
-    unsigned long long mb = 0;
-    const char *env = getenv("QWEN_BF16_CACHE_MB");
-    if (env && env[0] != '\0') {
-        char *end = NULL;
-        unsigned long long v = strtoull(env, &end, 10);
-        if (end != env) mb = v;
-    }
-    bf16_cache_limit_bytes = (size_t)(mb * 1024ULL * 1024ULL);
+static inline uint32_t bf16_cache_hash(const uint16_t *src, size_t n) {
+    uint64_t h = (uint64_t)(uintptr_t)src ^ ((uint64_t)n * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
 
-    if (qwen_verbose >= 2) {
-        fprintf(stderr, "BF16 cache: limit=%llu MB\n", mb);
+qwen_bf16_cache_t *qwen_bf16_cache_create(size_t limit_bytes) {
+    qwen_bf16_cache_t *c = (qwen_bf16_cache_t *)calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->n_buckets = BF16_CACHE_MIN_BUCKETS;
+    c->buckets = (int *)malloc((size_t)c->n_buckets * sizeof(int));
+    if (!c->buckets) {
+        free(c);
+        return NULL;
     }
+    for (int i = 0; i < c->n_buckets; i++) c->buckets[i] = -1;
+    c->free_list = -1;
+    c->lru_head = c->lru_tail = -1;
+    c->limit_bytes = limit_bytes;
+    pthread_mutex_init(&c->mutex, NULL);
+    return c;
+}
+
+void qwen_bf16_cache_free(qwen_bf16_cache_t *c) {
+    if (!c) return;
+    if (bound_cache == c) bound_cache = NULL;
+    for (int i = 0; i < c->n_entries; i++) free(c->entries[i].dst_f32);
+    free(c->entries);
+    free(c->buckets);
+    pthread_mutex_destroy(&c->mutex);
+    free(c);
+}
+
+void qwen_bf16_cache_stats(qwen_bf16_cache_t *c, qwen_bf16_cache_stats_t *st) {
+    memset(st, 0, sizeof(*st));
+    if (!c) return;
+    pthread_mutex_lock(&c->mutex);
+    st->hits = c->hits;
+    st->misses = c->misses;
+    st->evictions = c->evictions;
+    st->bypass = c->bypass;
+    st->bytes = c->bytes;
+    st->limit_bytes = c->limit_bytes;
+    for (int i = c->lru_head; i >= 0; i = c->entries[i].next) st->entries++;
+    pthread_mutex_unlock(&c->mutex);
+}
+
+qwen_bf16_cache_t *qwen_bf16_cache_bind(qwen_bf16_cache_t *c) {
+    qwen_bf16_cache_t *prev = bound_cache;
+    bound_cache = c;
+    return prev;
 }
 
-static const float *bf16_get_cached_f32(const uint16_t *src, size_t n) {
-    bf16_cache_init_limit();
+static void bf16_lru_unlink(qwen_bf16_cache_t *c, int i) {
+    bf16_cache_entry_t *e = &c->entries[i];
+    if (e->prev >= 0) c->entries[e->prev].next = e->next; else c->lru_head = e->next;
+    if (e->next >= 0) c->entries[e->next].prev = e->prev; else c->lru_tail = e->prev;
+    e->prev = e->next = -1;
+}
+
+static void bf16_lru_push_front(qwen_bf16_cache_t *c, int i) {
+    bf16_cache_entry_t *e = &c->entries[i];
+    e->prev = -1;
+    e->next = c->lru_head;
+    if (c->lru_head >= 0) c->entries[c->lru_head].prev = i;
+    c->lru_head = i;
+    if (c->lru_tail < 0) c->lru_tail = i;
+}
+
+static void bf16_hash_remove(qwen_bf16_cache_t *c, int i) {
+    bf16_cache_entry_t *e = &c->entries[i];
+    int *link = &c->buckets[bf16_cache_hash(e->src, e->n) & (uint32_t)(c->n_buckets - 1)];
+    while (*link != i) link = &c->entries[*link].hnext;
+    *link = e->hnext;
+}
+
+static void bf16_hash_insert(qwen_bf16_cache_t *c, int i) {
+    bf16_cache_entry_t *e = &c->entries[i];
+    int b = (int)(bf16_cache_hash(e->src, e->n) & (uint32_t)(c->n_buckets - 1));
+    e->hnext = c->buckets[b];
+    c->buckets[b] = i;
+}
 
-    for (int i = 0; i < bf16_cache_len; i++) {
-        if (bf16_cache[i].src == src && bf16_cache[i].n == n) {
-            return bf16_cache[i].dst_f32;
+/* Evict unpinned entries from the LRU tail until `need` more bytes fit. */
+static int bf16_cache_make_room(qwen_bf16_cache_t *c, size_t need) {
+    int i = c->lru_tail;
+    while (c->bytes + need > c->limit_bytes && i >= 0) {
+        int prev = c->entries[i].prev;
+        bf16_cache_entry_t *e = &c->entries[i];
+        if (e->refs == 0) {
+            bf16_lru_unlink(c, i);
+            bf16_hash_remove(c, i);
+            c->bytes -= e->n * sizeof(float);
+            free(e->dst_f32);
+            e->dst_f32 = NULL;
+            e->src = NULL;
+            e->hnext = c->free_list;
+            c->free_list = i;
+            c->evictions++;
         }
+        i = prev;
     }
+    return c->bytes + need <= c->limit_bytes ? 0 : -1;
+}
 
-    if (bf16_cache_limit_bytes == 0) return NULL;
+static int bf16_cache_new_slot(qwen_bf16_cache_t *c) {
+    if (c->free_list >= 0) {
+        int i = c->free_list;
+        c->free_list = c->entries[i].hnext;
+        return i;
+    }
+    if (c->n_entries == c->cap_entries) {
+        int new_cap = c->cap_entries > 0 ? c->cap_entries * 2 : 64;
+        bf16_cache_entry_t *tmp = (bf16_cache_entry_t *)realloc(
+            c->entries, (size_t)new_cap * sizeof(bf16_cache_entry_t));
+        if (!tmp) return -1;
+        c->entries = tmp;
+        c->cap_entries = new_cap;
+    }
+    /* Keep chains short: rehash at load factor 1 */
+    if (c->n_entries >= c->n_buckets) {
+        int nb = c->n_buckets * 2;
+        int *tmp = (int *)malloc((size_t)nb * sizeof(int));
+        if (tmp) {
+            free(c->buckets);
+            c->buckets = tmp;
+            c->n_buckets = nb;
+            for (int b = 0; b < nb; b++) c->buckets[b] = -1;
+            for (int j = c->lru_head; j >= 0; j = c->entries[j].next)
+                bf16_hash_insert(c, j);
+        }
+    }
+    return c->n_entries++;
+}
 
-    size_t bytes = n * sizeof(float);
-    if (bytes > bf16_cache_limit_bytes) return NULL;
-    if (bf16_cache_bytes + bytes > bf16_cache_limit_bytes) return NULL;
+/* Return a pinned f32 copy of src, converting on a miss; NULL if it does
+ * not fit in the budget. */
+static const float *bf16_cache_acquire(qwen_bf16_cache_t *c, const uint16_t *src, size_t n) {
+    pthread_mutex_lock(&c->mutex);
+    int b = (int)(bf16_cache_hash(src, n) & (uint32_t)(c->n_buckets - 1));
+    for (int i = c->buckets[b]; i >= 0; i = c->entries[i].hnext) {
+        bf16_cache_entry_t *e = &c->entries[i];
+        if (e->src == src && e->n == n) {
+            e->refs++;
+            bf16_lru_unlink(c, i);
+            bf16_lru_push_front(c, i);
+            c->hits++;
+            pthread_mutex_unlock(&c->mutex);
+            return e->dst_f32;
+        }
+    }
 
+    size_t bytes = n * sizeof(float);
+    c->misses++;
+    if (bytes > c->limit_bytes || bf16_cache_make_room(c, bytes) != 0) {
+        c->bypass++;
+        pthread_mutex_unlock(&c->mutex);
+        return NULL;
+    }
     float *dst = (float *)malloc(bytes);
-    if (!dst) return NULL;
+    int i = dst ? bf16_cache_new_slot(c) : -1;
+    if (i < 0) {
+        free(dst);
+        c->bypass++;
+        pthread_mutex_unlock(&c->mutex);
+        return NULL;
+    }
     bf16_to_f32_buf(dst, src, n);
+    bf16_cache_entry_t *e = &c->entries[i];
+    e->src = src;
+    e->n = n;
+    e->dst_f32 = dst;
+    e->refs = 1;
+    c->bytes += bytes;
+    bf16_lru_push_front(c, i);
+    bf16_hash_insert(c, i);
+    pthread_mutex_unlock(&c->mutex);
+    return dst;
+}
 
-    if (bf16_cache_len == bf16_cache_cap) {
-        int new_cap = bf16_cache_cap > 0 ? bf16_cache_cap * 2 : 256;
-        bf16_cache_entry_t *tmp = (bf16_cache_entry_t *)realloc(
-            bf16_cache, (size_t)new_cap * sizeof(bf16_cache_entry_t));
-        if (!tmp) {
-            free(dst);
-            return NULL;
+static void bf16_cache_release(qwen_bf16_cache_t *c, const uint16_t *src, size_t n) {
+    pthread_mutex_lock(&c->mutex);
+    int b = (int)(bf16_cache_hash(src, n) & (uint32_t)(c->n_buckets - 1));
+    for (int i = c->buckets[b]; i >= 0; i = c->entries[i].hnext) {
+        bf16_cache_entry_t *e = &c->entries[i];
+        if (e->src == src && e->n == n) {
+            if (e->refs > 0) e->refs--;
+            break;
         }
-        bf16_cache = tmp;
-        bf16_cache_cap = new_cap;
     }
-
-    bf16_cache[bf16_cache_len].src = src;
-    bf16_cache[bf16_cache_len].n = n;
-    bf16_cache[bf16_cache_len].dst_f32 = dst;
-    bf16_cache_len++;
-    bf16_cache_bytes += bytes;
-    return dst;
+    pthread_mutex_unlock(&c->mutex);
 }
 
-static const float *bf16_get_f32_view(const uint16_t *src, size_t n) {
-    const float *cached = bf16_get_cached_f32(src, n);
-    if (cached) return cached;
+static void weight_gemm_tiled(float *y, const float *x, const qwen_weight_t *W,
+                              const float *b, int seq_len);
 
-    float *scratch = bf16_get_scratch(n);
-    if (!scratch) return NULL;
-    bf16_to_f32_buf(scratch, src, n);
-    return scratch;
+/* seq > 1 with bf16 weights: reuse a full f32 copy from the bound cache when
+ * it can hold one, otherwise expand and multiply one cache-sized row panel at
+ * a time, so the matrix is never materialized in f32. */
+static void bf16_gemm(float *y, const float *x, const uint16_t *W_bf16,
+                      const float *b, int seq_len, int in_dim, int out_dim) {
+    size_t n = (size_t)out_dim * in_dim;
+    if (bound_cache && bound_cache->limit_bytes > 0) {
+        const float *W_f32 = bf16_cache_acquire(bound_cache, W_bf16, n);
+        if (W_f32) {
+            qwen_linear(y, x, W_f32, b, seq_len, in_dim, out_dim);
+            bf16_cache_release(bound_cache, W_bf16, n);
+            return;
+        }
+    }
+    qwen_weight_t w = { .format = QWEN_WEIGHT_BF16, .out_dim = out_dim,
+                        .in_dim = in_dim, .bf16 = W_bf16 };
+    weight_gemm_tiled(y, x, &w, b, seq_len);
 }
 
 /*
@@ -364,7 +843,7 @@ static void matvec_worker(int tid, int n_threads, void *arg) {
 
 static void bf16_matvec_threaded(float *y, const float *x, const uint16_t *W_bf16,
                                   const float *bias, int in_dim, int out_dim) {
-    if (tp.n_threads <= 1) {
+    if (pool_threads() <= 1) {
         bf16_matvec_fused(y, x, W_bf16, bias, in_dim, out_dim);
         return;
     }
@@ -372,115 +851,41 @@ static void bf16_matvec_threaded(float *y, const float *x, const uint16_t *W_bf1
     parallel_for(matvec_worker, &task);
 }
 
-typedef struct {
-    float *q;
-    float *k;
-    float *v;
-    const float *x;
-    const uint16_t *Wq_bf16;
-    const uint16_t *Wk_bf16;
-    const uint16_t *Wv_bf16;
-    int in_dim;
-    int q_dim;
-    int kv_dim;
-    int total_dim;
-} qkv_matvec_task_t;
-
-static void qkv_matvec_worker(int tid, int n_threads, void *arg) {
-    qkv_matvec_task_t *t = (qkv_matvec_task_t *)arg;
-    int chunk = (t->total_dim + n_threads - 1) / n_threads;
-    int start = tid * chunk;
-    int end = start + chunk;
-    if (end > t->total_dim) end = t->total_dim;
-    if (start >= end) return;
-
-    int q_end = t->q_dim;
-    int k_end = q_end + t->kv_dim;
-    int v_end = k_end + t->kv_dim;
-
-    if (start < q_end) {
-        int s = start;
-        int e = end < q_end ? end : q_end;
-        if (s < e) {
-            bf16_matvec_fused(t->q + s, t->x,
-                              t->Wq_bf16 + (size_t)s * t->in_dim,
-                              NULL, t->in_dim, e - s);
-        }
-    }
-
-    if (end > q_end && start < k_end) {
-        int s = start > q_end ? start - q_end : 0;
-        int e_abs = end < k_end ? end : k_end;
-        int e = e_abs - q_end;
-        if (s < e) {
-            bf16_matvec_fused(t->k + s, t->x,
-                              t->Wk_bf16 + (size_t)s * t->in_dim,
-                              NULL, t->in_dim, e - s);
-        }
-    }
-
-    if (end > k_end && start < v_end) {
-        int s = start > k_end ? start - k_end : 0;
-        int e_abs = end < v_end ? end : v_end;
-        int e = e_abs - k_end;
-        if (s < e) {
-            bf16_matvec_fused(t->v + s, t->x,
-                              t->Wv_bf16 + (size_t)s * t->in_dim,
-                              NULL, t->in_dim, e - s);
-        }
-    }
-}
-
 void qwen_linear_nobias_bf16_qkv(float *q, float *k, float *v, const float *x,
                                  const uint16_t *Wq_bf16,
                                  const uint16_t *Wk_bf16,
                                  const uint16_t *Wv_bf16,
                                  int in_dim, int q_dim, int kv_dim) {
-    if (tp.n_threads <= 1) {
-        bf16_matvec_fused(q, x, Wq_bf16, NULL, in_dim, q_dim);
-        bf16_matvec_fused(k, x, Wk_bf16, NULL, in_dim, kv_dim);
-        bf16_matvec_fused(v, x, Wv_bf16, NULL, in_dim, kv_dim);
-        return;
-    }
-
-    qkv_matvec_task_t task = {
-        .q = q,
-        .k = k,
-        .v = v,
-        .x = x,
-        .Wq_bf16 = Wq_bf16,
-        .Wk_bf16 = Wk_bf16,
-        .Wv_bf16 = Wv_bf16,
-        .in_dim = in_dim,
-        .q_dim = q_dim,
-        .kv_dim = kv_dim,
-        .total_dim = q_dim + 2 * kv_dim,
-    };
-    parallel_for(qkv_matvec_worker, &task);
+    PERF_KERNEL(QWEN_PERF_MATVEC, (size_t)(q_dim + 2 * kv_dim) * in_dim * sizeof(uint16_t));
+    qwen_weight_t wq = { .format = QWEN_WEIGHT_BF16, .out_dim = q_dim,
+                         .in_dim = in_dim, .bf16 = Wq_bf16 };
+    qwen_weight_t wk = { .format = QWEN_WEIGHT_BF16, .out_dim = kv_dim,
+                         .in_dim = in_dim, .bf16 = Wk_bf16 };
+    qwen_weight_t wv = { .format = QWEN_WEIGHT_BF16, .out_dim = kv_dim,
+                         .in_dim = in_dim, .bf16 = Wv_bf16 };
+    qwen_linear_w_qkv(q, k, v, x, &wq, &wk, &wv);
 }
 
 void qwen_linear_nobias_bf16(float *y, const float *x, const uint16_t *W_bf16,
                               int seq_len, int in_dim, int out_dim) {
+    PERF_KERNEL(seq_len == 1 ? QWEN_PERF_MATVEC : QWEN_PERF_MATMUL,
+                (size_t)out_dim * in_dim * sizeof(uint16_t));
     if (seq_len == 1) {
         bf16_matvec_threaded(y, x, W_bf16, NULL, in_dim, out_dim);
         return;
     }
-    size_t n = (size_t)out_dim * in_dim;
-    const float *W_f32 = bf16_get_f32_view(W_bf16, n);
-    if (!W_f32) return;
-    qwen_linear_nobias(y, x, W_f32, seq_len, in_dim, out_dim);
+    bf16_gemm(y, x, W_bf16, NULL, seq_len, in_dim, out_dim);
 }
 
 void qwen_linear_bf16(float *y, const float *x, const uint16_t *W_bf16,
                       const float *b, int seq_len, int in_dim, int out_dim) {
+    PERF_KERNEL(seq_len == 1 ? QWEN_PERF_MATVEC : QWEN_PERF_MATMUL,
+                (size_t)out_dim * in_dim * sizeof(uint16_t));
     if (seq_len == 1) {
         bf16_matvec_threaded(y, x, W_bf16, b, in_dim, out_dim);
         return;
     }
-    size_t n = (size_t)out_dim * in_dim;
-    const float *W_f32 = bf16_get_f32_view(W_bf16, n);
-    if (!W_f32) return;
-    qwen_linear(y, x, W_f32, b, seq_len, in_dim, out_dim);
+    bf16_gemm(y, x, W_bf16, b, seq_len, in_dim, out_dim);
 }
 
 /* Find argmax over a range of output rows [start, end).
@@ -491,49 +896,450 @@ static void argmax_bf16_range(const float *x, const uint16_t *W_bf16,
     qwen_argmax_bf16_range_impl(x, W_bf16, in_dim, start, end, best_out, best_val_out);
 }
 
+int qwen_argmax_matvec_bf16(const float *x, const uint16_t *W_bf16,
+                             int in_dim, int out_dim) {
+    PERF_KERNEL(QWEN_PERF_LM_HEAD, (size_t)out_dim * in_dim * sizeof(uint16_t));
+    qwen_weight_t w = { .format = QWEN_WEIGHT_BF16, .out_dim = out_dim,
+                        .in_dim = in_dim, .bf16 = W_bf16 };
+    return qwen_argmax_matvec_w(x, &w);
+}
+
+void qwen_matmul_t_bf16(float *C, const float *A, const uint16_t *B_bf16,
+                         int M, int K, int N) {
+    PERF_KERNEL(M == 1 ? QWEN_PERF_MATVEC : QWEN_PERF_MATMUL, (size_t)N * K * sizeof(uint16_t));
+    if (M == 1) {
+        bf16_matvec_threaded(C, A, B_bf16, NULL, K, N);
+    } else {
+        bf16_gemm(C, A, B_bf16, NULL, M, K, N);
+    }
+}
+
+/* ========================================================================
+ * Multi-format Weights
+ * ======================================================================== */
+
+/* Scratch budget for one expanded weight tile (floats). 128K floats = 512 KB
+ * keeps the tile L2-resident while giving the GEMM enough columns. */
+#define WEIGHT_TILE_FLOATS (1 << 17)
+#define WEIGHT_TILE_MIN_ROWS 32
+
+const char *qwen_weight_format_name(int format) {
+    switch (format) {
+    case QWEN_WEIGHT_F32:  return "f32";
+    case QWEN_WEIGHT_BF16: return "bf16";
+    case QWEN_WEIGHT_INT8: return "int8";
+    case QWEN_WEIGHT_INT4: return "int4";
+    default:               return "unknown";
+    }
+}
+
+int qwen_weight_from_bf16(qwen_weight_t *w, const uint16_t *src,
+                          int out_dim, int in_dim, int format) {
+    return qwen_weight_from_bf16_rows(w, src, NULL, out_dim, in_dim, format);
+}
+
+int qwen_weight_from_bf16_rows(qwen_weight_t *w, const uint16_t *src, const int *rows,
+                               int n_rows, int in_dim, int format) {
+    memset(w, 0, sizeof(*w));
+    if (!src) return -1;
+    w->format = format;
+    w->out_dim = n_rows;
+    w->in_dim = in_dim;
+    size_t n = (size_t)n_rows * in_dim;
+
+#define SRC_ROW(o) (src + (size_t)(rows ? rows[o] : (o)) * in_dim)
+
+    switch (format) {
+    case QWEN_WEIGHT_F32:
+        w->f32 = (float *)malloc(n * sizeof(float));
+        if (!w->f32) return -1;
+        for (int o = 0; o < n_rows; o++)
+            bf16_to_f32_buf(w->f32 + (size_t)o * in_dim, SRC_ROW(o), (size_t)in_dim);
+        return 0;
+    case QWEN_WEIGHT_BF16:
+        if (rows) return -1;    /* gathered rows would need a copy */
+        w->bf16 = src;
+        return 0;
+    case QWEN_WEIGHT_INT8:
+        w->i8 = (int8_t *)malloc(n);
+        w->scale = (float *)malloc((size_t)n_rows * sizeof(float));
+        if (!w->i8 || !w->scale) {
+            qwen_weight_free(w);
+            return -1;
+        }
+        /* Symmetric per-row quantization: q = round(w / (max|w| / 127)) */
+        for (int o = 0; o < n_rows; o++) {
+            const uint16_t *row = SRC_ROW(o);
+            int8_t *qrow = w->i8 + (size_t)o * in_dim;
+            float amax = 0.0f;
+            for (int i = 0; i < in_dim; i++) {
+                float a = fabsf(bf16_to_f32(row[i]));
+                if (a > amax) amax = a;
+            }
+            float scale = amax > 0.0f ? amax / 127.0f : 1.0f;
+            float inv = 1.0f / scale;
+            for (int i = 0; i < in_dim; i++) {
+                int q = (int)lrintf(bf16_to_f32(row[i]) * inv);
+                if (q > 127) q = 127;
+                if (q < -127) q = -127;
+                qrow[i] = (int8_t)q;
+            }
+            w->scale[o] = scale;
+        }
+        return 0;
+    case QWEN_WEIGHT_INT4: {
+        if (in_dim % QWEN_Q4_GROUP != 0) return -1;
+        int groups = in_dim / QWEN_Q4_GROUP;
+        int half = QWEN_Q4_GROUP / 2;
+        w->i4 = (uint8_t *)malloc(n / 2);
+        w->scale = (float *)malloc(n / QWEN_Q4_GROUP * sizeof(float));
+        if (!w->i4 || !w->scale) {
+            qwen_weight_free(w);
+            return -1;
+        }
+        /* Symmetric per-group quantization to [-7, 7], stored as q+8 */
+        for (int o = 0; o < n_rows; o++) {
+            const uint16_t *row = SRC_ROW(o);
+            for (int g = 0; g < groups; g++) {
+                const uint16_t *grp = row + (size_t)g * QWEN_Q4_GROUP;
+                uint8_t *qg = w->i4 + ((size_t)o * groups + g) * half;
+                float amax = 0.0f;
+                for (int i = 0; i < QWEN_Q4_GROUP; i++) {
+                    float a = fabsf(bf16_to_f32(grp[i]));
+                    if (a > amax) amax = a;
+                }
+                float scale = amax > 0.0f ? amax / 7.0f : 1.0f;
+                float inv = 1.0f / scale;
+                for (int j = 0; j < half; j++) {
+                    int lo = (int)lrintf(bf16_to_f32(grp[j]) * inv);
+                    int hi = (int)lrintf(bf16_to_f32(grp[j + half]) * inv);
+                    if (lo > 7) lo = 7;
+                    if (lo < -7) lo = -7;
+                    if (hi > 7) hi = 7;
+                    if (hi < -7) hi = -7;
+                    qg[j] = (uint8_t)((lo + 8) | ((hi + 8) << 4));
+                }
+                w->scale[(size_t)o * groups + g] = scale;
+            }
+        }
+        return 0;
+    }
+    default:
+        return -1;
+    }
+
+#undef SRC_ROW
+}
+
+void qwen_weight_free(qwen_weight_t *w) {
+    if (!w) return;
+    free(w->f32);
+    free(w->i8);
+    free(w->i4);
+    free(w->scale);
+    memset(w, 0, sizeof(*w));
+}
+
+size_t qwen_weight_bytes(const qwen_weight_t *w) {
+    size_t n = (size_t)w->out_dim * w->in_dim;
+    switch (w->format) {
+    case QWEN_WEIGHT_F32:  return w->f32 ? n * sizeof(float) : 0;
+    case QWEN_WEIGHT_BF16: return w->bf16 ? n * sizeof(uint16_t) : 0;
+    case QWEN_WEIGHT_INT8: return w->i8 ? n + (size_t)w->out_dim * sizeof(float) : 0;
+    case QWEN_WEIGHT_INT4: return w->i4 ? n / 2 + n / QWEN_Q4_GROUP * sizeof(float) : 0;
+    default:               return 0;
+    }
+}
+
+/* Expand rows [r0, r0+nr) of W into dst[nr, in_dim] as f32. */
+static void weight_expand_rows(float *dst, const qwen_weight_t *W, int r0, int nr) {
+    int in_dim = W->in_dim;
+    if (W->format == QWEN_WEIGHT_BF16) {
+        bf16_to_f32_buf(dst, W->bf16 + (size_t)r0 * in_dim, (size_t)nr * in_dim);
+        return;
+    }
+    if (W->format == QWEN_WEIGHT_INT4) {
+        int half = QWEN_Q4_GROUP / 2;
+        size_t groups = (size_t)nr * in_dim / QWEN_Q4_GROUP;
+        const uint8_t *q = W->i4 + (size_t)r0 * in_dim / 2;
+        const float *sc = W->scale + (size_t)r0 * in_dim / QWEN_Q4_GROUP;
+        for (size_t g = 0; g < groups; g++) {
+            const uint8_t *qg = q + g * half;
+            float *d = dst + g * QWEN_Q4_GROUP;
+            for (int j = 0; j < half; j++) {
+                d[j] = (float)((int)(qg[j] & 0x0F) - 8) * sc[g];
+                d[j + half] = (float)((int)(qg[j] >> 4) - 8) * sc[g];
+            }
+        }
+        return;
+    }
+    for (int r = 0; r < nr; r++) {
+        const int8_t *q = W->i8 + (size_t)(r0 + r) * in_dim;
+        float s = W->scale[r0 + r];
+        float *d = dst + (size_t)r * in_dim;
+        for (int i = 0; i < in_dim; i++) d[i] = (float)q[i] * s;
+    }
+}
+
+/* Rows [r0, r1) of W @ x + bias into y[0 .. r1-r0), reading W in its stored format. */
+static void weight_matvec_rows(float *y, const float *x, const qwen_weight_t *W,
+                               const float *bias, int r0, int r1) {
+    int in_dim = W->in_dim;
+    int nr = r1 - r0;
+    const float *b = bias ? bias + r0 : NULL;
+    switch (W->format) {
+    case QWEN_WEIGHT_BF16:
+        bf16_matvec_fused(y, x, W->bf16 + (size_t)r0 * in_dim, b, in_dim, nr);
+        break;
+    case QWEN_WEIGHT_INT8:
+        qwen_i8_matvec_impl(y, x, W->i8 + (size_t)r0 * in_dim,
+                            W->scale + r0, b, in_dim, nr);
+        break;
+    case QWEN_WEIGHT_INT4:
+        qwen_i4_matvec_impl(y, x, W->i4 + (size_t)r0 * in_dim / 2,
+                            W->scale + (size_t)r0 * in_dim / QWEN_Q4_GROUP,
+                            b, in_dim, nr);
+        break;
+    default:
+        for (int o = r0; o < r1; o++) {
+            y[o - r0] = qwen_dot_f32_impl(W->f32 + (size_t)o * in_dim, x, in_dim) +
+                   (bias ? bias[o] : 0.0f);
+        }
+        break;
+    }
+}
+
+/* Rows [r0, r1) of W @ x + bias for n inputs x[n, in_dim]; input i writes
+ * y + i * ldy and adds bias + i * ldb. Each block of weight rows is reused
+ * for all inputs while it is in cache. Blocks start at multiples of
+ * MATVEC_ROW_BLOCK from r0, so every row goes through the same kernel
+ * lanes as in the n == 1 call and sums in the same order. */
+#define MATVEC_ROW_BLOCK 16
+
+static void weight_matvec_rows_n(float *y, size_t ldy, const float *x, int n,
+                                 const qwen_weight_t *W, const float *bias, size_t ldb,
+                                 int r0, int r1) {
+    if (n == 1) {
+        weight_matvec_rows(y, x, W, bias, r0, r1);
+        return;
+    }
+    for (int b0 = r0; b0 < r1; b0 += MATVEC_ROW_BLOCK) {
+        int b1 = b0 + MATVEC_ROW_BLOCK < r1 ? b0 + MATVEC_ROW_BLOCK : r1;
+        for (int i = 0; i < n; i++)
+            weight_matvec_rows(y + i * ldy + (b0 - r0), x + (size_t)i * W->in_dim, W,
+                               bias ? bias + i * ldb : NULL, b0, b1);
+    }
+}
+
+/* Argmax of (W @ x) over rows [start, end). */
+static void weight_argmax_rows(const float *x, const qwen_weight_t *W,
+                               int start, int end, int *best_out, float *best_val_out) {
+    int in_dim = W->in_dim;
+    switch (W->format) {
+    case QWEN_WEIGHT_BF16:
+        argmax_bf16_range(x, W->bf16, in_dim, start, end, best_out, best_val_out);
+        return;
+    case QWEN_WEIGHT_INT8:
+        qwen_argmax_i8_range_impl(x, W->i8, W->scale, in_dim, start, end,
+                                  best_out, best_val_out);
+        return;
+    case QWEN_WEIGHT_INT4:
+        qwen_argmax_i4_range_impl(x, W->i4, W->scale, in_dim, start, end,
+                                  best_out, best_val_out);
+        return;
+    default: {
+        int best = start;
+        float best_val = -1e30f;
+        for (int o = start; o < end; o++) {
+            float v = qwen_dot_f32_impl(W->f32 + (size_t)o * in_dim, x, in_dim);
+            if (v > best_val) { best_val = v; best = o; }
+        }
+        *best_out = best;
+        *best_val_out = best_val;
+        return;
+    }
+    }
+}
+
+/* Threaded matvec over n inputs: split output rows across threads */
 typedef struct {
+    float *y;
     const float *x;
-    const uint16_t *W_bf16;
-    int in_dim;
-    int out_dim;
+    const qwen_weight_t *W;
+    const float *bias;
+    size_t ldb;
+    int n;
+} weight_matvec_task_t;
+
+static void weight_matvec_worker(int tid, int n_threads, void *arg) {
+    weight_matvec_task_t *t = (weight_matvec_task_t *)arg;
+    int out_dim = t->W->out_dim;
+    int chunk = (out_dim + n_threads - 1) / n_threads;
+    int start = tid * chunk;
+    int end = start + chunk;
+    if (end > out_dim) end = out_dim;
+    if (start >= end) return;
+    weight_matvec_rows_n(t->y + start, (size_t)out_dim, t->x, t->n, t->W,
+                         t->bias, t->ldb, start, end);
+}
+
+static void weight_matvec_threaded(float *y, const float *x, const qwen_weight_t *W,
+                                   const float *bias, size_t ldb, int n) {
+    weight_matvec_task_t task = { y, x, W, bias, ldb, n };
+    if (pool_threads() <= 1) {
+        weight_matvec_worker(0, 1, &task);
+        return;
+    }
+    parallel_for(weight_matvec_worker, &task);
+}
+
+/* Q/K/V rows are treated as one [q_dim + 2*kv_dim] output split across threads */
+typedef struct {
+    float *out[3];
+    const float *x;
+    const qwen_weight_t *W[3];
+    int total_dim;
+} qkv_matvec_task_t;
+
+static void qkv_matvec_worker(int tid, int n_threads, void *arg) {
+    qkv_matvec_task_t *t = (qkv_matvec_task_t *)arg;
+    int chunk = (t->total_dim + n_threads - 1) / n_threads;
+    int start = tid * chunk;
+    int end = start + chunk;
+    if (end > t->total_dim) end = t->total_dim;
+    if (start >= end) return;
+
+    int base = 0;
+    for (int m = 0; m < 3; m++) {
+        int rows = t->W[m]->out_dim;
+        int s = start > base ? start - base : 0;
+        int e = (end < base + rows ? end : base + rows) - base;
+        if (s < e) weight_matvec_rows(t->out[m] + s, t->x, t->W[m], NULL, s, e);
+        base += rows;
+    }
+}
+
+void qwen_linear_w_qkv(float *q, float *k, float *v, const float *x,
+                       const qwen_weight_t *Wq, const qwen_weight_t *Wk,
+                       const qwen_weight_t *Wv) {
+    PERF_KERNEL(QWEN_PERF_MATVEC,
+                qwen_weight_bytes(Wq) + qwen_weight_bytes(Wk) + qwen_weight_bytes(Wv));
+    if (pool_threads() <= 1) {
+        weight_matvec_rows(q, x, Wq, NULL, 0, Wq->out_dim);
+        weight_matvec_rows(k, x, Wk, NULL, 0, Wk->out_dim);
+        weight_matvec_rows(v, x, Wv, NULL, 0, Wv->out_dim);
+        return;
+    }
+
+    qkv_matvec_task_t task = {
+        .out = { q, k, v },
+        .x = x,
+        .W = { Wq, Wk, Wv },
+        .total_dim = Wq->out_dim + Wk->out_dim + Wv->out_dim,
+    };
+    parallel_for(qkv_matvec_worker, &task);
+}
+
+typedef struct {
+    const float *x;
+    const qwen_weight_t *W;
     int best_idx[QWEN_MAX_THREADS];
     float best_val[QWEN_MAX_THREADS];
 } argmax_task_t;
 
 static void argmax_worker(int tid, int n_threads, void *arg) {
     argmax_task_t *t = (argmax_task_t *)arg;
-    int chunk = (t->out_dim + n_threads - 1) / n_threads;
+    int out_dim = t->W->out_dim;
+    int chunk = (out_dim + n_threads - 1) / n_threads;
     int start = tid * chunk;
     int end = start + chunk;
-    if (end > t->out_dim) end = t->out_dim;
+    if (end > out_dim) end = out_dim;
     if (start >= end) {
         t->best_val[tid] = -1e30f;
         t->best_idx[tid] = 0;
         return;
     }
-    argmax_bf16_range(t->x, t->W_bf16, t->in_dim, start, end,
-                      &t->best_idx[tid], &t->best_val[tid]);
+    weight_argmax_rows(t->x, t->W, start, end, &t->best_idx[tid], &t->best_val[tid]);
 }
 
-int qwen_argmax_matvec_bf16(const float *x, const uint16_t *W_bf16,
-                             int in_dim, int out_dim) {
-    if (tp.n_threads <= 1) {
+/* Row-batched argmax: each thread scans the same rows as for one input, in
+ * blocks reused across the inputs, and keeps the first maximum as
+ * weight_argmax_rows does, so every input gets its seq=1 result. */
+#define ARGMAX_BLOCK_ROWS 64
+
+typedef struct {
+    const float *x;
+    const qwen_weight_t *W;
+    int n;
+    int best_idx[QWEN_ARGMAX_ROWS_MAX][QWEN_MAX_THREADS];
+    float best_val[QWEN_ARGMAX_ROWS_MAX][QWEN_MAX_THREADS];
+} argmax_rows_task_t;
+
+static void argmax_rows_worker(int tid, int n_threads, void *arg) {
+    argmax_rows_task_t *t = (argmax_rows_task_t *)arg;
+    int out_dim = t->W->out_dim;
+    int in_dim = t->W->in_dim;
+    int chunk = (out_dim + n_threads - 1) / n_threads;
+    int start = tid * chunk;
+    int end = start + chunk;
+    if (end > out_dim) end = out_dim;
+    for (int i = 0; i < t->n; i++) {
+        t->best_idx[i][tid] = 0;
+        t->best_val[i][tid] = -1e30f;
+    }
+    for (int r0 = start; r0 < end; r0 += ARGMAX_BLOCK_ROWS) {
+        int r1 = r0 + ARGMAX_BLOCK_ROWS < end ? r0 + ARGMAX_BLOCK_ROWS : end;
+        for (int i = 0; i < t->n; i++) {
+            int idx;
+            float v;
+            weight_argmax_rows(t->x + (size_t)i * in_dim, t->W, r0, r1, &idx, &v);
+            if (r0 == start || v > t->best_val[i][tid]) {
+                t->best_val[i][tid] = v;
+                t->best_idx[i][tid] = idx;
+            }
+        }
+    }
+}
+
+void qwen_argmax_matvec_w_rows(const float *x, const qwen_weight_t *W, int n, int *out) {
+    PERF_KERNEL(QWEN_PERF_LM_HEAD, qwen_weight_bytes(W));
+    argmax_rows_task_t task;
+    task.W = W;
+    for (int r0 = 0; r0 < n; r0 += QWEN_ARGMAX_ROWS_MAX) {
+        task.x = x + (size_t)r0 * W->in_dim;
+        task.n = n - r0 < QWEN_ARGMAX_ROWS_MAX ? n - r0 : QWEN_ARGMAX_ROWS_MAX;
+        int n_threads = parallel_for(argmax_rows_worker, &task);
+        for (int i = 0; i < task.n; i++) {
+            int best = task.best_idx[i][0];
+            float best_val = task.best_val[i][0];
+            for (int t = 1; t < n_threads; t++) {
+                if (task.best_val[i][t] > best_val) {
+                    best_val = task.best_val[i][t];
+                    best = task.best_idx[i][t];
+                }
+            }
+            out[r0 + i] = best;
+        }
+    }
+}
+
+int qwen_argmax_matvec_w(const float *x, const qwen_weight_t *W) {
+    PERF_KERNEL(QWEN_PERF_LM_HEAD, qwen_weight_bytes(W));
+    if (pool_threads() <= 1) {
         int best;
         float best_val;
-        argmax_bf16_range(x, W_bf16, in_dim, 0, out_dim, &best, &best_val);
+        weight_argmax_rows(x, W, 0, W->out_dim, &best, &best_val);
         return best;
     }
 
     argmax_task_t task;
     task.x = x;
-    task.W_bf16 = W_bf16;
-    task.in_dim = in_dim;
-    task.out_dim = out_dim;
-    parallel_for(argmax_worker, &task);
+    task.W = W;
+    int n_threads = parallel_for(argmax_worker, &task);
 
     int best = task.best_idx[0];
     float best_val = task.best_val[0];
-    for (int i = 1; i < tp.n_threads; i++) {
+    for (int i = 1; i < n_threads; i++) {
         if (task.best_val[i] > best_val) {
             best_val = task.best_val[i];
             best = task.best_idx[i];
@@ -542,16 +1348,281 @@ int qwen_argmax_matvec_bf16(const float *x, const uint16_t *W_bf16,
     return best;
 }
 
-void qwen_matmul_t_bf16(float *C, const float *A, const uint16_t *B_bf16,
-                         int M, int K, int N) {
-    if (M == 1) {
-        bf16_matvec_threaded(C, A, B_bf16, NULL, K, N);
-    } else {
-        size_t n = (size_t)N * K;
-        const float *B_f32 = bf16_get_f32_view(B_bf16, n);
-        if (!B_f32) return;
-        qwen_matmul_t(C, A, B_f32, M, K, N);
+/* Top-k: each thread scores its rows in small blocks and keeps a sorted
+ * local list; the lists are merged after the dispatch. */
+#define TOPK_BLOCK_ROWS 64
+
+typedef struct {
+    const float *x;
+    const qwen_weight_t *W;
+    int k;
+    qwen_topk_scratch_t *lists;
+} topk_task_t;
+
+/* Insert (v, id) into a descending list of n entries capped at k. */
+static int topk_insert(int *idx, float *val, int n, int k, int id, float v) {
+    if (n == k && v <= val[k - 1]) return n;
+    int pos = n < k ? n++ : k - 1;
+    while (pos > 0 && val[pos - 1] < v) {
+        val[pos] = val[pos - 1];
+        idx[pos] = idx[pos - 1];
+        pos--;
+    }
+    val[pos] = v;
+    idx[pos] = id;
+    return n;
+}
+
+static void topk_worker(int tid, int n_threads, void *arg) {
+    topk_task_t *t = (topk_task_t *)arg;
+    int out_dim = t->W->out_dim;
+    int chunk = (out_dim + n_threads - 1) / n_threads;
+    int start = tid * chunk;
+    int end = start + chunk;
+    if (end > out_dim) end = out_dim;
+
+    float scores[TOPK_BLOCK_ROWS];
+    int n = 0;
+    for (int r0 = start; r0 < end; r0 += TOPK_BLOCK_ROWS) {
+        int r1 = r0 + TOPK_BLOCK_ROWS < end ? r0 + TOPK_BLOCK_ROWS : end;
+        weight_matvec_rows(scores, t->x, t->W, NULL, r0, r1);
+        for (int r = r0; r < r1; r++)
+            n = topk_insert(t->lists->idx[tid], t->lists->val[tid], n, t->k, r, scores[r - r0]);
+    }
+    t->lists->n_found[tid] = n;
+}
+
+int qwen_topk_matvec_w(const float *x, const qwen_weight_t *W, int k,
+                       qwen_topk_scratch_t *scratch, int *idx_out, float *val_out) {
+    PERF_KERNEL(QWEN_PERF_LM_HEAD, qwen_weight_bytes(W));
+    if (k > QWEN_TOPK_MAX) k = QWEN_TOPK_MAX;
+    if (k > W->out_dim) k = W->out_dim;
+    if (k <= 0 || !scratch) return 0;
+
+    topk_task_t task;
+    task.x = x;
+    task.W = W;
+    task.k = k;
+    task.lists = scratch;
+    int n_threads = parallel_for(topk_worker, &task);
+
+    int n = 0;
+    for (int t = 0; t < n_threads; t++) {
+        for (int i = 0; i < scratch->n_found[t]; i++)
+            n = topk_insert(idx_out, val_out, n, k, scratch->idx[t][i], scratch->val[t][i]);
+    }
+    return n;
+}
+
+int qwen_argmax_rows_w(const float *x, const qwen_weight_t *W,
+                       const int *rows, int n_rows) {
+    PERF_KERNEL(QWEN_PERF_LM_HEAD,
+                W->out_dim > 0 ? qwen_weight_bytes(W) / W->out_dim * n_rows : 0);
+    int best = n_rows > 0 ? rows[0] : 0;
+    float best_val = -1e30f;
+    for (int i = 0; i < n_rows; i++) {
+        int idx;
+        float v;
+        weight_argmax_rows(x, W, rows[i], rows[i] + 1, &idx, &v);
+        if (v > best_val) {
+            best_val = v;
+            best = rows[i];
+        }
+    }
+    return best;
+}
+
+#ifndef USE_BLAS
+/* y[seq, ldy] (columns [0, nr)) = x[seq, in] @ tile[nr, in]^T, 4x4 register
+ * blocks so each x/tile row load feeds four accumulators. */
+static void tile_gemm_native(float *y, int ldy, const float *x, const float *tile,
+                             int seq_len, int nr, int in_dim) {
+    int s = 0;
+    for (; s + 4 <= seq_len; s += 4) {
+        const float *x0 = x + (size_t)s * in_dim;
+        const float *x1 = x0 + in_dim, *x2 = x1 + in_dim, *x3 = x2 + in_dim;
+        int r = 0;
+        for (; r + 4 <= nr; r += 4) {
+            const float *w0 = tile + (size_t)r * in_dim;
+            const float *w1 = w0 + in_dim, *w2 = w1 + in_dim, *w3 = w2 + in_dim;
+            float acc[4][4] = {{0}};
+            for (int i = 0; i < in_dim; i++) {
+                float a0 = x0[i], a1 = x1[i], a2 = x2[i], a3 = x3[i];
+                float b0 = w0[i], b1 = w1[i], b2 = w2[i], b3 = w3[i];
+                acc[0][0] += a0 * b0; acc[0][1] += a0 * b1; acc[0][2] += a0 * b2; acc[0][3] += a0 * b3;
+                acc[1][0] += a1 * b0; acc[1][1] += a1 * b1; acc[1][2] += a1 * b2; acc[1][3] += a1 * b3;
+                acc[2][0] += a2 * b0; acc[2][1] += a2 * b1; acc[2][2] += a2 * b2; acc[2][3] += a2 * b3;
+                acc[3][0] += a3 * b0; acc[3][1] += a3 * b1; acc[3][2] += a3 * b2; acc[3][3] += a3 * b3;
+            }
+            for (int a = 0; a < 4; a++)
+                for (int c = 0; c < 4; c++)
+                    y[(size_t)(s + a) * ldy + r + c] = acc[a][c];
+        }
+        for (; r < nr; r++) {
+            const float *w = tile + (size_t)r * in_dim;
+            for (int a = 0; a < 4; a++) {
+                const float *xa = x0 + (size_t)a * in_dim;
+                float sum = 0.0f;
+                for (int i = 0; i < in_dim; i++) sum += xa[i] * w[i];
+                y[(size_t)(s + a) * ldy + r] = sum;
+            }
+        }
+    }
+    for (; s < seq_len; s++) {
+        const float *x_row = x + (size_t)s * in_dim;
+        for (int r = 0; r < nr; r++) {
+            const float *w = tile + (size_t)r * in_dim;
+            float sum = 0.0f;
+            for (int i = 0; i < in_dim; i++) sum += x_row[i] * w[i];
+            y[(size_t)s * ldy + r] = sum;
+        }
+    }
+}
+#endif
+
+/* One panel of weight_gemm_tiled, split by rows across the pool: each thread
+ * expands its slice of the panel once and (natively) multiplies it against
+ * every input block while it is still in cache. */
+typedef struct {
+    float *y;
+    const float *x;
+    const qwen_weight_t *W;
+    float *tile;
+    int o0;
+    int nr;
+    int seq_len;
+    int seq_rows;
+} weight_panel_task_t;
+
+static void weight_panel_worker(int tid, int n_threads, void *arg) {
+    weight_panel_task_t *t = (weight_panel_task_t *)arg;
+    int in_dim = t->W->in_dim;
+    /* Multiples of 4 rows keep tile_gemm_native on its 4x4 blocks */
+    int chunk = ((t->nr + n_threads - 1) / n_threads + 3) & ~3;
+    int r0 = tid * chunk;
+    int r1 = r0 + chunk;
+    if (r1 > t->nr) r1 = t->nr;
+    if (r0 >= r1) return;
+    float *slice = t->tile + (size_t)r0 * in_dim;
+    weight_expand_rows(slice, t->W, t->o0 + r0, r1 - r0);
+#ifndef USE_BLAS
+    int out_dim = t->W->out_dim;
+    for (int s0 = 0; s0 < t->seq_len; s0 += t->seq_rows) {
+        int ns = t->seq_len - s0;
+        if (ns > t->seq_rows) ns = t->seq_rows;
+        tile_gemm_native(t->y + (size_t)s0 * out_dim + t->o0 + r0, out_dim,
+                         t->x + (size_t)s0 * in_dim, slice, ns, r1 - r0, in_dim);
+    }
+#endif
+}
+
+/* Multi-row GEMM over a non-f32 weight: expand one L2-sized panel of rows
+ * at a time, split across the pool, and multiply it against the inputs in
+ * L2-sized blocks of rows, so neither the panel nor the input block depends
+ * on seq_len and each panel is expanded exactly once. */
+static void weight_gemm_tiled(float *y, const float *x, const qwen_weight_t *W,
+                              const float *b, int seq_len) {
+    int in_dim = W->in_dim;
+    int out_dim = W->out_dim;
+    int tile_rows = WEIGHT_TILE_FLOATS / in_dim;
+    if (tile_rows < WEIGHT_TILE_MIN_ROWS) tile_rows = WEIGHT_TILE_MIN_ROWS;
+    if (tile_rows > out_dim) tile_rows = out_dim;
+    int seq_rows = WEIGHT_TILE_FLOATS / in_dim;
+    if (seq_rows < WEIGHT_TILE_MIN_ROWS) seq_rows = WEIGHT_TILE_MIN_ROWS;
+    if (seq_rows > seq_len) seq_rows = seq_len;
+    float *tile = bf16_get_scratch((size_t)tile_rows * in_dim);
+    if (!tile) return;
+
+    weight_panel_task_t task = { y, x, W, tile, 0, 0, seq_len, seq_rows };
+    for (int o0 = 0; o0 < out_dim; o0 += tile_rows) {
+        int nr = out_dim - o0;
+        if (nr > tile_rows) nr = tile_rows;
+        task.o0 = o0;
+        task.nr = nr;
+        parallel_for(weight_panel_worker, &task);
+#ifdef USE_BLAS
+        /* sgemm threads itself; only the expansion needs the pool */
+        for (int s0 = 0; s0 < seq_len; s0 += seq_rows) {
+            int ns = seq_len - s0;
+            if (ns > seq_rows) ns = seq_rows;
+            cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                        ns, nr, in_dim,
+                        1.0f, x + (size_t)s0 * in_dim, in_dim, tile, in_dim,
+                        0.0f, y + (size_t)s0 * out_dim + o0, out_dim);
+        }
+#endif
+    }
+
+    if (b != NULL) {
+        for (int s = 0; s < seq_len; s++) {
+            float *y_row = y + (size_t)s * out_dim;
+            for (int o = 0; o < out_dim; o++) y_row[o] += b[o];
+        }
+    }
+}
+
+void qwen_linear_w(float *y, const float *x, const qwen_weight_t *W,
+                   const float *b, int seq_len) {
+    PERF_KERNEL(seq_len == 1 ? QWEN_PERF_MATVEC : QWEN_PERF_MATMUL, qwen_weight_bytes(W));
+    if (W->format == QWEN_WEIGHT_F32) {
+        qwen_linear(y, x, W->f32, b, seq_len, W->in_dim, W->out_dim);
+        return;
+    }
+    if (seq_len == 1) {
+        weight_matvec_threaded(y, x, W, b, 0, 1);
+        return;
+    }
+    weight_gemm_tiled(y, x, W, b, seq_len);
+}
+
+/* Widest row qwen_linear_w_batch expands on the stack */
+#define WEIGHT_BATCH_MAX_IN 8192
+
+typedef struct {
+    float *y;
+    const float *x;
+    const qwen_weight_t *W;
+    int n;
+} weight_batch_task_t;
+
+static void weight_batch_worker(int tid, int n_threads, void *arg) {
+    weight_batch_task_t *t = (weight_batch_task_t *)arg;
+    const qwen_weight_t *W = t->W;
+    int in_dim = W->in_dim;
+    int out_dim = W->out_dim;
+    int chunk = (out_dim + n_threads - 1) / n_threads;
+    int start = tid * chunk;
+    int end = start + chunk;
+    if (end > out_dim) end = out_dim;
+
+    if (start >= end) return;
+    if (W->format == QWEN_WEIGHT_BF16) {
+        qwen_bf16_matmul_rows_impl(t->y + start, out_dim, t->x, t->n,
+                                   W->bf16 + (size_t)start * in_dim, in_dim, end - start);
+        return;
+    }
+    float row[WEIGHT_BATCH_MAX_IN];
+    for (int o = start; o < end; o++) {
+        weight_expand_rows(row, W, o, 1);
+        const float *w = row;
+        for (int s = 0; s < t->n; s++)
+            t->y[(size_t)s * out_dim + o] =
+                qwen_dot_f32_impl(w, t->x + (size_t)s * in_dim, in_dim);
+    }
+}
+
+void qwen_linear_w_batch(float *y, const float *x, const qwen_weight_t *W, int n) {
+    PERF_KERNEL(QWEN_PERF_MATVEC, qwen_weight_bytes(W));
+    if (n == 1 || W->format == QWEN_WEIGHT_F32 || W->in_dim > WEIGHT_BATCH_MAX_IN) {
+        qwen_linear_w(y, x, W, NULL, n);
+        return;
+    }
+    weight_batch_task_t task = { y, x, W, n };
+    if (pool_threads() <= 1) {
+        weight_batch_worker(0, 1, &task);
+        return;
     }
+    parallel_for(weight_batch_worker, &task);
 }
 
 /* ========================================================================
@@ -563,22 +1634,27 @@ void qwen_matmul_t_bf16(float *C, const float *A, const uint16_t *B_bf16,
  * Input: [C_in, H_in, W_in]
  * Output columns: [C_in * kH * kW, H_out * W_out]
  */
+/* Image img of n in a channel-major [c_in, n, h_in, w_in] input, written to
+ * columns [img * h_out * w_out, ...) of cols [patch, n * h_out * w_out]. */
 static void im2col(const float *in, float *cols,
                    int c_in, int h_in, int w_in,
                    int kh, int kw, int stride, int padding,
-                   int h_out, int w_out) {
+                   int h_out, int w_out, int n, int img) {
     int col_len = h_out * w_out;
+    size_t plane = (size_t)h_in * w_in;
+    size_t row_len = (size_t)n * col_len;
     for (int ic = 0; ic < c_in; ic++) {
+        const float *src = in + ((size_t)ic * n + img) * plane;
         for (int ki = 0; ki < kh; ki++) {
             for (int kj = 0; kj < kw; kj++) {
                 int col_row = (ic * kh + ki) * kw + kj;
-                float *col_ptr = cols + (size_t)col_row * col_len;
+                float *col_ptr = cols + (size_t)col_row * row_len + (size_t)img * col_len;
                 for (int oh = 0; oh < h_out; oh++) {
                     int ih = oh * stride - padding + ki;
                     for (int ow = 0; ow < w_out; ow++) {
                         int iw = ow * stride - padding + kj;
                         if (ih >= 0 && ih < h_in && iw >= 0 && iw < w_in) {
-                            col_ptr[oh * w_out + ow] = in[ic * h_in * w_in + ih * w_in + iw];
+                            col_ptr[oh * w_out + ow] = src[ih * w_in + iw];
                         } else {
                             col_ptr[oh * w_out + ow] = 0.0f;
                         }
@@ -589,17 +1665,31 @@ static void im2col(const float *in, float *cols,
     }
 }
 
-void qwen_conv2d(float *out, const float *in, const float *weight, const float *bias,
-                 int c_in, int c_out, int h_in, int w_in,
-                 int kh, int kw, int stride, int padding) {
+size_t qwen_conv2d_cols_floats(int n, int c_in, int h_in, int w_in,
+                               int kh, int kw, int stride, int padding) {
     int h_out = (h_in + 2 * padding - kh) / stride + 1;
     int w_out = (w_in + 2 * padding - kw) / stride + 1;
-    int patch_size = c_in * kh * kw;
-    int spatial_out = h_out * w_out;
+    return (size_t)c_in * kh * kw * n * h_out * w_out;
+}
 
-    /* im2col: input -> column matrix [patch_size, spatial_out] */
-    float *cols = (float *)malloc((size_t)patch_size * spatial_out * sizeof(float));
-    im2col(in, cols, c_in, h_in, w_in, kh, kw, stride, padding, h_out, w_out);
+void qwen_conv2d_batch(float *out, const float *in, const float *weight, const float *bias,
+                       int n, int c_in, int c_out, int h_in, int w_in,
+                       int kh, int kw, int stride, int padding, float *cols) {
+    PERF_KERNEL(QWEN_PERF_CONV, (size_t)c_out * c_in * kh * kw * sizeof(float));
+    int h_out = (h_in + 2 * padding - kh) / stride + 1;
+    int w_out = (w_in + 2 * padding - kw) / stride + 1;
+    int patch_size = c_in * kh * kw;
+    int spatial_out = n * h_out * w_out;
+
+    /* im2col: input -> column matrix [patch_size, n * h_out * w_out] */
+    float *owned = NULL;
+    if (!cols) {
+        owned = (float *)malloc((size_t)patch_size * spatial_out * sizeof(float));
+        if (!owned) return;
+        cols = owned;
+    }
+    for (int img = 0; img < n; img++)
+        im2col(in, cols, c_in, h_in, w_in, kh, kw, stride, padding, h_out, w_out, n, img);
 
     /* GEMM: weight[c_out, patch_size] @ cols[patch_size, spatial_out] = out[c_out, spatial_out] */
 #ifdef USE_BLAS
@@ -612,20 +1702,20 @@ void qwen_conv2d(float *out, const float *in, const float *weight, const float *
         for (int s = 0; s < spatial_out; s++) {
             float sum = 0.0f;
             for (int p = 0; p < patch_size; p++) {
-                sum += weight[oc * patch_size + p] * cols[p * spatial_out + s];
+                sum += weight[oc * patch_size + p] * cols[(size_t)p * spatial_out + s];
             }
-            out[oc * spatial_out + s] = sum;
+            out[(size_t)oc * spatial_out + s] = sum;
         }
     }
 #endif
 
-    free(cols);
+    free(owned);
 
     /* Add bias */
     if (bias) {
         for (int oc = 0; oc < c_out; oc++) {
             float b = bias[oc];
-            float *row = out + oc * spatial_out;
+            float *row = out + (size_t)oc * spatial_out;
             for (int s = 0; s < spatial_out; s++) {
                 row[s] += b;
             }
@@ -633,12 +1723,20 @@ void qwen_conv2d(float *out, const float *in, const float *weight, const float *
     }
 }
 
+void qwen_conv2d(float *out, const float *in, const float *weight, const float *bias,
+                 int c_in, int c_out, int h_in, int w_in,
+                 int kh, int kw, int stride, int padding) {
+    qwen_conv2d_batch(out, in, weight, bias, 1, c_in, c_out, h_in, w_in,
+                      kh, kw, stride, padding, NULL);
+}
+
 /* ========================================================================
  * Normalization
  * ======================================================================== */
 
 void qwen_layer_norm(float *out, const float *x, const float *weight, const float *bias,
                      int seq_len, int hidden, float eps) {
+    PERF_KERNEL(QWEN_PERF_NORM, 0);
     for (int s = 0; s < seq_len; s++) {
         const float *x_row = x + s * hidden;
         float *out_row = out + s * hidden;
@@ -747,8 +1845,10 @@ void qwen_layer_norm(float *out, const float *x, const float *weight, const floa
     }
 }
 
-void qwen_rms_norm(float *out, const float *x, const float *weight,
-                   int seq_len, int hidden, float eps) {
+/* Body of qwen_rms_norm; the shape-specialized kernels below instantiate
+ * it with a constant hidden size. */
+static inline KERNEL_INLINE void rms_norm_rows(float *out, const float *x, const float *weight,
+                                               int seq_len, const int hidden, float eps) {
     for (int s = 0; s < seq_len; s++) {
         const float *x_row = x + s * hidden;
         float *out_row = out + s * hidden;
@@ -808,8 +1908,15 @@ void qwen_rms_norm(float *out, const float *x, const float *weight,
     }
 }
 
+void qwen_rms_norm(float *out, const float *x, const float *weight,
+                   int seq_len, int hidden, float eps) {
+    PERF_KERNEL(QWEN_PERF_NORM, 0);
+    rms_norm_rows(out, x, weight, seq_len, hidden, eps);
+}
+
 void qwen_rms_norm_per_head(float *x, const float *weight,
                              int seq_len, int n_heads, int head_dim, float eps) {
+    PERF_KERNEL(QWEN_PERF_NORM, 0);
     /* x is [seq, n_heads * head_dim] - normalize each [head_dim] segment */
     int hidden = n_heads * head_dim;
     for (int s = 0; s < seq_len; s++) {
@@ -951,7 +2058,7 @@ void qwen_swiglu_multiply(float *out, const float *gate_up, int seq_len, int int
         .intermediate = intermediate
     };
 
-    if (tp.n_threads > 1 && seq_len >= 2 && intermediate >= 256) {
+    if (pool_threads() > 1 && seq_len >= 2 && intermediate >= 256) {
         parallel_for(swiglu_worker, &task);
     } else {
         swiglu_worker(0, 1, &task);
@@ -1000,7 +2107,7 @@ static inline void qwen_vec_scale_add(float *dst, const float *src, float correc
     qwen_vec_scale_add_impl(dst, src, correction, n);
 }
 
-void qwen_bidirectional_attention(float *out, const float *Q, const float *K,
+void qwen_bidirectional_attention_ref(float *out, const float *Q, const float *K,
                                    const float *V, int seq __attribute__((unused)),
                                    int n_heads, int head_dim, float scale,
                                    const int *window_starts, int n_windows) {
@@ -1047,6 +2154,324 @@ void qwen_bidirectional_attention(float *out, const float *Q, const float *K,
     }
 }
 
+/* Tiled encoder attention: every (head, window) pair is an independent work
+ * item, processed flash-style in ENC_ATTN_QB query x ENC_ATTN_KB key blocks
+ * with the score and PV products as small GEMMs. */
+#define ENC_ATTN_QB 64
+#define ENC_ATTN_KB 128
+#define ENC_ATTN_MAX_HEAD_DIM 128
+
+typedef struct {
+    float *out;
+    const float *Q, *K, *V;
+    int n_heads, head_dim;
+    float scale;
+    const int *window_starts;
+    int n_windows;
+} enc_attn_task_t;
+
+/* Below this many query rows the score/PV products stay on dot/axpy loops */
+#define ATTN_GEMM_MIN_ROWS 4
+
+/* S[qb, kb] = scale * Q[qb, d] @ K[kb, d]^T, Q/K rows ldq/ldk floats apart */
+static void attn_scores(float *S, const float *Q, int ldq, const float *K, int ldk,
+                        int qb, int kb, int d, float scale) {
+#ifdef USE_BLAS
+    if (qb >= ATTN_GEMM_MIN_ROWS) {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, qb, kb, d,
+                    scale, Q, ldq, K, ldk, 0.0f, S, kb);
+        return;
+    }
+#endif
+    for (int i = 0; i < qb; i++)
+        for (int j = 0; j < kb; j++)
+            S[i * kb + j] = qwen_dot_f32(Q + (size_t)i * ldq, K + (size_t)j * ldk, d) * scale;
+}
+
+/* O[qb, d] += P[qb, kb] @ V[kb, d], O/V rows ldo/ldv floats apart */
+static void attn_pv(float *O, int ldo, const float *P, const float *V, int ldv,
+                    int qb, int kb, int d) {
+#ifdef USE_BLAS
+    if (qb >= ATTN_GEMM_MIN_ROWS) {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, qb, d, kb,
+                    1.0f, P, kb, V, ldv, 1.0f, O, ldo);
+        return;
+    }
+#endif
+    for (int i = 0; i < qb; i++)
+        for (int j = 0; j < kb; j++)
+            if (P[i * kb + j] != 0.0f)
+                qwen_vec_axpy_inplace(O + (size_t)i * ldo, V + (size_t)j * ldv,
+                                      P[i * kb + j], d);
+}
+
+/* P = exp(S - m_new) in place for the first n_valid of kb columns (the rest
+ * zeroed), folding the row into its running max m and sum l. Returns the
+ * factor the row's accumulated output must be scaled by. */
+static float attn_softmax_row(float *row, int kb, int n_valid, float *m, float *l) {
+    if (n_valid <= 0) {
+        memset(row, 0, (size_t)kb * sizeof(float));
+        return 1.0f;
+    }
+    float mx = *m;
+    for (int j = 0; j < n_valid; j++) if (row[j] > mx) mx = row[j];
+    float corr = expf(*m - mx);
+    for (int j = 0; j < n_valid; j++) row[j] -= mx;
+#if defined(__APPLE__) && defined(USE_BLAS)
+    vvexpf(row, row, &n_valid);
+#else
+    for (int j = 0; j < n_valid; j++) row[j] = expf(row[j]);
+#endif
+    float sum = 0.0f;
+    for (int j = 0; j < n_valid; j++) sum += row[j];
+    for (int j = n_valid; j < kb; j++) row[j] = 0.0f;
+    *l = *l * corr + sum;
+    *m = mx;
+    return corr;
+}
+
+/* Fixed-length variants of qwen_dot_f32 / the attn_pv axpy loop for the
+ * decode attention: d is a compile-time constant in the instantiations, so
+ * the loops unroll fully and need no remainder handling (d must be a
+ * multiple of 32). Summation order matches the runtime-length kernels. */
+static inline KERNEL_INLINE float dot_fixed(const float *a, const float *b, const int d) {
+#if defined(__AVX512F__)
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 64 <= d; i += 64) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i),      _mm512_loadu_ps(b + i),      acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+    }
+    __m512 acc = _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+    for (; i < d; i += 16)
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc);
+    return _mm512_reduce_add_ps(acc);
+#elif defined(__AVX2__) && defined(__FMA__)
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    for (int i = 0; i < d; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i),      _mm256_loadu_ps(b + i),      acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),  _mm256_loadu_ps(b + i + 8),  acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    acc0 = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 r = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+    r = _mm_hadd_ps(r, r);
+    r = _mm_hadd_ps(r, r);
+    return _mm_cvtss_f32(r);
+#elif defined(__ARM_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    for (int i = 0; i < d; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i),     vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    return vaddvq_f32(vaddq_f32(acc0, acc1));
+#else
+    float sum = 0.0f;
+    for (int i = 0; i < d; i++) sum += a[i] * b[i];
+    return sum;
+#endif
+}
+
+/* o[d] += sum_j p[j] * V[j], keeping a 32-float slice of o in registers
+ * across all kb keys instead of reloading it per key. */
+static inline KERNEL_INLINE void pv_row_fixed(float *o, const float *p, const float *V,
+                                              int ldv, int kb, const int d) {
+#if defined(__AVX2__) && defined(__FMA__)
+    for (int c = 0; c < d; c += 32) {
+        __m256 a0 = _mm256_loadu_ps(o + c),      a1 = _mm256_loadu_ps(o + c + 8);
+        __m256 a2 = _mm256_loadu_ps(o + c + 16), a3 = _mm256_loadu_ps(o + c + 24);
+        for (int j = 0; j < kb; j++) {
+            if (p[j] == 0.0f) continue;
+            __m256 w = _mm256_set1_ps(p[j]);
+            const float *v = V + (size_t)j * ldv + c;
+            a0 = _mm256_fmadd_ps(_mm256_loadu_ps(v),      w, a0);
+            a1 = _mm256_fmadd_ps(_mm256_loadu_ps(v + 8),  w, a1);
+            a2 = _mm256_fmadd_ps(_mm256_loadu_ps(v + 16), w, a2);
+            a3 = _mm256_fmadd_ps(_mm256_loadu_ps(v + 24), w, a3);
+        }
+        _mm256_storeu_ps(o + c, a0);
+        _mm256_storeu_ps(o + c + 8, a1);
+        _mm256_storeu_ps(o + c + 16, a2);
+        _mm256_storeu_ps(o + c + 24, a3);
+    }
+#elif defined(__ARM_NEON)
+    for (int c = 0; c < d; c += 32) {
+        float32x4_t a[8];
+        for (int u = 0; u < 8; u++) a[u] = vld1q_f32(o + c + 4 * u);
+        for (int j = 0; j < kb; j++) {
+            if (p[j] == 0.0f) continue;
+            float32x4_t w = vdupq_n_f32(p[j]);
+            const float *v = V + (size_t)j * ldv + c;
+            for (int u = 0; u < 8; u++) a[u] = vfmaq_f32(a[u], vld1q_f32(v + 4 * u), w);
+        }
+        for (int u = 0; u < 8; u++) vst1q_f32(o + c + 4 * u, a[u]);
+    }
+#else
+    for (int j = 0; j < kb; j++)
+        if (p[j] != 0.0f) qwen_vec_axpy_inplace(o, V + (size_t)j * ldv, p[j], d);
+#endif
+}
+
+/* attn_scores / attn_pv with a constant head size */
+static inline KERNEL_INLINE void attn_scores_fixed(float *S, const float *Q, int ldq,
+                                                   const float *K, int ldk, int qb, int kb,
+                                                   const int d, float scale) {
+#ifdef USE_BLAS
+    if (qb >= ATTN_GEMM_MIN_ROWS) {
+        attn_scores(S, Q, ldq, K, ldk, qb, kb, d, scale);
+        return;
+    }
+#endif
+    for (int i = 0; i < qb; i++)
+        for (int j = 0; j < kb; j++)
+            S[i * kb + j] = dot_fixed(Q + (size_t)i * ldq, K + (size_t)j * ldk, d) * scale;
+}
+
+static inline KERNEL_INLINE void attn_pv_fixed(float *O, int ldo, const float *P,
+                                               const float *V, int ldv, int qb, int kb,
+                                               const int d) {
+#ifdef USE_BLAS
+    if (qb >= ATTN_GEMM_MIN_ROWS) {
+        attn_pv(O, ldo, P, V, ldv, qb, kb, d);
+        return;
+    }
+#endif
+    for (int i = 0; i < qb; i++)
+        pv_row_fixed(O + (size_t)i * ldo, P + (size_t)i * kb, V, ldv, kb, d);
+}
+
+static void enc_attn_window(const enc_attn_task_t *t, int h, int w,
+                            float *S, float *O, float *m, float *l) {
+    int hidden = t->n_heads * t->head_dim;
+    int d = t->head_dim;
+    int ws = t->window_starts[w];
+    int we = t->window_starts[w + 1];
+
+    for (int q0 = ws; q0 < we; q0 += ENC_ATTN_QB) {
+        int qb = we - q0 < ENC_ATTN_QB ? we - q0 : ENC_ATTN_QB;
+        const float *Qb = t->Q + (size_t)q0 * hidden + h * d;
+        for (int i = 0; i < qb; i++) {
+            m[i] = -1e30f;
+            l[i] = 0.0f;
+        }
+        memset(O, 0, (size_t)qb * d * sizeof(float));
+
+        for (int k0 = ws; k0 < we; k0 += ENC_ATTN_KB) {
+            int kb = we - k0 < ENC_ATTN_KB ? we - k0 : ENC_ATTN_KB;
+            attn_scores(S, Qb, hidden, t->K + (size_t)k0 * hidden + h * d, hidden,
+                        qb, kb, d, t->scale);
+
+            /* Online softmax across key blocks */
+            for (int i = 0; i < qb; i++) {
+                float corr = attn_softmax_row(S + (size_t)i * kb, kb, kb, &m[i], &l[i]);
+                if (corr != 1.0f) qwen_vec_scale_inplace(O + (size_t)i * d, corr, d);
+            }
+
+            attn_pv(O, d, S, t->V + (size_t)k0 * hidden + h * d, hidden, qb, kb, d);
+        }
+
+        for (int i = 0; i < qb; i++) {
+            float *o_row = t->out + (size_t)(q0 + i) * hidden + h * d;
+            float inv = l[i] > 0.0f ? 1.0f / l[i] : 0.0f;
+            const float *src = O + (size_t)i * d;
+            for (int j = 0; j < d; j++) o_row[j] = src[j] * inv;
+        }
+    }
+}
+
+static void enc_attn_worker(int tid, int n_threads, void *arg) {
+    enc_attn_task_t *t = (enc_attn_task_t *)arg;
+    int n_items = t->n_heads * t->n_windows;
+    int chunk = (n_items + n_threads - 1) / n_threads;
+    int i0 = tid * chunk;
+    int i1 = i0 + chunk;
+    if (i1 > n_items) i1 = n_items;
+    if (i0 >= i1) return;
+
+    float S[ENC_ATTN_QB * ENC_ATTN_KB];
+    float O[ENC_ATTN_QB * ENC_ATTN_MAX_HEAD_DIM];
+    float m[ENC_ATTN_QB], l[ENC_ATTN_QB];
+    for (int it = i0; it < i1; it++)
+        enc_attn_window(t, it / t->n_windows, it % t->n_windows, S, O, m, l);
+}
+
+void qwen_bidirectional_attention(float *out, const float *Q, const float *K,
+                                   const float *V, int seq,
+                                   int n_heads, int head_dim, float scale,
+                                   const int *window_starts, int n_windows) {
+    PERF_KERNEL(QWEN_PERF_ATTENTION, 0);
+    if (head_dim > ENC_ATTN_MAX_HEAD_DIM) {
+        qwen_bidirectional_attention_ref(out, Q, K, V, seq, n_heads, head_dim,
+                                         scale, window_starts, n_windows);
+        return;
+    }
+    enc_attn_task_t task = {
+        .out = out, .Q = Q, .K = K, .V = V,
+        .n_heads = n_heads, .head_dim = head_dim, .scale = scale,
+        .window_starts = window_starts, .n_windows = n_windows
+    };
+    parallel_for(enc_attn_worker, &task);
+}
+
+static double bench_time_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+int qwen_bench_bidirectional_attention(int n_heads, int head_dim, int window_tokens,
+                                       int n_windows, int iters,
+                                       double *tiled_ms, double *ref_ms, float *max_diff) {
+    if (n_heads <= 0 || head_dim <= 0 || window_tokens <= 0 || n_windows <= 0) return -1;
+    if (iters < 1) iters = 1;
+    int seq = window_tokens * n_windows;
+    size_t n = (size_t)seq * n_heads * head_dim;
+    float *buf = (float *)malloc(n * 5 * sizeof(float));
+    int *starts = (int *)malloc((size_t)(n_windows + 1) * sizeof(int));
+    if (!buf || !starts) {
+        free(buf);
+        free(starts);
+        return -1;
+    }
+    float *Q = buf, *K = buf + n, *V = buf + 2 * n, *o_tiled = buf + 3 * n, *o_ref = buf + 4 * n;
+    uint32_t r = 12345u;
+    for (size_t i = 0; i < 3 * n; i++) {
+        r = r * 1664525u + 1013904223u;
+        buf[i] = (float)(r >> 8) / 16777216.0f - 0.5f;
+    }
+    for (int w = 0; w <= n_windows; w++) starts[w] = w * window_tokens;
+    float scale = 1.0f / sqrtf((float)head_dim);
+
+    /* Warm up both, then time */
+    qwen_bidirectional_attention(o_tiled, Q, K, V, seq, n_heads, head_dim, scale, starts, n_windows);
+    qwen_bidirectional_attention_ref(o_ref, Q, K, V, seq, n_heads, head_dim, scale, starts, n_windows);
+
+    double t0 = bench_time_ms();
+    for (int i = 0; i < iters; i++)
+        qwen_bidirectional_attention(o_tiled, Q, K, V, seq, n_heads, head_dim, scale, starts, n_windows);
+    double t1 = bench_time_ms();
+    for (int i = 0; i < iters; i++)
+        qwen_bidirectional_attention_ref(o_ref, Q, K, V, seq, n_heads, head_dim, scale, starts, n_windows);
+    double t2 = bench_time_ms();
+
+    float md = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        float d = fabsf(o_tiled[i] - o_ref[i]);
+        if (d > md) md = d;
+    }
+    if (tiled_ms) *tiled_ms = (t1 - t0) / iters;
+    if (ref_ms) *ref_ms = (t2 - t1) / iters;
+    if (max_diff) *max_diff = md;
+    free(buf);
+    free(starts);
+    return 0;
+}
+
 static void qwen_causal_attention_heads(float *out, const float *Q, const float *K,
                                         const float *V, int seq_q, int seq_k,
                                         int n_heads, int n_kv_heads, int head_dim,
@@ -1124,7 +2549,8 @@ static void causal_attn_worker(int tid, int n_threads, void *arg) {
 void qwen_causal_attention(float *out, const float *Q, const float *K, const float *V,
                             int seq_q, int seq_k, int n_heads, int n_kv_heads,
                             int head_dim, float scale, int q_offset) {
-    if (tp.n_threads > 1 && n_heads >= 2 && (seq_q >= 2 || seq_k >= 128)) {
+    PERF_KERNEL(QWEN_PERF_ATTENTION, 0);
+    if (pool_threads() > 1 && n_heads >= 2 && (seq_q >= 2 || seq_k >= 128)) {
         causal_attn_task_t task = {
             .out = out, .Q = Q, .K = K, .V = V,
             .seq_q = seq_q, .seq_k = seq_k,
@@ -1140,6 +2566,399 @@ void qwen_causal_attention(float *out, const float *Q, const float *K, const flo
                                 head_dim, scale, q_offset, 0, n_heads);
 }
 
+/* ========================================================================
+ * Paged KV Cache
+ * ======================================================================== */
+
+/* fp16 storage: native __fp16 on ARM, F16C on x86 when available, else a
+ * round-to-nearest-even software conversion. */
+#if defined(__aarch64__) || defined(__arm__)
+typedef __fp16 kv_half_t;
+
+static void kv_f32_to_half(kv_half_t *dst, const float *src, int n) {
+    for (int i = 0; i < n; i++) dst[i] = (kv_half_t)src[i];
+}
+
+static void kv_half_to_f32(float *dst, const kv_half_t *src, int n) {
+    for (int i = 0; i < n; i++) dst[i] = (float)src[i];
+}
+#else
+typedef uint16_t kv_half_t;
+
+static uint16_t f32_to_half_bits(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t ax = x & 0x7fffffff;
+    if (ax >= 0x7f800000) return (uint16_t)(sign | 0x7c00 | (ax > 0x7f800000 ? 0x200 : 0));
+    if (ax >= 0x477ff000) return (uint16_t)(sign | 0x7c00);     /* rounds past 65504 */
+    if (ax < 0x38800000) {                                        /* half subnormal */
+        if (ax < 0x33000000) return (uint16_t)sign;
+        uint32_t m = (ax & 0x7fffff) | 0x800000;
+        int shift = 126 - (int)(ax >> 23);
+        uint32_t h = m >> shift;
+        uint32_t rem = m & ((1u << shift) - 1), half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1))) h++;
+        return (uint16_t)(sign | h);
+    }
+    uint32_t h = (ax >> 13) - (112u << 10);
+    uint32_t rem = ax & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return (uint16_t)(sign | h);
+}
+
+static float half_bits_to_f32(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t e = (h >> 10) & 0x1f, m = h & 0x3ff, x;
+    float f;
+    if (e == 0) {
+        f = (float)m * (1.0f / 16777216.0f);
+        memcpy(&x, &f, sizeof(x));
+        x |= sign;
+    } else if (e == 31) {
+        x = sign | 0x7f800000 | (m << 13);
+    } else {
+        x = sign | ((e + 112) << 23) | (m << 13);
+    }
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static void kv_f32_to_half(kv_half_t *dst, const float *src, int n) {
+    int i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+    for (; i < n; i++) dst[i] = f32_to_half_bits(src[i]);
+}
+
+static void kv_half_to_f32(float *dst, const kv_half_t *src, int n) {
+    int i = 0;
+#ifdef __F16C__
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+#endif
+    for (; i < n; i++) dst[i] = half_bits_to_f32(src[i]);
+}
+#endif
+
+static size_t kv_elem_bytes(int format) {
+    return format == QWEN_KV_F32 ? sizeof(float) :
+           format == QWEN_KV_FP16 ? sizeof(kv_half_t) : 1;
+}
+
+static size_t kv_row_bytes(const qwen_kv_cache_t *kv) {
+    return (size_t)kv->n_kv_heads * kv->head_dim * kv_elem_bytes(kv->format);
+}
+
+/* Page layout: K rows, V rows, then (int8) K scales and V scales */
+static uint8_t *kv_page(const qwen_kv_cache_t *kv, int layer, int page) {
+    return kv->pages[(size_t)page * kv->n_layers + layer];
+}
+
+static float *kv_page_scales(const qwen_kv_cache_t *kv, uint8_t *page, int is_v) {
+    float *s = (float *)(page + 2 * QWEN_KV_PAGE * kv_row_bytes(kv));
+    return is_v ? s + QWEN_KV_PAGE * kv->n_kv_heads : s;
+}
+
+const char *qwen_kv_format_name(int format) {
+    switch (format) {
+    case QWEN_KV_F32:  return "f32";
+    case QWEN_KV_FP16: return "fp16";
+    case QWEN_KV_INT8: return "int8";
+    default:           return "unknown";
+    }
+}
+
+int qwen_kv_cache_init(qwen_kv_cache_t *kv, int format, int n_layers,
+                       int n_kv_heads, int head_dim) {
+    memset(kv, 0, sizeof(*kv));
+    if (format != QWEN_KV_F32 && format != QWEN_KV_FP16 && format != QWEN_KV_INT8) return -1;
+    if (head_dim <= 0 || head_dim > QWEN_KV_MAX_HEAD_DIM || n_layers <= 0 || n_kv_heads <= 0)
+        return -1;
+    kv->format = format;
+    kv->n_layers = n_layers;
+    kv->n_kv_heads = n_kv_heads;
+    kv->head_dim = head_dim;
+    kv->page_bytes = 2 * QWEN_KV_PAGE * kv_row_bytes(kv);
+    if (format == QWEN_KV_INT8)
+        kv->page_bytes += 2 * QWEN_KV_PAGE * (size_t)n_kv_heads * sizeof(float);
+    return 0;
+}
+
+void qwen_kv_cache_free(qwen_kv_cache_t *kv) {
+    if (!kv->pages) return;
+    for (size_t i = 0; i < (size_t)kv->n_pages * kv->n_layers; i++) free(kv->pages[i]);
+    free(kv->pages);
+    kv->pages = NULL;
+    kv->n_pages = 0;
+    kv->pages_cap = 0;
+}
+
+int qwen_kv_cache_reserve(qwen_kv_cache_t *kv, int n_pos) {
+    int need = (n_pos + QWEN_KV_PAGE - 1) / QWEN_KV_PAGE;
+    if (need <= kv->n_pages) return 0;
+    if (kv->page_bytes == 0) return -1;
+
+    if (need > kv->pages_cap) {
+        int cap = kv->pages_cap ? kv->pages_cap : 16;
+        while (cap < need) cap *= 2;
+        /* Page-major indexing: existing entries keep their slots */
+        uint8_t **pages = (uint8_t **)realloc(kv->pages, (size_t)cap * kv->n_layers * sizeof(uint8_t *));
+        if (!pages) return -1;
+        kv->pages = pages;
+        kv->pages_cap = cap;
+    }
+
+    for (int p = kv->n_pages; p < need; p++) {
+        for (int l = 0; l < kv->n_layers; l++) {
+            uint8_t *page = (uint8_t *)malloc(kv->page_bytes);
+            if (!page) {
+                for (int j = 0; j < l; j++) free(kv->pages[(size_t)p * kv->n_layers + j]);
+                return -1;
+            }
+            kv->pages[(size_t)p * kv->n_layers + l] = page;
+        }
+        kv->n_pages = p + 1;
+    }
+    return 0;
+}
+
+int qwen_kv_cache_copy_prefix(qwen_kv_cache_t *dst, const qwen_kv_cache_t *src, int n_pos) {
+    if (n_pos <= 0) return 0;
+    if (n_pos > qwen_kv_cache_capacity(src)) return -1;
+    if (!dst->page_bytes &&
+        qwen_kv_cache_init(dst, src->format, src->n_layers, src->n_kv_heads, src->head_dim) != 0)
+        return -1;
+    if (dst->format != src->format || dst->n_layers != src->n_layers ||
+        dst->page_bytes != src->page_bytes)
+        return -1;
+    if (qwen_kv_cache_reserve(dst, n_pos) != 0) return -1;
+    int n_pages = (n_pos + QWEN_KV_PAGE - 1) / QWEN_KV_PAGE;
+    for (int p = 0; p < n_pages; p++)
+        for (int l = 0; l < src->n_layers; l++)
+            memcpy(kv_page(dst, l, p), kv_page(src, l, p), src->page_bytes);
+    return 0;
+}
+
+int qwen_kv_cache_capacity(const qwen_kv_cache_t *kv) {
+    return kv->n_pages * QWEN_KV_PAGE;
+}
+
+size_t qwen_kv_cache_bytes(const qwen_kv_cache_t *kv) {
+    return (size_t)kv->n_pages * kv->n_layers * kv->page_bytes;
+}
+
+/* Store kv head h of one position; src is that head's [head_dim] row. */
+static void kv_store_head(const qwen_kv_cache_t *kv, uint8_t *page, int slot, int is_v,
+                          int h, const float *src) {
+    int d = kv->head_dim;
+    uint8_t *dst = page + (is_v ? QWEN_KV_PAGE : 0) * kv_row_bytes(kv) + slot * kv_row_bytes(kv);
+
+    if (kv->format == QWEN_KV_F32) {
+        memcpy((float *)dst + h * d, src, (size_t)d * sizeof(float));
+    } else if (kv->format == QWEN_KV_FP16) {
+        kv_f32_to_half((kv_half_t *)dst + h * d, src, d);
+    } else {
+        /* One symmetric scale per (position, kv head) */
+        float *scales = kv_page_scales(kv, page, is_v) + slot * kv->n_kv_heads;
+        int8_t *q = (int8_t *)dst + h * d;
+        float amax = 0.0f;
+        for (int i = 0; i < d; i++) {
+            float a = fabsf(src[i]);
+            if (a > amax) amax = a;
+        }
+        float s = amax / 127.0f;
+        float inv = s > 0.0f ? 1.0f / s : 0.0f;
+        for (int i = 0; i < d; i++) q[i] = (int8_t)lrintf(src[i] * inv);
+        scales[h] = s;
+    }
+}
+
+static void kv_store_row(const qwen_kv_cache_t *kv, uint8_t *page, int slot, int is_v,
+                         const float *src) {
+    for (int h = 0; h < kv->n_kv_heads; h++)
+        kv_store_head(kv, page, slot, is_v, h, src + h * kv->head_dim);
+}
+
+void qwen_kv_cache_store(qwen_kv_cache_t *kv, int layer, int pos, int n,
+                         const float *K, const float *V) {
+    int kv_dim = kv->n_kv_heads * kv->head_dim;
+    for (int i = 0; i < n; i++) {
+        int p = pos + i;
+        uint8_t *page = kv_page(kv, layer, p / QWEN_KV_PAGE);
+        kv_store_row(kv, page, p % QWEN_KV_PAGE, 0, K + (size_t)i * kv_dim);
+        kv_store_row(kv, page, p % QWEN_KV_PAGE, 1, V + (size_t)i * kv_dim);
+    }
+}
+
+/* f32 view of n rows of one kv head of a page: a pointer into the page for
+ * f32 caches (rows kv_dim apart), otherwise converted into tile (rows
+ * head_dim apart). */
+static const float *kv_page_rows(const qwen_kv_cache_t *kv, uint8_t *page, int is_v,
+                                 int kv_h, int n, float *tile, int *ld) {
+    int d = kv->head_dim;
+    size_t row = kv_row_bytes(kv);
+    const uint8_t *base = page + (is_v ? QWEN_KV_PAGE : 0) * row;
+
+    if (kv->format == QWEN_KV_F32) {
+        *ld = kv->n_kv_heads * d;
+        return (const float *)base + kv_h * d;
+    }
+    *ld = d;
+    if (kv->format == QWEN_KV_FP16) {
+        for (int j = 0; j < n; j++)
+            kv_half_to_f32(tile + (size_t)j * d,
+                           (const kv_half_t *)(base + j * row) + kv_h * d, d);
+    } else {
+        const float *scales = kv_page_scales(kv, page, is_v);
+        for (int j = 0; j < n; j++) {
+            const int8_t *q = (const int8_t *)(base + j * row) + kv_h * d;
+            float s = scales[j * kv->n_kv_heads + kv_h];
+            float *dst = tile + (size_t)j * d;
+            for (int i = 0; i < d; i++) dst[i] = (float)q[i] * s;
+        }
+    }
+    return tile;
+}
+
+/* Work item = (kv head, block of queries): each page is converted once and
+ * shared by every query head of the group, processed flash-style with the
+ * group's rows stacked in one score block. */
+#define KV_ATTN_ROWS 64
+
+typedef struct {
+    float *out;
+    const float *Q;
+    const qwen_kv_cache_t *kv;
+    int layer;
+    int seq_q, seq_k;
+    int n_heads;
+    float scale;
+    int q_offset;
+    int q_block;               /* queries per work item */
+} kv_attn_task_t;
+
+/* fixed_d > 0 instantiates the item for that constant head size */
+static inline KERNEL_INLINE void kv_attn_item(const kv_attn_task_t *t, int kv_h, int q0, int nq,
+                                              float *S, float *Kt, float *Vt, float *m, float *l,
+                                              const int fixed_d) {
+    const qwen_kv_cache_t *kv = t->kv;
+    const int d = fixed_d > 0 ? fixed_d : kv->head_dim;
+    int hpk = t->n_heads / kv->n_kv_heads;
+    int q_hidden = t->n_heads * d;
+    int k_end = t->q_offset + q0 + nq;
+    if (k_end > t->seq_k) k_end = t->seq_k;
+
+    /* Query heads of the group in chunks that fit KV_ATTN_ROWS rows */
+    int hc = KV_ATTN_ROWS / nq;
+    if (hc > hpk) hc = hpk;
+    for (int hh0 = 0; hh0 < hpk; hh0 += hc) {
+        int nh = hpk - hh0 < hc ? hpk - hh0 : hc;
+        for (int r = 0; r < nh * nq; r++) {
+            m[r] = -1e30f;
+            l[r] = 0.0f;
+        }
+        for (int hh = 0; hh < nh; hh++)
+            for (int i = 0; i < nq; i++)
+                memset(t->out + (size_t)(q0 + i) * q_hidden + (kv_h * hpk + hh0 + hh) * d,
+                       0, (size_t)d * sizeof(float));
+
+        for (int p0 = 0; p0 < k_end; p0 += QWEN_KV_PAGE) {
+            int kb = k_end - p0 < QWEN_KV_PAGE ? k_end - p0 : QWEN_KV_PAGE;
+            uint8_t *page = kv_page(kv, t->layer, p0 / QWEN_KV_PAGE);
+            int ldk, ldv;
+            const float *Kp = kv_page_rows(kv, page, 0, kv_h, kb, Kt, &ldk);
+            const float *Vp = kv_page_rows(kv, page, 1, kv_h, kb, Vt, &ldv);
+
+            for (int hh = 0; hh < nh; hh++) {
+                int h = kv_h * hpk + hh0 + hh;
+                float *Sh = S + (size_t)hh * nq * kb;
+                float *Oh = t->out + (size_t)q0 * q_hidden + h * d;
+                if (fixed_d > 0)
+                    attn_scores_fixed(Sh, t->Q + (size_t)q0 * q_hidden + h * d, q_hidden,
+                                      Kp, ldk, nq, kb, d, t->scale);
+                else
+                    attn_scores(Sh, t->Q + (size_t)q0 * q_hidden + h * d, q_hidden,
+                                Kp, ldk, nq, kb, d, t->scale);
+                for (int i = 0; i < nq; i++) {
+                    int r = hh * nq + i;
+                    int n_valid = t->q_offset + q0 + i - p0 + 1;
+                    if (n_valid > kb) n_valid = kb;
+                    float corr = attn_softmax_row(Sh + (size_t)i * kb, kb, n_valid, &m[r], &l[r]);
+                    if (corr != 1.0f) qwen_vec_scale_inplace(Oh + (size_t)i * q_hidden, corr, d);
+                }
+                if (fixed_d > 0)
+                    attn_pv_fixed(Oh, q_hidden, Sh, Vp, ldv, nq, kb, d);
+                else
+                    attn_pv(Oh, q_hidden, Sh, Vp, ldv, nq, kb, d);
+            }
+        }
+
+        for (int hh = 0; hh < nh; hh++) {
+            int h = kv_h * hpk + hh0 + hh;
+            for (int i = 0; i < nq; i++) {
+                float lr = l[hh * nq + i];
+                if (lr > 0.0f)
+                    qwen_vec_scale_inplace(t->out + (size_t)(q0 + i) * q_hidden + h * d,
+                                           1.0f / lr, d);
+            }
+        }
+    }
+}
+
+static inline KERNEL_INLINE void kv_attn_run(int tid, int n_threads, void *arg,
+                                             const int fixed_d) {
+    kv_attn_task_t *t = (kv_attn_task_t *)arg;
+    int n_qblocks = (t->seq_q + t->q_block - 1) / t->q_block;
+    int n_items = t->kv->n_kv_heads * n_qblocks;
+    int chunk = (n_items + n_threads - 1) / n_threads;
+    int i0 = tid * chunk;
+    int i1 = i0 + chunk;
+    if (i1 > n_items) i1 = n_items;
+    if (i0 >= i1) return;
+
+    float S[KV_ATTN_ROWS * QWEN_KV_PAGE];
+    float Kt[QWEN_KV_PAGE * QWEN_KV_MAX_HEAD_DIM];
+    float Vt[QWEN_KV_PAGE * QWEN_KV_MAX_HEAD_DIM];
+    float m[KV_ATTN_ROWS], l[KV_ATTN_ROWS];
+    for (int it = i0; it < i1; it++) {
+        int q0 = (it % n_qblocks) * t->q_block;
+        int nq = t->seq_q - q0 < t->q_block ? t->seq_q - q0 : t->q_block;
+        kv_attn_item(t, it / n_qblocks, q0, nq, S, Kt, Vt, m, l, fixed_d);
+    }
+}
+
+static void kv_attn_worker(int tid, int n_threads, void *arg) {
+    kv_attn_run(tid, n_threads, arg, 0);
+}
+
+static void kv_attn_dispatch(float *out, const float *Q, const qwen_kv_cache_t *kv,
+                             int layer, int seq_q, int seq_k, int n_heads,
+                             float scale, int q_offset, parallel_fn_t worker) {
+    int hpk = n_heads / kv->n_kv_heads;
+    int q_block = hpk >= KV_ATTN_ROWS ? 1 : KV_ATTN_ROWS / hpk;
+    kv_attn_task_t task = {
+        .out = out, .Q = Q, .kv = kv, .layer = layer,
+        .seq_q = seq_q, .seq_k = seq_k, .n_heads = n_heads,
+        .scale = scale, .q_offset = q_offset, .q_block = q_block
+    };
+    if (pool_threads() > 1 && kv->n_kv_heads >= 2 && (seq_q >= 2 || seq_k >= 128))
+        parallel_for(worker, &task);
+    else
+        worker(0, 1, &task);
+}
+
+void qwen_causal_attention_kv(float *out, const float *Q, const qwen_kv_cache_t *kv,
+                              int layer, int seq_q, int seq_k, int n_heads,
+                              float scale, int q_offset) {
+    PERF_KERNEL(QWEN_PERF_ATTENTION, 0);
+    kv_attn_dispatch(out, Q, kv, layer, seq_q, seq_k, n_heads, scale, q_offset,
+                     kv_attn_worker);
+}
+
 /* ========================================================================
  * Position Embeddings
  * ======================================================================== */
@@ -1245,3 +3064,195 @@ void qwen_apply_rope_neox(float *x, const float *cos_vals, const float *sin_vals
         }
     }
 }
+
+/* ========================================================================
+ * Fused Decode-Step Kernels (seq=1)
+ *
+ * The single-token decoder step is bound by the weight stream, but the
+ * small passes between matvecs (per-head norm, RoPE, cache write, SwiGLU,
+ * residual add) ran serially on the calling thread after each dispatch.
+ * These variants split output rows on whole heads / gate-up pairs so each
+ * worker finishes its own slice while it is still in cache. They also take
+ * n inputs at consecutive positions (speculative verification): each
+ * worker keeps the rows it has for one input, so every input is computed
+ * exactly as its own seq=1 step would be.
+ * ======================================================================== */
+
+typedef struct {
+    float *out[3];
+    const float *x;
+    const qwen_weight_t *W[3];
+    const float *norm[2];          /* q, k per-head RMSNorm weights */
+    float eps;
+    const float *rope_cos, *rope_sin;
+    qwen_kv_cache_t *kv;
+    int layer, pos;
+    int head_dim;
+    int n_heads;                   /* q heads + 2 * kv heads */
+    int n;                         /* inputs, at positions pos .. pos + n - 1 */
+} qkv_rope_task_t;
+
+static void qkv_rope_worker(int tid, int n_threads, void *arg) {
+    qkv_rope_task_t *t = (qkv_rope_task_t *)arg;
+    int d = t->head_dim;
+    int chunk = (t->n_heads + n_threads - 1) / n_threads;
+    int h0 = tid * chunk;
+    int h1 = h0 + chunk;
+    if (h1 > t->n_heads) h1 = t->n_heads;
+    if (h0 >= h1) return;
+
+    int base = 0;
+    for (int m = 0; m < 3; m++) {
+        int rows = t->W[m]->out_dim;
+        int heads = rows / d;
+        int s = h0 > base ? h0 - base : 0;
+        int e = (h1 < base + heads ? h1 : base + heads) - base;
+        if (s < e) {
+            weight_matvec_rows_n(t->out[m] + (size_t)s * d, (size_t)rows, t->x, t->n,
+                                 t->W[m], NULL, 0, s * d, e * d);
+            for (int i = 0; i < t->n; i++) {
+                float *o = t->out[m] + (size_t)i * rows + (size_t)s * d;
+                if (m < 2) {
+                    qwen_rms_norm_per_head(o, t->norm[m], 1, e - s, d, t->eps);
+                    qwen_apply_rope_neox(o, t->rope_cos + (size_t)i * d,
+                                         t->rope_sin + (size_t)i * d, 1, e - s, d);
+                }
+                if (m > 0) {
+                    int pos = t->pos + i;
+                    uint8_t *page = kv_page(t->kv, t->layer, pos / QWEN_KV_PAGE);
+                    for (int h = s; h < e; h++)
+                        kv_store_head(t->kv, page, pos % QWEN_KV_PAGE, m == 2, h,
+                                      o + (size_t)(h - s) * d);
+                }
+            }
+        }
+        base += heads;
+    }
+}
+
+void qwen_linear_w_qkv_rope(float *q, float *k, float *v, const float *x,
+                            const qwen_weight_t *Wq, const qwen_weight_t *Wk,
+                            const qwen_weight_t *Wv, const float *q_norm,
+                            const float *k_norm, float eps, const float *rope_cos,
+                            const float *rope_sin, int head_dim,
+                            qwen_kv_cache_t *kv, int layer, int pos, int n) {
+    PERF_KERNEL(QWEN_PERF_MATVEC,
+                qwen_weight_bytes(Wq) + qwen_weight_bytes(Wk) + qwen_weight_bytes(Wv));
+    qkv_rope_task_t task = {
+        .out = { q, k, v },
+        .x = x,
+        .W = { Wq, Wk, Wv },
+        .norm = { q_norm, k_norm },
+        .eps = eps,
+        .rope_cos = rope_cos,
+        .rope_sin = rope_sin,
+        .kv = kv,
+        .layer = layer,
+        .pos = pos,
+        .head_dim = head_dim,
+        .n_heads = (Wq->out_dim + Wk->out_dim + Wv->out_dim) / head_dim,
+        .n = n,
+    };
+    if (pool_threads() <= 1) {
+        qkv_rope_worker(0, 1, &task);
+        return;
+    }
+    parallel_for(qkv_rope_worker, &task);
+}
+
+typedef struct {
+    float *out;
+    float *gate_up;
+    const float *x;
+    const qwen_weight_t *W;
+    int n;
+} swiglu_matvec_task_t;
+
+static void swiglu_matvec_worker(int tid, int n_threads, void *arg) {
+    swiglu_matvec_task_t *t = (swiglu_matvec_task_t *)arg;
+    int inter = t->W->out_dim / 2;
+    int chunk = (inter + n_threads - 1) / n_threads;
+    int j0 = tid * chunk;
+    int j1 = j0 + chunk;
+    if (j1 > inter) j1 = inter;
+    if (j0 >= j1) return;
+
+    /* Rows are interleaved [g0, u0, g1, u1, ...] */
+    weight_matvec_rows_n(t->gate_up + 2 * (size_t)j0, 2 * (size_t)inter, t->x, t->n,
+                         t->W, NULL, 0, 2 * j0, 2 * j1);
+    for (int i = 0; i < t->n; i++) {
+        const float *gu = t->gate_up + (size_t)i * 2 * inter + 2 * (size_t)j0;
+        float *out = t->out + (size_t)i * inter + j0;
+        for (int j = 0; j < j1 - j0; j++) {
+            float g = gu[2 * j];
+            out[j] = g / (1.0f + expf(-g)) * gu[2 * j + 1];
+        }
+    }
+}
+
+void qwen_linear_w_swiglu(float *out, float *gate_up, const float *x,
+                          const qwen_weight_t *W, int n) {
+    PERF_KERNEL(QWEN_PERF_MATVEC, qwen_weight_bytes(W));
+    swiglu_matvec_task_t task = { out, gate_up, x, W, n };
+    if (pool_threads() <= 1) {
+        swiglu_matvec_worker(0, 1, &task);
+        return;
+    }
+    parallel_for(swiglu_matvec_worker, &task);
+}
+
+void qwen_linear_w_residual(float *y, const float *x, const qwen_weight_t *W, int n) {
+    PERF_KERNEL(QWEN_PERF_MATVEC, qwen_weight_bytes(W));
+    /* Each row reads its bias before writing it, so y can serve as both */
+    weight_matvec_threaded(y, x, W, y, (size_t)W->out_dim, n);
+}
+
+/* ========================================================================
+ * Shape-Specialized Kernels
+ *
+ * The shipped models share head_dim 128 and differ in hidden size (1024
+ * for 0.6B, 2048 for 1.7B). The decoder's norm and attention bodies are
+ * instantiated with those constants; qwen_dec_kernels_select picks the set
+ * for a config once at load and falls back to the runtime-shape kernels.
+ * ======================================================================== */
+
+#define DEFINE_RMS_NORM_FIXED(H)                                                 \
+    static void rms_norm_##H(float *out, const float *x, const float *weight,    \
+                             int seq_len, int hidden, float eps) {               \
+        (void)hidden;                                                            \
+        PERF_KERNEL(QWEN_PERF_NORM, 0);                                          \
+        rms_norm_rows(out, x, weight, seq_len, H, eps);                          \
+    }
+
+#define DEFINE_KV_ATTN_FIXED(D)                                                  \
+    static void kv_attn_worker_d##D(int tid, int n_threads, void *arg) {         \
+        kv_attn_run(tid, n_threads, arg, D);                                     \
+    }                                                                            \
+    static void causal_attention_kv_d##D(float *out, const float *Q,             \
+                                         const qwen_kv_cache_t *kv, int layer,   \
+                                         int seq_q, int seq_k, int n_heads,      \
+                                         float scale, int q_offset) {            \
+        PERF_KERNEL(QWEN_PERF_ATTENTION, 0);                                     \
+        kv_attn_dispatch(out, Q, kv, layer, seq_q, seq_k, n_heads, scale,        \
+                         q_offset, kv_attn_worker_d##D);                         \
+    }
+
+DEFINE_RMS_NORM_FIXED(1024)
+DEFINE_RMS_NORM_FIXED(2048)
+DEFINE_KV_ATTN_FIXED(128)
+
+static const qwen_dec_kernels_t dec_kernels[] = {
+    { "hidden=1024 head_dim=128", 1024, 128, rms_norm_1024, causal_attention_kv_d128 },
+    { "hidden=2048 head_dim=128", 2048, 128, rms_norm_2048, causal_attention_kv_d128 },
+};
+
+static const qwen_dec_kernels_t dec_kernels_generic = {
+    "generic", 0, 0, qwen_rms_norm, qwen_causal_attention_kv
+};
+
+const qwen_dec_kernels_t *qwen_dec_kernels_select(int hidden, int head_dim) {
+    for (size_t i = 0; i < sizeof(dec_kernels) / sizeof(dec_kernels[0]); i++)
+        if (dec_kernels[i].hidden == hidden && dec_kernels[i].head_dim == head_dim)
+            return &dec_kernels[i];
+    return &dec_kernels_generic;
+}
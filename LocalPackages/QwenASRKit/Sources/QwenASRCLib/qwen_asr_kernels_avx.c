@@ -7,6 +7,10 @@
  *
  * The bf16 matvec processes 4 output rows simultaneously to reduce instruction
  * overhead and improve out-of-order execution on memory-bound workloads.
+ *
+ * int8/int4 weights are widened with vpmovsxbd and accumulated in f32; they
+ * read 1 or ~0.6 bytes per weight instead of 2, so AVX2 is enough to saturate
+ * memory bandwidth and no separate AVX-512 variant is kept.
  */
 
 #include "qwen_asr_kernels_impl.h"
@@ -349,6 +353,223 @@ void qwen_argmax_bf16_range_avx(const float *x, const uint16_t *W_bf16,
 
 #endif /* AVX-512F+BW vs AVX2 for bf16 */
 
+/* =====================================================================
+ * INT8 / INT4 weight-only matvec - AVX2+FMA (also used on AVX-512 hosts)
+ * ===================================================================== */
+
+static inline float hsum_ps256(__m256 v) {
+    __m128 r = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    r = _mm_hadd_ps(r, r);
+    r = _mm_hadd_ps(r, r);
+    return _mm_cvtss_f32(r);
+}
+
+/* Helper: int8→f32 for 8 elements */
+static inline __m256 i8x8_to_f32(const int8_t *src) {
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)src)));
+}
+
+/* Unpack one 32-element INT4 group (16 bytes, low nibbles = 0..15,
+ * high nibbles = 16..31, stored as q+8) to 4 x __m256 */
+static inline void i4x32_to_f32(const uint8_t *src, __m256 *f) {
+    __m128i raw = _mm_loadu_si128((const __m128i *)src);
+    __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i off = _mm_set1_epi8(8);
+    __m128i lo = _mm_sub_epi8(_mm_and_si128(raw, mask), off);
+    __m128i hi = _mm_sub_epi8(_mm_and_si128(_mm_srli_epi16(raw, 4), mask), off);
+    f[0] = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(lo));
+    f[1] = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(lo, 8)));
+    f[2] = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(hi));
+    f[3] = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_srli_si128(hi, 8)));
+}
+
+/* Unscaled dot products of two int8 rows with x, 16 elements/iter */
+static inline void i8_dot2_avx(const int8_t *w0, const int8_t *w1, const float *x,
+                               int in_dim, float *s0_out, float *s1_out) {
+    __m256 a0=_mm256_setzero_ps(), a1=_mm256_setzero_ps();
+    __m256 b0=_mm256_setzero_ps(), b1=_mm256_setzero_ps();
+    int k = 0;
+    for (; k + 16 <= in_dim; k += 16) {
+        __m256 xlo = _mm256_loadu_ps(x + k);
+        __m256 xhi = _mm256_loadu_ps(x + k + 8);
+        a0 = _mm256_fmadd_ps(i8x8_to_f32(w0 + k), xlo, a0);
+        a1 = _mm256_fmadd_ps(i8x8_to_f32(w0 + k + 8), xhi, a1);
+        b0 = _mm256_fmadd_ps(i8x8_to_f32(w1 + k), xlo, b0);
+        b1 = _mm256_fmadd_ps(i8x8_to_f32(w1 + k + 8), xhi, b1);
+    }
+    float s0 = hsum_ps256(_mm256_add_ps(a0, a1));
+    float s1 = hsum_ps256(_mm256_add_ps(b0, b1));
+    for (; k < in_dim; k++) {
+        s0 += (float)w0[k] * x[k];
+        s1 += (float)w1[k] * x[k];
+    }
+    *s0_out = s0;
+    *s1_out = s1;
+}
+
+/* Scaled dot products of two int4 rows with x, one 32-element group/iter */
+static inline void i4_dot2_avx(const uint8_t *w0, const uint8_t *w1,
+                               const float *sc0, const float *sc1,
+                               const float *x, int in_dim,
+                               float *s0_out, float *s1_out) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 w[4];
+    int groups = in_dim / 32;
+    for (int g = 0; g < groups; g++) {
+        const float *xg = x + (size_t)g * 32;
+        __m256 x0 = _mm256_loadu_ps(xg);
+        __m256 x1 = _mm256_loadu_ps(xg + 8);
+        __m256 x2 = _mm256_loadu_ps(xg + 16);
+        __m256 x3 = _mm256_loadu_ps(xg + 24);
+
+        i4x32_to_f32(w0 + (size_t)g * 16, w);
+        __m256 p0 = _mm256_mul_ps(w[0], x0);
+        __m256 p1 = _mm256_mul_ps(w[1], x1);
+        p0 = _mm256_fmadd_ps(w[2], x2, p0);
+        p1 = _mm256_fmadd_ps(w[3], x3, p1);
+        acc0 = _mm256_fmadd_ps(_mm256_add_ps(p0, p1), _mm256_set1_ps(sc0[g]), acc0);
+
+        i4x32_to_f32(w1 + (size_t)g * 16, w);
+        __m256 q0 = _mm256_mul_ps(w[0], x0);
+        __m256 q1 = _mm256_mul_ps(w[1], x1);
+        q0 = _mm256_fmadd_ps(w[2], x2, q0);
+        q1 = _mm256_fmadd_ps(w[3], x3, q1);
+        acc1 = _mm256_fmadd_ps(_mm256_add_ps(q0, q1), _mm256_set1_ps(sc1[g]), acc1);
+    }
+    *s0_out = hsum_ps256(acc0);
+    *s1_out = hsum_ps256(acc1);
+}
+
+/* The 2-row helpers share each x load between rows; a trailing odd row is
+ * passed as both rows. */
+void qwen_i8_matvec_avx(float *y, const float *x, const int8_t *W_i8,
+                        const float *scale, const float *bias, int in_dim, int out_dim) {
+    for (int o = 0; o < out_dim; o += 2) {
+        int o1 = o + 1 < out_dim ? o + 1 : o;
+        float s0, s1;
+        i8_dot2_avx(W_i8 + (size_t)o * in_dim, W_i8 + (size_t)o1 * in_dim,
+                    x, in_dim, &s0, &s1);
+        y[o] = s0 * scale[o] + (bias ? bias[o] : 0.0f);
+        if (o1 != o) y[o1] = s1 * scale[o1] + (bias ? bias[o1] : 0.0f);
+    }
+}
+
+void qwen_argmax_i8_range_avx(const float *x, const int8_t *W_i8, const float *scale,
+                              int in_dim, int start, int end,
+                              int *best_out, float *best_val_out) {
+    int best = start;
+    float best_val = -1e30f;
+    for (int o = start; o < end; o += 2) {
+        int o1 = o + 1 < end ? o + 1 : o;
+        float s0, s1;
+        i8_dot2_avx(W_i8 + (size_t)o * in_dim, W_i8 + (size_t)o1 * in_dim,
+                    x, in_dim, &s0, &s1);
+        s0 *= scale[o];
+        s1 *= scale[o1];
+        if (s0 > best_val) { best_val = s0; best = o; }
+        if (s1 > best_val) { best_val = s1; best = o1; }
+    }
+    *best_out = best;
+    *best_val_out = best_val;
+}
+
+void qwen_i4_matvec_avx(float *y, const float *x, const uint8_t *W_i4,
+                        const float *scale, const float *bias, int in_dim, int out_dim) {
+    size_t row_bytes = (size_t)in_dim / 2;
+    size_t groups = (size_t)in_dim / 32;
+    for (int o = 0; o < out_dim; o += 2) {
+        int o1 = o + 1 < out_dim ? o + 1 : o;
+        float s0, s1;
+        i4_dot2_avx(W_i4 + o * row_bytes, W_i4 + o1 * row_bytes,
+                    scale + o * groups, scale + o1 * groups,
+                    x, in_dim, &s0, &s1);
+        y[o] = s0 + (bias ? bias[o] : 0.0f);
+        if (o1 != o) y[o1] = s1 + (bias ? bias[o1] : 0.0f);
+    }
+}
+
+void qwen_argmax_i4_range_avx(const float *x, const uint8_t *W_i4, const float *scale,
+                              int in_dim, int start, int end,
+                              int *best_out, float *best_val_out) {
+    size_t row_bytes = (size_t)in_dim / 2;
+    size_t groups = (size_t)in_dim / 32;
+    int best = start;
+    float best_val = -1e30f;
+    for (int o = start; o < end; o += 2) {
+        int o1 = o + 1 < end ? o + 1 : o;
+        float s0, s1;
+        i4_dot2_avx(W_i4 + o * row_bytes, W_i4 + o1 * row_bytes,
+                    scale + o * groups, scale + o1 * groups,
+                    x, in_dim, &s0, &s1);
+        if (s0 > best_val) { best_val = s0; best = o; }
+        if (s1 > best_val) { best_val = s1; best = o1; }
+    }
+    *best_out = best;
+    *best_val_out = best_val;
+}
+
+/* =====================================================================
+ * BF16 multi-input matmul - AVX2+FMA (also used on AVX-512 hosts)
+ * Each widened weight vector feeds 4 inputs; the row stays in L1 across
+ * input groups, so the weights stream from memory once for all n.
+ * ===================================================================== */
+
+static inline __m256 bf16x8_load_f32(const uint16_t *src) {
+    __m128i raw = _mm_loadu_si128((const __m128i *)src);
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(raw), 16));
+}
+
+static inline float bf16_scalar_f32(uint16_t v) {
+    uint32_t bits = ((uint32_t)v) << 16;
+    float f;
+    memcpy(&f, &bits, 4);
+    return f;
+}
+
+void qwen_bf16_matmul_rows_avx(float *y, int ldy, const float *x, int n,
+                               const uint16_t *W_bf16, int in_dim, int out_dim) {
+    for (int o = 0; o < out_dim; o++) {
+        const uint16_t *w = W_bf16 + (size_t)o * in_dim;
+        int s = 0;
+        for (; s + 3 < n; s += 4) {
+            const float *x0 = x + (size_t)s * in_dim;
+            const float *x1 = x0 + in_dim;
+            const float *x2 = x1 + in_dim;
+            const float *x3 = x2 + in_dim;
+            __m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps();
+            __m256 a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+            int k = 0;
+            for (; k + 8 <= in_dim; k += 8) {
+                __m256 wv = bf16x8_load_f32(w + k);
+                a0 = _mm256_fmadd_ps(wv, _mm256_loadu_ps(x0 + k), a0);
+                a1 = _mm256_fmadd_ps(wv, _mm256_loadu_ps(x1 + k), a1);
+                a2 = _mm256_fmadd_ps(wv, _mm256_loadu_ps(x2 + k), a2);
+                a3 = _mm256_fmadd_ps(wv, _mm256_loadu_ps(x3 + k), a3);
+            }
+            float s0 = hsum_ps256(a0), s1 = hsum_ps256(a1);
+            float s2 = hsum_ps256(a2), s3 = hsum_ps256(a3);
+            for (; k < in_dim; k++) {
+                float wv = bf16_scalar_f32(w[k]);
+                s0 += wv * x0[k]; s1 += wv * x1[k]; s2 += wv * x2[k]; s3 += wv * x3[k];
+            }
+            y[(size_t)s * ldy + o] = s0;
+            y[(size_t)(s + 1) * ldy + o] = s1;
+            y[(size_t)(s + 2) * ldy + o] = s2;
+            y[(size_t)(s + 3) * ldy + o] = s3;
+        }
+        for (; s < n; s++) {
+            const float *xs = x + (size_t)s * in_dim;
+            __m256 a0 = _mm256_setzero_ps();
+            int k = 0;
+            for (; k + 8 <= in_dim; k += 8)
+                a0 = _mm256_fmadd_ps(bf16x8_load_f32(w + k), _mm256_loadu_ps(xs + k), a0);
+            float sum = hsum_ps256(a0);
+            for (; k < in_dim; k++) sum += bf16_scalar_f32(w[k]) * xs[k];
+            y[(size_t)s * ldy + o] = sum;
+        }
+    }
+}
+
 /* =====================================================================
  * f32 attention helpers - AVX2+FMA, with AVX-512F when available
  * (operates on L1-resident head vectors)
@@ -21,6 +21,24 @@ void qwen_bf16_matvec_fused_generic(float *y, const float *x, const uint16_t *W_
     }
 }
 
+void qwen_bf16_matmul_rows_generic(float *y, int ldy, const float *x, int n,
+                                   const uint16_t *W_bf16, int in_dim, int out_dim) {
+    for (int o = 0; o < out_dim; o++) {
+        const uint16_t *w_row = W_bf16 + (size_t)o * in_dim;
+        for (int s = 0; s < n; s++) {
+            const float *xs = x + (size_t)s * in_dim;
+            float sum = 0.0f;
+            for (int k = 0; k < in_dim; k++) {
+                uint32_t f32_bits = ((uint32_t)w_row[k]) << 16;
+                float w_val;
+                memcpy(&w_val, &f32_bits, sizeof(float));
+                sum += w_val * xs[k];
+            }
+            y[(size_t)s * ldy + o] = sum;
+        }
+    }
+}
+
 void qwen_argmax_bf16_range_generic(const float *x, const uint16_t *W_bf16,
                                     int in_dim, int start, int end,
                                     int *best_out, float *best_val_out) {
@@ -46,6 +64,86 @@ void qwen_argmax_bf16_range_generic(const float *x, const uint16_t *W_bf16,
     *best_val_out = best_val;
 }
 
+/* INT8 rows carry one scale each: y[o] = scale[o] * dot(q_row, x). */
+static float i8_row_dot_generic(const int8_t *w_row, const float *x, int in_dim) {
+    float sum = 0.0f;
+    for (int k = 0; k < in_dim; k++) sum += (float)w_row[k] * x[k];
+    return sum;
+}
+
+void qwen_i8_matvec_generic(float *y, const float *x, const int8_t *W_i8,
+                            const float *scale, const float *bias, int in_dim, int out_dim) {
+    for (int o = 0; o < out_dim; o++) {
+        float sum = i8_row_dot_generic(W_i8 + (size_t)o * in_dim, x, in_dim) * scale[o];
+        y[o] = bias ? sum + bias[o] : sum;
+    }
+}
+
+void qwen_argmax_i8_range_generic(const float *x, const int8_t *W_i8, const float *scale,
+                                  int in_dim, int start, int end,
+                                  int *best_out, float *best_val_out) {
+    int best = start;
+    float best_val = -1e30f;
+
+    for (int o = start; o < end; o++) {
+        float sum = i8_row_dot_generic(W_i8 + (size_t)o * in_dim, x, in_dim) * scale[o];
+        if (sum > best_val) {
+            best_val = sum;
+            best = o;
+        }
+    }
+
+    *best_out = best;
+    *best_val_out = best_val;
+}
+
+/* INT4 rows are in_dim/32 groups of 16 bytes with one scale per group. */
+static float i4_row_dot_generic(const uint8_t *w_row, const float *scale_row,
+                                const float *x, int in_dim) {
+    float sum = 0.0f;
+    for (int g = 0; g < in_dim / 32; g++) {
+        const uint8_t *b = w_row + (size_t)g * 16;
+        const float *xg = x + (size_t)g * 32;
+        float gsum = 0.0f;
+        for (int j = 0; j < 16; j++) {
+            gsum += (float)((int)(b[j] & 0x0F) - 8) * xg[j];
+            gsum += (float)((int)(b[j] >> 4) - 8) * xg[j + 16];
+        }
+        sum += gsum * scale_row[g];
+    }
+    return sum;
+}
+
+void qwen_i4_matvec_generic(float *y, const float *x, const uint8_t *W_i4,
+                            const float *scale, const float *bias, int in_dim, int out_dim) {
+    int groups = in_dim / 32;
+    for (int o = 0; o < out_dim; o++) {
+        float sum = i4_row_dot_generic(W_i4 + (size_t)o * (in_dim / 2),
+                                       scale + (size_t)o * groups, x, in_dim);
+        y[o] = bias ? sum + bias[o] : sum;
+    }
+}
+
+void qwen_argmax_i4_range_generic(const float *x, const uint8_t *W_i4, const float *scale,
+                                  int in_dim, int start, int end,
+                                  int *best_out, float *best_val_out) {
+    int groups = in_dim / 32;
+    int best = start;
+    float best_val = -1e30f;
+
+    for (int o = start; o < end; o++) {
+        float sum = i4_row_dot_generic(W_i4 + (size_t)o * (in_dim / 2),
+                                       scale + (size_t)o * groups, x, in_dim);
+        if (sum > best_val) {
+            best_val = sum;
+            best = o;
+        }
+    }
+
+    *best_out = best;
+    *best_val_out = best_val;
+}
+
 float qwen_dot_f32_generic(const float *a, const float *b, int n) {
     float sum = 0.0f;
     for (int i = 0; i < n; i++) sum += a[i] * b[i];
@@ -115,6 +115,49 @@ void qwen_bf16_matvec_fused_neon(float *y, const float *x, const uint16_t *W_bf1
     }
 }
 
+/* Each widened weight vector feeds 4 inputs; the row stays in L1 across
+ * input groups, so the weights stream from memory once for all n. */
+void qwen_bf16_matmul_rows_neon(float *y, int ldy, const float *x, int n,
+                                const uint16_t *W_bf16, int in_dim, int out_dim) {
+    for (int o = 0; o < out_dim; o++) {
+        const uint16_t *w = W_bf16 + (size_t)o * in_dim;
+        int s = 0;
+        for (; s + 3 < n; s += 4) {
+            const float *x0 = x + (size_t)s * in_dim;
+            const float *x1 = x0 + in_dim;
+            const float *x2 = x1 + in_dim;
+            const float *x3 = x2 + in_dim;
+            float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f);
+            float32x4_t a2 = vdupq_n_f32(0.0f), a3 = vdupq_n_f32(0.0f);
+            int k = 0;
+            for (; k + 8 <= in_dim; k += 8) {
+                uint16x8_t r = vld1q_u16(w + k);
+                float32x4_t lo = vreinterpretq_f32_u32(vshll_n_u16(vget_low_u16(r), 16));
+                float32x4_t hi = vreinterpretq_f32_u32(vshll_n_u16(vget_high_u16(r), 16));
+                a0 = vfmaq_f32(vfmaq_f32(a0, lo, vld1q_f32(x0 + k)), hi, vld1q_f32(x0 + k + 4));
+                a1 = vfmaq_f32(vfmaq_f32(a1, lo, vld1q_f32(x1 + k)), hi, vld1q_f32(x1 + k + 4));
+                a2 = vfmaq_f32(vfmaq_f32(a2, lo, vld1q_f32(x2 + k)), hi, vld1q_f32(x2 + k + 4));
+                a3 = vfmaq_f32(vfmaq_f32(a3, lo, vld1q_f32(x3 + k)), hi, vld1q_f32(x3 + k + 4));
+            }
+            float s0 = vaddvq_f32(a0), s1 = vaddvq_f32(a1);
+            float s2 = vaddvq_f32(a2), s3 = vaddvq_f32(a3);
+            for (; k < in_dim; k++) {
+                uint32_t bits = ((uint32_t)w[k]) << 16;
+                float wv;
+                memcpy(&wv, &bits, sizeof(float));
+                s0 += wv * x0[k]; s1 += wv * x1[k]; s2 += wv * x2[k]; s3 += wv * x3[k];
+            }
+            y[(size_t)s * ldy + o] = s0;
+            y[(size_t)(s + 1) * ldy + o] = s1;
+            y[(size_t)(s + 2) * ldy + o] = s2;
+            y[(size_t)(s + 3) * ldy + o] = s3;
+        }
+        for (; s < n; s++)
+            qwen_bf16_matvec_fused_neon(y + (size_t)s * ldy + o, x + (size_t)s * in_dim,
+                                        w, NULL, in_dim, 1);
+    }
+}
+
 void qwen_argmax_bf16_range_neon(const float *x, const uint16_t *W_bf16,
                                  int in_dim, int start, int end,
                                  int *best_out, float *best_val_out) {
@@ -214,6 +257,190 @@ void qwen_argmax_bf16_range_neon(const float *x, const uint16_t *W_bf16,
     *best_val_out = best_val;
 }
 
+/* =====================================================================
+ * INT8 / INT4 weight-only matvec (f32 activations, f32 accumulation)
+ * ===================================================================== */
+
+/* Widen 16 int8 weights to 4 x float32x4 */
+static inline void i8x16_to_f32(int8x16_t q, float32x4_t *f) {
+    int16x8_t lo = vmovl_s8(vget_low_s8(q));
+    int16x8_t hi = vmovl_s8(vget_high_s8(q));
+    f[0] = vcvtq_f32_s32(vmovl_s16(vget_low_s16(lo)));
+    f[1] = vcvtq_f32_s32(vmovl_s16(vget_high_s16(lo)));
+    f[2] = vcvtq_f32_s32(vmovl_s16(vget_low_s16(hi)));
+    f[3] = vcvtq_f32_s32(vmovl_s16(vget_high_s16(hi)));
+}
+
+/* Unpack one 32-element INT4 group (16 bytes, low nibbles = 0..15,
+ * high nibbles = 16..31, stored as q+8) to 8 x float32x4 */
+static inline void i4x32_to_f32(const uint8_t *b, float32x4_t *f) {
+    uint8x16_t raw = vld1q_u8(b);
+    int8x16_t off = vdupq_n_s8(8);
+    int8x16_t lo = vsubq_s8(vreinterpretq_s8_u8(vandq_u8(raw, vdupq_n_u8(0x0F))), off);
+    int8x16_t hi = vsubq_s8(vreinterpretq_s8_u8(vshrq_n_u8(raw, 4)), off);
+    i8x16_to_f32(lo, f);
+    i8x16_to_f32(hi, f + 4);
+}
+
+/* Unscaled dot products of two int8 rows with x, 16 elements/iter */
+static inline void i8_dot2_neon(const int8_t *w0, const int8_t *w1, const float *x,
+                                int in_dim, float *s0_out, float *s1_out) {
+    float32x4_t a0 = vdupq_n_f32(0.0f), a1 = vdupq_n_f32(0.0f);
+    float32x4_t a2 = vdupq_n_f32(0.0f), a3 = vdupq_n_f32(0.0f);
+    float32x4_t b0 = vdupq_n_f32(0.0f), b1 = vdupq_n_f32(0.0f);
+    float32x4_t b2 = vdupq_n_f32(0.0f), b3 = vdupq_n_f32(0.0f);
+    float32x4_t w[4];
+    int k = 0;
+
+    for (; k + 16 <= in_dim; k += 16) {
+        float32x4_t x0 = vld1q_f32(x + k);
+        float32x4_t x1 = vld1q_f32(x + k + 4);
+        float32x4_t x2 = vld1q_f32(x + k + 8);
+        float32x4_t x3 = vld1q_f32(x + k + 12);
+
+        i8x16_to_f32(vld1q_s8(w0 + k), w);
+        a0 = vfmaq_f32(a0, w[0], x0);
+        a1 = vfmaq_f32(a1, w[1], x1);
+        a2 = vfmaq_f32(a2, w[2], x2);
+        a3 = vfmaq_f32(a3, w[3], x3);
+
+        i8x16_to_f32(vld1q_s8(w1 + k), w);
+        b0 = vfmaq_f32(b0, w[0], x0);
+        b1 = vfmaq_f32(b1, w[1], x1);
+        b2 = vfmaq_f32(b2, w[2], x2);
+        b3 = vfmaq_f32(b3, w[3], x3);
+    }
+
+    float s0 = vaddvq_f32(vaddq_f32(vaddq_f32(a0, a2), vaddq_f32(a1, a3)));
+    float s1 = vaddvq_f32(vaddq_f32(vaddq_f32(b0, b2), vaddq_f32(b1, b3)));
+    for (; k < in_dim; k++) {
+        s0 += (float)w0[k] * x[k];
+        s1 += (float)w1[k] * x[k];
+    }
+    *s0_out = s0;
+    *s1_out = s1;
+}
+
+/* Scaled dot products of two int4 rows with x, one 32-element group/iter */
+static inline void i4_dot2_neon(const uint8_t *w0, const uint8_t *w1,
+                                const float *sc0, const float *sc1,
+                                const float *x, int in_dim,
+                                float *s0_out, float *s1_out) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f), acc1 = vdupq_n_f32(0.0f);
+    float32x4_t w[8];
+    int groups = in_dim / 32;
+
+    for (int g = 0; g < groups; g++) {
+        const float *xg = x + (size_t)g * 32;
+        float32x4_t x0 = vld1q_f32(xg);
+        float32x4_t x1 = vld1q_f32(xg + 4);
+        float32x4_t x2 = vld1q_f32(xg + 8);
+        float32x4_t x3 = vld1q_f32(xg + 12);
+        float32x4_t x4 = vld1q_f32(xg + 16);
+        float32x4_t x5 = vld1q_f32(xg + 20);
+        float32x4_t x6 = vld1q_f32(xg + 24);
+        float32x4_t x7 = vld1q_f32(xg + 28);
+
+        i4x32_to_f32(w0 + (size_t)g * 16, w);
+        float32x4_t p0 = vmulq_f32(w[0], x0);
+        float32x4_t p1 = vmulq_f32(w[1], x1);
+        p0 = vfmaq_f32(p0, w[2], x2);
+        p1 = vfmaq_f32(p1, w[3], x3);
+        p0 = vfmaq_f32(p0, w[4], x4);
+        p1 = vfmaq_f32(p1, w[5], x5);
+        p0 = vfmaq_f32(p0, w[6], x6);
+        p1 = vfmaq_f32(p1, w[7], x7);
+        acc0 = vfmaq_n_f32(acc0, vaddq_f32(p0, p1), sc0[g]);
+
+        i4x32_to_f32(w1 + (size_t)g * 16, w);
+        float32x4_t q0 = vmulq_f32(w[0], x0);
+        float32x4_t q1 = vmulq_f32(w[1], x1);
+        q0 = vfmaq_f32(q0, w[2], x2);
+        q1 = vfmaq_f32(q1, w[3], x3);
+        q0 = vfmaq_f32(q0, w[4], x4);
+        q1 = vfmaq_f32(q1, w[5], x5);
+        q0 = vfmaq_f32(q0, w[6], x6);
+        q1 = vfmaq_f32(q1, w[7], x7);
+        acc1 = vfmaq_n_f32(acc1, vaddq_f32(q0, q1), sc1[g]);
+    }
+
+    *s0_out = vaddvq_f32(acc0);
+    *s1_out = vaddvq_f32(acc1);
+}
+
+/* The 2-row helpers share each x load between rows; a trailing odd row is
+ * passed as both rows. */
+void qwen_i8_matvec_neon(float *y, const float *x, const int8_t *W_i8,
+                         const float *scale, const float *bias, int in_dim, int out_dim) {
+    for (int o = 0; o < out_dim; o += 2) {
+        int o1 = o + 1 < out_dim ? o + 1 : o;
+        float s0, s1;
+        i8_dot2_neon(W_i8 + (size_t)o * in_dim, W_i8 + (size_t)o1 * in_dim,
+                     x, in_dim, &s0, &s1);
+        y[o] = s0 * scale[o] + (bias ? bias[o] : 0.0f);
+        if (o1 != o) y[o1] = s1 * scale[o1] + (bias ? bias[o1] : 0.0f);
+    }
+}
+
+void qwen_argmax_i8_range_neon(const float *x, const int8_t *W_i8, const float *scale,
+                               int in_dim, int start, int end,
+                               int *best_out, float *best_val_out) {
+    int best = start;
+    float best_val = -1e30f;
+
+    for (int o = start; o < end; o += 2) {
+        int o1 = o + 1 < end ? o + 1 : o;
+        float s0, s1;
+        i8_dot2_neon(W_i8 + (size_t)o * in_dim, W_i8 + (size_t)o1 * in_dim,
+                     x, in_dim, &s0, &s1);
+        s0 *= scale[o];
+        s1 *= scale[o1];
+        if (s0 > best_val) { best_val = s0; best = o; }
+        if (s1 > best_val) { best_val = s1; best = o1; }
+    }
+
+    *best_out = best;
+    *best_val_out = best_val;
+}
+
+void qwen_i4_matvec_neon(float *y, const float *x, const uint8_t *W_i4,
+                         const float *scale, const float *bias, int in_dim, int out_dim) {
+    size_t row_bytes = (size_t)in_dim / 2;
+    size_t groups = (size_t)in_dim / 32;
+
+    for (int o = 0; o < out_dim; o += 2) {
+        int o1 = o + 1 < out_dim ? o + 1 : o;
+        float s0, s1;
+        i4_dot2_neon(W_i4 + o * row_bytes, W_i4 + o1 * row_bytes,
+                     scale + o * groups, scale + o1 * groups,
+                     x, in_dim, &s0, &s1);
+        y[o] = s0 + (bias ? bias[o] : 0.0f);
+        if (o1 != o) y[o1] = s1 + (bias ? bias[o1] : 0.0f);
+    }
+}
+
+void qwen_argmax_i4_range_neon(const float *x, const uint8_t *W_i4, const float *scale,
+                               int in_dim, int start, int end,
+                               int *best_out, float *best_val_out) {
+    size_t row_bytes = (size_t)in_dim / 2;
+    size_t groups = (size_t)in_dim / 32;
+    int best = start;
+    float best_val = -1e30f;
+
+    for (int o = start; o < end; o += 2) {
+        int o1 = o + 1 < end ? o + 1 : o;
+        float s0, s1;
+        i4_dot2_neon(W_i4 + o * row_bytes, W_i4 + o1 * row_bytes,
+                     scale + o * groups, scale + o1 * groups,
+                     x, in_dim, &s0, &s1);
+        if (s0 > best_val) { best_val = s0; best = o; }
+        if (s1 > best_val) { best_val = s1; best = o1; }
+    }
+
+    *best_out = best;
+    *best_val_out = best_val;
+}
+
 float qwen_dot_f32_neon(const float *a, const float *b, int n) {
     int i = 0;
     float32x4_t acc0 = vdupq_n_f32(0.0f);
@@ -23,6 +23,7 @@
 #include <fcntl.h>
 #if defined(__APPLE__)
 #include <TargetConditionals.h>
+#include <sys/sysctl.h>
 #endif
 
 static double get_time_ms(void) {
@@ -96,6 +97,14 @@ static void set_last_error(const char *fmt, ...) {
 #define MAX_DEC_LAYERS 28
 #define MAX_NEW_TOKENS 1024
 #define CHUNK_SIZE     100   /* mel frames per encoder chunk */
+#define CHUNK_TOKENS   13    /* audio tokens per chunk: three stride-2 convs */
+
+/* Devices with at least this much RAM keep all three sessions loaded
+ * (6 GB devices report a little under 6144 MB). */
+#define WARM_SESSIONS_MIN_MB 5632
+
+/* KV positions reserved past the prompt; the buffers double when exceeded */
+#define KV_RESERVE_TOKENS 128
 
 /* Prompt prefix: <|im_start|>system\n<|im_end|>\n<|im_start|>user\n<|audio_start|> */
 static const int PROMPT_PREFIX[] = {151644, 8948, 198, 151645, 198, 151644, 872, 198, 151669};
@@ -141,6 +150,29 @@ struct qwen_onnx_ctx {
     int              enc_threads;
     int              dec_threads;
     int              keep_sessions;
+
+    /* Decode step I/O, bound once per decode session */
+    OrtIoBinding    *decode_binding;
+    float           *logits_buf;         /* bound "logits" output */
+    OrtValue        *logits_val;
+    size_t           logits_count;
+    float           *token_buf;          /* bound "token_embed" input [hidden] */
+    OrtValue        *token_val;
+    int64_t          pos_buf;            /* bound "position" input */
+    OrtValue        *pos_val;
+
+    /* KV cache layout (from decoder_prefill's k_cache_0) and buffers.
+     * Every cache is one contiguous tensor with a growing sequence axis;
+     * side `kv_cur` holds the live caches and each step writes its outputs
+     * into the other side, so steps ping-pong without allocating. */
+    ONNXTensorElementDataType kv_type;
+    int64_t          kv_shape[8];
+    size_t           kv_ndim;
+    int              kv_seq_axis;        /* -1 until the layout is known */
+    size_t           kv_pos_bytes;       /* bytes per position per cache */
+    uint8_t         *kv_buf[2];          /* [2 * n_layers][kv_cap positions] */
+    int              kv_cap;
+    int              kv_cur;
 };
 
 /* ======================================================================== */
@@ -429,6 +461,278 @@ static void embed_token_fp16(const uint16_t *embed_fp16, int token_id,
     } \
 } while(0)
 
+/* ======================================================================== */
+/* Session Policy                                                            */
+/* ======================================================================== */
+
+static uint64_t physical_memory_mb(void) {
+#if defined(__APPLE__)
+    uint64_t bytes = 0;
+    size_t len = sizeof(bytes);
+    if (sysctlbyname("hw.memsize", &bytes, &len, NULL, 0) != 0) return 0;
+    return bytes / (1024 * 1024);
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page <= 0) return 0;
+    return (uint64_t)pages * (uint64_t)page / (1024 * 1024);
+#endif
+}
+
+/* 1 = keep encoder/prefill/decode sessions loaded between calls.
+ * QWEN_ONNX_KEEP_SESSIONS=0|1 overrides the memory tier. */
+static int warm_sessions_policy(void) {
+    const char *env = getenv("QWEN_ONNX_KEEP_SESSIONS");
+    if (env && env[0] != '\0') return atoi(env) != 0;
+#if defined(__APPLE__) && defined(TARGET_OS_OSX) && TARGET_OS_OSX
+    return 1;
+#else
+    uint64_t mb = physical_memory_mb();
+    log_msg("qwen_onnx: physical memory %llu MB (warm sessions from %d MB)\n",
+            (unsigned long long)mb, WARM_SESSIONS_MIN_MB);
+    return mb >= WARM_SESSIONS_MIN_MB;
+#endif
+}
+
+/* ======================================================================== */
+/* Decode I/O (IOBinding + ping-pong KV buffers)                             */
+/* ======================================================================== */
+
+/* Log and release a failed status. Returns 1 if s was OK. */
+static int ort_ok(const OrtApi *api, OrtStatus *s) {
+    if (!s) return 1;
+    log_msg("qwen_onnx ORT error: %s\n", api->GetErrorMessage(s));
+    api->ReleaseStatus(s);
+    return 0;
+}
+
+/* Element type and dims of a session output; dynamic dims are left < 0. */
+static int output_layout(const OrtApi *api, OrtSession *session, size_t index,
+                         ONNXTensorElementDataType *type, int64_t *dims, size_t *ndim) {
+    OrtTypeInfo *info = NULL;
+    const OrtTensorTypeAndShapeInfo *tinfo = NULL;
+    int ok = ort_ok(api, api->SessionGetOutputTypeInfo(session, index, &info)) &&
+             ort_ok(api, api->CastTypeInfoToTensorInfo(info, &tinfo)) &&
+             ort_ok(api, api->GetTensorElementType(tinfo, type)) &&
+             ort_ok(api, api->GetDimensionsCount(tinfo, ndim)) &&
+             *ndim <= 8 &&
+             ort_ok(api, api->GetDimensions(tinfo, dims, *ndim));
+    if (info) api->ReleaseTypeInfo(info);
+    return ok;
+}
+
+/* Index of the named session output, or -1. */
+static int find_output(const OrtApi *api, OrtSession *session, const char *name) {
+    OrtAllocator *alloc = NULL;
+    size_t n = 0;
+    if (!ort_ok(api, api->GetAllocatorWithDefaultOptions(&alloc)) ||
+        !ort_ok(api, api->SessionGetOutputCount(session, &n)))
+        return -1;
+    for (size_t i = 0; i < n; i++) {
+        char *out_name = NULL;
+        if (!ort_ok(api, api->SessionGetOutputName(session, i, alloc, &out_name))) return -1;
+        int match = strcmp(out_name, name) == 0;
+        ort_ok(api, api->AllocatorFree(alloc, out_name));
+        if (match) return (int)i;
+    }
+    return -1;
+}
+
+/* Read the KV cache layout from the prefill session (first call only).
+ * The sequence axis is the last dynamic dim; other dynamic dims are 1. */
+static int kv_init_layout(qwen_onnx_ctx_t *ctx) {
+    if (ctx->kv_seq_axis >= 0) return 1;
+    const OrtApi *api = ctx->api;
+    int idx = find_output(api, ctx->prefill, "k_cache_0");
+    if (idx < 0 || !output_layout(api, ctx->prefill, (size_t)idx, &ctx->kv_type,
+                                  ctx->kv_shape, &ctx->kv_ndim)) {
+        set_last_error("cannot read k_cache_0 layout from decoder_prefill");
+        return 0;
+    }
+    size_t elem;
+    if (ctx->kv_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) elem = 4;
+    else if (ctx->kv_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16) elem = 2;
+    else {
+        set_last_error("unsupported KV cache element type %d", (int)ctx->kv_type);
+        return 0;
+    }
+    int seq_axis = -1;
+    for (size_t d = 0; d < ctx->kv_ndim; d++)
+        if (ctx->kv_shape[d] < 0) seq_axis = (int)d;
+    if (seq_axis < 0) {
+        set_last_error("k_cache_0 has no dynamic sequence axis");
+        return 0;
+    }
+    size_t pos_bytes = elem;
+    for (size_t d = 0; d < ctx->kv_ndim; d++) {
+        if ((int)d == seq_axis) continue;
+        if (ctx->kv_shape[d] < 0) ctx->kv_shape[d] = 1;
+        pos_bytes *= (size_t)ctx->kv_shape[d];
+    }
+    ctx->kv_seq_axis = seq_axis;
+    ctx->kv_pos_bytes = pos_bytes;
+    log_msg("[QwenOnnx] KV layout: %zu dims, seq axis %d, %zu bytes/position/cache\n",
+            ctx->kv_ndim, seq_axis, pos_bytes);
+    return 1;
+}
+
+static void kv_free(qwen_onnx_ctx_t *ctx) {
+    free(ctx->kv_buf[0]);
+    free(ctx->kv_buf[1]);
+    ctx->kv_buf[0] = ctx->kv_buf[1] = NULL;
+    ctx->kv_cap = 0;
+    ctx->kv_cur = 0;
+}
+
+/* Make room for `positions` per cache, keeping the first `live` positions
+ * of side kv_cur. Grows geometrically, so steps rarely reallocate. */
+static int kv_reserve(qwen_onnx_ctx_t *ctx, int positions, int live) {
+    if (positions <= ctx->kv_cap) return 1;
+    int n_kv = 2 * ctx->n_layers;
+    int cap = ctx->kv_cap > 0 ? ctx->kv_cap * 2 : positions + KV_RESERVE_TOKENS;
+    if (cap < positions) cap = positions;
+    size_t stride = (size_t)cap * ctx->kv_pos_bytes;
+    uint8_t *side[2];
+    side[0] = (uint8_t *)malloc((size_t)n_kv * stride);
+    side[1] = (uint8_t *)malloc((size_t)n_kv * stride);
+    if (!side[0] || !side[1]) {
+        free(side[0]); free(side[1]);
+        set_last_error("KV cache allocation failed (%d positions)", cap);
+        return 0;
+    }
+    if (live > 0 && ctx->kv_buf[ctx->kv_cur]) {
+        size_t old_stride = (size_t)ctx->kv_cap * ctx->kv_pos_bytes;
+        for (int i = 0; i < n_kv; i++)
+            memcpy(side[ctx->kv_cur] + (size_t)i * stride,
+                   ctx->kv_buf[ctx->kv_cur] + (size_t)i * old_stride,
+                   (size_t)live * ctx->kv_pos_bytes);
+    }
+    free(ctx->kv_buf[0]);
+    free(ctx->kv_buf[1]);
+    ctx->kv_buf[0] = side[0];
+    ctx->kv_buf[1] = side[1];
+    ctx->kv_cap = cap;
+    if (qwen_onnx_verbose)
+        log_msg("[QwenOnnx] KV buffers: %d positions x %d caches x 2 (%.1f MB)\n",
+                cap, n_kv, 2.0 * n_kv * stride / (1024.0 * 1024.0));
+    return 1;
+}
+
+/* Tensor over cache i of a side, holding `positions` positions. The value
+ * does not own the data. */
+static OrtValue *kv_view(qwen_onnx_ctx_t *ctx, int side, int i, int positions) {
+    int64_t shape[8];
+    memcpy(shape, ctx->kv_shape, ctx->kv_ndim * sizeof(int64_t));
+    shape[ctx->kv_seq_axis] = positions;
+    size_t stride = (size_t)ctx->kv_cap * ctx->kv_pos_bytes;
+    OrtValue *v = NULL;
+    if (!ort_ok(ctx->api, ctx->api->CreateTensorWithDataAsOrtValue(
+            ctx->mem_info, ctx->kv_buf[side] + (size_t)i * stride,
+            (size_t)positions * ctx->kv_pos_bytes, shape, ctx->kv_ndim,
+            ctx->kv_type, &v)))
+        return NULL;
+    return v;
+}
+
+static void decode_io_release(qwen_onnx_ctx_t *ctx) {
+    const OrtApi *api = ctx->api;
+    if (ctx->decode_binding) api->ReleaseIoBinding(ctx->decode_binding);
+    if (ctx->logits_val) api->ReleaseValue(ctx->logits_val);
+    if (ctx->token_val) api->ReleaseValue(ctx->token_val);
+    if (ctx->pos_val) api->ReleaseValue(ctx->pos_val);
+    free(ctx->logits_buf);
+    free(ctx->token_buf);
+    ctx->decode_binding = NULL;
+    ctx->logits_val = ctx->token_val = ctx->pos_val = NULL;
+    ctx->logits_buf = ctx->token_buf = NULL;
+    ctx->logits_count = 0;
+}
+
+/* Release the decode session together with the binding made on it. */
+static void release_decode_session(qwen_onnx_ctx_t *ctx) {
+    decode_io_release(ctx);
+    if (ctx->decode) {
+        ctx->api->ReleaseSession(ctx->decode);
+        ctx->decode = NULL;
+    }
+}
+
+/* Create the decode binding with its fixed inputs (token embedding,
+ * position) and the logits output; only the KV caches are rebound per step. */
+static int decode_io_init(qwen_onnx_ctx_t *ctx) {
+    if (ctx->decode_binding) return 1;
+    const OrtApi *api = ctx->api;
+    int hidden = ctx->hidden_dim;
+
+    ONNXTensorElementDataType type;
+    int64_t dims[8];
+    size_t ndim = 0;
+    if (!output_layout(api, ctx->decode, 0, &type, dims, &ndim) ||
+        type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) {
+        set_last_error("unexpected decoder_decode logits output");
+        return 0;
+    }
+    size_t count = 1;
+    for (size_t d = 0; d < ndim; d++) {
+        if (dims[d] < 0) dims[d] = 1;
+        count *= (size_t)dims[d];
+    }
+    if (count < (size_t)ctx->vocab_size) {
+        set_last_error("decoder_decode logits hold %zu values, vocab is %d",
+                       count, ctx->vocab_size);
+        return 0;
+    }
+
+    int64_t tok_shape[] = {1, 1, hidden};
+    int64_t pos_shape[] = {1};
+    ctx->logits_buf = (float *)malloc(count * sizeof(float));
+    ctx->token_buf = (float *)malloc((size_t)hidden * sizeof(float));
+    ctx->logits_count = count;
+    int ok = ctx->logits_buf && ctx->token_buf &&
+        ort_ok(api, api->CreateIoBinding(ctx->decode, &ctx->decode_binding)) &&
+        ort_ok(api, api->CreateTensorWithDataAsOrtValue(ctx->mem_info, ctx->logits_buf,
+               count * sizeof(float), dims, ndim, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT,
+               &ctx->logits_val)) &&
+        ort_ok(api, api->CreateTensorWithDataAsOrtValue(ctx->mem_info, ctx->token_buf,
+               (size_t)hidden * sizeof(float), tok_shape, 3,
+               ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &ctx->token_val)) &&
+        ort_ok(api, api->CreateTensorWithDataAsOrtValue(ctx->mem_info, &ctx->pos_buf,
+               sizeof(int64_t), pos_shape, 1, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64,
+               &ctx->pos_val)) &&
+        ort_ok(api, api->BindInput(ctx->decode_binding, "token_embed", ctx->token_val)) &&
+        ort_ok(api, api->BindInput(ctx->decode_binding, "position", ctx->pos_val)) &&
+        ort_ok(api, api->BindOutput(ctx->decode_binding, "logits", ctx->logits_val));
+    if (!ok) {
+        decode_io_release(ctx);
+        set_last_error("failed to set up decoder_decode IOBinding");
+    }
+    return ok;
+}
+
+/* One decode step: caches of side kv_cur at `past` positions in, side
+ * kv_cur ^ 1 at past + 1 out. Returns 1 on success. */
+static int decode_step(qwen_onnx_ctx_t *ctx, const char *const *in_names,
+                       const char *const *out_names, int past) {
+    const OrtApi *api = ctx->api;
+    int n_kv = 2 * ctx->n_layers;
+    if (!kv_reserve(ctx, past + 1, past)) return 0;
+    int src = ctx->kv_cur, dst = ctx->kv_cur ^ 1;
+    for (int i = 0; i < n_kv; i++) {
+        /* The binding keeps its own reference to each value */
+        OrtValue *in = kv_view(ctx, src, i, past);
+        OrtValue *out = kv_view(ctx, dst, i, past + 1);
+        int ok = in && out &&
+                 ort_ok(api, api->BindInput(ctx->decode_binding, in_names[i], in)) &&
+                 ort_ok(api, api->BindOutput(ctx->decode_binding, out_names[i], out));
+        if (in) api->ReleaseValue(in);
+        if (out) api->ReleaseValue(out);
+        if (!ok) return 0;
+    }
+    if (!ort_ok(api, api->RunWithBinding(ctx->decode, NULL, ctx->decode_binding))) return 0;
+    ctx->kv_cur = dst;
+    return 1;
+}
+
 /* ======================================================================== */
 /* Load / Free                                                               */
 /* ======================================================================== */
@@ -532,17 +836,17 @@ qwen_onnx_ctx_t *qwen_onnx_load(const char *model_dir) {
     int dec_threads = (n_threads >= 6) ? 3 : 2;
     log_msg("qwen_onnx: threads enc=%d dec=%d (cores=%d)\n", enc_threads, dec_threads, n_threads);
 
-    /* macOS: keep ORT sessions loaded to avoid re-creating them inside transcribe().
-     * iOS/Android: stay conservative to reduce peak RSS on mobile devices. */
-    int keep_sessions = 0;
-#if defined(__APPLE__) && defined(TARGET_OS_OSX) && TARGET_OS_OSX
-    keep_sessions = 1;
-#endif
+    /* macOS and devices with >= 6 GB RAM keep ORT sessions loaded to avoid
+     * re-creating them inside transcribe(); smaller devices load each session
+     * on demand to keep peak RSS low. */
+    int keep_sessions = warm_sessions_policy();
+    log_msg("qwen_onnx: sessions %s\n", keep_sessions ? "kept warm" : "loaded on demand");
 
     /* Store model_dir and thread counts for on-demand session loading in transcribe() */
     ctx->model_dir = strdup(model_dir);
     ctx->dec_threads = dec_threads;
     ctx->keep_sessions = keep_sessions;
+    ctx->kv_seq_axis = -1;
 
     /* Load tokenizer first (small, ~2 MB) */
     log_msg("qwen_onnx: loading tokenizer...\n");
@@ -648,10 +952,11 @@ void qwen_onnx_free(qwen_onnx_ctx_t *ctx) {
     if (api) {
         if (ctx->encoder)  api->ReleaseSession(ctx->encoder);
         if (ctx->prefill)  api->ReleaseSession(ctx->prefill);
-        if (ctx->decode)   api->ReleaseSession(ctx->decode);
+        release_decode_session(ctx);
         if (ctx->mem_info) api->ReleaseMemoryInfo(ctx->mem_info);
         if (ctx->env)      api->ReleaseEnv(ctx->env);
     }
+    kv_free(ctx);
     if (ctx->embed_mmap_base) munmap(ctx->embed_mmap_base, ctx->embed_mmap_size);
     if (ctx->tokenizer)    qwen_tokenizer_free(ctx->tokenizer);
     if (ctx->model_dir)    free(ctx->model_dir);
@@ -671,42 +976,57 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
 
     /* Tracking arrays for cleanup */
     OrtValue *enc_input = NULL, *enc_output = NULL;
+    OrtIoBinding *enc_binding = NULL;
     OrtValue *prefill_input = NULL;
     OrtValue **prefill_outputs = NULL;
-    OrtValue *decode_token_input = NULL, *decode_pos_input = NULL;
-    OrtValue **decode_outputs = NULL;
-    OrtValue **kv_caches = NULL;  /* 2 * n_layers OrtValue pointers */
-    float *decode_token_buf = NULL;
-    int64_t decode_pos_val = 0;
-    float *input_embeds = NULL;
+    float *input_embeds = NULL;  /* data of prefill_input */
     int *generated = NULL;
 
     /* These will be set after on-demand decoder loading */
     int n_layers = 0, n_kv = 0;
-    int prefill_n_outputs = 0, decode_n_inputs = 0, decode_n_outputs = 0;
+    int prefill_n_outputs = 0;
 
     generated = (int *)malloc(MAX_NEW_TOKENS * sizeof(int));
     if (!generated) goto cleanup;
 
     double t_start = get_time_ms();
 
+    OrtAllocator *allocator = NULL;
+    ORT_CHECK(api->GetAllocatorWithDefaultOptions(&allocator));
+
+    /* Sizes follow from the sample count: frames are padded to a multiple of
+     * CHUNK_SIZE and every chunk yields CHUNK_TOKENS audio tokens. */
+    int n_frames = qwen_mel_frame_count(n_samples);
+    if (n_frames <= 0) { log_msg("qwen_onnx: audio too short\n"); goto cleanup; }
+    int padded_frames = (n_frames + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE;
+    int n_audio = padded_frames / CHUNK_SIZE * CHUNK_TOKENS;
+    int prompt_len = N_PREFIX + n_audio + N_SUFFIX;
+
     /* ---- Step 1: Mel spectrogram ---- */
-    int n_frames;
-    float *mel = qwen_mel_spectrogram(samples, n_samples, &n_frames);
-    if (!mel) { log_msg("qwen_onnx: mel spectrogram failed\n"); goto cleanup; }
+    /* Written straight into the ORT-owned, chunk-padded encoder input */
+    {
+        int64_t mel_shape[] = {1, QWEN_MEL_BINS, padded_frames};
+        float *mel;
+        ORT_CHECK(api->CreateTensorAsOrtValue(allocator, mel_shape, 3,
+                  ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &enc_input));
+        ORT_CHECK(api->GetTensorMutableData(enc_input, (void **)&mel));
+        if (qwen_mel_spectrogram_into(samples, n_samples, mel, padded_frames) < 0) {
+            log_msg("qwen_onnx: mel spectrogram failed\n");
+            goto cleanup;
+        }
+    }
     double t_mel = get_time_ms();
     log_msg("[QwenOnnx] mel spectrogram: %.1f ms\n", t_mel - t_start);
+    log_msg("Mel: %d x %d (padded from %d)\n", QWEN_MEL_BINS, padded_frames, n_frames);
 
-    /* Pad frames to multiple of CHUNK_SIZE */
-    int pad_frames = (CHUNK_SIZE - (n_frames % CHUNK_SIZE)) % CHUNK_SIZE;
-    int padded_frames = n_frames + pad_frames;
-    if (pad_frames > 0) {
-        float *padded = (float *)calloc((size_t)QWEN_MEL_BINS * padded_frames, sizeof(float));
-        memcpy(padded, mel, (size_t)QWEN_MEL_BINS * n_frames * sizeof(float));
-        free(mel);
-        mel = padded;
+    /* The prompt embedding tensor; the encoder fills rows
+     * [N_PREFIX, N_PREFIX + n_audio) in place. */
+    {
+        int64_t emb_shape[] = {1, prompt_len, hidden};
+        ORT_CHECK(api->CreateTensorAsOrtValue(allocator, emb_shape, 3,
+                  ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &prefill_input));
+        ORT_CHECK(api->GetTensorMutableData(prefill_input, (void **)&input_embeds));
     }
-    log_msg("Mel: %d x %d (padded from %d)\n", QWEN_MEL_BINS, padded_frames, n_frames);
 
     /* ---- Step 1b: On-demand encoder loading ---- */
     if (!ctx->encoder) {
@@ -724,38 +1044,33 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
 
     /* ---- Step 2: Run encoder ---- */
     {
-        int64_t mel_shape[] = {1, QWEN_MEL_BINS, padded_frames};
-        size_t mel_size = sizeof(float) * QWEN_MEL_BINS * padded_frames;
-        ORT_CHECK(api->CreateTensorWithDataAsOrtValue(ctx->mem_info, mel, mel_size,
-                  mel_shape, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &enc_input));
-
-        const char *enc_in_names[]  = {"mel_input"};
-        const char *enc_out_names[] = {"audio_embeddings"};
-        OrtValue *enc_inputs[]  = {enc_input};
-        OrtValue *enc_outputs[] = {NULL};
-        ORT_CHECK(api->Run(ctx->encoder, NULL, enc_in_names, (const OrtValue *const *)enc_inputs, 1,
-                  enc_out_names, 1, enc_outputs));
-        enc_output = enc_outputs[0];
+        int64_t out_shape[] = {1, n_audio, hidden};
+        ORT_CHECK(api->CreateTensorWithDataAsOrtValue(ctx->mem_info,
+                  input_embeds + (size_t)N_PREFIX * hidden,
+                  (size_t)n_audio * hidden * sizeof(float), out_shape, 3,
+                  ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &enc_output));
+        ORT_CHECK(api->CreateIoBinding(ctx->encoder, &enc_binding));
+        ORT_CHECK(api->BindInput(enc_binding, "mel_input", enc_input));
+        ORT_CHECK(api->BindOutput(enc_binding, "audio_embeddings", enc_output));
+        OrtStatus *st = api->RunWithBinding(ctx->encoder, NULL, enc_binding);
+        if (st) {
+            set_last_error("encoder run failed (expected %d audio tokens): %s",
+                           n_audio, api->GetErrorMessage(st));
+            api->ReleaseStatus(st);
+            goto cleanup;
+        }
+        api->ReleaseIoBinding(enc_binding);
+        enc_binding = NULL;
     }
-    free(mel); mel = NULL;
+    /* The mel is no longer needed; the embeddings already sit in the prompt */
+    api->ReleaseValue(enc_input); enc_input = NULL;
+    api->ReleaseValue(enc_output); enc_output = NULL;
     double t_encoder = get_time_ms();
     log_msg("[QwenOnnx] encoder: %.1f ms\n", t_encoder - t_mel);
-
-    /* Get audio embedding shape */
-    OrtTensorTypeAndShapeInfo *enc_info;
-    ORT_CHECK(api->GetTensorTypeAndShape(enc_output, &enc_info));
-    int64_t enc_shape[3];
-    ORT_CHECK(api->GetDimensions(enc_info, enc_shape, 3));
-    api->ReleaseTensorTypeAndShapeInfo(enc_info);
-
-    int n_audio = (int)enc_shape[1];
-    log_msg("Audio embeddings: %d tokens x %d dim\n", n_audio, (int)enc_shape[2]);
-
-    float *audio_embeds;
-    ORT_CHECK(api->GetTensorMutableData(enc_output, (void **)&audio_embeds));
+    log_msg("Audio embeddings: %d tokens x %d dim\n", n_audio, hidden);
 
     /* Release encoder session to free ~191 MB before loading decoder.
-     * The enc_output OrtValue owns its own memory and survives session release. */
+     * The embeddings live in prefill_input, which survives session release. */
     if (ctx->encoder && !ctx->keep_sessions) {
         api->ReleaseSession(ctx->encoder);
         ctx->encoder = NULL;
@@ -797,27 +1112,17 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
     n_layers = ctx->n_layers;
     n_kv = 2 * n_layers;
     prefill_n_outputs = 1 + n_kv;
-    decode_n_inputs = 2 + n_kv;
-    decode_n_outputs = 1 + n_kv;
 
     prefill_outputs = (OrtValue **)calloc(prefill_n_outputs, sizeof(OrtValue *));
-    decode_outputs  = (OrtValue **)calloc(decode_n_outputs, sizeof(OrtValue *));
-    kv_caches       = (OrtValue **)calloc(n_kv, sizeof(OrtValue *));
-    if (!prefill_outputs || !decode_outputs || !kv_caches) goto cleanup;
-
-    /* ---- Step 3: Build input embeddings ---- */
-    int prompt_len = N_PREFIX + n_audio + N_SUFFIX;
-    input_embeds = (float *)malloc((size_t)prompt_len * hidden * sizeof(float));
-    if (!input_embeds) goto cleanup;
+    if (!prefill_outputs) goto cleanup;
+    if (!kv_init_layout(ctx)) goto cleanup;
 
+    /* ---- Step 3: Complete the prompt embeddings around the audio ---- */
     /* Embed prefix tokens (fp16→fp32 on-the-fly) */
     for (int i = 0; i < N_PREFIX; i++)
         embed_token_fp16(ctx->embed_tokens_fp16, PROMPT_PREFIX[i], hidden,
                          input_embeds + i * hidden);
 
-    /* Insert audio embeddings */
-    memcpy(input_embeds + N_PREFIX * hidden, audio_embeds, (size_t)n_audio * hidden * sizeof(float));
-
     /* Embed suffix tokens (fp16→fp32 on-the-fly) */
     for (int i = 0; i < N_SUFFIX; i++)
         embed_token_fp16(ctx->embed_tokens_fp16, PROMPT_SUFFIX[i], hidden,
@@ -825,11 +1130,6 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
 
     /* ---- Step 4: Run decoder prefill ---- */
     {
-        int64_t emb_shape[] = {1, prompt_len, hidden};
-        size_t emb_size = sizeof(float) * prompt_len * hidden;
-        ORT_CHECK(api->CreateTensorWithDataAsOrtValue(ctx->mem_info, input_embeds, emb_size,
-                  emb_shape, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &prefill_input));
-
         /* Build output names */
         char output_name_bufs[1 + MAX_DEC_LAYERS * 2][24];
         const char *pf_out_names[1 + MAX_DEC_LAYERS * 2];
@@ -843,6 +1143,15 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
             pf_out_names[1 + n_layers + i] = output_name_bufs[1 + n_layers + i];
         }
 
+        /* The caches are written straight into side 0 of the KV buffers;
+         * ORT allocates the logits. */
+        ctx->kv_cur = 0;
+        if (!kv_reserve(ctx, prompt_len + KV_RESERVE_TOKENS, 0)) goto cleanup;
+        for (int i = 0; i < n_kv; i++) {
+            prefill_outputs[1 + i] = kv_view(ctx, 0, i, prompt_len);
+            if (!prefill_outputs[1 + i]) goto cleanup;
+        }
+
         const char *pf_in_names[] = {"input_embeds"};
         OrtValue *pf_inputs[] = {prefill_input};
         ORT_CHECK(api->Run(ctx->prefill, NULL, pf_in_names, (const OrtValue *const *)pf_inputs, 1,
@@ -859,19 +1168,16 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
         generated[0] = first_token;
         log_msg("First token: %d\n", first_token);
 
-        /* Transfer KV caches from prefill output */
-        for (int i = 0; i < n_kv; i++) {
-            kv_caches[i] = prefill_outputs[1 + i];
-            prefill_outputs[1 + i] = NULL;  /* prevent double-free */
+        /* The caches stay in the KV buffers; drop the views and the logits */
+        for (int i = 0; i < prefill_n_outputs; i++) {
+            api->ReleaseValue(prefill_outputs[i]);
+            prefill_outputs[i] = NULL;
         }
-        /* Free prefill logits */
-        api->ReleaseValue(prefill_outputs[0]);
-        prefill_outputs[0] = NULL;
     }
 
     /* ---- Step 4b: Release prefill, load decode on-demand ---- */
     /* Release prefill session BEFORE loading decode to minimize peak memory.
-     * KV caches from prefill are still held in kv_caches[]. */
+     * KV caches from prefill are still held in ctx->kv_buf. */
     if (ctx->prefill && !ctx->keep_sessions) {
         api->ReleaseSession(ctx->prefill);
         ctx->prefill = NULL;
@@ -892,6 +1198,7 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
         }
         log_msg("[QwenOnnx] decoder_decode loaded: %.1f ms\n", get_time_ms() - t_dc_load);
     }
+    if (!decode_io_init(ctx)) goto cleanup;
 
     /* ---- Step 5: Decode loop ---- */
     {
@@ -899,77 +1206,36 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
         int token = generated[0];
 
         /* Pre-build input/output name strings */
-        char in_name_bufs[2 + MAX_DEC_LAYERS * 2][24];
-        const char *dc_in_names[2 + MAX_DEC_LAYERS * 2];
-        dc_in_names[0] = "token_embed";
-        dc_in_names[1] = "position";
-        for (int i = 0; i < n_layers; i++) {
-            snprintf(in_name_bufs[2 + i], 24, "k_cache_in_%d", i);
-            dc_in_names[2 + i] = in_name_bufs[2 + i];
-        }
+        char in_name_bufs[MAX_DEC_LAYERS * 2][24];
+        char out_name_bufs[MAX_DEC_LAYERS * 2][24];
+        const char *dc_in_names[MAX_DEC_LAYERS * 2];
+        const char *dc_out_names[MAX_DEC_LAYERS * 2];
         for (int i = 0; i < n_layers; i++) {
-            snprintf(in_name_bufs[2 + n_layers + i], 24, "v_cache_in_%d", i);
-            dc_in_names[2 + n_layers + i] = in_name_bufs[2 + n_layers + i];
+            snprintf(in_name_bufs[i], 24, "k_cache_in_%d", i);
+            snprintf(in_name_bufs[n_layers + i], 24, "v_cache_in_%d", i);
+            snprintf(out_name_bufs[i], 24, "k_cache_out_%d", i);
+            snprintf(out_name_bufs[n_layers + i], 24, "v_cache_out_%d", i);
         }
-
-        char out_name_bufs[1 + MAX_DEC_LAYERS * 2][24];
-        const char *dc_out_names[1 + MAX_DEC_LAYERS * 2];
-        dc_out_names[0] = "logits";
-        for (int i = 0; i < n_layers; i++) {
-            snprintf(out_name_bufs[1 + i], 24, "k_cache_out_%d", i);
-            dc_out_names[1 + i] = out_name_bufs[1 + i];
-        }
-        for (int i = 0; i < n_layers; i++) {
-            snprintf(out_name_bufs[1 + n_layers + i], 24, "v_cache_out_%d", i);
-            dc_out_names[1 + n_layers + i] = out_name_bufs[1 + n_layers + i];
+        for (int i = 0; i < n_kv; i++) {
+            dc_in_names[i] = in_name_bufs[i];
+            dc_out_names[i] = out_name_bufs[i];
         }
 
-        /* Reuse decode input tensors across all steps to avoid per-token OrtValue creation overhead. */
-        int64_t tok_shape[] = {1, 1, hidden};
-        int64_t pos_shape[] = {1};
-        decode_token_buf = (float *)malloc((size_t)hidden * sizeof(float));
-        if (!decode_token_buf) goto cleanup;
-        ORT_CHECK(api->CreateTensorWithDataAsOrtValue(ctx->mem_info, decode_token_buf,
-                  (size_t)hidden * sizeof(float), tok_shape, 3,
-                  ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &decode_token_input));
-        ORT_CHECK(api->CreateTensorWithDataAsOrtValue(ctx->mem_info, &decode_pos_val,
-                  sizeof(int64_t), pos_shape, 1,
-                  ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64, &decode_pos_input));
-
+        /* Token, position and logits are bound once per session; each step
+         * only rebinds the KV views, so no step allocates tensor data. */
         for (int step = 0; step < MAX_NEW_TOKENS - 1; step++) {
             if (is_eos(token)) break;
 
-            embed_token_fp16(ctx->embed_tokens_fp16, token, hidden, decode_token_buf);
-            decode_pos_val = (int64_t)(prompt_len + step);
-
-            /* Build input array: [token_embed, position, k_0..k_n, v_0..v_n] */
-            OrtValue *dc_inputs[2 + MAX_DEC_LAYERS * 2];
-            dc_inputs[0] = decode_token_input;
-            dc_inputs[1] = decode_pos_input;
-            for (int i = 0; i < n_kv; i++)
-                dc_inputs[2 + i] = kv_caches[i];
-
-            /* Run decode */
-            memset(decode_outputs, 0, decode_n_outputs * sizeof(OrtValue *));
-            ORT_CHECK(api->Run(ctx->decode, NULL, dc_in_names,
-                      (const OrtValue *const *)dc_inputs, decode_n_inputs,
-                      dc_out_names, decode_n_outputs, decode_outputs));
-
-            /* Extract next token */
-            float *logits;
-            ORT_CHECK(api->GetTensorMutableData(decode_outputs[0], (void **)&logits));
-            token = argmax_f32(logits, ctx->vocab_size);
-            generated[n_generated++] = token;
+            embed_token_fp16(ctx->embed_tokens_fp16, token, hidden, ctx->token_buf);
+            ctx->pos_buf = (int64_t)(prompt_len + step);
 
-            /* Free old KV caches, keep new ones */
-            for (int i = 0; i < n_kv; i++) {
-                api->ReleaseValue(kv_caches[i]);
-                kv_caches[i] = decode_outputs[1 + i];
-                decode_outputs[1 + i] = NULL;
+            if (!decode_step(ctx, dc_in_names, dc_out_names, prompt_len + step)) {
+                set_last_error("decode step %d failed", step);
+                goto cleanup;
             }
-            /* Free decode logits */
-            api->ReleaseValue(decode_outputs[0]);
-            decode_outputs[0] = NULL;
+
+            token = argmax_f32(ctx->logits_buf, ctx->vocab_size);
+            generated[n_generated++] = token;
         }
 
         double t_decode = get_time_ms();
@@ -1055,26 +1321,15 @@ char *qwen_onnx_transcribe(qwen_onnx_ctx_t *ctx, const float *samples, int n_sam
 cleanup:
     if (enc_input)  api->ReleaseValue(enc_input);
     if (enc_output) api->ReleaseValue(enc_output);
+    if (enc_binding) api->ReleaseIoBinding(enc_binding);
     if (prefill_input) api->ReleaseValue(prefill_input);
-    if (decode_token_input) api->ReleaseValue(decode_token_input);
-    if (decode_pos_input) api->ReleaseValue(decode_pos_input);
     if (prefill_outputs) {
         for (int i = 0; i < prefill_n_outputs; i++)
             if (prefill_outputs[i]) api->ReleaseValue(prefill_outputs[i]);
         free(prefill_outputs);
     }
-    if (decode_outputs) {
-        for (int i = 0; i < decode_n_outputs; i++)
-            if (decode_outputs[i]) api->ReleaseValue(decode_outputs[i]);
-        free(decode_outputs);
-    }
-    if (kv_caches) {
-        for (int i = 0; i < n_kv; i++)
-            if (kv_caches[i]) api->ReleaseValue(kv_caches[i]);
-        free(kv_caches);
-    }
-    free(decode_token_buf);
-    free(input_embeds);
+    /* The caches grow with the transcript; don't hold them between calls */
+    kv_free(ctx);
     free(generated);
 
     /* Release ONNX sessions to keep memory low on mobile devices.
@@ -1091,8 +1346,7 @@ cleanup:
             log_msg("[QwenOnnx] released decoder_prefill session\n");
         }
         if (ctx->decode) {
-            api->ReleaseSession(ctx->decode);
-            ctx->decode = NULL;
+            release_decode_session(ctx);
             log_msg("[QwenOnnx] released decoder_decode session\n");
         }
     }
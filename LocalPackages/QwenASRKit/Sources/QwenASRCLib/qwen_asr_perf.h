@@ -0,0 +1,36 @@
+/*
+ * qwen_asr_perf.h - internal profiling hooks (not installed with the public headers)
+ */
+
+#ifndef QWEN_ASR_PERF_H
+#define QWEN_ASR_PERF_H
+
+#include "qwen_asr.h"
+
+/* Profiling hooks. qwen_perf_decode_step records one step that started at
+ * t0 (qwen_perf_now_ms), setting the TTFT on the first; note_memory raises
+ * the KV and scratch high-water marks with the current sizes. */
+void qwen_perf_decode_step(qwen_ctx_t *ctx, double t0);
+void qwen_perf_note_memory(qwen_ctx_t *ctx, size_t kv_bytes);
+
+/* os_signpost intervals on Apple platforms (no-ops elsewhere and with
+ * QWEN_PROFILE=0), keyed by the context so Instruments nests them */
+#define QWEN_SIGNPOST_TRANSCRIBE 0
+#define QWEN_SIGNPOST_ENCODE     1
+#define QWEN_SIGNPOST_PREFILL    2
+void qwen_signpost_begin(const qwen_ctx_t *ctx, int kind);
+void qwen_signpost_end(const qwen_ctx_t *ctx, int kind);
+
+/* Per-layer wall time into ms[layer] (first QWEN_PERF_MAX_LAYERS layers) */
+#if QWEN_PROFILE
+#define QWEN_PERF_LAYER_BEGIN() double perf_layer_t0_ = qwen_perf_now_ms()
+#define QWEN_PERF_LAYER_END(ms, layer) do { \
+    if ((layer) < QWEN_PERF_MAX_LAYERS) \
+        (ms)[layer] += qwen_perf_now_ms() - perf_layer_t0_; \
+} while (0)
+#else
+#define QWEN_PERF_LAYER_BEGIN() ((void)0)
+#define QWEN_PERF_LAYER_END(ms, layer) ((void)0)
+#endif
+
+#endif /* QWEN_ASR_PERF_H */
@@ -0,0 +1,239 @@
+/*
+ * qwen_asr_residency.c - Page residency hints for mapped weights
+ *
+ * Matrices that live in a file mapping (bf16 safetensors, or everything in
+ * a compiled model) are paged in on first touch and can be dropped by the
+ * OS at any time. This file tells the kernel what comes next:
+ *
+ *   - MADV_WILLNEED for layer i+1 while layer i computes, so a cold pass
+ *     overlaps disk reads with math instead of faulting serially.
+ *   - MADV_DONTNEED for the encoder after encoding in low-memory mode.
+ *   - qwen_set_low_memory: drop every mapped weight page and the scratch,
+ *     KV and draft buffers that are rebuilt on demand, without a
+ *     qwen_free/qwen_load cycle.
+ *
+ * Heap-owned matrices (f32 encoder, int8/int4 quantized at load) are never
+ * advised: DONTNEED on anonymous memory would discard their contents.
+ */
+
+#include "qwen_asr.h"
+#include "qwen_asr_kernels.h"
+#include "qwen_asr_safetensors.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* ========================================================================
+ * Mapped Ranges
+ * ======================================================================== */
+
+/* 1 if [p, p+bytes) lies inside one of the context's file mappings */
+static int is_mapped(const qwen_ctx_t *ctx, const void *p, size_t bytes) {
+    const uint8_t *b = (const uint8_t *)p;
+    if (!b || bytes == 0) return 0;
+    const uint8_t *base = (const uint8_t *)ctx->compiled;
+    if (base && b >= base && b + bytes <= base + ctx->compiled_bytes) return 1;
+    const multi_safetensors_t *ms = (const multi_safetensors_t *)ctx->safetensors;
+    if (!ms) return 0;
+    for (int i = 0; i < ms->num_shards; i++) {
+        const safetensors_file_t *sf = ms->shards[i];
+        base = (const uint8_t *)sf->data;
+        if (base && b >= base && b + bytes <= base + sf->file_size) return 1;
+    }
+    return 0;
+}
+
+/* Advise the whole pages covering a mapped array; others are ignored. */
+static void advise_range(const qwen_ctx_t *ctx, const void *p, size_t bytes, int advice) {
+    if (!is_mapped(ctx, p, bytes)) return;
+    static size_t page = 0;
+    if (page == 0) page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)p & ~(uintptr_t)(page - 1);
+    uintptr_t end = ((uintptr_t)p + bytes + page - 1) & ~(uintptr_t)(page - 1);
+    /* Hints only: a failure just means the kernel ignored it */
+    (void)madvise((void *)start, end - start, advice);
+}
+
+static void advise_f32(const qwen_ctx_t *ctx, const float *p, size_t n, int advice) {
+    advise_range(ctx, p, n * sizeof(float), advice);
+}
+
+static void advise_weight(const qwen_ctx_t *ctx, const qwen_weight_t *w, int advice) {
+    size_t n = (size_t)w->out_dim * w->in_dim;
+    switch (w->format) {
+    case QWEN_WEIGHT_F32:
+        advise_f32(ctx, w->f32, n, advice);
+        break;
+    case QWEN_WEIGHT_BF16:
+        advise_range(ctx, w->bf16, n * sizeof(uint16_t), advice);
+        break;
+    case QWEN_WEIGHT_INT8:
+        advise_range(ctx, w->i8, n, advice);
+        advise_f32(ctx, w->scale, (size_t)w->out_dim, advice);
+        break;
+    case QWEN_WEIGHT_INT4:
+        advise_range(ctx, w->i4, n / 2, advice);
+        advise_f32(ctx, w->scale, n / QWEN_Q4_GROUP, advice);
+        break;
+    default:
+        break;
+    }
+}
+
+/* ========================================================================
+ * Decoder / Encoder Hints
+ * ======================================================================== */
+
+static void advise_dec_layer(const qwen_ctx_t *ctx, int layer, int advice) {
+    const qwen_dec_layer_t *l = &ctx->decoder.layers[layer];
+    advise_weight(ctx, &l->wq, advice);
+    advise_weight(ctx, &l->wk, advice);
+    advise_weight(ctx, &l->wv, advice);
+    advise_weight(ctx, &l->wo, advice);
+    advise_weight(ctx, &l->gate_up, advice);
+    advise_weight(ctx, &l->down, advice);
+}
+
+/* Layer dec_layers stands for the LM head, used after the last layer */
+void qwen_residency_prefetch_dec_layer(qwen_ctx_t *ctx, int layer) {
+    if (layer >= 0 && layer < ctx->config.dec_layers)
+        advise_dec_layer(ctx, layer, MADV_WILLNEED);
+    else if (layer == ctx->config.dec_layers)
+        advise_weight(ctx, &ctx->decoder.lm_head, MADV_WILLNEED);
+}
+
+static void advise_enc_layer(const qwen_ctx_t *ctx, int layer, int advice) {
+    const qwen_enc_layer_t *l = &ctx->encoder.layers[layer];
+    advise_weight(ctx, &l->wq_weight, advice);
+    advise_weight(ctx, &l->wk_weight, advice);
+    advise_weight(ctx, &l->wv_weight, advice);
+    advise_weight(ctx, &l->wo_weight, advice);
+    advise_weight(ctx, &l->fc1_weight, advice);
+    advise_weight(ctx, &l->fc2_weight, advice);
+}
+
+/* Layer enc_layers stands for the output projections */
+void qwen_residency_prefetch_enc_layer(qwen_ctx_t *ctx, int layer) {
+    if (layer >= 0 && layer < ctx->config.enc_layers) {
+        advise_enc_layer(ctx, layer, MADV_WILLNEED);
+    } else if (layer == ctx->config.enc_layers) {
+        advise_weight(ctx, &ctx->encoder.proj1_weight, MADV_WILLNEED);
+        advise_weight(ctx, &ctx->encoder.proj2_weight, MADV_WILLNEED);
+    }
+}
+
+static void advise_encoder(const qwen_ctx_t *ctx, int advice) {
+    const qwen_encoder_t *enc = &ctx->encoder;
+    const qwen_config_t *c = &ctx->config;
+    advise_weight(ctx, &enc->conv_out_weight, advice);
+    for (int i = 0; i < c->enc_layers; i++) advise_enc_layer(ctx, i, advice);
+    advise_weight(ctx, &enc->proj1_weight, advice);
+    advise_weight(ctx, &enc->proj2_weight, advice);
+    /* The conv stem is f32 and only mapped in a compiled model */
+    size_t conv = (size_t)QWEN_CONV_HIDDEN * QWEN_CONV_HIDDEN * QWEN_CONV_KERNEL * QWEN_CONV_KERNEL;
+    advise_f32(ctx, enc->conv2_weight, conv, advice);
+    advise_f32(ctx, enc->conv3_weight, conv, advice);
+}
+
+void qwen_residency_release_encoder(qwen_ctx_t *ctx) {
+    advise_encoder(ctx, MADV_DONTNEED);
+}
+
+/* ========================================================================
+ * Low-Memory Mode
+ * ======================================================================== */
+
+/* Free scratch that the forward passes regrow on demand. */
+static void trim_scratch(qwen_ctx_t *ctx) {
+    free(ctx->pref_x); free(ctx->pref_x_norm);
+    free(ctx->pref_q); free(ctx->pref_k); free(ctx->pref_v);
+    free(ctx->pref_attn_out); free(ctx->pref_proj_out); free(ctx->pref_ffn_out);
+    free(ctx->pref_gate); free(ctx->pref_gate_up);
+    ctx->pref_x = ctx->pref_x_norm = ctx->pref_q = ctx->pref_k = ctx->pref_v = NULL;
+    ctx->pref_attn_out = ctx->pref_proj_out = ctx->pref_ffn_out = NULL;
+    ctx->pref_gate = ctx->pref_gate_up = NULL;
+    ctx->pref_seq_cap = 0;
+
+    free(ctx->bat_x); free(ctx->bat_x_norm);
+    free(ctx->bat_q); free(ctx->bat_k); free(ctx->bat_v);
+    free(ctx->bat_attn_out); free(ctx->bat_proj_out); free(ctx->bat_ffn_out);
+    free(ctx->bat_gate); free(ctx->bat_gate_up); free(ctx->bat_logits);
+    ctx->bat_x = ctx->bat_x_norm = ctx->bat_q = ctx->bat_k = ctx->bat_v = NULL;
+    ctx->bat_attn_out = ctx->bat_proj_out = ctx->bat_ffn_out = NULL;
+    ctx->bat_gate = ctx->bat_gate_up = ctx->bat_logits = NULL;
+    ctx->bat_cap = 0;
+
+    free(ctx->enc_x); free(ctx->enc_x_norm);
+    free(ctx->enc_q); free(ctx->enc_k); free(ctx->enc_v);
+    free(ctx->enc_attn_out); free(ctx->enc_proj_out);
+    free(ctx->enc_ffn_mid); free(ctx->enc_ffn_out);
+    ctx->enc_x = ctx->enc_x_norm = ctx->enc_q = ctx->enc_k = ctx->enc_v = NULL;
+    ctx->enc_attn_out = ctx->enc_proj_out = ctx->enc_ffn_mid = ctx->enc_ffn_out = NULL;
+    ctx->enc_seq_cap = 0;
+
+    /* The conv stem buffers (im2col up to ENC_STEM_COLS_MAX) are rebuilt by
+     * ensure_enc_stem on the next encode */
+    free(ctx->enc_stem_mel); free(ctx->enc_stem_c1);
+    free(ctx->enc_stem_c2); free(ctx->enc_stem_c3);
+    free(ctx->enc_stem_cols); free(ctx->enc_stem_reshaped); free(ctx->enc_pe);
+    ctx->enc_stem_mel = ctx->enc_stem_c1 = ctx->enc_stem_c2 = ctx->enc_stem_c3 = NULL;
+    ctx->enc_stem_cols = ctx->enc_stem_reshaped = ctx->enc_pe = NULL;
+    ctx->enc_stem_bytes = 0;
+
+    qwen_scratch_release(&ctx->scratch);
+    qwen_scratch_release(&ctx->enc_scratch);
+
+    /* Keep the limit, drop the expansions */
+    if (ctx->bf16_cache) {
+        qwen_bf16_cache_stats_t st;
+        qwen_bf16_cache_stats(ctx->bf16_cache, &st);
+        qwen_bf16_cache_free(ctx->bf16_cache);
+        ctx->bf16_cache = qwen_bf16_cache_create(st.limit_bytes);
+    }
+}
+
+/* Free decoder state the next call rebuilds: the KV pages (so the prompt
+ * prefix is prefilled again) and the LM-head draft. An open streaming
+ * session still needs both. */
+static void trim_decoder_state(qwen_ctx_t *ctx) {
+    if (ctx->stream_sessions > 0) return;
+    qwen_kv_cache_free(&ctx->kv_cache);
+    memset(&ctx->kv_cache, 0, sizeof(ctx->kv_cache));
+    ctx->kv_cache_len = 0;
+    ctx->kv_cache_max = 0;
+    ctx->kv_prompt_len = 0;
+
+    if (ctx->lm_draft_shared) {
+        memset(&ctx->lm_draft, 0, sizeof(ctx->lm_draft));
+        ctx->lm_draft_shared = 0;
+    } else {
+        qwen_weight_free(&ctx->lm_draft);
+        free(ctx->lm_vocab);
+    }
+    ctx->lm_vocab = NULL;
+    free(ctx->lm_vocab_lang);
+    ctx->lm_vocab_lang = NULL;
+    ctx->lm_vocab_ready = 0;
+}
+
+int qwen_set_low_memory(qwen_ctx_t *ctx, int enabled) {
+    if (!ctx) return -1;
+    ctx->low_memory = enabled ? 1 : 0;
+    if (!enabled) return 0;
+
+    trim_scratch(ctx);
+    trim_decoder_state(ctx);
+    advise_encoder(ctx, MADV_DONTNEED);
+    for (int i = 0; i < ctx->config.dec_layers; i++)
+        advise_dec_layer(ctx, i, MADV_DONTNEED);
+    advise_weight(ctx, &ctx->decoder.lm_head, MADV_DONTNEED);
+    advise_range(ctx, ctx->decoder.tok_embeddings_bf16,
+                 (size_t)ctx->config.vocab_size * ctx->config.dec_hidden * sizeof(uint16_t),
+                 MADV_DONTNEED);
+    /* The next decoder pass starts cold and prefetches ahead */
+    ctx->weights_cold = 1;
+    if (qwen_verbose >= 1) fprintf(stderr, "Low-memory mode: mapped weights and scratch released\n");
+    return 0;
+}
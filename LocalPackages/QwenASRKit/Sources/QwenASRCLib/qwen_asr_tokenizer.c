@@ -4,6 +4,7 @@
  * Supports:
  *   - decode token IDs to UTF-8 text (for ASR output assembly)
  *   - encode UTF-8 text to token IDs using vocab.json + merges.txt
+ *   - tokenizer.bin: the parsed tables, mmap'd on later loads
  */
 
 #include "qwen_asr_tokenizer.h"
@@ -13,6 +14,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* ========================================================================
  * GPT-2 Bytes-to-Unicode Mapping
@@ -239,6 +244,208 @@ static int map_get(const str_int_entry_t *map, int cap, const char *key) {
     return -1;
 }
 
+/* ========================================================================
+ * Precompiled Blob (tokenizer.bin)
+ *
+ * [header] [text_off: u32 x vocab] [bpe_off: u32 x vocab]
+ * [vocab map: entry x vocab_map_cap] [merge map: entry x merge_map_cap]
+ * [strings]
+ *
+ * The maps are the in-memory maps slot for slot (same hash and probing)
+ * with keys stored as string pool offsets, so lookups run on the mapping
+ * directly. The header records the sizes and mtimes of vocab.json and
+ * merges.txt so a stale blob is rejected without reading either.
+ * ======================================================================== */
+
+#define TOK_BLOB_MAGIC   0x4b4f5451u /* "QTOK" */
+#define TOK_BLOB_VERSION 1
+#define TOK_BLOB_NONE    UINT32_MAX
+
+typedef struct {
+    uint32_t magic, version;
+    uint32_t vocab_size, vocab_map_cap, merge_map_cap, strings_size;
+    uint64_t vocab_bytes, merges_bytes;
+    int64_t vocab_mtime, merges_mtime;
+} tok_blob_header_t;
+
+typedef struct {
+    uint32_t key;   /* string pool offset, TOK_BLOB_NONE for an empty slot */
+    int32_t value;
+} blob_entry_t;
+
+typedef struct {
+    uint64_t vocab_bytes, merges_bytes;
+    int64_t vocab_mtime, merges_mtime;
+} tok_sources_t;
+
+static size_t blob_strings_offset(const tok_blob_header_t *h) {
+    return sizeof(tok_blob_header_t) +
+           (size_t)h->vocab_size * 2 * sizeof(uint32_t) +
+           ((size_t)h->vocab_map_cap + h->merge_map_cap) * sizeof(blob_entry_t);
+}
+
+static const uint32_t *blob_text_off(const qwen_tokenizer_t *tok) {
+    return (const uint32_t *)((const tok_blob_header_t *)tok->blob + 1);
+}
+
+static const char *blob_str(const qwen_tokenizer_t *tok, uint32_t off) {
+    const tok_blob_header_t *h = (const tok_blob_header_t *)tok->blob;
+    if (off >= h->strings_size) return NULL;
+    return (const char *)tok->blob + blob_strings_offset(h) + off;
+}
+
+static int blob_map_get(const qwen_tokenizer_t *tok, const blob_entry_t *map, int cap,
+                        const char *key) {
+    if (!map || cap <= 0 || !key) return -1;
+    int mask = cap - 1;
+    int pos = (int)(fnv1a_hash(key) & (uint64_t)mask);
+    for (int i = 0; i < cap; i++) {
+        int idx = (pos + i) & mask;
+        if (map[idx].key == TOK_BLOB_NONE) return -1;
+        const char *k = blob_str(tok, map[idx].key);
+        if (k && strcmp(k, key) == 0) return map[idx].value;
+    }
+    return -1;
+}
+
+/* Lookups that work on both the parsed and the mmap'd tables. */
+static int vocab_lookup(const qwen_tokenizer_t *tok, const char *key) {
+    if (tok->blob)
+        return blob_map_get(tok, (const blob_entry_t *)tok->vocab_map, tok->vocab_map_cap, key);
+    return map_get((const str_int_entry_t *)tok->vocab_map, tok->vocab_map_cap, key);
+}
+
+static int merge_lookup(const qwen_tokenizer_t *tok, const char *key) {
+    if (tok->blob)
+        return blob_map_get(tok, (const blob_entry_t *)tok->merge_map, tok->merge_map_cap, key);
+    return map_get((const str_int_entry_t *)tok->merge_map, tok->merge_map_cap, key);
+}
+
+static int stat_sources(const char *vocab_path, const char *merges_path, tok_sources_t *src) {
+    struct stat st;
+    memset(src, 0, sizeof(*src));
+    if (stat(vocab_path, &st) != 0) return -1;
+    src->vocab_bytes = (uint64_t)st.st_size;
+    src->vocab_mtime = (int64_t)st.st_mtime;
+    if (stat(merges_path, &st) == 0) {
+        src->merges_bytes = (uint64_t)st.st_size;
+        src->merges_mtime = (int64_t)st.st_mtime;
+    }
+    return 0;
+}
+
+static qwen_tokenizer_t *load_blob(const char *path, const tok_sources_t *src) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) { close(fd); return NULL; }
+    size_t file_size = (size_t)st.st_size;
+    if (file_size < sizeof(tok_blob_header_t)) { close(fd); return NULL; }
+
+    void *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    const tok_blob_header_t *h = (const tok_blob_header_t *)data;
+    if (h->magic != TOK_BLOB_MAGIC || h->version != TOK_BLOB_VERSION ||
+        h->vocab_bytes != src->vocab_bytes || h->vocab_mtime != src->vocab_mtime ||
+        h->merges_bytes != src->merges_bytes || h->merges_mtime != src->merges_mtime ||
+        h->vocab_size == 0 || h->vocab_size > INT_MAX / 2 ||
+        h->vocab_map_cap > INT_MAX / 2 || h->merge_map_cap > INT_MAX / 2 ||
+        h->strings_size == 0 || blob_strings_offset(h) + h->strings_size != file_size ||
+        ((const char *)data)[file_size - 1] != '\0') {
+        munmap(data, file_size);
+        return NULL;
+    }
+
+    qwen_tokenizer_t *tok = (qwen_tokenizer_t *)calloc(1, sizeof(qwen_tokenizer_t));
+    if (!tok) { munmap(data, file_size); return NULL; }
+    tok->blob = data;
+    tok->blob_size = file_size;
+    tok->vocab_size = (int)h->vocab_size;
+    /* Skip text_off and bpe_off */
+    tok->vocab_map = (void *)(blob_text_off(tok) + 2 * (size_t)h->vocab_size);
+    tok->vocab_map_cap = (int)h->vocab_map_cap;
+    tok->merge_map = h->merge_map_cap > 0
+                         ? (void *)((blob_entry_t *)tok->vocab_map + h->vocab_map_cap) : NULL;
+    tok->merge_map_cap = (int)h->merge_map_cap;
+    return tok;
+}
+
+static uint32_t pool_add(char *pool, uint32_t *used, const char *str) {
+    size_t n = strlen(str) + 1;
+    uint32_t off = *used;
+    memcpy(pool + off, str, n);
+    *used += (uint32_t)n;
+    return off;
+}
+
+/* Write the parsed tables to path (via a temp file and rename). */
+static int save_blob(const qwen_tokenizer_t *tok, const char *path, const tok_sources_t *src) {
+    const str_int_entry_t *vmap = (const str_int_entry_t *)tok->vocab_map;
+    const str_int_entry_t *mrg = (const str_int_entry_t *)tok->merge_map;
+
+    size_t strings_size = 0;
+    for (int i = 0; i < tok->vocab_size; i++) {
+        if (tok->id_to_text[i]) strings_size += strlen(tok->id_to_text[i]) + 1;
+        if (tok->id_to_bpe[i]) strings_size += strlen(tok->id_to_bpe[i]) + 1;
+    }
+    for (int i = 0; i < tok->merge_map_cap; i++)
+        if (mrg[i].key) strings_size += strlen(mrg[i].key) + 1;
+    if (strings_size == 0 || strings_size >= TOK_BLOB_NONE) return -1;
+
+    tok_blob_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = TOK_BLOB_MAGIC;
+    h.version = TOK_BLOB_VERSION;
+    h.vocab_size = (uint32_t)tok->vocab_size;
+    h.vocab_map_cap = (uint32_t)tok->vocab_map_cap;
+    h.merge_map_cap = (uint32_t)tok->merge_map_cap;
+    h.strings_size = (uint32_t)strings_size;
+    h.vocab_bytes = src->vocab_bytes;
+    h.vocab_mtime = src->vocab_mtime;
+    h.merges_bytes = src->merges_bytes;
+    h.merges_mtime = src->merges_mtime;
+
+    size_t total = blob_strings_offset(&h) + strings_size;
+    char *buf = (char *)calloc(1, total);
+    if (!buf) return -1;
+    memcpy(buf, &h, sizeof(h));
+    uint32_t *text_off = (uint32_t *)(buf + sizeof(h));
+    uint32_t *bpe_off = text_off + tok->vocab_size;
+    blob_entry_t *bvmap = (blob_entry_t *)(bpe_off + tok->vocab_size);
+    blob_entry_t *bmmap = bvmap + tok->vocab_map_cap;
+    char *pool = buf + blob_strings_offset(&h);
+    uint32_t used = 0;
+
+    for (int i = 0; i < tok->vocab_size; i++) {
+        text_off[i] = tok->id_to_text[i] ? pool_add(pool, &used, tok->id_to_text[i]) : TOK_BLOB_NONE;
+        bpe_off[i] = tok->id_to_bpe[i] ? pool_add(pool, &used, tok->id_to_bpe[i]) : TOK_BLOB_NONE;
+    }
+    /* Vocab keys are the id_to_bpe strings themselves. */
+    for (int i = 0; i < tok->vocab_map_cap; i++) {
+        bvmap[i].key = vmap[i].key ? bpe_off[vmap[i].value] : TOK_BLOB_NONE;
+        bvmap[i].value = vmap[i].key ? vmap[i].value : -1;
+    }
+    for (int i = 0; i < tok->merge_map_cap; i++) {
+        bmmap[i].key = mrg[i].key ? pool_add(pool, &used, mrg[i].key) : TOK_BLOB_NONE;
+        bmmap[i].value = mrg[i].key ? mrg[i].value : -1;
+    }
+
+    char tmp_path[1100];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    int rc = -1;
+    if (f) {
+        int ok = fwrite(buf, 1, total, f) == total;
+        if (fclose(f) == 0 && ok && rename(tmp_path, path) == 0) rc = 0;
+        else remove(tmp_path);
+    }
+    free(buf);
+    return rc;
+}
+
 /* ========================================================================
  * BPE helpers
  * ======================================================================== */
@@ -308,7 +515,7 @@ static int merge_rank(const qwen_tokenizer_t *tok, const char *a, const char *b)
     memcpy(pair + la + 1, b, lb);
     pair[la + 1 + lb] = '\0';
 
-    int rank = map_get((const str_int_entry_t *)tok->merge_map, tok->merge_map_cap, pair);
+    int rank = merge_lookup(tok, pair);
     free(pair);
     return rank >= 0 ? rank : INT_MAX;
 }
@@ -386,7 +593,7 @@ static int encode_bpe_word(const qwen_tokenizer_t *tok, const char *mapped, int
     int *ids = NULL;
     int n_ids = 0, cap = 0;
     for (int i = 0; i < n_syms; i++) {
-        int id = map_get((const str_int_entry_t *)tok->vocab_map, tok->vocab_map_cap, syms[i]);
+        int id = vocab_lookup(tok, syms[i]);
         if (id < 0) {
             /* Should not happen with valid vocab + merges + byte-level mapping. */
             for (int k = 0; k < n_syms; k++) free(syms[k]);
@@ -410,17 +617,19 @@ static int encode_bpe_word(const qwen_tokenizer_t *tok, const char *mapped, int
     return 0;
 }
 
-static int derive_merges_path(const char *vocab_path, char *out_path, size_t out_cap) {
+/* Path of `name` in the directory of vocab_path. */
+static int derive_sibling_path(const char *vocab_path, const char *name,
+                               char *out_path, size_t out_cap) {
     const char *slash = strrchr(vocab_path, '/');
     if (!slash) {
-        if (snprintf(out_path, out_cap, "merges.txt") >= (int)out_cap) return -1;
+        if (snprintf(out_path, out_cap, "%s", name) >= (int)out_cap) return -1;
         return 0;
     }
     size_t dir_len = (size_t)(slash - vocab_path);
-    if (dir_len + 12 >= out_cap) return -1;
+    if (dir_len + strlen(name) + 2 > out_cap) return -1;
     memcpy(out_path, vocab_path, dir_len);
     out_path[dir_len] = '\0';
-    snprintf(out_path + dir_len, out_cap - dir_len, "/merges.txt");
+    snprintf(out_path + dir_len, out_cap - dir_len, "/%s", name);
     return 0;
 }
 
@@ -497,7 +706,7 @@ static int load_merges_map(qwen_tokenizer_t *tok, const char *merges_path) {
  * Public API
  * ======================================================================== */
 
-qwen_tokenizer_t *qwen_tokenizer_load(const char *vocab_json_path) {
+static qwen_tokenizer_t *load_json(const char *vocab_json_path, const char *merges_path) {
     FILE *f = fopen(vocab_json_path, "rb");
     if (!f) {
         fprintf(stderr, "qwen_tokenizer_load: cannot open %s\n", vocab_json_path);
@@ -592,19 +801,49 @@ qwen_tokenizer_t *qwen_tokenizer_load(const char *vocab_json_path) {
         }
     }
 
-    char merges_path[1024];
-    if (derive_merges_path(vocab_json_path, merges_path, sizeof(merges_path)) == 0) {
-        if (load_merges_map(tok, merges_path) != 0 && qwen_verbose >= 2) {
-            fprintf(stderr, "Tokenizer: merges not loaded from %s (encoding falls back to byte-level)\n",
-                    merges_path);
+    if (merges_path && load_merges_map(tok, merges_path) != 0 && qwen_verbose >= 2) {
+        fprintf(stderr, "Tokenizer: merges not loaded from %s (encoding falls back to byte-level)\n",
+                merges_path);
+    }
+
+    return tok;
+}
+
+qwen_tokenizer_t *qwen_tokenizer_load(const char *vocab_json_path) {
+    char merges_path[1024], blob_path[1024];
+    int have_merges = derive_sibling_path(vocab_json_path, "merges.txt",
+                                          merges_path, sizeof(merges_path)) == 0;
+    const char *env = getenv("QWEN_TOKENIZER_BLOB");
+    int use_blob = have_merges && !(env && strcmp(env, "0") == 0) &&
+                   derive_sibling_path(vocab_json_path, "tokenizer.bin",
+                                       blob_path, sizeof(blob_path)) == 0;
+
+    tok_sources_t src;
+    if (use_blob && stat_sources(vocab_json_path, merges_path, &src) != 0) use_blob = 0;
+    if (use_blob) {
+        qwen_tokenizer_t *tok = load_blob(blob_path, &src);
+        if (tok) {
+            if (qwen_verbose >= 2)
+                fprintf(stderr, "Tokenizer: mapped %s (%d tokens)\n", blob_path, tok->vocab_size);
+            return tok;
         }
     }
 
+    qwen_tokenizer_t *tok = load_json(vocab_json_path, have_merges ? merges_path : NULL);
+    if (tok && use_blob) {
+        int rc = save_blob(tok, blob_path, &src);
+        if (qwen_verbose >= 2)
+            fprintf(stderr, "Tokenizer: %s %s\n", rc == 0 ? "wrote" : "could not write", blob_path);
+    }
     return tok;
 }
 
 const char *qwen_tokenizer_decode(const qwen_tokenizer_t *tok, int token_id) {
     if (!tok || token_id < 0 || token_id >= tok->vocab_size) return "";
+    if (tok->blob) {
+        const char *text = blob_str(tok, blob_text_off(tok)[token_id]);
+        return text ? text : "";
+    }
     return tok->id_to_text[token_id] ? tok->id_to_text[token_id] : "";
 }
 
@@ -630,6 +869,12 @@ int *qwen_tokenizer_encode(const qwen_tokenizer_t *tok, const char *text, int *o
 
 void qwen_tokenizer_free(qwen_tokenizer_t *tok) {
     if (!tok) return;
+    if (tok->blob) {
+        /* All tables live in the mapping */
+        munmap(tok->blob, tok->blob_size);
+        free(tok);
+        return;
+    }
 
     if (tok->id_to_text) {
         for (int i = 0; i < tok->vocab_size; i++) free(tok->id_to_text[i]);
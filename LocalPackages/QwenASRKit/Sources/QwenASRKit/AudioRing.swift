@@ -0,0 +1,65 @@
+import Foundation
+import QwenASRCLib
+
+/// Lock-free single-producer/single-consumer ring of Float32 samples,
+/// backed by the C capture ring so streaming sessions can read it in place.
+///
+/// One thread may write (e.g. an audio tap) and one may read at a time.
+/// Storage is allocated once; a full ring drops the newest samples and
+/// counts them in `overruns` rather than blocking or allocating.
+public final class AudioRing: @unchecked Sendable {
+    let ring: OpaquePointer
+
+    /// Capacity is rounded up to a power of two. Returns nil on allocation failure.
+    public init?(capacity: Int) {
+        guard capacity > 0, capacity <= Int(Int32.max),
+              let r = qwen_audio_ring_create(Int32(capacity)) else { return nil }
+        ring = r
+    }
+
+    deinit {
+        qwen_audio_ring_free(ring)
+    }
+
+    public var capacity: Int { Int(qwen_audio_ring_capacity(ring)) }
+
+    /// Unread samples. Exact on the consumer side; on the producer side it
+    /// may overstate but never understate, so `capacity - available` is
+    /// space a write is sure to fit in.
+    public var available: Int { Int(qwen_audio_ring_available(ring)) }
+
+    /// Samples dropped because the ring was full.
+    public var overruns: Int64 { qwen_audio_ring_overruns(ring) }
+
+    /// Samples ever written.
+    public var written: Int64 { qwen_audio_ring_written(ring) }
+
+    /// Producer: copy samples in. Returns the count written.
+    @discardableResult
+    public func write(_ samples: UnsafeBufferPointer<Float>) -> Int {
+        guard let base = samples.baseAddress, !samples.isEmpty else { return 0 }
+        return Int(qwen_audio_ring_write(ring, base, Int32(samples.count)))
+    }
+
+    /// Consumer: pass the unread samples to `body` in order, as at most two
+    /// contiguous spans valid only during the call, then mark them read.
+    /// Returns the count read.
+    @discardableResult
+    public func read(_ body: (UnsafeBufferPointer<Float>) -> Void) -> Int {
+        var p1: UnsafePointer<Float>?
+        var p2: UnsafePointer<Float>?
+        var n1: Int32 = 0
+        var n2: Int32 = 0
+        let n = qwen_audio_ring_read_regions(ring, &p1, &n1, &p2, &n2)
+        guard n > 0 else { return 0 }
+        if let p1 { body(UnsafeBufferPointer(start: p1, count: Int(n1))) }
+        if let p2 { body(UnsafeBufferPointer(start: p2, count: Int(n2))) }
+        qwen_audio_ring_consume(ring, n)
+        return Int(n)
+    }
+
+    /// Consumer: discard everything unread.
+    public func clear() {
+        qwen_audio_ring_clear(ring)
+    }
+}
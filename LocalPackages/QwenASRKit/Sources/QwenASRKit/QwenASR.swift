@@ -4,15 +4,88 @@ import QwenASRCLib
 /// Thread-safe Swift wrapper around the qwen-asr C library.
 public final class QwenASR: @unchecked Sendable {
     private var ctx: UnsafeMutablePointer<qwen_ctx_t>?
+    private var stream: OpaquePointer?
     private let lock = NSLock()
 
+    /// Storage format for encoder matrices, fixed at load time.
+    public enum EncoderWeights: Int32, Sendable {
+        /// bf16 expanded to float32 at load (fastest, largest).
+        case f32 = 0
+        /// mmap'd bf16, expanded per tile during the encoder GEMMs.
+        case bf16 = 1
+        /// Per-row int8 quantized at load (smallest resident size).
+        case int8 = 2
+    }
+
+    /// Storage format for decoder matrices and the tied LM head, fixed at load time.
+    public enum DecoderWeights: Int32, Sendable {
+        /// mmap'd bf16 (2 bytes per weight per token).
+        case bf16 = 1
+        /// Per-row int8 quantized at load (~1 byte per weight).
+        case int8 = 2
+        /// Group-wise int4 quantized at load (~0.6 bytes per weight).
+        case int4 = 3
+    }
+
+    /// How each token is picked from the tied LM head.
+    public enum LMHeadMode: Int32, Sendable {
+        /// Exact argmax over the whole vocabulary.
+        case full = 0
+        /// int4 first pass over the forced language's vocabulary, exact re-score of the top-k.
+        case fast = 1
+        /// Runs both, emits the full result and counts disagreements.
+        case check = 2
+    }
+
+    /// Scheduling class for this instance's worker threads.
+    public enum ThreadQoS: Int32, Sendable {
+        /// Inherit the class of the creating thread.
+        case `default` = 0
+        /// User-interactive; favours performance cores.
+        case performance = 1
+        /// Utility; favours efficiency cores, and idle workers park at once.
+        case efficiency = 2
+    }
+
+    /// Storage for the decoder's KV cache; smaller formats trade a little
+    /// attention precision for memory on long segments.
+    public enum KVCacheFormat: Int32, Sendable {
+        /// float32 (exact).
+        case f32 = 0
+        /// Half precision (half the memory).
+        case fp16 = 1
+        /// int8 with a scale per head and position (a quarter of the memory).
+        case int8 = 2
+    }
+
     /// Load a Qwen ASR model from a directory containing config.json, model.safetensors, vocab.json, merges.txt.
+    /// A positive `encoderThreads` encodes the next segment on its own pool of
+    /// that size while `threads` decode the current one.
+    /// Options left nil keep the library's choice: `QWEN_ENC_WEIGHTS`,
+    /// `QWEN_DEC_WEIGHTS`, `QWEN_KV_CACHE` and `QWEN_PIPELINE_ENC_THREADS`
+    /// when set, otherwise f32 / bf16 / f32 / no pipeline.
     /// Returns nil if model loading fails.
-    public init?(modelDir: String) {
-        let threads = Int32(Self.recommendedThreads())
-        qwen_set_threads(threads)
+    public init?(modelDir: String, encoderWeights: EncoderWeights? = nil,
+                 decoderWeights: DecoderWeights? = nil,
+                 threads: Int? = nil, threadQoS: ThreadQoS = .default,
+                 kvCache: KVCacheFormat? = nil, encoderThreads: Int? = nil) {
         qwen_verbose = 0 // Suppress stderr logging on mobile
+        qwen_set_encoder_weight_format(encoderWeights?.rawValue ?? -1)
+        qwen_set_decoder_weight_format(decoderWeights?.rawValue ?? -1)
         guard let c = qwen_load(modelDir) else { return nil }
+        // Own worker pool, so several instances can transcribe concurrently
+        let poolThreads = Int32(threads ?? Self.recommendedThreads())
+        var failed = qwen_ctx_set_threads(c, poolThreads, threadQoS.rawValue) != 0
+        if !failed, let encoderThreads {
+            failed = qwen_ctx_set_pipeline(c, Int32(encoderThreads), threadQoS.rawValue) != 0
+        }
+        if !failed, let kvCache {
+            failed = qwen_ctx_set_kv_cache_format(c, kvCache.rawValue) != 0
+        }
+        if failed {
+            qwen_free(c)
+            return nil
+        }
         // Configure for segmented offline mode (bounded memory)
         c.pointee.segment_sec = 20.0
         c.pointee.search_sec = 3.0
@@ -21,17 +94,20 @@ public final class QwenASR: @unchecked Sendable {
 
     deinit {
         lock.lock()
+        if let s = stream { qwen_stream_close(s) }
+        stream = nil
         if let c = ctx { qwen_free(c) }
         ctx = nil
         lock.unlock()
     }
 
     /// Transcribe Float32 audio samples (16kHz mono, range [-1, 1]).
-    /// Returns transcribed text, or nil on failure.
+    /// Returns transcribed text, or nil on failure or while a streaming
+    /// session is open (it owns the decoder state until finished).
     public func transcribe(samples: [Float]) -> String? {
         lock.lock()
         defer { lock.unlock() }
-        guard let c = ctx else { return nil }
+        guard let c = ctx, stream == nil else { return nil }
         let result = samples.withUnsafeBufferPointer { buf in
             qwen_transcribe_audio(c, buf.baseAddress, Int32(buf.count))
         }
@@ -41,16 +117,159 @@ public final class QwenASR: @unchecked Sendable {
         return text
     }
 
+    /// Transcribe several recordings (16kHz mono Float32) on `workers`
+    /// contexts sharing this instance's weights, each on its own pool of
+    /// `threadsPerWorker` threads (nil splits the cores between them).
+    /// Segments of all files are load-balanced across the workers.
+    /// Returns one text per recording, nil where it failed; all nil while a
+    /// streaming session is open.
+    public func transcribeBatch(_ recordings: [[Float]], workers: Int,
+                                threadsPerWorker: Int? = nil) -> [String?] {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx, stream == nil, !recordings.isEmpty else { return recordings.map { _ in nil } }
+        var counts = recordings.map { Int32($0.count) }
+        var texts = [UnsafeMutablePointer<CChar>?](repeating: nil, count: recordings.count)
+        Self.withPinnedSamples(recordings) { pointers in
+            var pointers = pointers
+            _ = qwen_transcribe_batch(c, &pointers, &counts, Int32(recordings.count),
+                                      Int32(workers), Int32(threadsPerWorker ?? 0), &texts)
+        }
+        return texts.map { t in
+            guard let t else { return nil }
+            defer { free(t) }
+            return String(cString: t)
+        }
+    }
+
+    /// Call `body` with the base address of every recording, pinned by one
+    /// nested withUnsafeBufferPointer per recording instead of copied. Empty
+    /// recordings get a one-sample buffer so no pointer is nil.
+    private static func withPinnedSamples<R>(_ recordings: [[Float]], from index: Int = 0,
+                                             pinned: [UnsafePointer<Float>?] = [],
+                                             _ body: ([UnsafePointer<Float>?]) -> R) -> R {
+        guard index < recordings.count else { return body(pinned) }
+        let samples = recordings[index].isEmpty ? [0] : recordings[index]
+        return samples.withUnsafeBufferPointer { buf in
+            withPinnedSamples(recordings, from: index + 1, pinned: pinned + [buf.baseAddress], body)
+        }
+    }
+
+    /// Start an incremental streaming session, closing any previous one.
+    /// A positive `horizonSeconds` bounds the audio the decoder attends to:
+    /// older audio is replaced by the last committed text, so latency and
+    /// memory stay flat in long sessions. With `skipSilence` (opt-in),
+    /// silent chunks after the first are dropped before the encoder, so
+    /// pauses cost almost no CPU. With `speculative` (the default), each
+    /// chunk checks the previous hypothesis in one decoder pass instead of
+    /// regenerating it token by token; the tokens are the same either way.
+    /// Returns false if the session could not be opened.
+    public func startStream(horizonSeconds: Float = 0, skipSilence: Bool = false,
+                            speculative: Bool = true) -> Bool {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx else { return false }
+        if let s = stream { qwen_stream_close(s) }
+        c.pointee.stream_horizon_sec = horizonSeconds
+        c.pointee.stream_vad_gate = skipSilence ? 1 : 0
+        c.pointee.stream_speculative = speculative ? 1 : 0
+        stream = qwen_stream_open(c)
+        return stream != nil
+    }
+
+    /// Append Float32 audio (16kHz mono) to the open session.
+    /// Only the new audio is processed; returns the text committed since the
+    /// previous call ("" if none), or nil on failure.
+    public func pushStream(samples: [Float]) -> String? {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let s = stream else { return nil }
+        let rc = samples.withUnsafeBufferPointer { buf in
+            qwen_stream_push(s, buf.baseAddress, Int32(buf.count))
+        }
+        guard rc == 0 else { return nil }
+        return Self.pollStream(s)
+    }
+
+    /// Append everything unread in `ring` to the open session, reading it in
+    /// place; this caller becomes the ring's consumer. Returns the text
+    /// committed since the previous call ("" if none), or nil on failure.
+    public func pushStream(ring: AudioRing) -> String? {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let s = stream else { return nil }
+        guard qwen_stream_push_ring(s, ring.ring) >= 0 else { return nil }
+        return Self.pollStream(s)
+    }
+
+    /// Flush the open session and close it. Returns the remaining committed
+    /// text, or nil on failure or if no session is open.
+    public func finishStream() -> String? {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let s = stream else { return nil }
+        stream = nil
+        defer { qwen_stream_close(s) }
+        guard qwen_stream_finish(s) == 0 else { return nil }
+        return Self.pollStream(s)
+    }
+
+    /// Whether a streaming session is open. Offline transcription and
+    /// language or LM-head changes are refused until it is finished.
+    public var isStreamOpen: Bool {
+        lock.lock()
+        defer { lock.unlock() }
+        return stream != nil
+    }
+
+    private static func pollStream(_ s: OpaquePointer) -> String? {
+        guard let result = qwen_stream_poll(s) else { return nil }
+        let text = String(cString: result)
+        free(result)
+        return text
+    }
+
     /// Set forced language (e.g. "English", "Japanese"). Pass nil for auto-detect.
-    public func setLanguage(_ language: String?) {
+    /// Returns false while a streaming session is open or on failure.
+    @discardableResult
+    public func setLanguage(_ language: String?) -> Bool {
         lock.lock()
         defer { lock.unlock() }
-        guard let c = ctx else { return }
+        guard let c = ctx, stream == nil else { return false }
         if let lang = language {
-            qwen_set_force_language(c, lang)
-        } else {
-            qwen_set_force_language(c, nil)
+            return qwen_set_force_language(c, lang) == 0
         }
+        return qwen_set_force_language(c, nil) == 0
+    }
+
+    /// Select the LM-head mode. Pass topK <= 0 to keep the current candidate count.
+    /// Returns false while a streaming session is open or on failure.
+    @discardableResult
+    public func setLMHeadMode(_ mode: LMHeadMode, topK: Int = 0) -> Bool {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx, stream == nil else { return false }
+        return qwen_set_lm_head_mode(c, mode.rawValue, Int32(topK)) == 0
+    }
+
+    /// Decode up to `count` independent segments together in offline
+    /// transcription, sharing each weight pass. 1 decodes them one by one.
+    /// Ignored while past-text conditioning is enabled.
+    public func setDecodeBatch(_ count: Int) {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx else { return }
+        c.pointee.decode_batch = Int32(max(1, min(count, Int(QWEN_DECODE_BATCH_MAX))))
+    }
+
+    /// Cut offline audio into segments of about `seconds` at the quietest
+    /// point within `searchSeconds`; 0 decodes it in one pass.
+    public func setSegmentation(seconds: Float, searchSeconds: Float = 3) {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx else { return }
+        c.pointee.segment_sec = max(seconds, 0)
+        c.pointee.search_sec = max(searchSeconds, 0)
     }
 
     /// Performance stats from last transcription.
@@ -61,14 +280,218 @@ public final class QwenASR: @unchecked Sendable {
         return (c.pointee.perf_total_ms, Int(c.pointee.perf_text_tokens), c.pointee.perf_audio_ms)
     }
 
+    /// Stage, decode-step, kernel, per-layer and memory figures of one run
+    /// (see qwen_get_perf_report). Kernel and layer figures are zero in
+    /// builds with QWEN_PROFILE=0.
+    public struct PerformanceReport: Sendable {
+        /// Calls, wall time and streamed weight bytes of one kernel class.
+        public struct Kernel: Sendable {
+            public let calls: Int
+            public let ms: Double
+            public let weightBytes: Int
+        }
+
+        public let totalMs: Double
+        public let encodeMs: Double
+        public let prefillMs: Double
+        public let decodeMs: Double
+        public let audioMs: Double
+        /// Call start to the first generated token.
+        public let timeToFirstTokenMs: Double
+        public let realTimeFactor: Double
+        /// Share of encoder time hidden behind decoding (pipelined segments), 0...1.
+        public let pipelineOverlap: Double
+        public let textTokens: Int
+
+        public let decodeSteps: Int
+        public let stepMeanMs: Double
+        public let stepP50Ms: Double
+        public let stepP90Ms: Double
+        public let stepP99Ms: Double
+        public let stepMaxMs: Double
+        /// Decode steps per latency bin: < 1 ms, then [2^(i-1), 2^i) ms.
+        public let stepHistogram: [Int]
+
+        public let matvec: Kernel
+        public let matmul: Kernel
+        public let attention: Kernel
+        public let norm: Kernel
+        public let lmHead: Kernel
+        public let conv: Kernel
+        public let poolDispatches: Int
+        public let poolComputeMs: Double
+        public let poolWaitMs: Double
+        public let weightBytesPerStep: Double
+        public let weightGBPerSecond: Double
+
+        public let encoderLayerMs: [Double]
+        public let decoderLayerMs: [Double]
+
+        public let kvPeakBytes: Int
+        public let scratchPeakBytes: Int
+
+        /// One-line summary for logs.
+        public var summary: String {
+            String(format: "total %.0f ms (enc %.0f, prefill %.0f, dec %.0f), RTF %.2f, TTFT %.0f ms, overlap %.0f%%, "
+                   + "%d steps p50 %.1f / p90 %.1f / p99 %.1f ms, %.1f GB/s, KV %.1f MB, scratch %.1f MB",
+                   totalMs, encodeMs, prefillMs, decodeMs, realTimeFactor, timeToFirstTokenMs, pipelineOverlap * 100,
+                   decodeSteps, stepP50Ms, stepP90Ms, stepP99Ms, weightGBPerSecond,
+                   Double(kvPeakBytes) / 1_048_576, Double(scratchPeakBytes) / 1_048_576)
+        }
+
+        init(_ r: qwen_perf_report_t) {
+            func array<T, E>(_ tuple: T, count: Int, as _: E.Type) -> [E] {
+                withUnsafeBytes(of: tuple) { Array($0.bindMemory(to: E.self).prefix(count)) }
+            }
+            let kernels = array(r.kernel, count: Int(QWEN_PERF_KERNELS), as: qwen_perf_kernel_t.self)
+                .map { Kernel(calls: Int($0.calls), ms: $0.ms, weightBytes: Int($0.weight_bytes)) }
+            totalMs = r.total_ms
+            encodeMs = r.encode_ms
+            prefillMs = r.prefill_ms
+            decodeMs = r.decode_ms
+            audioMs = r.audio_ms
+            timeToFirstTokenMs = r.ttft_ms
+            realTimeFactor = r.rtf
+            pipelineOverlap = r.pipeline_overlap
+            textTokens = Int(r.text_tokens)
+            decodeSteps = Int(r.decode_steps)
+            stepMeanMs = r.step_mean_ms
+            stepP50Ms = r.step_p50_ms
+            stepP90Ms = r.step_p90_ms
+            stepP99Ms = r.step_p99_ms
+            stepMaxMs = r.step_max_ms
+            stepHistogram = array(r.step_hist, count: Int(QWEN_PERF_HIST_BINS), as: Int32.self).map(Int.init)
+            matvec = kernels[Int(QWEN_PERF_MATVEC)]
+            matmul = kernels[Int(QWEN_PERF_MATMUL)]
+            attention = kernels[Int(QWEN_PERF_ATTENTION)]
+            norm = kernels[Int(QWEN_PERF_NORM)]
+            lmHead = kernels[Int(QWEN_PERF_LM_HEAD)]
+            conv = kernels[Int(QWEN_PERF_CONV)]
+            poolDispatches = Int(r.pool_dispatches)
+            poolComputeMs = r.pool_compute_ms
+            poolWaitMs = r.pool_wait_ms
+            weightBytesPerStep = r.weight_bytes_per_step
+            weightGBPerSecond = r.weight_gb_per_s
+            encoderLayerMs = array(r.enc_layer_ms, count: Int(r.enc_layers), as: Double.self)
+            decoderLayerMs = array(r.dec_layer_ms, count: Int(r.dec_layers), as: Double.self)
+            kvPeakBytes = r.kv_peak_bytes
+            scratchPeakBytes = r.scratch_peak_bytes
+        }
+    }
+
+    /// Detailed report of the last transcription (streaming: since the
+    /// session opened), or nil without a model.
+    public var performanceReport: PerformanceReport? {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx else { return nil }
+        var report = qwen_perf_report_t()
+        guard qwen_get_perf_report(c, &report) == 0 else { return nil }
+        return PerformanceReport(report)
+    }
+
+    /// Toggle low-memory mode, e.g. from a memory-pressure source. Enabling
+    /// drops the pages of memory-mapped weights and regrowable scratch, and
+    /// the KV cache and LM-head draft unless a streaming session is open;
+    /// the model stays loaded and pages back in on the next call. Waits for
+    /// a running transcription to finish.
+    public func setLowMemory(_ enabled: Bool) {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx else { return }
+        qwen_set_low_memory(c, enabled ? 1 : 0)
+    }
+
+    /// Wall time of the model load and the resident memory it added.
+    public var loadPerformance: (ms: Double, residentBytes: Int) {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx else { return (0, 0) }
+        return (c.pointee.perf_load_ms, Int(c.pointee.load_resident_bytes))
+    }
+
+    /// Write the loaded weights, already converted to the selected formats,
+    /// next to the model so later loads with the same formats map them
+    /// instead of converting. Returns false if the file could not be written.
+    public func compileModel() -> Bool {
+        lock.lock()
+        defer { lock.unlock() }
+        guard let c = ctx else { return false }
+        return qwen_compile_model(c) == 0
+    }
+
     /// Release all resources. Safe to call multiple times.
     public func release() {
         lock.lock()
+        if let s = stream { qwen_stream_close(s) }
+        stream = nil
         if let c = ctx { qwen_free(c) }
         ctx = nil
         lock.unlock()
     }
 
+    /// Time the tiled encoder attention kernel against the serial reference
+    /// on random inputs (defaults: 1.7B geometry, four 8 s windows).
+    /// Returns nil on invalid arguments.
+    public static func benchmarkEncoderAttention(
+        heads: Int = 16, headDim: Int = 64, windowTokens: Int = 104, windows: Int = 4,
+        iterations: Int = 20, threads: Int? = nil
+    ) -> (tiledMs: Double, referenceMs: Double, maxDiff: Float)? {
+        let pool = qwen_threadpool_create(Int32(threads ?? recommendedThreads()),
+                                          ThreadQoS.default.rawValue)
+        let prev = qwen_threadpool_bind(pool)
+        defer {
+            qwen_threadpool_bind(prev)
+            qwen_threadpool_free(pool)
+        }
+        var tiled = 0.0, reference = 0.0
+        var maxDiff: Float = 0
+        guard qwen_bench_bidirectional_attention(Int32(heads), Int32(headDim), Int32(windowTokens),
+                                                 Int32(windows), Int32(iterations),
+                                                 &tiled, &reference, &maxDiff) == 0 else {
+            return nil
+        }
+        return (tiled, reference, maxDiff)
+    }
+
+    /// One kernel timed by `benchmarkKernels`.
+    public struct KernelBenchmark: Sendable {
+        public let name: String
+        public let shape: String
+        /// Runs on the worker pool (false: a single thread).
+        public let threaded: Bool
+        public let ms: Double
+        public let gflops: Double
+        public let gbPerSecond: Double
+    }
+
+    /// Time the hot C kernels (decoder matvec and LM-head argmax, decoder and
+    /// encoder attention, conv stem, mel spectrogram) on random inputs at the
+    /// 0.6B or 1.7B shapes. Returns nil on allocation failure.
+    public static func benchmarkKernels(largeModel: Bool = false, iterations: Int = 20,
+                                        threads: Int? = nil) -> [KernelBenchmark]? {
+        let pool = qwen_threadpool_create(Int32(threads ?? recommendedThreads()),
+                                          ThreadQoS.default.rawValue)
+        let prev = qwen_threadpool_bind(pool)
+        defer {
+            qwen_threadpool_bind(prev)
+            qwen_threadpool_free(pool)
+        }
+        var cfg = qwen_config_t()
+        qwen_config_variant(&cfg, largeModel ? 1 : 0)
+        var results = [qwen_bench_kernel_t](repeating: qwen_bench_kernel_t(),
+                                            count: Int(QWEN_BENCH_MAX_KERNELS))
+        let n = qwen_bench_kernels(&cfg, Int32(iterations), &results, QWEN_BENCH_MAX_KERNELS)
+        guard n >= 0 else { return nil }
+        return results.prefix(Int(n)).map { r in
+            var r = r
+            let shape = withUnsafeBytes(of: &r.shape) { String(cString: $0.bindMemory(to: CChar.self).baseAddress!) }
+            return KernelBenchmark(name: String(cString: r.name), shape: shape,
+                                   threaded: r.threaded != 0, ms: r.ms,
+                                   gflops: r.gflops, gbPerSecond: r.gb_per_s)
+        }
+    }
+
     private static func recommendedThreads() -> Int {
         let cores = max(ProcessInfo.processInfo.activeProcessorCount, 1)
         return min(cores / 2, 4)
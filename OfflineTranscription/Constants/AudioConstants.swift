@@ -13,6 +13,17 @@ enum AudioConstants {
     /// 16000 samples/sec x 1800 sec = 28.8M samples ~ 30 minutes (~115 MB max).
     static let maxAudioSamples = 28_800_000
 
+    /// Capture ring between the audio tap and the main actor: 30 s at 16 kHz,
+    /// so a stalled main thread drops nothing short of that.
+    static let captureRingSamples = 480_000
+
+    /// Energy values (one per tap buffer, ~12/s at 48 kHz) the capture can
+    /// hold between drains.
+    static let captureEnergyFrames = 1024
+
+    /// How often the main actor drains the capture rings (seconds).
+    static let captureDrainInterval: TimeInterval = 0.05
+
     /// Cap energy array to prevent unbounded memory growth.
     /// ~100 frames/sec x 600 sec = 60k frames ~ 10 minutes of visualization data.
     static let maxEnergyFrames = 60_000
@@ -30,6 +41,11 @@ enum AudioConstants {
 
     /// Compute RMS energy of samples and normalize to 0–1 on a dBFS scale.
     static func normalizedEnergy(of samples: [Float]) -> Float {
+        samples.withUnsafeBufferPointer { normalizedEnergy(of: $0) }
+    }
+
+    /// Same as `normalizedEnergy(of:)` over samples in place, e.g. on the audio thread.
+    static func normalizedEnergy(of samples: UnsafeBufferPointer<Float>) -> Float {
         let sumSquares = samples.reduce(Float(0)) { $0 + $1 * $1 }
         let rms = sqrt(sumSquares / Float(samples.count))
         let dbFS = dbfsScaleFactor * log10(max(rms, dbfsFloor))
@@ -1,8 +1,12 @@
 import AVFoundation
 import Foundation
+import QwenASRKit
 
 /// Shared AVAudioEngine-based recorder for sherpa-onnx engines.
 /// Captures 16kHz mono Float32 audio and computes RMS energy.
+/// The tap only writes into preallocated lock-free rings, which the main
+/// actor drains on a timer; the audio thread never waits on the main actor
+/// or schedules work on it.
 @MainActor
 final class AudioRecorder {
     private var audioEngine: AVAudioEngine?
@@ -17,6 +21,19 @@ final class AudioRecorder {
     /// Called on the main actor whenever new audio arrives.
     var onNewAudio: (([Float]) -> Void)?
 
+    /// Optional handoff to a streaming consumer on another thread: the tap
+    /// writes into its ring directly, and each drain forwards the new audio
+    /// to it (which it needs only once the ring has overflowed, to spill),
+    /// then calls `onStreamAudio`. Set before `startRecording`; cleared on stop.
+    var streamCapture: StreamCapture?
+    var onStreamAudio: (() -> Void)?
+
+    /// Single-producer/single-consumer handoffs from the audio tap to the
+    /// main actor: converted samples, and one energy value per tap buffer.
+    private let captureRing = AudioRing(capacity: AudioConstants.captureRingSamples)
+    private let energyRing = AudioRing(capacity: AudioConstants.captureEnergyFrames)
+    private var drainTimer: Timer?
+
     private static let maxAudioSamples = AudioConstants.maxAudioSamples
 
     private let sampleRate: Double = AudioConstants.sampleRate
@@ -83,50 +100,63 @@ final class AudioRecorder {
             ))
         }
 
-        let converter = AVAudioConverter(from: hwFormat, to: targetFormat)
+        guard let ring = captureRing, let energyRing else {
+            throw AppError.audioSessionSetupFailed(underlying: NSError(
+                domain: "AudioRecorder", code: -3,
+                userInfo: [NSLocalizedDescriptionKey: "Cannot allocate capture buffer"]
+            ))
+        }
+        // A previous session's leftovers must not reach this one
+        ring.clear()
+        energyRing.clear()
+        let streamCapture = self.streamCapture
 
-        node.installTap(onBus: 0, bufferSize: bufferSize, format: hwFormat) { [weak self] buffer, _ in
-            guard let self else { return }
+        // Converter, its output buffer and its input block are created once
+        // per session; the tap then only converts and writes into the rings.
+        let needsConversion = hwFormat.sampleRate != sampleRate || hwFormat.channelCount != 1
+        let converter = needsConversion ? AVAudioConverter(from: hwFormat, to: targetFormat) : nil
+        let ratio = sampleRate / hwFormat.sampleRate
+        let outputCapacity = AVAudioFrameCount((Double(bufferSize) * ratio).rounded(.up)) * 2 + 64
+        let outputBuffer = converter != nil ?
+            AVAudioPCMBuffer(pcmFormat: targetFormat, frameCapacity: outputCapacity) : nil
+        // Each tap buffer is offered to the resampler once, so it keeps its
+        // filter state across callbacks.
+        let pending = PendingInput()
+        let inputBlock: AVAudioConverterInputBlock = { _, outStatus in
+            guard let buffer = pending.buffer else {
+                outStatus.pointee = .noDataNow
+                return nil
+            }
+            pending.buffer = nil
+            outStatus.pointee = .haveData
+            return buffer
+        }
 
-            var samples: [Float] = []
-            if let converter, hwFormat.sampleRate != self.sampleRate || hwFormat.channelCount != 1 {
-                // Resample to 16kHz mono
-                let ratio = self.sampleRate / hwFormat.sampleRate
-                let outputFrames = AVAudioFrameCount(Double(buffer.frameLength) * ratio)
-                guard let outputBuffer = AVAudioPCMBuffer(pcmFormat: targetFormat, frameCapacity: outputFrames) else { return }
+        node.installTap(onBus: 0, bufferSize: bufferSize, format: hwFormat) { buffer, _ in
+            var energy: Float = -1
 
+            if let converter {
+                guard let outputBuffer else { return }
+                // Resample to 16kHz mono
+                pending.buffer = buffer
                 var error: NSError?
-                converter.convert(to: outputBuffer, error: &error) { _, outStatus in
-                    outStatus.pointee = .haveData
-                    return buffer
-                }
-                if error == nil, let channelData = outputBuffer.floatChannelData {
-                    samples = Array(UnsafeBufferPointer(start: channelData[0], count: Int(outputBuffer.frameLength)))
-                }
-            } else {
+                var status: AVAudioConverterOutputStatus
+                repeat {
+                    outputBuffer.frameLength = 0
+                    status = converter.convert(to: outputBuffer, error: &error, withInputFrom: inputBlock)
+                    guard error == nil, let channelData = outputBuffer.floatChannelData else { break }
+                    let samples = UnsafeBufferPointer(start: channelData[0], count: Int(outputBuffer.frameLength))
+                    energy = max(energy, Self.emit(samples, into: ring, stream: streamCapture))
+                } while status == .haveData
+                pending.buffer = nil
+            } else if let channelData = buffer.floatChannelData {
                 // Already 16kHz mono
-                if let channelData = buffer.floatChannelData {
-                    samples = Array(UnsafeBufferPointer(start: channelData[0], count: Int(buffer.frameLength)))
-                }
+                let samples = UnsafeBufferPointer(start: channelData[0], count: Int(buffer.frameLength))
+                energy = Self.emit(samples, into: ring, stream: streamCapture)
             }
 
-            guard !samples.isEmpty else { return }
-
-            let normalizedEnergy = AudioConstants.normalizedEnergy(of: samples)
-
-            Task { @MainActor [weak self] in
-                guard let self else { return }
-                self.audioSamples.append(contentsOf: samples)
-                // Cap audio samples to prevent unbounded memory growth
-                if self.audioSamples.count > Self.maxAudioSamples {
-                    self.audioSamples = Array(self.audioSamples.suffix(Self.maxAudioSamples / 2))
-                }
-                self.relativeEnergy.append(normalizedEnergy)
-                // Cap energy array to prevent unbounded growth
-                if self.relativeEnergy.count > Self.maxEnergyFrames {
-                    self.relativeEnergy = Array(self.relativeEnergy.suffix(Self.maxEnergyFrames / 2))
-                }
-                self.onNewAudio?(samples)
+            if energy >= 0 {
+                _ = withUnsafePointer(to: energy) { energyRing.write(UnsafeBufferPointer(start: $0, count: 1)) }
             }
         }
 
@@ -138,16 +168,73 @@ final class AudioRecorder {
         self.isRecording = true
         self.audioSamples = []
         self.relativeEnergy = []
+
+        let timer = Timer(timeInterval: AudioConstants.captureDrainInterval, repeats: true) { [weak self] _ in
+            MainActor.assumeIsolated { self?.drainCapture() }
+        }
+        RunLoop.main.add(timer, forMode: .common)
+        drainTimer = timer
     }
 
     func stopRecording() {
         guard isRecording else { return }
-        onNewAudio = nil
         inputNode?.removeTap(onBus: 0)
         audioEngine?.stop()
         audioEngine = nil
         inputNode = nil
         isRecording = false
+        // No drain runs after this one; the last chunk still reaches the consumers
+        drainTimer?.invalidate()
+        drainTimer = nil
+        drainCapture()
+        onNewAudio = nil
+        onStreamAudio = nil
+        streamCapture = nil
+    }
+
+    /// Tap side: copy converted samples into the stream capture's ring and
+    /// then the capture ring, and return their energy, or -1 for an empty
+    /// buffer. Both get only what the capture ring is sure to take, so the
+    /// drain stays in step with the stream; the stream goes first so its
+    /// overflow is visible by the time the drain sees these samples.
+    private nonisolated static func emit(_ samples: UnsafeBufferPointer<Float>, into ring: AudioRing,
+                                         stream: StreamCapture?) -> Float {
+        guard !samples.isEmpty else { return -1 }
+        let fits = UnsafeBufferPointer(rebasing: samples.prefix(ring.capacity - ring.available))
+        stream?.tapWrite(fits)
+        ring.write(fits)
+        return AudioConstants.normalizedEnergy(of: samples)
+    }
+
+    /// Move everything the tap has written into `audioSamples` and the stream
+    /// capture, reading the rings in place. The main actor is their only consumer.
+    private func drainCapture() {
+        guard let ring = captureRing, let energyRing else { return }
+        let wantsChunk = onNewAudio != nil
+        let streamCapture = self.streamCapture
+        var chunk: [Float] = []
+        let drained = ring.read { span in
+            audioSamples.append(contentsOf: span)
+            streamCapture?.forward(span)
+            if wantsChunk { chunk.append(contentsOf: span) }
+        }
+        // Cap audio samples to prevent unbounded memory growth
+        if audioSamples.count > Self.maxAudioSamples {
+            audioSamples.removeFirst(audioSamples.count - Self.maxAudioSamples / 2)
+        }
+        energyRing.read { span in
+            relativeEnergy.append(contentsOf: span)
+        }
+        // Cap energy array to prevent unbounded growth
+        if relativeEnergy.count > Self.maxEnergyFrames {
+            relativeEnergy.removeFirst(relativeEnergy.count - Self.maxEnergyFrames / 2)
+        }
+        if drained > 0 {
+            onStreamAudio?()
+        }
+        if !chunk.isEmpty {
+            onNewAudio?(chunk)
+        }
     }
 
     deinit {
@@ -155,6 +242,7 @@ final class AudioRecorder {
         // Cannot call stopRecording() directly since deinit is nonisolated.
         inputNode?.removeTap(onBus: 0)
         audioEngine?.stop()
+        drainTimer?.invalidate()
     }
 
     func clearBuffers() {
@@ -162,3 +250,9 @@ final class AudioRecorder {
         relativeEnergy = []
     }
 }
+
+/// Tap buffer waiting for the converter's input block; touched only on the
+/// audio thread.
+private final class PendingInput: @unchecked Sendable {
+    var buffer: AVAudioPCMBuffer?
+}
@@ -1,9 +1,12 @@
 import Foundation
 import QwenASRKit
 
+/// ASREngine for the qwen-asr C runtime. Live audio is pushed into one
+/// incremental streaming session, so each chunk is transcribed once instead
+/// of re-transcribing the growing buffer.
 @MainActor
 final class QwenASREngine: ASREngine {
-    var isStreaming: Bool { false }
+    var isStreaming: Bool { true }
     private(set) var modelState: ASRModelState = .unloaded
     private(set) var downloadProgress: Double = 0
     private(set) var loadingStatusMessage: String = ""
@@ -13,8 +16,29 @@ final class QwenASREngine: ASREngine {
 
     private let recorder = AudioRecorder()
     private let downloader = ModelDownloader()
+    private let metrics = SystemMetrics()
     private var qwen: QwenASR?
     private var segmentIdCounter: Int = 0
+    private var memoryPressureSource: DispatchSourceMemoryPressure?
+
+    /// Text the live session has committed so far (updated from the decode queue).
+    private var latestText: String = ""
+
+    /// Bumped whenever `latestText` is cleared for a new session. Decode work
+    /// captures it when queued, so text from a session that was reset while
+    /// the work was in flight is dropped instead of appended.
+    private var sessionGeneration = 0
+
+    /// Microphone audio of the live session, drained on the decode queue.
+    private var streamCapture: StreamCapture?
+
+    /// Serial queue for session pushes and file transcription, keeping
+    /// decoding off the main actor and in arrival order.
+    private let decodeQueue = DispatchQueue(label: "qwen.streaming.decode", qos: .userInteractive)
+
+    /// Decoder audio context of a live session; older audio is replaced by
+    /// its committed text, so long recordings stay at a flat cost per chunk.
+    private static let streamHorizonSeconds: Float = 30
 
     func setupModel(_ model: ModelInfo) async throws {
         guard model.qwenModelConfig != nil else {
@@ -48,6 +72,7 @@ final class QwenASREngine: ASREngine {
         }
 
         qwen = runtime
+        startMemoryPressureMonitor()
         modelState = .loaded
         downloadProgress = 1
         loadingStatusMessage = ""
@@ -76,37 +101,130 @@ final class QwenASREngine: ASREngine {
         }
 
         qwen = runtime
+        startMemoryPressureMonitor()
         modelState = .loaded
         loadingStatusMessage = ""
     }
 
+    /// Drop the runtime's mapped weight pages under memory pressure instead
+    /// of unloading; they page back in on the next transcription.
+    private func startMemoryPressureMonitor() {
+        guard memoryPressureSource == nil else { return }
+        let source = DispatchSource.makeMemoryPressureSource(
+            eventMask: [.normal, .warning, .critical], queue: .main
+        )
+        source.setEventHandler { [weak self, weak source] in
+            guard let event = source?.data else { return }
+            Task { @MainActor [weak self] in
+                guard let runtime = self?.qwen else { return }
+                let lowMemory = !event.contains(.normal)
+                // setLowMemory waits for a running transcription; keep it off the main actor
+                Task.detached { runtime.setLowMemory(lowMemory) }
+            }
+        }
+        source.resume()
+        memoryPressureSource = source
+    }
+
     func isModelDownloaded(_ model: ModelInfo) -> Bool {
         downloader.isModelDownloaded(model)
     }
 
     func unloadModel() async {
         stopRecording()
+        // Let the final session flush finish before the runtime goes away
+        await withCheckedContinuation { continuation in
+            decodeQueue.async {
+                continuation.resume()
+            }
+        }
+        memoryPressureSource?.cancel()
+        memoryPressureSource = nil
         qwen?.release()
         qwen = nil
         modelState = .unloaded
         downloadProgress = 0
         loadingStatusMessage = ""
+        latestText = ""
+        sessionGeneration += 1
     }
 
     func startRecording(captureMode: AudioCaptureMode) async throws {
-        try await recorder.startRecording(captureMode: captureMode)
+        guard !recorder.isRecording else { return }
+
+        // The session opens on the first drain (broadcast audio arrives via
+        // feedAudio). Without a capture ring, chunks are pushed as arrays.
+        let capture = StreamCapture(capacity: AudioConstants.captureRingSamples)
+        if let capture {
+            recorder.streamCapture = capture
+            recorder.onStreamAudio = { [weak self] in
+                self?.enqueueCapture(capture)
+            }
+        } else {
+            recorder.onNewAudio = { [weak self] samples in
+                self?.enqueueAudio(samples)
+            }
+        }
+        do {
+            try await recorder.startRecording(captureMode: captureMode)
+        } catch {
+            recorder.streamCapture = nil
+            recorder.onStreamAudio = nil
+            recorder.onNewAudio = nil
+            throw error
+        }
+        streamCapture = capture
+        latestText = ""
+        sessionGeneration += 1
     }
 
     func stopRecording() {
+        // The recorder's last drain queues the final ring push
         recorder.stopRecording()
+        let capture = streamCapture
+        streamCapture = nil
+
+        // Flush the session on the decode queue, after the pushes still queued
+        guard let qwen else { return }
+        let generation = sessionGeneration
+        decodeQueue.async { [weak self] in
+            guard qwen.isStreamOpen else { return }
+            var text = ""
+            if let capture {
+                // Spilled audio still being written must reach the session first
+                capture.flush()
+                text = Self.drain(capture, into: qwen)
+            }
+            guard let tail = qwen.finishStream() else { return }
+            text += tail
+            let report = qwen.performanceReport
+            Task { @MainActor [weak self] in
+                guard let self else { return }
+                if let report {
+                    InferenceLogger.shared.log(String(format: "[QwenASREngine] stream %@, peak footprint %.0f MB",
+                                                      report.summary, self.metrics.peakMemoryMB()))
+                }
+                self.appendText(text, generation: generation)
+            }
+        }
     }
 
     func transcribe(audioArray: [Float], options: ASRTranscriptionOptions) async throws -> ASRResult {
         guard let qwen else { throw AppError.modelNotReady }
 
-        qwen.setLanguage(options.language)
-        guard let text = qwen.transcribe(samples: audioArray)?
-            .trimmingCharacters(in: .whitespacesAndNewlines),
+        // Queued behind a live session's final flush; the runtime refuses
+        // offline transcription while a session is open.
+        let result = await withCheckedContinuation { (continuation: CheckedContinuation<String?, Never>) in
+            decodeQueue.async {
+                qwen.setLanguage(options.language)
+                continuation.resume(returning: qwen.transcribe(samples: audioArray))
+            }
+        }
+        if let report = qwen.performanceReport {
+            InferenceLogger.shared.log(String(format: "[QwenASREngine] %@, peak footprint %.0f MB",
+                                              report.summary, metrics.peakMemoryMB()))
+        }
+        guard let text = result?.trimmingCharacters(in: .whitespacesAndNewlines),
               !text.isEmpty else {
             return ASRResult(text: "", segments: [], language: options.language)
         }
@@ -122,4 +240,87 @@ final class QwenASREngine: ASREngine {
 
         return ASRResult(text: text, segments: [segment], language: options.language)
     }
+
+    /// Drain the live capture into the session on the decode queue, opening
+    /// it on first use; committed text is appended on the main actor.
+    private func enqueueCapture(_ capture: StreamCapture) {
+        guard let qwen else { return }
+        let horizon = Self.streamHorizonSeconds
+        let generation = sessionGeneration
+
+        decodeQueue.async { [weak self] in
+            if !qwen.isStreamOpen, !qwen.startStream(horizonSeconds: horizon, skipSilence: true) {
+                return
+            }
+            let text = Self.drain(capture, into: qwen)
+            guard !text.isEmpty else { return }
+            Task { @MainActor [weak self] in
+                self?.appendText(text, generation: generation)
+            }
+        }
+    }
+
+    /// Push everything the capture holds, the ring read in place and then
+    /// any spilled audio, returning the committed text. Decode queue only.
+    private nonisolated static func drain(_ capture: StreamCapture, into qwen: QwenASR) -> String {
+        var text = ""
+        capture.drain(pushRing: { text += qwen.pushStream(ring: $0) ?? "" },
+                      pushSamples: { text += qwen.pushStream(samples: $0) ?? "" })
+        return text
+    }
+
+    /// Push broadcast audio into the session on the decode queue, opening it
+    /// on the first chunk; committed text is appended on the main actor.
+    private func enqueueAudio(_ samples: [Float]) {
+        guard let qwen else { return }
+        let horizon = Self.streamHorizonSeconds
+        let generation = sessionGeneration
+
+        decodeQueue.async { [weak self] in
+            if !qwen.isStreamOpen, !qwen.startStream(horizonSeconds: horizon, skipSilence: true) {
+                return
+            }
+            guard let text = qwen.pushStream(samples: samples), !text.isEmpty else { return }
+            Task { @MainActor [weak self] in
+                self?.appendText(text, generation: generation)
+            }
+        }
+    }
+
+    /// Append committed text unless its session has since been reset.
+    private func appendText(_ text: String, generation: Int) {
+        guard generation == sessionGeneration else { return }
+        latestText += text
+    }
+
+    func feedAudio(_ samples: [Float]) throws {
+        guard qwen != nil else { throw AppError.modelNotReady }
+        enqueueAudio(samples)
+    }
+
+    func getStreamingResult() -> ASRResult? {
+        let text = latestText.trimmingCharacters(in: .whitespacesAndNewlines)
+        guard !text.isEmpty else { return nil }
+
+        let duration = Float(audioSamples.count) / 16000
+        let segment = ASRSegment(
+            id: segmentIdCounter,
+            text: " " + text,
+            start: 0,
+            end: duration
+        )
+
+        return ASRResult(text: text, segments: [segment], language: nil)
+    }
+
+    /// Close the live session; the next pushed chunk opens a fresh one.
+    func resetStreamingState() {
+        latestText = ""
+        sessionGeneration += 1
+        segmentIdCounter += 1
+        guard let qwen else { return }
+        decodeQueue.async {
+            _ = qwen.finishStream()
+        }
+    }
 }
@@ -0,0 +1,194 @@
+import Foundation
+import QwenASRKit
+
+/// Live audio handed from the recorder to a streaming consumer on another
+/// thread. The audio tap writes straight into a ring the consumer reads in
+/// place (e.g. `QwenASR.pushStream(ring:)`). The first time the ring cannot
+/// hold a tap buffer, the tap stops writing for good and the main actor,
+/// which sees the same audio, takes over as the ring's producer from the
+/// first sample it refused. From then on what the ring cannot hold goes to
+/// a 16-bit WAV spill file, written in bulk on a background queue and handed
+/// back, in order, once the ring is empty. If the spill file cannot be
+/// created or written, spilling stops: that audio is dropped and counted,
+/// and the consumer moves past it.
+final class StreamCapture: @unchecked Sendable {
+    let ring: AudioRing
+
+    /// Touched only by the audio thread.
+    private var tapStopped = false
+    /// Touched only by the main actor: samples passed to `forward`, and the
+    /// sample index from which it writes the ring instead of the tap.
+    private var forwarded: Int64 = 0
+    private var handover: Int64?
+
+    private let spillURL: URL
+    private let spillQueue = DispatchQueue(label: "audio.capture.spill", qos: .utility)
+    /// Touched only on `spillQueue`.
+    private var spillWriter: WAVWriter.Stream?
+    /// Touched only by the consumer.
+    private var spillReader: FileHandle?
+
+    private let lock = NSLock()
+    /// Samples sent to the spill, in order: every one ends up either on disk
+    /// (`spillWritten`, read back through `spillRead`) or dropped.
+    private var spillQueued = 0
+    private var spillWritten = 0
+    private var spillRead = 0
+    private var spillDropped = 0
+    /// Set once the spill file has failed; later overflow is dropped at once.
+    private var spillFailed = false
+
+    /// Spilled samples handed back per `takeSpilled` call (1 s).
+    private static let spillReadSamples = 16_000
+
+    init?(capacity: Int, spillDirectory: URL = FileManager.default.temporaryDirectory) {
+        guard let ring = AudioRing(capacity: capacity) else { return nil }
+        self.ring = ring
+        spillURL = spillDirectory.appendingPathComponent("capture-\(UUID().uuidString).wav")
+    }
+
+    deinit {
+        try? spillWriter?.close()
+        try? spillReader?.close()
+        try? FileManager.default.removeItem(at: spillURL)
+    }
+
+    /// Samples that went to the spill file because the ring was full.
+    var spilledSampleCount: Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return spillQueued
+    }
+
+    /// Spilled samples lost because the spill file failed.
+    var droppedSampleCount: Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return spillDropped
+    }
+
+    // MARK: - Producer
+
+    /// Audio thread: copy a tap buffer into the ring, without locking or
+    /// allocating. Stops at the first buffer that does not fit whole.
+    func tapWrite(_ samples: UnsafeBufferPointer<Float>) {
+        guard !tapStopped, !samples.isEmpty else { return }
+        if ring.write(samples) < samples.count {
+            tapStopped = true
+        }
+    }
+
+    /// Main actor: the same audio the tap was given, in order. Ignored
+    /// while the tap writes the ring; once it has stopped, everything from
+    /// the first sample it refused goes through `write`. The tap must write
+    /// the ring before publishing a buffer to the main actor, so a refusal
+    /// is visible by the time the refused samples arrive here.
+    func forward(_ samples: UnsafeBufferPointer<Float>) {
+        let start = forwarded
+        forwarded += Int64(samples.count)
+        if handover == nil {
+            // The tap only overruns the ring on the write that stops it
+            guard ring.overruns > 0 else { return }
+            handover = ring.written
+        }
+        guard let handover else { return }
+        let skip = Int(max(0, min(handover - start, Int64(samples.count))))
+        write(UnsafeBufferPointer(rebasing: samples[skip...]))
+    }
+
+    /// Append samples after everything written before, from the one thread
+    /// producing for the ring (no tap, or after the handover). Once the ring
+    /// has overflowed, new audio keeps going to the spill file until the
+    /// consumer has read all of it, so it never sees audio out of order.
+    func write(_ samples: UnsafeBufferPointer<Float>) {
+        guard !samples.isEmpty else { return }
+        lock.lock()
+        let accepted = spillQueued == spillRead + spillDropped ? ring.write(samples) : 0
+        let spilled = samples.count - accepted
+        spillQueued += spilled
+        let failed = spillFailed
+        if failed {
+            spillDropped += spilled
+        }
+        lock.unlock()
+        guard spilled > 0, !failed else { return }
+
+        let pending = Array(samples[accepted...])
+        spillQueue.async { [self] in
+            lock.lock()
+            let failed = spillFailed
+            lock.unlock()
+            var written = 0
+            if !failed {
+                do {
+                    if spillWriter == nil {
+                        spillWriter = try WAVWriter.Stream(url: spillURL)
+                    }
+                    try pending.withUnsafeBufferPointer { try spillWriter?.append($0) }
+                    written = pending.count
+                } catch {
+                    // The file is no longer trusted past what it holds:
+                    // stop spilling rather than retry every block
+                    NSLog("[StreamCapture] spill write failed, dropping overflow: \(error)")
+                    try? spillWriter?.close()
+                    spillWriter = nil
+                }
+            }
+            lock.lock()
+            spillWritten += written
+            spillDropped += pending.count - written
+            if written < pending.count {
+                spillFailed = true
+            }
+            lock.unlock()
+        }
+    }
+
+    /// Wait until every spilled sample is on disk, e.g. before the final drain.
+    func flush() {
+        spillQueue.sync {}
+    }
+
+    // MARK: - Consumer
+
+    /// Feed everything available in order: the ring in place through
+    /// `pushRing`, and spilled audio through `pushSamples` once the ring
+    /// holds nothing older.
+    func drain(pushRing: (AudioRing) -> Void, pushSamples: ([Float]) -> Void) {
+        pushRing(ring)
+        while let samples = takeSpilled() {
+            pushSamples(samples)
+            pushRing(ring)
+        }
+    }
+
+    /// The next spilled samples on disk, or nil while the ring still holds
+    /// older audio or there is nothing spilled to read. Dropped samples are
+    /// never on disk, so reading simply goes on past them.
+    func takeSpilled() -> [Float]? {
+        lock.lock()
+        // The producer only writes the ring while nothing spilled is unread,
+        // so with spilled audio pending the ring cannot fill up under us.
+        guard ring.available == 0, spillWritten > spillRead else {
+            lock.unlock()
+            return nil
+        }
+        let start = spillRead
+        let count = min(spillWritten - spillRead, Self.spillReadSamples)
+        spillRead += count
+        lock.unlock()
+        return readSpill(from: start, count: count)
+    }
+
+    private func readSpill(from start: Int, count: Int) -> [Float] {
+        if spillReader == nil {
+            spillReader = try? FileHandle(forReadingFrom: spillURL)
+        }
+        guard let reader = spillReader,
+              (try? reader.seek(toOffset: UInt64(WAVWriter.headerSize + start * 2))) != nil,
+              let data = try? reader.read(upToCount: count * 2) else { return [] }
+        return data.withUnsafeBytes { raw in
+            raw.bindMemory(to: Int16.self).map { Float(Int16(littleEndian: $0)) / 32767.0 }
+        }
+    }
+}
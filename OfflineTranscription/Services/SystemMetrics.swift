@@ -53,4 +53,17 @@ final class SystemMetrics: Sendable {
         guard result == KERN_SUCCESS else { return 0 }
         return Double(info.phys_footprint) / Self.bytesPerMB
     }
+
+    /// Highest physical memory footprint of the process so far, in MB.
+    func peakMemoryMB() -> Double {
+        var info = task_vm_info_data_t()
+        var count = Self.taskVmInfoCount
+        let result = withUnsafeMutablePointer(to: &info) { ptr in
+            ptr.withMemoryRebound(to: integer_t.self, capacity: Int(count)) { raw in
+                task_info(mach_task_self_, task_flavor_t(TASK_VM_INFO), raw, &count)
+            }
+        }
+        guard result == KERN_SUCCESS else { return 0 }
+        return Double(info.ledger_phys_footprint_peak) / Self.bytesPerMB
+    }
 }
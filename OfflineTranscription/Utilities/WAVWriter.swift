@@ -1,17 +1,74 @@
 import Foundation
 
 enum WAVWriter {
+    private static let numChannels: UInt16 = 1
+    private static let bitsPerSample: UInt16 = 16
+    private static let blockAlign = numChannels * (bitsPerSample / 8)
+    /// Bytes before the PCM data in the files written here.
+    static let headerSize = 44
+
     /// Write 16kHz mono 16-bit PCM WAV file from Float32 samples normalized to [-1, 1].
     static func write(samples: [Float], sampleRate: Int = 16000, to url: URL) throws {
-        let numChannels: UInt16 = 1
-        let bitsPerSample: UInt16 = 16
-        let byteRate = UInt32(sampleRate) * UInt32(numChannels) * UInt32(bitsPerSample / 8)
-        let blockAlign = numChannels * (bitsPerSample / 8)
         let dataSize = UInt32(samples.count * Int(blockAlign))
+
+        var data = header(dataSize: dataSize, sampleRate: sampleRate)
+        data.reserveCapacity(headerSize + Int(dataSize))
+        samples.withUnsafeBufferPointer { appendPCM($0, to: &data) }
+
+        try data.write(to: url, options: .atomic)
+    }
+
+    /// Incremental writer for recordings too long to hold in memory: samples
+    /// are appended as they arrive and the header sizes are patched on close.
+    final class Stream {
+        let url: URL
+        private(set) var sampleCount = 0
+        private let sampleRate: Int
+        private var handle: FileHandle?
+        private var scratch: [Int16] = []
+
+        init(url: URL, sampleRate: Int = 16000) throws {
+            self.url = url
+            self.sampleRate = sampleRate
+            try WAVWriter.header(dataSize: 0, sampleRate: sampleRate).write(to: url, options: .atomic)
+            handle = try FileHandle(forWritingTo: url)
+            try handle?.seekToEnd()
+        }
+
+        deinit {
+            try? close()
+        }
+
+        func append(_ samples: UnsafeBufferPointer<Float>) throws {
+            guard let handle, !samples.isEmpty else { return }
+            // Convert the whole block, then write it in one call
+            scratch.removeAll(keepingCapacity: true)
+            scratch.reserveCapacity(samples.count)
+            for sample in samples {
+                scratch.append(WAVWriter.pcm16(sample).littleEndian)
+            }
+            try scratch.withUnsafeBytes { try handle.write(contentsOf: $0) }
+            sampleCount += samples.count
+        }
+
+        /// Patch the RIFF and data sizes and close the file. Further appends are ignored.
+        func close() throws {
+            guard let handle else { return }
+            self.handle = nil
+            defer { try? handle.close() }
+            let header = WAVWriter.header(dataSize: UInt32(sampleCount * Int(WAVWriter.blockAlign)),
+                                          sampleRate: sampleRate)
+            try handle.seek(toOffset: 0)
+            try handle.write(contentsOf: header)
+        }
+    }
+
+    private static func header(dataSize: UInt32, sampleRate: Int) -> Data {
+        let byteRate = UInt32(sampleRate) * UInt32(numChannels) * UInt32(bitsPerSample / 8)
         let fileSize = 36 + dataSize
 
         var data = Data()
-        data.reserveCapacity(Int(44 + dataSize))
+        data.reserveCapacity(headerSize)
 
         // RIFF header
         data.append(contentsOf: "RIFF".utf8)
@@ -31,15 +88,18 @@ enum WAVWriter {
         // data sub-chunk
         data.append(contentsOf: "data".utf8)
         data.appendLittleEndian(dataSize)
+        return data
+    }
 
-        // Convert Float32 → Int16 PCM
+    /// Convert Float32 → Int16 PCM
+    private static func appendPCM(_ samples: UnsafeBufferPointer<Float>, to data: inout Data) {
         for sample in samples {
-            let clamped = max(-1.0, min(1.0, sample))
-            let int16Value = Int16(clamped * 32767.0)
-            data.appendLittleEndian(int16Value)
+            data.appendLittleEndian(pcm16(sample))
         }
+    }
 
-        try data.write(to: url, options: .atomic)
+    private static func pcm16(_ sample: Float) -> Int16 {
+        Int16(max(-1.0, min(1.0, sample)) * 32767.0)
     }
 }
 
@@ -0,0 +1,182 @@
+import XCTest
+import QwenASRKit
+@testable import OfflineTranscription
+
+/// Capture handoff pieces: the lock-free ring, the incremental WAV writer and
+/// the ring-plus-spill stream capture built from them.
+final class AudioCaptureTests: XCTestCase {
+
+    // MARK: - AudioRing
+
+    func testRingCapacityRoundsUpToPowerOfTwo() throws {
+        let ring = try XCTUnwrap(AudioRing(capacity: 5))
+        XCTAssertEqual(ring.capacity, 8)
+        XCTAssertNil(AudioRing(capacity: 0))
+    }
+
+    func testRingWrapAroundReadsTwoSpansInOrder() throws {
+        let ring = try XCTUnwrap(AudioRing(capacity: 8))
+        XCTAssertEqual(write(ring, (0..<6).map(Float.init)), 6)
+        XCTAssertEqual(drainRing(ring).samples, (0..<6).map(Float.init))
+
+        // Starts at slot 6 of 8, so the data wraps to the front
+        XCTAssertEqual(write(ring, (6..<11).map(Float.init)), 5)
+        XCTAssertEqual(ring.available, 5)
+        let (samples, spans) = drainRing(ring)
+        XCTAssertEqual(samples, (6..<11).map(Float.init))
+        XCTAssertEqual(spans, [2, 3])
+        XCTAssertEqual(ring.available, 0)
+        XCTAssertEqual(ring.overruns, 0)
+    }
+
+    func testRingOverflowKeepsOldestAndCountsOverruns() throws {
+        let ring = try XCTUnwrap(AudioRing(capacity: 8))
+        XCTAssertEqual(write(ring, (0..<10).map(Float.init)), 8)
+        XCTAssertEqual(ring.overruns, 2)
+        XCTAssertEqual(write(ring, [99]), 0)
+        XCTAssertEqual(ring.overruns, 3)
+
+        XCTAssertEqual(drainRing(ring).samples, (0..<8).map(Float.init))
+        XCTAssertEqual(write(ring, [42]), 1)
+        XCTAssertEqual(drainRing(ring).samples, [42])
+    }
+
+    func testRingClearDropsUnread() throws {
+        let ring = try XCTUnwrap(AudioRing(capacity: 8))
+        write(ring, [1, 2, 3])
+        ring.clear()
+        XCTAssertEqual(ring.available, 0)
+        XCTAssertEqual(drainRing(ring).samples, [])
+    }
+
+    // MARK: - WAVWriter.Stream
+
+    func testStreamPatchesHeaderSizesOnClose() throws {
+        let url = FileManager.default.temporaryDirectory
+            .appendingPathComponent("wav-stream-\(UUID().uuidString).wav")
+        defer { try? FileManager.default.removeItem(at: url) }
+
+        let writer = try WAVWriter.Stream(url: url, sampleRate: 16000)
+        let samples: [Float] = (0..<1000).map { sin(Float($0) * 0.01) }
+        try samples.withUnsafeBufferPointer { try writer.append($0) }
+        try samples.prefix(234).withUnsafeBufferPointer { try writer.append($0) }
+        try writer.close()
+
+        let data = try Data(contentsOf: url)
+        let dataBytes = 1234 * 2
+        XCTAssertEqual(writer.sampleCount, 1234)
+        XCTAssertEqual(data.count, WAVWriter.headerSize + dataBytes)
+        XCTAssertEqual(String(decoding: data[0..<4], as: UTF8.self), "RIFF")
+        XCTAssertEqual(uint32(data, at: 4), UInt32(36 + dataBytes))
+        XCTAssertEqual(String(decoding: data[36..<40], as: UTF8.self), "data")
+        XCTAssertEqual(uint32(data, at: 40), UInt32(dataBytes))
+    }
+
+    // MARK: - StreamCapture
+
+    func testStreamCaptureSpillsOverflowAndDrainsInOrder() throws {
+        let capture = try XCTUnwrap(StreamCapture(capacity: 8))
+        let input = (0..<40).map(Float.init).map { $0 / 64 }
+
+        // 8 fit in the ring; the rest spills, and so does everything after
+        // it until the consumer has read the spill back
+        input[0..<20].withUnsafeBufferPointer { capture.write($0) }
+        input[20..<24].withUnsafeBufferPointer { capture.write($0) }
+        XCTAssertEqual(capture.spilledSampleCount, 16)
+        capture.flush()
+
+        var received: [Float] = []
+        capture.drain(pushRing: { ring in received += drainRing(ring).samples },
+                      pushSamples: { received += $0 })
+        // Caught up: new audio goes through the ring again
+        input[24...].withUnsafeBufferPointer { capture.write($0) }
+        XCTAssertEqual(capture.spilledSampleCount, 24)
+        capture.flush()
+        capture.drain(pushRing: { ring in received += drainRing(ring).samples },
+                      pushSamples: { received += $0 })
+
+        XCTAssertEqual(received.count, input.count)
+        for (got, want) in zip(received, input) {
+            XCTAssertEqual(got, want, accuracy: 1.0 / 32767)
+        }
+    }
+
+    func testStreamCaptureDropsAudioWhenSpillFails() throws {
+        // The spill file cannot be created in a directory that does not exist
+        let missing = FileManager.default.temporaryDirectory
+            .appendingPathComponent("missing-\(UUID().uuidString)", isDirectory: true)
+        let capture = try XCTUnwrap(StreamCapture(capacity: 8, spillDirectory: missing))
+        let input = (0..<32).map(Float.init).map { $0 / 64 }
+        var received: [Float] = []
+
+        input[0..<20].withUnsafeBufferPointer { capture.write($0) }
+        capture.flush()
+        XCTAssertEqual(capture.spilledSampleCount, 12)
+        XCTAssertEqual(capture.droppedSampleCount, 12)
+
+        // Nothing to read back: the consumer gets the ring and moves on
+        capture.drain(pushRing: { ring in received += drainRing(ring).samples },
+                      pushSamples: { received += $0 })
+        XCTAssertEqual(received, Array(input[0..<8]))
+
+        // New audio goes through the ring again; overflow after that is
+        // dropped at once instead of retrying the file
+        input[20...].withUnsafeBufferPointer { capture.write($0) }
+        XCTAssertEqual(capture.spilledSampleCount, 16)
+        XCTAssertEqual(capture.droppedSampleCount, 16)
+        capture.flush()
+        capture.drain(pushRing: { ring in received += drainRing(ring).samples },
+                      pushSamples: { received += $0 })
+        XCTAssertEqual(received, Array(input[0..<8] + input[20..<28]))
+    }
+
+    func testStreamCaptureTapHandsOverOnOverflow() throws {
+        let capture = try XCTUnwrap(StreamCapture(capacity: 8))
+        let input = (0..<24).map(Float.init).map { $0 / 64 }
+        var received: [Float] = []
+
+        // While the tap's writes fit, forwarding the same audio adds nothing
+        input[0..<6].withUnsafeBufferPointer { capture.tapWrite($0) }
+        input[0..<6].withUnsafeBufferPointer { capture.forward($0) }
+        received += drainRing(capture.ring).samples
+        XCTAssertEqual(received.count, 6)
+
+        // 8 of the next 14 fit; the tap then stops for good, and forwarding
+        // picks up at the first refused sample
+        input[6..<20].withUnsafeBufferPointer { capture.tapWrite($0) }
+        input[20...].withUnsafeBufferPointer { capture.tapWrite($0) }
+        input[6..<20].withUnsafeBufferPointer { capture.forward($0) }
+        input[20...].withUnsafeBufferPointer { capture.forward($0) }
+        XCTAssertEqual(capture.spilledSampleCount, 10)
+        capture.flush()
+        capture.drain(pushRing: { ring in received += drainRing(ring).samples },
+                      pushSamples: { received += $0 })
+
+        XCTAssertEqual(received.count, input.count)
+        for (got, want) in zip(received, input) {
+            XCTAssertEqual(got, want, accuracy: 1.0 / 32767)
+        }
+    }
+
+    // MARK: - Helpers
+
+    @discardableResult
+    private func write(_ ring: AudioRing, _ samples: [Float]) -> Int {
+        samples.withUnsafeBufferPointer { ring.write($0) }
+    }
+
+    private func uint32(_ data: Data, at offset: Int) -> UInt32 {
+        data[offset..<offset + 4].enumerated().reduce(UInt32(0)) { $0 | UInt32($1.element) << (8 * $1.offset) }
+    }
+}
+
+/// Everything unread, plus the length of each span the ring handed out.
+private func drainRing(_ ring: AudioRing) -> (samples: [Float], spans: [Int]) {
+    var samples: [Float] = []
+    var spans: [Int] = []
+    ring.read { span in
+        samples.append(contentsOf: span)
+        spans.append(span.count)
+    }
+    return (samples, spans)
+}
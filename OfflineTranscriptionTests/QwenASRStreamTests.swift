@@ -0,0 +1,114 @@
+import AVFoundation
+import XCTest
+import QwenASRKit
+
+/// Streaming session tests for the qwen-asr runtime. They need a downloaded
+/// model: set QWEN_TEST_MODEL_DIR to its directory, otherwise they skip.
+final class QwenASRStreamTests: XCTestCase {
+
+    private var qwen: QwenASR!
+    private var samples: [Float] = []
+
+    override func setUpWithError() throws {
+        try super.setUpWithError()
+        guard let modelDir = ProcessInfo.processInfo.environment["QWEN_TEST_MODEL_DIR"],
+              FileManager.default.fileExists(atPath: modelDir) else {
+            throw XCTSkip("QWEN_TEST_MODEL_DIR not set")
+        }
+        guard let url = Bundle.main.url(forResource: "test_speech", withExtension: "wav") else {
+            throw XCTSkip("test_speech.wav not bundled")
+        }
+        qwen = try XCTUnwrap(QwenASR(modelDir: modelDir))
+        samples = try Self.loadSamples(url)
+    }
+
+    override func tearDown() {
+        qwen?.release()
+        qwen = nil
+        super.tearDown()
+    }
+
+    // MARK: - Push / Finish
+
+    func testChunkedPushesMatchSinglePush() throws {
+        XCTAssertTrue(qwen.startStream())
+        let first = try XCTUnwrap(qwen.pushStream(samples: samples))
+        let reference = first + (try XCTUnwrap(qwen.finishStream()))
+        XCTAssertFalse(reference.trimmingCharacters(in: .whitespacesAndNewlines).isEmpty)
+
+        // Pushes that straddle chunk boundaries must not change the result
+        XCTAssertTrue(qwen.startStream())
+        var text = ""
+        let step = 16_000 * 3 / 10
+        for start in stride(from: 0, to: samples.count, by: step) {
+            let piece = Array(samples[start..<min(start + step, samples.count)])
+            text += try XCTUnwrap(qwen.pushStream(samples: piece))
+        }
+        text += try XCTUnwrap(qwen.finishStream())
+
+        XCTAssertEqual(text, reference)
+    }
+
+    func testSingleChunkStreamMatchesOffline() throws {
+        // Shorter than one stream chunk: finish decodes it in one final pass
+        // over the whole clip, as offline transcription does.
+        let clip = Array(samples.prefix(16_000 * 19 / 10))
+        XCTAssertTrue(qwen.startStream())
+        let pushed = try XCTUnwrap(qwen.pushStream(samples: clip))
+        XCTAssertEqual(pushed, "")
+        let streamed = try XCTUnwrap(qwen.finishStream())
+        let offline = try XCTUnwrap(qwen.transcribe(samples: clip))
+
+        XCTAssertEqual(streamed.trimmingCharacters(in: .whitespacesAndNewlines),
+                       offline.trimmingCharacters(in: .whitespacesAndNewlines))
+    }
+
+    func testSpeculativeRollbackMatchesTokenByToken() throws {
+        // Short pushes make every chunk re-decode its rollback tail; the
+        // verify pass must commit exactly what seq=1 decoding commits, at
+        // the same pushes.
+        func run(speculative: Bool) throws -> [String] {
+            XCTAssertTrue(qwen.startStream(speculative: speculative))
+            var pieces: [String] = []
+            let step = 16_000 / 2
+            for start in stride(from: 0, to: samples.count, by: step) {
+                let piece = Array(samples[start..<min(start + step, samples.count)])
+                pieces.append(try XCTUnwrap(qwen.pushStream(samples: piece)))
+            }
+            pieces.append(try XCTUnwrap(qwen.finishStream()))
+            return pieces
+        }
+
+        let reference = try run(speculative: false)
+        XCTAssertFalse(reference.joined().trimmingCharacters(in: .whitespacesAndNewlines).isEmpty)
+        XCTAssertEqual(try run(speculative: true), reference)
+    }
+
+    // MARK: - Session Ownership
+
+    func testOfflineCallsRefusedWhileStreamOpen() throws {
+        XCTAssertTrue(qwen.startStream())
+        XCTAssertTrue(qwen.isStreamOpen)
+
+        XCTAssertNil(qwen.transcribe(samples: samples))
+        XCTAssertEqual(qwen.transcribeBatch([samples], workers: 1), [nil])
+        XCTAssertFalse(qwen.setLanguage("English"))
+        XCTAssertFalse(qwen.setLMHeadMode(.fast))
+
+        XCTAssertNotNil(qwen.finishStream())
+        XCTAssertFalse(qwen.isStreamOpen)
+        XCTAssertTrue(qwen.setLanguage("English"))
+        XCTAssertNotNil(qwen.transcribe(samples: samples))
+    }
+
+    // MARK: - Helpers
+
+    private static func loadSamples(_ url: URL) throws -> [Float] {
+        let file = try AVAudioFile(forReading: url)
+        let buffer = try XCTUnwrap(AVAudioPCMBuffer(pcmFormat: file.processingFormat,
+                                                    frameCapacity: AVAudioFrameCount(file.length)))
+        try file.read(into: buffer)
+        let channel = try XCTUnwrap(buffer.floatChannelData)
+        return Array(UnsafeBufferPointer(start: channel[0], count: Int(buffer.frameLength)))
+    }
+}
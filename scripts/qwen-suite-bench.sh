@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+# Kernel micro-benchmarks and end-to-end offline/segmented/streaming passes
+# of the qwen-asr C engine, written as JSON for regression tracking.
+#
+# Usage:
+#   QWEN_MODEL_DIR=<dir with model.safetensors> scripts/qwen-suite-bench.sh [out.json]
+# Optional: QWEN_BENCH_WAV, QWEN_BENCH_THREADS, QWEN_BENCH_LONG_SEC, QWEN_BENCH_LARGE=1
+set -euo pipefail
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+PROJECT_DIR="$(cd "$SCRIPT_DIR/.." && pwd)"
+
+MODEL_DIR="${QWEN_MODEL_DIR:?set QWEN_MODEL_DIR to a Qwen3-ASR safetensors directory}"
+WAV_PATH="${QWEN_BENCH_WAV:-$PROJECT_DIR/OfflineTranscription/Resources/test_speech.wav}"
+OUT="${1:-$PROJECT_DIR/artifacts/benchmarks/qwen_suite.json}"
+
+ARGS=(--suite "$MODEL_DIR" "$WAV_PATH"
+      --threads "${QWEN_BENCH_THREADS:-4}" --long-sec "${QWEN_BENCH_LONG_SEC:-300}")
+if [[ "${QWEN_BENCH_LARGE:-0}" == "1" ]]; then
+  ARGS+=(--large)
+fi
+
+mkdir -p "$(dirname "$OUT")"
+swift run --package-path "$PROJECT_DIR/tools/qwen-bench" -c release qwen-bench "${ARGS[@]}" > "$OUT"
+echo "Wrote $OUT"
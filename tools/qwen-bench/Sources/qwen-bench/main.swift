@@ -27,7 +27,9 @@ enum BenchError: Error, LocalizedError {
     var errorDescription: String? {
         switch self {
         case .usage:
-            return "Usage: qwen-bench <model_dir> <wav_path>"
+            return "Usage: qwen-bench <model_dir> <wav_path>\n       qwen-bench --attention [threads]\n"
+                + "       qwen-bench --suite <qwen_model_dir> <wav_path> [--long-sec N] [--threads N] "
+                + "[--iters N] [--large]"
         case .loadModelFailed(let path):
             return "Failed to load Qwen ONNX model from: \(path)"
         case .transcribeFailed:
@@ -102,7 +104,195 @@ func loadAudioFile(url: URL) throws -> [Float] {
     return Array(UnsafeBufferPointer(start: floatData[0], count: Int(outputBuffer.frameLength)))
 }
 
+struct AttentionBenchResult: Codable {
+    let threads: Int
+    let heads: Int
+    let headDim: Int
+    let windowTokens: Int
+    let windows: Int
+    let tiledMs: Double
+    let referenceMs: Double
+    let speedup: Double
+    let maxDiff: Float
+}
+
+/// Encoder attention kernel: tiled/threaded vs. the serial reference, for both model geometries.
+func runAttentionBench() throws {
+    let args = CommandLine.arguments
+    let threads = args.count > 2 ? Int(args[2]) ?? 4 : 4
+    var results: [AttentionBenchResult] = []
+    for heads in [16, 14] {
+        guard let r = QwenASR.benchmarkEncoderAttention(heads: heads, threads: threads) else {
+            throw BenchError.usage
+        }
+        results.append(AttentionBenchResult(
+            threads: threads, heads: heads, headDim: 64, windowTokens: 104, windows: 4,
+            tiledMs: r.tiledMs, referenceMs: r.referenceMs,
+            speedup: r.tiledMs > 0 ? r.referenceMs / r.tiledMs : 0, maxDiff: r.maxDiff
+        ))
+    }
+
+    let encoder = JSONEncoder()
+    encoder.outputFormatting = [.prettyPrinted, .sortedKeys]
+    let data = try encoder.encode(results)
+    FileHandle.standardOutput.write(data)
+    FileHandle.standardOutput.write("\n".data(using: .utf8)!)
+}
+
+struct SuiteKernelResult: Codable {
+    let name: String
+    let shape: String
+    let threaded: Bool
+    let ms: Double
+    let gflops: Double
+    let gbPerSecond: Double
+}
+
+struct SuitePassResult: Codable {
+    let name: String
+    let audioSec: Double
+    let wallMs: Double
+    let rtf: Double
+    let ttftMs: Double
+    let msPerToken: Double
+    let stepP50Ms: Double
+    let stepP99Ms: Double
+    let tokens: Int
+    let weightGBPerSecond: Double
+    let kvPeakMB: Double
+    let scratchPeakMB: Double
+    /// Change in the process's physical footprint across the pass.
+    let footprintDeltaMB: Double
+    let textPreview: String
+}
+
+struct SuiteResult: Codable {
+    let modelDir: String
+    let wavPath: String
+    let threads: Int
+    let kernels: [SuiteKernelResult]
+    let passes: [SuitePassResult]
+    let peakRssMB: Double
+}
+
+/// Process peak resident set size so far (ru_maxrss is in bytes on Darwin).
+/// Monotonic over the process, so only meaningful for the whole suite.
+func peakRssMB() -> Double {
+    var usage = rusage()
+    getrusage(RUSAGE_SELF, &usage)
+    return Double(usage.ru_maxrss) / 1_048_576
+}
+
+/// Current physical footprint (what jetsam accounts), or 0 if unavailable.
+func physFootprintMB() -> Double {
+    var info = task_vm_info_data_t()
+    var count = mach_msg_type_number_t(MemoryLayout<task_vm_info_data_t>.size / MemoryLayout<integer_t>.size)
+    let kr = withUnsafeMutablePointer(to: &info) {
+        $0.withMemoryRebound(to: integer_t.self, capacity: Int(count)) {
+            task_info(mach_task_self_, task_flavor_t(TASK_VM_INFO), $0, &count)
+        }
+    }
+    return kr == KERN_SUCCESS ? Double(info.phys_footprint) / 1_048_576 : 0
+}
+
+/// Kernel micro-benchmarks plus offline, segmented and streaming passes of
+/// the C engine, as one JSON document for regression tracking.
+func runSuite() throws {
+    var args = Array(CommandLine.arguments.dropFirst(2))
+    func option(_ name: String) -> Int? {
+        guard let i = args.firstIndex(of: name), i + 1 < args.count, let v = Int(args[i + 1]) else {
+            return nil
+        }
+        args.removeSubrange(i...(i + 1))
+        return v
+    }
+    let longSec = option("--long-sec") ?? 300
+    let threads = option("--threads") ?? 4
+    let iters = option("--iters") ?? 20
+    let large = args.contains("--large")
+    args.removeAll { $0 == "--large" }
+    guard args.count == 2 else { throw BenchError.usage }
+    let modelDir = args[0]
+    let wavPath = args[1]
+
+    guard let kernels = QwenASR.benchmarkKernels(largeModel: large, iterations: iters, threads: threads) else {
+        throw BenchError.transcribeFailed
+    }
+
+    let speech = try loadAudioFile(url: URL(fileURLWithPath: wavPath))
+    var long: [Float] = []
+    long.reserveCapacity(longSec * 16000)
+    while long.count < longSec * 16000 {
+        long.append(contentsOf: speech.prefix(longSec * 16000 - long.count))
+    }
+
+    guard let runtime = QwenASR(modelDir: modelDir, threads: threads) else {
+        throw BenchError.loadModelFailed(modelDir)
+    }
+
+    var passes: [SuitePassResult] = []
+    func record(_ name: String, _ samples: [Float], _ body: () -> String?) throws {
+        let footprintBefore = physFootprintMB()
+        let start = CFAbsoluteTimeGetCurrent()
+        guard let text = body() else { throw BenchError.transcribeFailed }
+        let wallMs = (CFAbsoluteTimeGetCurrent() - start) * 1000.0
+        guard let r = runtime.performanceReport else { throw BenchError.transcribeFailed }
+        let audioSec = Double(samples.count) / 16000.0
+        passes.append(SuitePassResult(
+            name: name, audioSec: audioSec, wallMs: wallMs,
+            rtf: audioSec > 0 ? wallMs / 1000.0 / audioSec : 0,
+            ttftMs: r.timeToFirstTokenMs, msPerToken: r.stepMeanMs,
+            stepP50Ms: r.stepP50Ms, stepP99Ms: r.stepP99Ms, tokens: r.textTokens,
+            weightGBPerSecond: r.weightGBPerSecond,
+            kvPeakMB: Double(r.kvPeakBytes) / 1_048_576,
+            scratchPeakMB: Double(r.scratchPeakBytes) / 1_048_576,
+            footprintDeltaMB: physFootprintMB() - footprintBefore,
+            textPreview: String(text.prefix(160))
+        ))
+    }
+
+    runtime.setSegmentation(seconds: 0)
+    try record("offline", speech) { runtime.transcribe(samples: speech) }
+    runtime.setSegmentation(seconds: 20)
+    try record("segmented_long", long) { runtime.transcribe(samples: long) }
+    try record("streaming", speech) {
+        guard runtime.startStream() else { return nil }
+        var text = ""
+        var pos = 0
+        while pos < speech.count {
+            let end = min(pos + 8000, speech.count)
+            guard let piece = runtime.pushStream(samples: Array(speech[pos..<end])) else { return nil }
+            text += piece
+            pos = end
+        }
+        guard let tail = runtime.finishStream() else { return nil }
+        return text + tail
+    }
+
+    let result = SuiteResult(
+        modelDir: modelDir, wavPath: wavPath, threads: threads,
+        kernels: kernels.map {
+            SuiteKernelResult(name: $0.name, shape: $0.shape, threaded: $0.threaded,
+                              ms: $0.ms, gflops: $0.gflops, gbPerSecond: $0.gbPerSecond)
+        },
+        passes: passes, peakRssMB: peakRssMB()
+    )
+    let encoder = JSONEncoder()
+    encoder.outputFormatting = [.prettyPrinted, .sortedKeys]
+    let data = try encoder.encode(result)
+    FileHandle.standardOutput.write(data)
+    FileHandle.standardOutput.write("\n".data(using: .utf8)!)
+}
+
 func run() throws {
+    if CommandLine.arguments.count >= 2 && CommandLine.arguments[1] == "--attention" {
+        try runAttentionBench()
+        return
+    }
+    if CommandLine.arguments.count >= 2 && CommandLine.arguments[1] == "--suite" {
+        try runSuite()
+        return
+    }
     guard CommandLine.arguments.count == 3 else {
         throw BenchError.usage
     }